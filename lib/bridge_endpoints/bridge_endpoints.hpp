@@ -0,0 +1,181 @@
+#pragma once
+// an api.txt line can list more than one bridge to try,
+// separated by |. we keep a smoothed round trip time for
+// each and send to the fastest healthy one, moving on to
+// the next when one fails or runs out of time. it's
+// templated on the transport so the native tests can run it
+// against stub bridges. the transport has:
+//   uint32_t now_ms(), uint32_t now_us() - the clocks
+//   bool parse(const char* url,char* host,size_t host_size,
+//     uint16_t* port,bool* secure) - false if it isn't http
+//   bool request(const char* url,int count,bool failover,
+//     uint32_t deadline_ms) - send count requests to url.
+//     when failover is set there's another bridge to try, so
+//     everything (lookup, connect, responses) gives up at
+//     deadline_ms and a dropped connection isn't retried
+//   bool probe(const bridge_endpoint& e,uint32_t deadline_ms)
+//     - true if anything answers, by deadline_ms
+//   void down(const bridge_endpoint& e) - it stopped answering
+//   void back(const bridge_endpoint& e) - a probe got an answer
+//   void failing_over(uint32_t failovers)
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+constexpr static const size_t endpoint_max = 4;
+// the longest alternative on a line we'll route
+constexpr static const size_t endpoint_url_max = 256;
+// how long each bridge gets before we move on to the next
+constexpr static const uint32_t endpoint_failover_ms = 1500;
+constexpr static const uint32_t endpoint_probe_min_ms = 5*1000;
+constexpr static const uint32_t endpoint_probe_max_ms = 5*60*1000;
+
+struct bridge_endpoint {
+    char host[64];
+    uint16_t port;
+    bool secure;
+    bool healthy;
+    // smoothed round trip time (us), 0 until we have one
+    uint32_t srtt;
+    // when we next probe it while it's down, and how
+    // long we wait after that
+    uint32_t probe_ts;
+    uint32_t probe_backoff_ms;
+};
+struct bridge_endpoints {
+    bridge_endpoint entries[endpoint_max];
+    size_t count;
+    uint32_t failovers;
+};
+inline bridge_endpoint* endpoint_for(bridge_endpoints* table,const char* host,uint16_t port,bool secure) {
+    for(size_t i = 0;i<table->count;++i) {
+        bridge_endpoint& e = table->entries[i];
+        if(e.port==port && e.secure==secure && 0==strcmp(e.host,host)) {
+            return &e;
+        }
+    }
+    if(table->count==endpoint_max || strlen(host)>=sizeof(table->entries[0].host)) {
+        return nullptr;
+    }
+    bridge_endpoint& e = table->entries[table->count++];
+    strcpy(e.host,host);
+    e.port = port;
+    e.secure = secure;
+    e.healthy = true;
+    e.srtt = 0;
+    e.probe_ts = 0;
+    e.probe_backoff_ms = endpoint_probe_min_ms;
+    return &e;
+}
+inline void endpoint_sample(bridge_endpoint* e,uint32_t rtt) {
+    // smoothed like TCP's, 1/8th of each new sample
+    e->srtt = e->srtt==0?rtt:(uint32_t)((int32_t)e->srtt+((int32_t)rtt-(int32_t)e->srtt)/8);
+    e->healthy = true;
+    e->probe_backoff_ms = endpoint_probe_min_ms;
+}
+inline bool endpoint_down(bridge_endpoint* e,uint32_t now_ms) {
+    // true if it was up until now
+    bool was_healthy = e->healthy;
+    e->healthy = false;
+    e->probe_ts = now_ms+e->probe_backoff_ms;
+    return was_healthy;
+}
+inline void endpoint_order(bridge_endpoint* const* candidates,int count,int* order) {
+    // healthy ones first, then the fastest. ones we haven't
+    // timed yet go first so we learn them. ties keep the
+    // api.txt order. candidates we couldn't track are null,
+    // and count as healthy and untimed
+    for(int i = 0;i<count;++i) {
+        const bridge_endpoint* e = candidates[i];
+        int j = i;
+        while(j>0) {
+            const bridge_endpoint* p = candidates[order[j-1]];
+            bool e_down = e!=nullptr && !e->healthy;
+            bool p_down = p!=nullptr && !p->healthy;
+            uint32_t e_srtt = e==nullptr?0:e->srtt;
+            uint32_t p_srtt = p==nullptr?0:p->srtt;
+            if(e_down>p_down || (e_down==p_down && e_srtt>=p_srtt)) {
+                break;
+            }
+            order[j] = order[j-1];
+            --j;
+        }
+        order[j] = i;
+    }
+}
+template<typename Transport>
+bool endpoints_request(bridge_endpoints* table,Transport& transport,const char* url,int count) {
+    // split out the alternatives. the url may live in a
+    // buffer the transport reuses, so we take copies. they're
+    // static to keep them off the network task's stack
+    static char alternates[endpoint_max][endpoint_url_max];
+    bridge_endpoint* candidates[endpoint_max];
+    int count_alternates = 0;
+    const char* sz = url;
+    while(*sz && count_alternates<(int)endpoint_max) {
+        const char* end = strchr(sz,'|');
+        if(end==nullptr) {
+            end = sz+strlen(sz);
+        }
+        size_t len = end-sz;
+        if(len>0 && len<sizeof(alternates[0])) {
+            char* alternate = alternates[count_alternates];
+            memcpy(alternate,sz,len);
+            alternate[len]=0;
+            char host[128];
+            uint16_t port;
+            bool secure;
+            if(transport.parse(alternate,host,sizeof(host),&port,&secure)) {
+                candidates[count_alternates++] = endpoint_for(table,host,port,secure);
+            }
+        }
+        sz = *end?end+1:end;
+    }
+    int order[endpoint_max];
+    endpoint_order(candidates,count_alternates,order);
+    // with somewhere else to go, don't let a slow bridge
+    // hold us up for long
+    bool failover = count_alternates>1;
+    bool result = false;
+    for(int i = 0;i<count_alternates && !result;++i) {
+        bridge_endpoint* e = candidates[order[i]];
+        uint32_t start_ts = transport.now_us();
+        result = transport.request(alternates[order[i]],count,failover,transport.now_ms()+endpoint_failover_ms);
+        if(e!=nullptr) {
+            if(result) {
+                endpoint_sample(e,transport.now_us()-start_ts);
+            } else if(endpoint_down(e,transport.now_ms())) {
+                transport.down(*e);
+            }
+        }
+        if(!result && i+1<count_alternates) {
+            ++table->failovers;
+            transport.failing_over(table->failovers);
+        }
+    }
+    return result;
+}
+template<typename Transport>
+bool endpoints_probe(bridge_endpoints* table,Transport& transport) {
+    // see if a bridge that went down is back, one per pass.
+    // true if we probed one
+    for(size_t i = 0;i<table->count;++i) {
+        bridge_endpoint& e = table->entries[i];
+        if(e.healthy || (int32_t)(transport.now_ms()-e.probe_ts)<0) {
+            continue;
+        }
+        uint32_t start_ts = transport.now_us();
+        if(transport.probe(e,transport.now_ms()+endpoint_failover_ms)) {
+            endpoint_sample(&e,transport.now_us()-start_ts);
+            transport.back(e);
+        } else {
+            e.probe_backoff_ms*=2;
+            if(e.probe_backoff_ms>endpoint_probe_max_ms) {
+                e.probe_backoff_ms = endpoint_probe_max_ms;
+            }
+            e.probe_ts = transport.now_ms()+e.probe_backoff_ms;
+        }
+        return true;
+    }
+    return false;
+}
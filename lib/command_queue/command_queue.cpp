@@ -0,0 +1,154 @@
+#include "command_queue.hpp"
+#include <string.h>
+#include <strings.h>
+
+void command_queue_init(command_queue* queue) {
+    queue->head.store(0);
+    queue->tail.store(0);
+    queue->max_depth = 0;
+    queue->dropped = 0;
+}
+bool command_queue_push(command_queue* queue,const command& cmd) {
+    uint32_t tail = queue->tail.load(std::memory_order_relaxed);
+    uint32_t depth = tail-queue->head.load(std::memory_order_acquire);
+    if(depth==command_queue_size) {
+        ++queue->dropped;
+        return false;
+    }
+    queue->items[tail%command_queue_size] = cmd;
+    queue->tail.store(tail+1,std::memory_order_release);
+    if(depth+1>queue->max_depth) {
+        queue->max_depth = depth+1;
+    }
+    return true;
+}
+size_t command_queue_depth(const command_queue* queue) {
+    return queue->tail.load(std::memory_order_acquire)-queue->head.load(std::memory_order_acquire);
+}
+bool command_queue_peek(command_queue* queue,command* cmd) {
+    uint32_t head = queue->head.load(std::memory_order_relaxed);
+    if(head==queue->tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    *cmd = queue->items[head%command_queue_size];
+    return true;
+}
+bool command_queue_pop(command_queue* queue,command* cmd) {
+    if(!command_queue_peek(queue,cmd)) {
+        return false;
+    }
+    queue->head.store(queue->head.load(std::memory_order_relaxed)+1,std::memory_order_release);
+    return true;
+}
+command_kind kind_for_url(const char* url_fmt) {
+    const char* sz = 0==strncmp(url_fmt,"upnp:",5)?
+        url_fmt+4:
+        strrchr(url_fmt,'/');
+    if(sz==nullptr) {
+        return command_kind::other;
+    }
+    ++sz;
+    if(0==strcasecmp(sz,"playpause")) {
+        return command_kind::toggle;
+    }
+    if(0==strcasecmp(sz,"next")) {
+        return command_kind::next;
+    }
+    if(0==strcasecmp(sz,"prev") || 0==strcasecmp(sz,"previous")) {
+        return command_kind::prev;
+    }
+    return command_kind::other;
+}
+size_t coalesce_commands(command* cmds,size_t count,const command_kind* kinds,command_stats* stats) {
+    size_t result = 0;
+    for(size_t i = 0;i<count;++i) {
+        const command& cmd = cmds[i];
+        command_kind kind = kinds[cmd.url_index];
+        if(result>0 && kind!=command_kind::other) {
+            command& last = cmds[result-1];
+            command_kind last_kind = kinds[last.url_index];
+            if(last.index==cmd.index && last_kind!=command_kind::other) {
+                if(kind==command_kind::toggle && last_kind==kind) {
+                    // playpause twice is a no-op
+                    --result;
+                    stats->saved+=2;
+                    continue;
+                }
+                if(kind==last_kind && kind!=command_kind::toggle) {
+                    // fold into one batched skip
+                    ++last.repeat;
+                    ++stats->batched;
+                    continue;
+                }
+                if(kind!=command_kind::toggle && last_kind!=command_kind::toggle) {
+                    // next and prev cancel each other
+                    if(0==--last.repeat) {
+                        --result;
+                    }
+                    stats->saved+=2;
+                    continue;
+                }
+            }
+        }
+        cmds[result++]=cmd;
+    }
+    return result;
+}
+size_t command_take_batch(command_queue* queue,command* batch,size_t size) {
+    size_t count = 0;
+    while(count<size && command_queue_pop(queue,&batch[count])) {
+        ++count;
+    }
+    return count;
+}
+void command_record_sent(command_stats* stats,uint32_t latency) {
+    ++stats->sent;
+    stats->latency_total+=latency;
+    if(latency>stats->latency_max) {
+        stats->latency_max = latency;
+    }
+}
+void command_held_init(command_held* held) {
+    held->count = 0;
+    held->expired = 0;
+    held->superseded = 0;
+    held->overflowed = 0;
+}
+void command_hold(command_held* held,const command& cmd,const command_kind* kinds) {
+    size_t count = held->count;
+    if(command_kind::toggle==kinds[cmd.url_index]) {
+        for(size_t i = 0;i<count;++i) {
+            const command& c = held->items[i];
+            if(c.index==cmd.index && command_kind::toggle==kinds[c.url_index]) {
+                memmove(held->items+i,held->items+i+1,(count-i-1)*sizeof(command));
+                --count;
+                ++held->superseded;
+                break;
+            }
+        }
+    }
+    if(count==command_queue_size) {
+        memmove(held->items,held->items+1,(count-1)*sizeof(command));
+        --count;
+        ++held->overflowed;
+    }
+    held->items[count++]=cmd;
+    held->count = count;
+}
+bool command_held_expire(command_held* held,uint32_t ts,uint32_t max_age_ms,uint32_t* latest_ts) {
+    size_t count = 0;
+    size_t old_count = held->count;
+    for(size_t i = 0;i<old_count;++i) {
+        if((ts-held->items[i].ts)/1000>max_age_ms) {
+            ++held->expired;
+            continue;
+        }
+        held->items[count++]=held->items[i];
+    }
+    held->count = count;
+    if(count==0 && old_count>0) {
+        *latest_ts = held->items[old_count-1].ts;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,85 @@
+#pragma once
+// presses on their way from the UI to the network task. the
+// queue has one producer (loop()) and one consumer (the
+// network task) so it needs no locks, and pushing never
+// waits, so the buttons keep working while a request is
+// stuck on a slow bridge
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// a command waiting to be sent by the network task
+struct command {
+    // the speaker/room index
+    int index;
+    // the api.txt line
+    int url_index;
+    // when it was queued (micros)
+    uint32_t ts;
+    // how many times to send it (batched skips)
+    int repeat;
+};
+// what a command does, as far as coalescing is concerned
+enum struct command_kind {
+    other,
+    toggle,
+    next,
+    prev
+};
+// how many presses we can hold while a request is in flight
+constexpr static const size_t command_queue_size = 16;
+struct command_queue {
+    command items[command_queue_size];
+    // only the consumer moves head, and only the producer tail
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    // the deepest it has been, and the presses that didn't fit
+    volatile uint32_t max_depth;
+    volatile uint32_t dropped;
+};
+// presses held while we aren't connected, to be sent
+// together once we are. only the consumer touches it
+struct command_held {
+    command items[command_queue_size];
+    volatile size_t count;
+    // ones we never sent, because they got too old, were
+    // replaced by a later playpause, or didn't fit
+    uint32_t expired;
+    uint32_t superseded;
+    uint32_t overflowed;
+};
+// what coalescing and sending have done
+struct command_stats {
+    // requests we never sent because they cancelled out
+    uint32_t saved;
+    // requests we folded into a batched skip
+    uint32_t batched;
+    // queued to sent latency (micros)
+    uint32_t sent;
+    uint64_t latency_total;
+    uint32_t latency_max;
+};
+void command_queue_init(command_queue* queue);
+// producer side. false if it's full
+bool command_queue_push(command_queue* queue,const command& cmd);
+size_t command_queue_depth(const command_queue* queue);
+// consumer side
+bool command_queue_peek(command_queue* queue,command* cmd);
+bool command_queue_pop(command_queue* queue,command* cmd);
+// what an api.txt line does, by the last path segment of
+// the url, or the action for upnp: lines
+command_kind kind_for_url(const char* url_fmt);
+// merges each command into the one before it when they're
+// for the same room. kinds has each api.txt line's kind
+size_t coalesce_commands(command* cmds,size_t count,const command_kind* kinds,command_stats* stats);
+// takes everything queued, up to size
+size_t command_take_batch(command_queue* queue,command* batch,size_t size);
+void command_record_sent(command_stats* stats,uint32_t latency);
+void command_held_init(command_held* held);
+// keeps only the latest playpause for a room, and lets the
+// oldest go when it's full
+void command_hold(command_held* held,const command& cmd,const command_kind* kinds);
+// drops the ones older than max_age_ms as of ts (micros).
+// true if that took the last of them, with latest_ts set to
+// the latest press, which has now failed
+bool command_held_expire(command_held* held,uint32_t ts,uint32_t max_age_ms,uint32_t* latest_ts);
@@ -0,0 +1,121 @@
+#pragma once
+// resolved bridge host addresses. on the device these live
+// in RTC memory so they survive deep sleep, and we use the
+// RTC backed time of day to expire them. it's templated on
+// the resolver so the native tests can stand in for DNS and
+// the mDNS responder. the resolver has:
+//   bool lookup(const char* host,uint32_t* address) - DNS
+//   bool query(const char* host,uint32_t* address) - mDNS
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+constexpr static const size_t dns_cache_size = 4;
+constexpr static const time_t dns_ttl_secs = 60*60;
+// how often we retry a stale .local entry
+constexpr static const uint32_t mdns_retry_ms = 10*1000;
+struct dns_entry {
+    char host[64];
+    uint32_t address;
+    time_t expires;
+    // .local entries don't expire. when we can't connect
+    // to one we keep using it, but look it up again
+    // in the background
+    bool stale;
+};
+struct dns_cache {
+    dns_entry entries[dns_cache_size];
+    uint32_t hits;
+    uint32_t misses;
+};
+inline bool dns_is_mdns(const char* host) {
+    size_t len = strlen(host);
+    return len>6 && 0==strcasecmp(host+len-6,".local");
+}
+template<typename Resolver>
+bool dns_cache_resolve(dns_cache* cache,Resolver& resolver,const char* host,uint32_t* address,time_t now) {
+    bool mdns = dns_is_mdns(host);
+    dns_entry* entry = nullptr;
+    for(size_t i = 0;i<dns_cache_size;++i) {
+        dns_entry& e = cache->entries[i];
+        if(0==strcmp(e.host,host)) {
+            if(mdns || now<e.expires) {
+                ++cache->hits;
+                *address = e.address;
+                return true;
+            }
+            entry = &e;
+            break;
+        }
+    }
+    ++cache->misses;
+    if(mdns?!resolver.query(host,address):!resolver.lookup(host,address)) {
+        return false;
+    }
+    if(entry==nullptr) {
+        // take a free slot, or else the one expiring soonest
+        entry = &cache->entries[0];
+        for(size_t i = 0;i<dns_cache_size;++i) {
+            dns_entry& e = cache->entries[i];
+            if(e.host[0]==0) {
+                entry = &e;
+                break;
+            }
+            if(e.expires<entry->expires) {
+                entry = &e;
+            }
+        }
+    }
+    if(strlen(host)<sizeof(entry->host)) {
+        strcpy(entry->host,host);
+        entry->address = *address;
+        entry->expires = now+dns_ttl_secs;
+        entry->stale = false;
+    }
+    return true;
+}
+// we couldn't connect to host. plain entries are dropped.
+// .local ones are marked stale and queried again by
+// dns_cache_refresh(), starting now
+inline void dns_cache_invalidate(dns_cache* cache,const char* host,uint32_t now_ms,uint32_t* retry_ts) {
+    for(size_t i = 0;i<dns_cache_size;++i) {
+        dns_entry& e = cache->entries[i];
+        if(0==strcmp(e.host,host)) {
+            if(dns_is_mdns(host)) {
+                // querying can take a while, so we do
+                // it in the background
+                e.stale = true;
+                *retry_ts = now_ms;
+                continue;
+            }
+            e.host[0]=0;
+            e.expires = 0;
+        }
+    }
+}
+// looks up one stale .local entry again, if it's time.
+// true if it sent a query
+template<typename Resolver>
+bool dns_cache_refresh(dns_cache* cache,Resolver& resolver,uint32_t now_ms,uint32_t* retry_ts) {
+    if((int32_t)(now_ms-*retry_ts)<0) {
+        return false;
+    }
+    for(size_t i = 0;i<dns_cache_size;++i) {
+        dns_entry& e = cache->entries[i];
+        if(e.host[0]==0 || !e.stale) {
+            continue;
+        }
+        uint32_t address;
+        if(resolver.query(e.host,&address)) {
+            e.address = address;
+            e.stale = false;
+        } else {
+            *retry_ts = now_ms+mdns_retry_ms;
+        }
+        // one per pass so commands don't wait long behind us
+        return true;
+    }
+    return false;
+}
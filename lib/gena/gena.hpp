@@ -0,0 +1,359 @@
+#pragma once
+// our UPnP event subscription to the current room's
+// AVTransport: subscribing, renewing before the speaker lets
+// it lapse, dropping it when we move to another room, and
+// reading the NOTIFYs it brings. LastChange streams through
+// a chunk at a time and is never held whole. it's templated
+// on the client, like http_pool.hpp, so the native tests can
+// run it against a stub speaker. following a room also takes
+// the speakers, which have:
+//   bool request(int index,const char* method) - connect to
+//     the room's speaker and gena_request() over it
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <http_pool.hpp>
+
+// decodes XML entities a character at a time. LastChange
+// is escaped XML, and the track metadata in it is
+// escaped again, so we run two of these back to back
+struct xml_unescaper {
+    char entity[8];
+    int len;
+};
+// a value we pull out of LastChange as it streams by
+struct lastchange_field {
+    const char* pattern;
+    char terminator;
+    char value[64];
+    size_t len;
+    int match;
+    bool capturing;
+    bool found;
+};
+// what we look for in a NOTIFY
+struct gena_event {
+    // the transport state, title, artist and radio's
+    // stream content
+    lastchange_field fields[4];
+    xml_unescaper outer;
+    xml_unescaper inner;
+};
+struct gena_subscription {
+    // the room we're subscribed to, or -1
+    int index;
+    // our subscription id, empty if we don't have one
+    char sid[96];
+    uint32_t renew_ts;
+    int timeout_secs;
+    // how long before it expires we renew it
+    uint32_t renew_margin_ms;
+    // how long we wait to try again if we can't subscribe
+    uint32_t retry_ms;
+    uint32_t request_timeout_ms;
+    // the last response's status, or -1 if there wasn't one
+    int status;
+};
+inline void gena_init(gena_subscription* s,int timeout_secs,uint32_t renew_margin_ms,uint32_t retry_ms,uint32_t request_timeout_ms) {
+    s->index = -1;
+    s->sid[0]=0;
+    s->renew_ts = 0;
+    s->timeout_secs = timeout_secs;
+    s->renew_margin_ms = renew_margin_ms;
+    s->retry_ms = retry_ms;
+    s->request_timeout_ms = request_timeout_ms;
+    s->status = -1;
+}
+inline void gena_reset(gena_subscription* s) {
+    // our subscription went with the connection
+    s->index = -1;
+    s->sid[0]=0;
+}
+inline bool gena_showing(const gena_subscription* s,int index) {
+    // whether the room's what's playing comes from its
+    // UPnP subscription, rather than anywhere else
+    return s->sid[0]!=0 && s->index==index;
+}
+inline int xml_unescape(xml_unescaper& u,int ch) {
+    // returns the decoded character, or -1 if it's
+    // still in the middle of an entity
+    if(u.len==0) {
+        if(ch=='&') {
+            u.entity[u.len++]=ch;
+            return -1;
+        }
+        return ch;
+    }
+    if(ch!=';') {
+        if(u.len<(int)sizeof(u.entity)-1) {
+            u.entity[u.len++]=ch;
+        }
+        return -1;
+    }
+    u.entity[u.len]=0;
+    u.len = 0;
+    const char* e = u.entity+1;
+    if(0==strcmp(e,"amp")) return '&';
+    if(0==strcmp(e,"lt")) return '<';
+    if(0==strcmp(e,"gt")) return '>';
+    if(0==strcmp(e,"quot")) return '"';
+    if(0==strcmp(e,"apos")) return '\'';
+    if(*e=='#') {
+        long i = *(e+1)=='x'?strtol(e+2,nullptr,16):strtol(e+1,nullptr,10);
+        return i>0 && i<128?(int)i:'?';
+    }
+    return '?';
+}
+inline void lastchange_feed(lastchange_field* fields,size_t count,int ch) {
+    for(size_t i = 0;i<count;++i) {
+        lastchange_field& f = fields[i];
+        if(f.found) {
+            // we only want the first one (the current track)
+            continue;
+        }
+        if(f.capturing) {
+            if(ch==f.terminator) {
+                f.value[f.len]=0;
+                f.capturing = false;
+                f.found = true;
+            } else if(f.len<sizeof(f.value)-1) {
+                f.value[f.len++]=(char)ch;
+            }
+            continue;
+        }
+        if(ch==f.pattern[f.match]) {
+            if(0==f.pattern[++f.match]) {
+                f.capturing = true;
+                f.len = 0;
+                f.match = 0;
+            }
+        } else {
+            f.match = ch==f.pattern[0];
+        }
+    }
+}
+inline void lastchange_value(lastchange_field& f) {
+    // the values are escaped one more time than the
+    // XML around them. decode them in place
+    xml_unescaper u = {{0},0};
+    size_t len = 0;
+    for(size_t i = 0;i<f.len;++i) {
+        int ch = xml_unescape(u,(uint8_t)f.value[i]);
+        if(ch>=0) {
+            f.value[len++]=(char)ch;
+        }
+    }
+    f.value[len]=0;
+    f.len = len;
+}
+inline void gena_event_init(gena_event* e) {
+    static const char* patterns[] = {
+        "<TransportState val=\"",
+        "<dc:title>",
+        "<dc:creator>",
+        "<r:streamContent>"
+    };
+    for(size_t i = 0;i<4;++i) {
+        lastchange_field& f = e->fields[i];
+        memset(&f,0,sizeof(f));
+        f.pattern = patterns[i];
+        f.terminator = i==0?'"':'<';
+    }
+    e->outer = {{0},0};
+    e->inner = {{0},0};
+}
+inline void gena_event_feed(gena_event* e,const char* data,size_t size) {
+    for(size_t i = 0;i<size;++i) {
+        // as unsigned, or UTF-8 would look like "still
+        // in an entity"
+        int ch = xml_unescape(e->outer,(uint8_t)data[i]);
+        if(ch>=0) {
+            ch = xml_unescape(e->inner,ch);
+            if(ch>=0) {
+                lastchange_feed(e->fields,4,ch);
+            }
+        }
+    }
+}
+inline void gena_now_playing(gena_event* e,char* text,size_t size,bool* active) {
+    // an event only has what changed, so text and active
+    // come in as what we had and go out updated
+    lastchange_field* fields = e->fields;
+    if(fields[0].found) {
+        *active = 0==strcmp(fields[0].value,"PLAYING") ||
+            0==strcmp(fields[0].value,"TRANSITIONING");
+    }
+    for(size_t i = 1;i<4;++i) {
+        if(fields[i].found) {
+            lastchange_value(fields[i]);
+        }
+    }
+    if(fields[3].found && fields[3].len>0) {
+        // radio puts what's playing here
+        snprintf(text,size,"%s",fields[3].value);
+    } else if(fields[1].found) {
+        if(fields[2].found && fields[2].len>0) {
+            snprintf(text,size,"%s - %s",fields[1].value,fields[2].value);
+        } else {
+            snprintf(text,size,"%s",fields[1].value);
+        }
+    }
+}
+template<typename Client>
+bool gena_notify(const gena_subscription* s,Client& client,char* buffer,size_t size,gena_event* event) {
+    // parse the LastChange event as it comes in, never
+    // holding more than a chunk of it at a time. true if
+    // it's for our subscription
+    uint32_t deadline = http_millis()+s->request_timeout_ms;
+    if(0>=http_read_line(client,buffer,size,deadline) ||
+            0!=strncmp(buffer,"NOTIFY ",7)) {
+        return false;
+    }
+    long content_length = -1;
+    bool ours = false;
+    while(true) {
+        int len = http_read_line(client,buffer,size,deadline);
+        if(len<=0) {
+            break;
+        }
+        if(0==strncasecmp(buffer,"Content-Length:",15)) {
+            content_length = atol(buffer+15);
+        } else if(0==strncasecmp(buffer,"SID:",4)) {
+            const char* sz = buffer+4;
+            while(*sz==' ') {
+                ++sz;
+            }
+            ours = s->sid[0]!=0 && 0==strcmp(sz,s->sid);
+        }
+    }
+    gena_event_init(event);
+    while(content_length!=0) {
+        size_t len = size;
+        if(content_length>0 && len>(size_t)content_length) {
+            len = content_length;
+        }
+        int read = client.read((uint8_t*)buffer,len);
+        if(read>0) {
+            gena_event_feed(event,buffer,read);
+            if(content_length>0) {
+                content_length-=read;
+            }
+            continue;
+        }
+        if(!client.connected() || (int32_t)(http_millis()-deadline)>=0) {
+            break;
+        }
+        http_idle();
+    }
+    static const char* ok = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    client.write((const uint8_t*)ok,strlen(ok));
+    // if it isn't ours it's left over from a room we were
+    // watching before
+    return ours;
+}
+inline int gena_format(const gena_subscription* s,char* buffer,size_t size,const char* method,const char* path,const char* host,const char* callback) {
+    // SUBSCRIBE (new or renew) or UNSUBSCRIBE. host is the
+    // speaker's host:port and callback where NOTIFYs go
+    if(s->sid[0]!=0 && *method=='U') {
+        return snprintf(buffer,size,
+            "%s %s HTTP/1.1\r\nHOST: %s\r\nSID: %s\r\n\r\n",
+            method,path,host,s->sid);
+    }
+    if(s->sid[0]!=0) {
+        // a renewal
+        return snprintf(buffer,size,
+            "%s %s HTTP/1.1\r\nHOST: %s\r\nSID: %s\r\nTIMEOUT: Second-%d\r\n\r\n",
+            method,path,host,s->sid,s->timeout_secs);
+    }
+    return snprintf(buffer,size,
+        "%s %s HTTP/1.1\r\nHOST: %s\r\n"
+        "CALLBACK: <%s>\r\n"
+        "NT: upnp:event\r\nTIMEOUT: Second-%d\r\n\r\n",
+        method,path,host,callback,s->timeout_secs);
+}
+template<typename Client>
+bool gena_request(gena_subscription* s,Client& client,const char* method,const char* path,const char* host,const char* callback,char* buffer,size_t size) {
+    // sends it down a connected client and takes the
+    // subscription from the response. the caller closes it
+    s->status = -1;
+    int len = gena_format(s,buffer,size,method,path,host,callback);
+    if(len<0 || (size_t)len>=size ||
+            (size_t)len!=client.write((const uint8_t*)buffer,len)) {
+        return false;
+    }
+    // we only need the status and the subscription headers
+    uint32_t deadline = http_millis()+s->request_timeout_ms;
+    if(0>=http_read_line(client,buffer,size,deadline) ||
+            0!=strncmp(buffer,"HTTP/1.",7)) {
+        return false;
+    }
+    int status = atoi(buffer+9);
+    int timeout = s->timeout_secs;
+    while(true) {
+        int len = http_read_line(client,buffer,size,deadline);
+        if(len<0) {
+            return false;
+        }
+        if(len==0) {
+            break;
+        }
+        if(status==200 && 0==strncasecmp(buffer,"SID:",4)) {
+            const char* sz = buffer+4;
+            while(*sz==' ') {
+                ++sz;
+            }
+            strncpy(s->sid,sz,sizeof(s->sid)-1);
+            s->sid[sizeof(s->sid)-1]=0;
+        } else if(0==strncasecmp(buffer,"TIMEOUT:",8)) {
+            // Second-infinite (or nonsense) parses to 0, and
+            // we don't trust a longer lease than we asked for
+            const char* sz = strstr(buffer,"Second-");
+            if(sz!=nullptr) {
+                timeout = atoi(sz+7);
+                if(timeout<=0 || timeout>s->timeout_secs) {
+                    timeout = s->timeout_secs;
+                }
+            }
+        }
+    }
+    s->status = status;
+    if(status!=200) {
+        return false;
+    }
+    uint32_t timeout_ms = (uint32_t)timeout*1000;
+    if(timeout_ms>s->renew_margin_ms*2) {
+        s->renew_ts = http_millis()+timeout_ms-s->renew_margin_ms;
+    } else {
+        s->renew_ts = http_millis()+timeout_ms/2;
+    }
+    return true;
+}
+template<typename Speakers>
+void gena_follow(gena_subscription* s,Speakers& speakers,int want) {
+    // follow the room we're showing, or none for -1
+    if(want!=s->index) {
+        if(s->index>=0 && s->sid[0]!=0) {
+            speakers.request(s->index,"UNSUBSCRIBE");
+        }
+        s->sid[0]=0;
+        s->index = want;
+        if(want>=0 && !speakers.request(want,"SUBSCRIBE")) {
+            s->sid[0]=0;
+            s->renew_ts = http_millis()+s->retry_ms;
+        }
+        return;
+    }
+    if(s->index>=0 && (int32_t)(http_millis()-s->renew_ts)>=0) {
+        // renew, or if that fails (or we never had
+        // one) start a new subscription
+        if(!speakers.request(s->index,"SUBSCRIBE")) {
+            s->sid[0]=0;
+            if(!speakers.request(s->index,"SUBSCRIBE")) {
+                s->renew_ts = http_millis()+s->retry_ms;
+            }
+        }
+    }
+}
@@ -0,0 +1,205 @@
+#pragma once
+// keep-alive HTTP/1.1 connections to the bridge(s), and the
+// little bit of HTTP we speak over them. it's templated on
+// the client so the same code runs over WiFiClient on the
+// device and over plain sockets in the native tests
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// the platform supplies these. on the device they're
+// millis() and delay(1)
+uint32_t http_millis();
+void http_idle();
+
+// response bodies bigger than this aren't worth reading
+// just to keep the connection. we drop it instead
+constexpr static const size_t http_max_drain = 4096;
+
+template<typename Client>
+struct http_connection {
+    char host[128];
+    uint16_t port;
+    bool secure;
+    uint32_t used_ts;
+    Client client;
+};
+template<typename Client>
+http_connection<Client>* http_pool_find(http_connection<Client>* pool,size_t size,const char* host,uint16_t port,bool secure) {
+    // an existing connection to this host, or else a
+    // free slot, or else the least recently used one
+    for(size_t i = 0;i<size;++i) {
+        http_connection<Client>& c = pool[i];
+        if(c.port==port && c.secure==secure && 0==strcmp(c.host,host)) {
+            return &c;
+        }
+    }
+    http_connection<Client>* result = &pool[0];
+    for(size_t i = 0;i<size;++i) {
+        http_connection<Client>& c = pool[i];
+        if(c.host[0]==0) {
+            return &c;
+        }
+        if(c.used_ts<result->used_ts) {
+            result = &c;
+        }
+    }
+    return result;
+}
+template<typename Client>
+bool http_pool_reuse(http_connection<Client>* conn,const char* host,uint16_t port,bool secure,uint32_t ts,uint32_t keep_alive_ms) {
+    // true if the connection is to host, still alive and
+    // hasn't idled out. otherwise it's closed and pointed
+    // at host, ready to be opened again
+    if(conn->port==port && conn->secure==secure && 0==strcmp(conn->host,host)) {
+        if(conn->client.connected() && ts-conn->used_ts<keep_alive_ms) {
+            return true;
+        }
+    } else {
+        strncpy(conn->host,host,sizeof(conn->host)-1);
+        conn->host[sizeof(conn->host)-1]=0;
+        conn->port = port;
+        conn->secure = secure;
+    }
+    conn->client.stop();
+    return false;
+}
+template<typename Client>
+bool http_write_requests(Client& client,char* buffer,size_t size,const char* host,const char* path,int count) {
+    // build the request(s) and write them in as few sends as
+    // we can. batched requests are pipelined on the connection
+    size_t used = 0;
+    for(int i = 0;i<count;++i) {
+        int len = snprintf(buffer+used,size-used,
+            "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n",
+            path,host);
+        if(len<0 || (size_t)len>=size) {
+            return false;
+        }
+        if(used+len>=size) {
+            // out of room. send what we have and start over
+            if(used!=client.write((const uint8_t*)buffer,used)) {
+                return false;
+            }
+            used = 0;
+            --i;
+            continue;
+        }
+        used+=len;
+    }
+    return used==client.write((const uint8_t*)buffer,used);
+}
+template<typename Client>
+int http_read_line(Client& client,char* line,size_t size,uint32_t deadline) {
+    // read a line, truncating it if it's longer than size
+    size_t len = 0;
+    while(true) {
+        int i = client.read();
+        if(i<0) {
+            if(!client.connected() || (int32_t)(http_millis()-deadline)>=0) {
+                return -1;
+            }
+            http_idle();
+            continue;
+        }
+        if(i=='\n') {
+            break;
+        }
+        if(i!='\r' && len<size-1) {
+            line[len++]=(char)i;
+        }
+    }
+    line[len]=0;
+    return (int)len;
+}
+template<typename Client>
+int http_read_head(Client& client,char* buffer,size_t size,uint32_t deadline,bool* keep_alive,long* content_length,bool* chunked) {
+    // the status line and the headers we care about.
+    // returns the status, or -1
+    if(0>=http_read_line(client,buffer,size,deadline) ||
+            0!=strncmp(buffer,"HTTP/1.",7)) {
+        return -1;
+    }
+    // HTTP/1.0 closes unless told otherwise
+    *keep_alive = buffer[7]!='0';
+    *content_length = -1;
+    *chunked = false;
+    int status = atoi(buffer+9);
+    while(true) {
+        int len = http_read_line(client,buffer,size,deadline);
+        if(len<0) {
+            return -1;
+        }
+        if(len==0) {
+            break;
+        }
+        if(0==strncasecmp(buffer,"Content-Length:",15)) {
+            *content_length = atol(buffer+15);
+        } else if(0==strncasecmp(buffer,"Transfer-Encoding:",18)) {
+            *chunked = nullptr!=strcasestr(buffer+18,"chunked");
+        } else if(0==strncasecmp(buffer,"Connection:",11)) {
+            *keep_alive = nullptr==strcasestr(buffer+11,"close");
+        }
+    }
+    return status;
+}
+template<typename Client>
+int http_read_status(Client& client,char* buffer,size_t size,uint32_t deadline,char* body,size_t body_size) {
+    // we mostly only care about the status code. the headers
+    // tell us how much to drain to reuse the socket
+    bool keep_alive;
+    bool chunked;
+    long content_length;
+    int status = http_read_head(client,buffer,size,deadline,&keep_alive,&content_length,&chunked);
+    if(status<0) {
+        return -1;
+    }
+    if(chunked) {
+        // not worth decoding chunks to save the socket
+        keep_alive = false;
+    }
+    bool drain = keep_alive && content_length>=0 && content_length<=(long)http_max_drain;
+    if(!drain && body==nullptr) {
+        client.stop();
+        return status;
+    }
+    // read the body, keeping as much as the caller wants and
+    // draining the rest so the next response lines up
+    size_t body_len = 0;
+    while(content_length!=0) {
+        bool into_body = body!=nullptr && body_len<body_size-1;
+        if(!into_body && !drain) {
+            break;
+        }
+        char* dst = into_body?body+body_len:buffer;
+        size_t len = into_body?body_size-1-body_len:size;
+        if(content_length>0 && len>(size_t)content_length) {
+            len = content_length;
+        }
+        int read = client.read((uint8_t*)dst,len);
+        if(read>0) {
+            if(into_body) {
+                body_len+=read;
+            }
+            if(content_length>0) {
+                content_length-=read;
+            }
+            continue;
+        }
+        if(!client.connected() || (int32_t)(http_millis()-deadline)>=0) {
+            drain = false;
+            break;
+        }
+        http_idle();
+    }
+    if(body!=nullptr) {
+        body[body_len]=0;
+    }
+    if(!drain) {
+        client.stop();
+    }
+    return status;
+}
@@ -0,0 +1,250 @@
+#include "json_reader.hpp"
+#include <string.h>
+
+void json_init(json_reader* reader,json_callback callback,void* state) {
+    reader->callback = callback;
+    reader->state = state;
+    reader->status = json_state::value;
+    reader->path[0]=0;
+    reader->path_len = 0;
+    reader->depth = 0;
+    reader->value_len = 0;
+    reader->fed = 0;
+}
+static void json_path_append(json_reader* reader,const char* sz,size_t len) {
+    if(reader->path_len+len>=sizeof(reader->path)) {
+        len = sizeof(reader->path)-1-reader->path_len;
+    }
+    memcpy(reader->path+reader->path_len,sz,len);
+    reader->path_len+=len;
+    reader->path[reader->path_len]=0;
+}
+static void json_path_element(json_reader* reader) {
+    // container.key or container[index]
+    size_t top = reader->depth-1;
+    reader->path_len = reader->base[top];
+    reader->path[reader->path_len]=0;
+    if(reader->index[top]<0) {
+        if(reader->path_len>0) {
+            json_path_append(reader,".",1);
+        }
+        json_path_append(reader,reader->value,reader->value_len);
+    } else {
+        // by hand. snprintf() wants a couple of KB of stack
+        char sz[8];
+        size_t len = sizeof(sz);
+        sz[--len]=']';
+        unsigned index = (unsigned)reader->index[top];
+        do {
+            sz[--len]=(char)('0'+index%10);
+            index/=10;
+        } while(index>0);
+        sz[--len]='[';
+        json_path_append(reader,sz+len,sizeof(sz)-len);
+    }
+}
+static void json_value_append(json_reader* reader,char ch) {
+    if(reader->value_len<sizeof(reader->value)-1) {
+        reader->value[reader->value_len++]=ch;
+    }
+}
+static void json_emit(json_reader* reader,json_type type) {
+    reader->value[reader->value_len]=0;
+    reader->callback(reader,type,reader->value,reader->state);
+    reader->status = json_state::next;
+}
+static void json_push(json_reader* reader,bool array) {
+    if(reader->depth==json_max_depth) {
+        reader->status = json_state::error;
+        return;
+    }
+    reader->base[reader->depth] = (uint16_t)reader->path_len;
+    reader->index[reader->depth] = array?0:-1;
+    ++reader->depth;
+    if(array) {
+        json_path_element(reader);
+    }
+    reader->status = array?json_state::value:json_state::key;
+}
+static void json_pop(json_reader* reader,char ch) {
+    if(reader->depth==0 || (ch==']')!=(reader->index[reader->depth-1]>=0)) {
+        reader->status = json_state::error;
+        return;
+    }
+    --reader->depth;
+    reader->path_len = reader->base[reader->depth];
+    reader->path[reader->path_len]=0;
+    reader->value_len = 0;
+    json_emit(reader,json_type::end);
+}
+void json_feed(json_reader* reader,const char* data,size_t size) {
+    reader->fed+=size;
+    size_t i = 0;
+    while(i<size && reader->status!=json_state::error) {
+        char ch = data[i];
+        bool space = ch==' ' || ch=='\t' || ch=='\r' || ch=='\n';
+        switch(reader->status) {
+            case json_state::value:
+                if(space) {
+                    break;
+                }
+                if(ch=='{' || ch=='[') {
+                    json_push(reader,ch=='[');
+                } else if(ch=='"') {
+                    reader->reading_key = false;
+                    reader->value_len = 0;
+                    reader->status = json_state::string;
+                } else if(ch==']' && reader->depth>0 && reader->index[reader->depth-1]==0) {
+                    // an empty array
+                    json_pop(reader,ch);
+                } else {
+                    reader->value_len = 0;
+                    reader->status = json_state::literal;
+                    // the literal state takes it from here
+                    continue;
+                }
+                break;
+            case json_state::key:
+                if(space) {
+                    break;
+                }
+                if(ch=='"') {
+                    reader->reading_key = true;
+                    reader->value_len = 0;
+                    reader->status = json_state::string;
+                } else if(ch=='}') {
+                    json_pop(reader,ch);
+                } else {
+                    reader->status = json_state::error;
+                }
+                break;
+            case json_state::colon:
+                if(ch==':') {
+                    reader->status = json_state::value;
+                } else if(!space) {
+                    reader->status = json_state::error;
+                }
+                break;
+            case json_state::next:
+                if(space || reader->depth==0) {
+                    // anything after the document is ignored
+                    break;
+                }
+                if(ch==',') {
+                    size_t top = reader->depth-1;
+                    if(reader->index[top]>=0) {
+                        ++reader->index[top];
+                        json_path_element(reader);
+                        reader->status = json_state::value;
+                    } else {
+                        reader->status = json_state::key;
+                    }
+                } else if(ch=='}' || ch==']') {
+                    json_pop(reader,ch);
+                } else {
+                    reader->status = json_state::error;
+                }
+                break;
+            case json_state::string:
+                if(ch=='\\') {
+                    reader->status = json_state::escape;
+                } else if(ch!='"') {
+                    json_value_append(reader,ch);
+                } else if(reader->reading_key) {
+                    json_path_element(reader);
+                    reader->status = json_state::colon;
+                } else {
+                    json_emit(reader,json_type::string);
+                }
+                break;
+            case json_state::escape:
+                reader->status = json_state::string;
+                switch(ch) {
+                    case 'n':
+                        json_value_append(reader,'\n');
+                        break;
+                    case 't':
+                        json_value_append(reader,'\t');
+                        break;
+                    case 'r':
+                        json_value_append(reader,'\r');
+                        break;
+                    case 'b':
+                        json_value_append(reader,'\b');
+                        break;
+                    case 'f':
+                        json_value_append(reader,'\f');
+                        break;
+                    case 'u':
+                        reader->unicode = 0;
+                        reader->unicode_digits = 0;
+                        reader->status = json_state::unicode;
+                        break;
+                    default:
+                        // \" \\ and \/
+                        json_value_append(reader,ch);
+                        break;
+                }
+                break;
+            case json_state::unicode: {
+                int digit = ch>='0' && ch<='9'?ch-'0':
+                    ch>='a' && ch<='f'?ch-'a'+10:
+                    ch>='A' && ch<='F'?ch-'A'+10:-1;
+                if(digit<0) {
+                    reader->status = json_state::error;
+                    break;
+                }
+                reader->unicode = (reader->unicode<<4)|digit;
+                if(++reader->unicode_digits<4) {
+                    break;
+                }
+                // as UTF-8. we don't pair up surrogates
+                uint16_t cp = reader->unicode;
+                if(cp<0x80) {
+                    json_value_append(reader,(char)cp);
+                } else if(cp<0x800) {
+                    json_value_append(reader,(char)(0xC0|(cp>>6)));
+                    json_value_append(reader,(char)(0x80|(cp&0x3F)));
+                } else if(cp>=0xD800 && cp<0xE000) {
+                    json_value_append(reader,'?');
+                } else {
+                    json_value_append(reader,(char)(0xE0|(cp>>12)));
+                    json_value_append(reader,(char)(0x80|((cp>>6)&0x3F)));
+                    json_value_append(reader,(char)(0x80|(cp&0x3F)));
+                }
+                reader->status = json_state::string;
+                break;
+            }
+            case json_state::literal:
+                if(ch==',' || ch=='}' || ch==']' || space) {
+                    // numbers, true, false and null
+                    json_type type = reader->value[0]=='t' || reader->value[0]=='f'?
+                        json_type::boolean:
+                        reader->value[0]=='n'?json_type::null:json_type::number;
+                    reader->value[reader->value_len]=0;
+                    json_emit(reader,type);
+                    // the delimiter is handled as the next thing
+                    continue;
+                }
+                json_value_append(reader,ch);
+                break;
+            default:
+                break;
+        }
+        ++i;
+    }
+}
+void json_extract_callback(json_reader* reader,json_type type,const char* value,void* state) {
+    json_fields* fields = (json_fields*)state;
+    if(type==json_type::end) {
+        return;
+    }
+    for(size_t i = 0;i<fields->count;++i) {
+        json_field& field = fields->fields[i];
+        if(!field.found && 0==strcmp(field.path,reader->path)) {
+            strncpy(field.value,value,field.size-1);
+            field.value[field.size-1]=0;
+            field.found = true;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+// a streaming JSON reader. it's fed a document a buffer at
+// a time and calls back with each value and its path, like
+// currentTrack.title or [2].members[0].roomName. it never
+// holds more than the path and the current value, and
+// longer ones are cut short
+#include <stdint.h>
+#include <stddef.h>
+
+constexpr static const size_t json_max_path = 128;
+constexpr static const size_t json_max_depth = 16;
+constexpr static const size_t json_max_value = 160;
+enum struct json_type : uint8_t {
+    string,
+    number,
+    boolean,
+    null,
+    // an object or array closed. the path is its own
+    end
+};
+enum struct json_state : uint8_t {
+    value,
+    key,
+    colon,
+    next,
+    string,
+    escape,
+    unicode,
+    literal,
+    error
+};
+struct json_reader;
+typedef void(*json_callback)(json_reader* reader,json_type type,const char* value,void* state);
+struct json_reader {
+    json_callback callback;
+    void* state;
+    json_state status;
+    char path[json_max_path];
+    size_t path_len;
+    // for each open object or array the length of its path,
+    // and which element we're on (-1 for objects)
+    uint16_t base[json_max_depth];
+    int16_t index[json_max_depth];
+    size_t depth;
+    bool reading_key;
+    char value[json_max_value];
+    size_t value_len;
+    uint16_t unicode;
+    uint8_t unicode_digits;
+    // how much we've been fed
+    size_t fed;
+};
+// pulls values out of a document by path, into
+// the caller's buffers
+struct json_field {
+    const char* path;
+    char* value;
+    size_t size;
+    bool found;
+};
+struct json_fields {
+    json_field* fields;
+    size_t count;
+};
+// start reading a new document
+void json_init(json_reader* reader,json_callback callback,void* state);
+// the next piece of the document, which can be any size
+// and split anywhere
+void json_feed(json_reader* reader,const char* data,size_t size);
+// a json_callback that fills in the json_fields in state
+void json_extract_callback(json_reader* reader,json_type type,const char* value,void* state);
@@ -0,0 +1,117 @@
+#include "mqtt_packet.hpp"
+#include <string.h>
+
+size_t mqtt_put_length(uint8_t* out,size_t length) {
+    size_t len = 0;
+    do {
+        uint8_t digit = length&0x7F;
+        length>>=7;
+        out[len++] = digit|(length>0?0x80:0);
+    } while(length>0);
+    return len;
+}
+size_t mqtt_put_string(uint8_t* out,const char* str,size_t len) {
+    out[0] = len>>8;
+    out[1] = len&0xFF;
+    memcpy(out+2,str,len);
+    return len+2;
+}
+// the fixed header for a body of length. 0 if the whole
+// packet doesn't fit
+static size_t mqtt_put_header(uint8_t* out,size_t size,uint8_t type,size_t length) {
+    uint8_t header[5];
+    header[0] = type;
+    size_t len = 1+mqtt_put_length(header+1,length);
+    if(length>0x0FFFFFFF || len+length>size) {
+        return 0;
+    }
+    memcpy(out,header,len);
+    return len;
+}
+size_t mqtt_connect_packet(uint8_t* out,size_t size,const char* client_id,uint16_t keep_alive_secs) {
+    // without a clean session, so the broker keeps our
+    // subscription while we sleep and we needn't redo it
+    size_t id_len = strlen(client_id);
+    size_t len = mqtt_put_header(out,size,0x10,10+2+id_len);
+    if(len==0) {
+        return 0;
+    }
+    len+=mqtt_put_string(out+len,"MQTT",4);
+    // protocol level 4 (3.1.1), no flags
+    out[len++] = 4;
+    out[len++] = 0;
+    out[len++] = keep_alive_secs>>8;
+    out[len++] = keep_alive_secs&0xFF;
+    len+=mqtt_put_string(out+len,client_id,id_len);
+    return len;
+}
+size_t mqtt_subscribe_packet(uint8_t* out,size_t size,uint16_t packet_id,const char* filter) {
+    size_t filter_len = strlen(filter);
+    size_t len = mqtt_put_header(out,size,0x82,2+2+filter_len+1);
+    if(len==0) {
+        return 0;
+    }
+    out[len++] = packet_id>>8;
+    out[len++] = packet_id&0xFF;
+    len+=mqtt_put_string(out+len,filter,filter_len);
+    // QoS 0 is all we need for a display
+    out[len++] = 0;
+    return len;
+}
+size_t mqtt_publish_packet(uint8_t* out,size_t size,const char* topic,size_t topic_len,const char* payload,size_t payload_len) {
+    size_t len = mqtt_put_header(out,size,0x30,2+topic_len+payload_len);
+    if(len==0) {
+        return 0;
+    }
+    len+=mqtt_put_string(out+len,topic,topic_len);
+    memcpy(out+len,payload,payload_len);
+    return len+payload_len;
+}
+void mqtt_header_init(mqtt_header* header) {
+    header->type = 0;
+    header->used = 0;
+    header->length = 0;
+}
+int mqtt_header_feed(mqtt_header* header,uint8_t ch) {
+    if(header->used==0) {
+        header->type = ch;
+        header->used = 1;
+        return 0;
+    }
+    header->length|=(size_t)(ch&0x7F)<<(7*(header->used-1));
+    ++header->used;
+    if(0==(ch&0x80)) {
+        return 1;
+    }
+    // the length takes at most 4 bytes
+    return header->used==5?-1:0;
+}
+bool mqtt_parse_connack(uint8_t type,const uint8_t* body,size_t size,bool* resumed,int* code) {
+    if(type!=0x20 || size<2) {
+        *resumed = false;
+        *code = -1;
+        return false;
+    }
+    *resumed = 0!=(body[0]&1);
+    *code = body[1];
+    return body[1]==0;
+}
+bool mqtt_parse_publish(uint8_t type,const uint8_t* body,size_t size,const char** topic,size_t* topic_len,const char** payload,size_t* payload_len) {
+    if((type&0xF0)!=0x30 || size<2) {
+        return false;
+    }
+    size_t len = (body[0]<<8)|body[1];
+    size_t offset = 2+len;
+    if(type&0x06) {
+        // the packet id, if it came at QoS 1 or 2
+        offset+=2;
+    }
+    if(offset>size) {
+        return false;
+    }
+    *topic = (const char*)body+2;
+    *topic_len = len;
+    *payload = (const char*)body+offset;
+    *payload_len = size-offset;
+    return true;
+}
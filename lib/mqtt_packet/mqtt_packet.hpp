@@ -0,0 +1,35 @@
+#pragma once
+// the little bit of MQTT 3.1.1 we speak: CONNECT without a
+// clean session, SUBSCRIBE and PUBLISH at QoS 0, and reading
+// the fixed header, CONNACK and PUBLISH from the broker
+#include <stdint.h>
+#include <stddef.h>
+
+// the fixed header's "remaining length" field, which takes
+// up to 4 bytes. returns how many it wrote
+size_t mqtt_put_length(uint8_t* out,size_t length);
+// a length prefixed string. returns how many bytes it wrote
+size_t mqtt_put_string(uint8_t* out,const char* str,size_t len);
+// each of these builds a whole packet into out and returns
+// its length, or 0 if it doesn't fit in size
+size_t mqtt_connect_packet(uint8_t* out,size_t size,const char* client_id,uint16_t keep_alive_secs);
+size_t mqtt_subscribe_packet(uint8_t* out,size_t size,uint16_t packet_id,const char* filter);
+size_t mqtt_publish_packet(uint8_t* out,size_t size,const char* topic,size_t topic_len,const char* payload,size_t payload_len);
+// reads a fixed header a byte at a time
+struct mqtt_header {
+    // the packet type and flags
+    uint8_t type;
+    size_t used;
+    // the remaining length, once it's complete
+    size_t length;
+};
+void mqtt_header_init(mqtt_header* header);
+// 1 when the header is complete, 0 if it needs more, or
+// -1 if it isn't valid
+int mqtt_header_feed(mqtt_header* header,uint8_t ch);
+// a CONNACK body. true if the broker took us, and whether it
+// still had our session. code is its return code, or -1
+bool mqtt_parse_connack(uint8_t type,const uint8_t* body,size_t size,bool* resumed,int* code);
+// a PUBLISH body, pointing into it. false if it isn't one,
+// or the topic was cut short
+bool mqtt_parse_publish(uint8_t type,const uint8_t* body,size_t size,const char** topic,size_t* topic_len,const char** payload,size_t* payload_len);
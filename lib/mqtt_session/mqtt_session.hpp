@@ -0,0 +1,228 @@
+#pragma once
+// the one connection we keep open to an MQTT broker: opening
+// it without a clean session so the broker keeps our
+// subscription while we sleep, keeping it alive while we're
+// awake, publishing down it and taking what the broker sends.
+// it's templated on the network so the native tests can run
+// it against a stub broker. the network has:
+//   uint32_t now_ms()
+//   void idle() - wait a moment for more to arrive
+//   bool connect(const char* host,uint16_t port)
+//   size_t write(const uint8_t* data,size_t size)
+//   int read() - the next byte, or -1
+//   int available()
+//   bool connected()
+//   void stop()
+//   void received(const char* topic,size_t topic_len,const char* payload,size_t payload_len)
+//     - a PUBLISH from the broker
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <mqtt_packet.hpp>
+
+// the most of a packet from the broker we look at
+constexpr static const size_t mqtt_max_packet = 512;
+enum struct mqtt_opened {
+    failed,
+    refused,
+    // it was already open
+    reused,
+    // the broker still had our session
+    resumed,
+    fresh
+};
+struct mqtt_session {
+    char host[64];
+    uint16_t port;
+    bool connected;
+    // the broker keeps our subscriptions (and anything else
+    // about the session) between connections under this id
+    const char* client_id;
+    uint16_t keep_alive_secs;
+    // what we subscribe to when the broker at subscribe_host
+    // has no session for us. empty for nothing
+    char subscribe_host[64];
+    uint16_t subscribe_port;
+    char filter[160];
+    uint32_t sent_ts;
+    uint32_t received_ts;
+    bool ping_pending;
+    uint16_t packet_id;
+    // last refusal's return code, or -1
+    int code;
+    uint8_t buffer[mqtt_max_packet];
+    uint32_t connects;
+    uint32_t resumed;
+    uint32_t published;
+};
+inline void mqtt_session_init(mqtt_session* s,const char* client_id,uint16_t keep_alive_secs) {
+    memset(s,0,sizeof(*s));
+    s->client_id = client_id;
+    s->keep_alive_secs = keep_alive_secs;
+    s->code = -1;
+}
+template<typename Network>
+void mqtt_close(mqtt_session* s,Network& network) {
+    network.stop();
+    s->connected = false;
+}
+template<typename Network>
+bool mqtt_write(mqtt_session* s,Network& network,const uint8_t* data,size_t size) {
+    if(size!=network.write(data,size)) {
+        mqtt_close(s,network);
+        return false;
+    }
+    s->sent_ts = network.now_ms();
+    return true;
+}
+template<typename Network>
+int mqtt_read_packet(mqtt_session* s,Network& network,uint32_t deadline,size_t* size) {
+    // returns the packet type and flags, or -1. anything
+    // past what fits in the buffer is read and dropped
+    mqtt_header header;
+    mqtt_header_init(&header);
+    bool in_header = true;
+    size_t remaining = 1;
+    while(remaining>0) {
+        int ch = network.read();
+        if(ch<0) {
+            if(!network.connected() || (int32_t)(network.now_ms()-deadline)>=0) {
+                mqtt_close(s,network);
+                return -1;
+            }
+            network.idle();
+            continue;
+        }
+        if(in_header) {
+            int result = mqtt_header_feed(&header,(uint8_t)ch);
+            if(result<0) {
+                mqtt_close(s,network);
+                return -1;
+            }
+            if(result>0) {
+                in_header = false;
+                remaining = header.length;
+                *size = 0;
+            }
+            continue;
+        }
+        if(*size<sizeof(s->buffer)) {
+            s->buffer[(*size)++]=(uint8_t)ch;
+        }
+        --remaining;
+    }
+    s->received_ts = network.now_ms();
+    s->ping_pending = false;
+    return header.type;
+}
+template<typename Network>
+bool mqtt_subscribe(mqtt_session* s,Network& network) {
+    if(++s->packet_id==0) {
+        s->packet_id = 1;
+    }
+    size_t len = mqtt_subscribe_packet(s->buffer,sizeof(s->buffer),s->packet_id,s->filter);
+    return len>0 && mqtt_write(s,network,s->buffer,len);
+}
+template<typename Network>
+mqtt_opened mqtt_open(mqtt_session* s,Network& network,const char* host,uint16_t port,uint32_t deadline) {
+    if(s->connected && port==s->port && 0==strcmp(host,s->host)) {
+        if(network.connected()) {
+            return mqtt_opened::reused;
+        }
+    }
+    mqtt_close(s,network);
+    strncpy(s->host,host,sizeof(s->host)-1);
+    s->host[sizeof(s->host)-1]=0;
+    s->port = port;
+    s->code = -1;
+    if(!network.connect(host,port)) {
+        return mqtt_opened::failed;
+    }
+    size_t len = mqtt_connect_packet(s->buffer,sizeof(s->buffer),s->client_id,s->keep_alive_secs);
+    s->connected = true;
+    if(!mqtt_write(s,network,s->buffer,len)) {
+        return mqtt_opened::failed;
+    }
+    size_t size;
+    int type = mqtt_read_packet(s,network,deadline,&size);
+    bool resumed;
+    if(type<0) {
+        return mqtt_opened::failed;
+    }
+    if(!mqtt_parse_connack((uint8_t)type,s->buffer,size,&resumed,&s->code)) {
+        mqtt_close(s,network);
+        return mqtt_opened::refused;
+    }
+    ++s->connects;
+    if(resumed) {
+        ++s->resumed;
+        return mqtt_opened::resumed;
+    }
+    // a new session has none of our subscriptions
+    if(s->filter[0]!=0 && port==s->subscribe_port && 0==strcmp(host,s->subscribe_host) &&
+            !mqtt_subscribe(s,network)) {
+        return mqtt_opened::failed;
+    }
+    return mqtt_opened::fresh;
+}
+template<typename Network>
+bool mqtt_publish(mqtt_session* s,Network& network,const char* host,uint16_t port,const uint8_t* packet,size_t len,int count,uint32_t deadline) {
+    // one PUBLISH for each press, down the open connection.
+    // if it was dropped while we weren't looking, open it
+    // again and send once more
+    for(int tries = 0;tries<2;++tries) {
+        if(tries>0 || !s->connected) {
+            mqtt_opened opened = mqtt_open(s,network,host,port,deadline);
+            if(opened==mqtt_opened::failed || opened==mqtt_opened::refused) {
+                return false;
+            }
+        }
+        bool written = true;
+        for(int i = 0;i<count && written;++i) {
+            written = mqtt_write(s,network,packet,len);
+        }
+        if(written) {
+            // QoS 0 has nothing to wait for
+            s->published+=count;
+            return true;
+        }
+    }
+    return false;
+}
+template<typename Network>
+void mqtt_receive(mqtt_session* s,Network& network,uint32_t deadline) {
+    // take whatever the broker has sent us
+    while(s->connected && network.available()>0) {
+        size_t size;
+        int type = mqtt_read_packet(s,network,deadline,&size);
+        if(type<0) {
+            return;
+        }
+        const char* topic;
+        const char* payload;
+        size_t topic_len;
+        size_t payload_len;
+        // skip acks, ping responses, and ones too big for us
+        if(mqtt_parse_publish((uint8_t)type,s->buffer,size,&topic,&topic_len,&payload,&payload_len)) {
+            network.received(topic,topic_len,payload,payload_len);
+        }
+    }
+}
+template<typename Network>
+bool mqtt_keep_alive(mqtt_session* s,Network& network) {
+    // ping when we owe the broker one, or it owes us
+    // something. false if it's gone quiet and we've let go
+    uint32_t ts = network.now_ms();
+    uint32_t keep_alive_ms = s->keep_alive_secs*1000;
+    if(ts-s->received_ts>keep_alive_ms*3/2) {
+        mqtt_close(s,network);
+        return false;
+    }
+    if(!s->ping_pending &&
+            (ts-s->sent_ts>=keep_alive_ms*3/4 ||
+            ts-s->received_ts>=keep_alive_ms*3/4)) {
+        static const uint8_t ping[] = {0xC0,0};
+        s->ping_pending = mqtt_write(s,network,ping,sizeof(ping));
+    }
+    return s->connected;
+}
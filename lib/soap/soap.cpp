@@ -0,0 +1,67 @@
+#include "soap.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+soap_action soap_actions[] = {
+    {"Play","/MediaRenderer/AVTransport/Control","AVTransport","Play","<Speed>1</Speed>",nullptr},
+    {"Pause","/MediaRenderer/AVTransport/Control","AVTransport","Pause","",nullptr},
+    {"Stop","/MediaRenderer/AVTransport/Control","AVTransport","Stop","",nullptr},
+    {"Next","/MediaRenderer/AVTransport/Control","AVTransport","Next","",nullptr},
+    {"Previous","/MediaRenderer/AVTransport/Control","AVTransport","Previous","",nullptr},
+    {"GetTransportInfo","/MediaRenderer/AVTransport/Control","AVTransport","GetTransportInfo","",nullptr},
+    {"VolumeUp","/MediaRenderer/RenderingControl/Control","RenderingControl","SetRelativeVolume","<Channel>Master</Channel><Adjustment>5</Adjustment>",nullptr},
+    {"VolumeDown","/MediaRenderer/RenderingControl/Control","RenderingControl","SetRelativeVolume","<Channel>Master</Channel><Adjustment>-5</Adjustment>",nullptr},
+    // not a real action. it's GetTransportInfo then Play or Pause
+    {"PlayPause",nullptr,nullptr,nullptr,nullptr,nullptr}
+};
+const size_t soap_action_count = sizeof(soap_actions)/sizeof(soap_action);
+
+soap_action* soap_action_for(const char* name) {
+    for(size_t i = 0;i<soap_action_count;++i) {
+        if(0==strcasecmp(soap_actions[i].name,name)) {
+            return &soap_actions[i];
+        }
+    }
+    return nullptr;
+}
+bool soap_build(soap_action* action) {
+    if(action->request!=nullptr || action->service==nullptr) {
+        return true;
+    }
+    static const char* body_fmt = 
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+        "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+        "<s:Body><u:%s xmlns:u=\"urn:schemas-upnp-org:service:%s:1\">"
+        "<InstanceID>0</InstanceID>%s</u:%s></s:Body></s:Envelope>";
+    static const char* header_fmt = 
+        "Content-Type: text/xml; charset=\"utf-8\"\r\n"
+        "SOAPACTION: \"urn:schemas-upnp-org:service:%s:1#%s\"\r\n"
+        "Content-Length: %d\r\n"
+        "Connection: keep-alive\r\n\r\n";
+    int body_len = snprintf(nullptr,0,body_fmt,action->action,action->service,action->args,action->action);
+    int header_len = snprintf(nullptr,0,header_fmt,action->service,action->action,body_len);
+    action->request = (char*)malloc(header_len+body_len+1);
+    if(action->request==nullptr) {
+        return false;
+    }
+    sprintf(action->request,header_fmt,action->service,action->action,body_len);
+    sprintf(action->request+header_len,body_fmt,action->action,action->service,action->args,action->action);
+    return true;
+}
+int soap_format(char* buffer,size_t size,const soap_action* action,const char* host) {
+    // the request line and host are all that vary
+    int len = snprintf(buffer,size,
+        "POST %s HTTP/1.1\r\nHost: %s:%d\r\n",
+        action->path,
+        host,
+        (int)soap_port);
+    size_t request_len = strlen(action->request);
+    if(len<0 || len+request_len>size) {
+        return -1;
+    }
+    memcpy(buffer+len,action->request,request_len);
+    return len+(int)request_len;
+}
@@ -0,0 +1,30 @@
+#pragma once
+// UPnP control requests, sent straight to a speaker
+// instead of through the bridge
+#include <stdint.h>
+#include <stddef.h>
+
+// the port Sonos speakers take UPnP requests on
+constexpr static const uint16_t soap_port = 1400;
+// an api.txt line of the form upnp:<action> skips the bridge
+// and sends one of these straight to the room's speaker
+struct soap_action {
+    const char* name;
+    const char* path;
+    const char* service;
+    const char* action;
+    const char* args;
+    // the prebuilt headers and body. they don't vary by room
+    // (it's always instance 0) so only the host is added later
+    char* request;
+};
+extern soap_action soap_actions[];
+extern const size_t soap_action_count;
+// the action by name, or null
+soap_action* soap_action_for(const char* name);
+// build everything but the request line and host.
+// false if we're out of memory
+bool soap_build(soap_action* action);
+// the whole request for host into buffer. returns the
+// length, or -1 if it doesn't fit
+int soap_format(char* buffer,size_t size,const soap_action* action,const char* host);
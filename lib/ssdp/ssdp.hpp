@@ -0,0 +1,170 @@
+#pragma once
+// finding the speakers with an SSDP search. we multicast an
+// M-SEARCH for ZonePlayers, collect who answers for a few
+// seconds, then fetch each one's device description to learn
+// its room, one per call so commands never wait long behind
+// discovery. it's templated on the network so the native
+// tests can run it against simulated speakers. the network
+// has:
+//   uint32_t now_ms()
+//   bool search(const char* msearch,size_t len) - send it to
+//     239.255.255.250:1900 and start listening for answers
+//   int receive(char* buf,size_t size,uint32_t* address) -
+//     the next answer and who sent it, or -1 if none is waiting
+//   void search_done() - stop listening
+//   bool describe(uint32_t address,char* body,size_t size) -
+//     GET /xml/device_description.xml from the speaker into
+//     body, on a connection of its own that's closed after
+//   void found(const ssdp_speaker& s) - s is the first
+//     speaker with its room
+//   void failed(const ssdp_speaker& s) - s didn't describe
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+constexpr static const size_t ssdp_max_speakers = 64;
+// how long we listen for search responses. speakers answer
+// within MX seconds of the search
+constexpr static const uint32_t ssdp_listen_ms = 3000;
+constexpr static const char* ssdp_msearch =
+    "M-SEARCH * HTTP/1.1\r\n"
+    "HOST: 239.255.255.250:1900\r\n"
+    "MAN: \"ssdp:discover\"\r\n"
+    "MX: 1\r\n"
+    "ST: urn:schemas-upnp-org:device:ZonePlayer:1\r\n\r\n";
+
+struct ssdp_speaker {
+    uint32_t address;
+    char room[64];
+    bool described;
+};
+enum struct ssdp_state {
+    idle,
+    listening,
+    describing,
+    done
+};
+struct ssdp_discovery {
+    ssdp_speaker speakers[ssdp_max_speakers];
+    int count;
+    ssdp_state status;
+    uint32_t ts;
+    // answers we saw more than once, or that weren't from a
+    // ZonePlayer
+    uint32_t duplicates;
+    uint32_t ignored;
+};
+inline bool ssdp_is_zone_player(const char* response) {
+    // a 200 whose ST names a ZonePlayer. other UPnP devices
+    // answer searches for things they aren't, now and then
+    if(0!=strncmp(response,"HTTP/1.1 200",12)) {
+        return false;
+    }
+    const char* line = strstr(response,"\r\n");
+    while(line!=nullptr && line[2]!='\r' && line[2]!=0) {
+        line+=2;
+        if(0==strncasecmp(line,"ST:",3)) {
+            const char* end = strstr(line,"\r\n");
+            const char* sz = strstr(line,"urn:schemas-upnp-org:device:ZonePlayer:");
+            return sz!=nullptr && (end==nullptr || sz<end);
+        }
+        line = strstr(line,"\r\n");
+    }
+    return false;
+}
+inline ssdp_speaker* ssdp_add(ssdp_discovery* d,uint32_t address) {
+    // speakers answer more than once, so we only keep the
+    // first. null if we've seen it, or there's no room
+    for(int i = 0;i<d->count;++i) {
+        if(d->speakers[i].address==address) {
+            ++d->duplicates;
+            return nullptr;
+        }
+    }
+    if(d->count==(int)ssdp_max_speakers) {
+        return nullptr;
+    }
+    ssdp_speaker& speaker = d->speakers[d->count++];
+    speaker.address = address;
+    speaker.room[0]=0;
+    speaker.described = false;
+    return &speaker;
+}
+inline bool ssdp_room_for(const char* description,char* room,size_t size) {
+    // the room name from a device description
+    const char* sz = strstr(description,"<roomName>");
+    if(sz==nullptr) {
+        return false;
+    }
+    sz+=10;
+    const char* end = strchr(sz,'<');
+    if(end==nullptr || (size_t)(end-sz)>=size) {
+        return false;
+    }
+    memcpy(room,sz,end-sz);
+    room[end-sz]=0;
+    return true;
+}
+template<typename Network>
+bool ssdp_search(ssdp_discovery* d,Network& network) {
+    d->count = 0;
+    d->duplicates = 0;
+    d->ignored = 0;
+    if(!network.search(ssdp_msearch,strlen(ssdp_msearch))) {
+        return false;
+    }
+    d->ts = network.now_ms();
+    d->status = ssdp_state::listening;
+    return true;
+}
+template<typename Network>
+bool ssdp_listen(ssdp_discovery* d,Network& network,char* buffer,size_t size) {
+    // take whatever answers have come in. true once we've
+    // listened long enough and it's time to describe them
+    uint32_t address;
+    int len;
+    while(0<=(len = network.receive(buffer,size-1,&address))) {
+        buffer[len]=0;
+        if(!ssdp_is_zone_player(buffer)) {
+            ++d->ignored;
+            continue;
+        }
+        ssdp_add(d,address);
+    }
+    if(network.now_ms()-d->ts<ssdp_listen_ms) {
+        return false;
+    }
+    network.search_done();
+    d->status = ssdp_state::describing;
+    return true;
+}
+template<typename Network>
+bool ssdp_describe_next(ssdp_discovery* d,Network& network,char* body,size_t size) {
+    // describe one speaker. false once they all are, and
+    // the search is done
+    for(int i = 0;i<d->count;++i) {
+        ssdp_speaker& speaker = d->speakers[i];
+        if(speaker.described) {
+            continue;
+        }
+        speaker.described = true;
+        if(!network.describe(speaker.address,body,size) ||
+                !ssdp_room_for(body,speaker.room,sizeof(speaker.room))) {
+            speaker.room[0]=0;
+            network.failed(speaker);
+            return true;
+        }
+        // only the first speaker of a pair or set
+        for(int j = 0;j<i;++j) {
+            if(0==strcmp(d->speakers[j].room,speaker.room)) {
+                return true;
+            }
+        }
+        network.found(speaker);
+        return true;
+    }
+    d->status = ssdp_state::done;
+    return false;
+}
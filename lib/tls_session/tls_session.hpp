@@ -0,0 +1,131 @@
+#pragma once
+// TLS sessions for https api.txt lines, so we can skip the
+// expensive part of the handshake. the serialized copies go
+// in RTC memory on the device to survive deep sleep, if they
+// fit. we leave out the server's certificate, which resuming
+// doesn't need and which would take most of the room. it's
+// templated on the TLS library so the native tests can run
+// it over OpenSSL. the library has:
+//   session - what it keeps a session in
+//   void init(session* s)
+//   void clear(session* s) - free it and init it again
+//   tls_save save(const session& s,uint8_t* data,size_t size,size_t* needed)
+//     - serialize it without the certificate. needed is
+//     what it took, or would have
+//   bool load(session* s,const uint8_t* data,size_t size)
+//   bool same_master(const session& a,const session& b)
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef TLS_SESSION_SIZE
+#define TLS_SESSION_SIZE 1024
+#endif
+constexpr static const size_t tls_session_slots = 2;
+enum struct tls_save {
+    saved,
+    too_big,
+    failed,
+    // the host name is too long to key it by
+    skipped
+};
+struct tls_session_entry {
+    char host[64];
+    uint16_t port;
+    uint16_t size;
+    uint8_t data[TLS_SESSION_SIZE];
+};
+// the part that lives in RTC memory
+struct tls_saved_sessions {
+    tls_session_entry entries[tls_session_slots];
+    uint8_t next;
+};
+// the same sessions, ready to hand to the library
+template<typename Tls>
+struct tls_session_cache {
+    tls_saved_sessions* saved;
+    typename Tls::session live[tls_session_slots];
+    bool valid[tls_session_slots];
+};
+template<typename Tls>
+void tls_session_init(tls_session_cache<Tls>* cache,Tls& tls,tls_saved_sessions* saved) {
+    cache->saved = saved;
+    for(size_t i = 0;i<tls_session_slots;++i) {
+        tls.init(&cache->live[i]);
+        cache->valid[i] = false;
+    }
+}
+inline int tls_slot_for(const tls_saved_sessions* saved,const char* host,uint16_t port) {
+    for(size_t i = 0;i<tls_session_slots;++i) {
+        const tls_session_entry& entry = saved->entries[i];
+        if(entry.port==port && 0==strcmp(entry.host,host)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+template<typename Tls>
+typename Tls::session* tls_session_offer(tls_session_cache<Tls>* cache,Tls& tls,const char* host,uint16_t port) {
+    // the last session we had with this server, or null
+    int slot = tls_slot_for(cache->saved,host,port);
+    if(slot<0) {
+        return nullptr;
+    }
+    if(!cache->valid[slot]) {
+        // after a deep sleep we only have the serialized copy
+        const tls_session_entry& entry = cache->saved->entries[slot];
+        if(entry.size==0 || !tls.load(&cache->live[slot],entry.data,entry.size)) {
+            return nullptr;
+        }
+        cache->valid[slot] = true;
+    }
+    return &cache->live[slot];
+}
+template<typename Tls>
+void tls_session_forget(tls_session_cache<Tls>* cache,Tls& tls,int slot) {
+    tls.clear(&cache->live[slot]);
+    cache->valid[slot] = false;
+    cache->saved->entries[slot].size = 0;
+}
+template<typename Tls>
+void tls_session_forget(tls_session_cache<Tls>* cache,Tls& tls,const char* host,uint16_t port) {
+    // so we don't trip over the same session next time
+    int slot = tls_slot_for(cache->saved,host,port);
+    if(slot>=0) {
+        tls_session_forget(cache,tls,slot);
+    }
+}
+template<typename Tls>
+bool tls_session_resumed(Tls& tls,const typename Tls::session* offered,const typename Tls::session& session) {
+    // a resumed session keeps the master secret of the one
+    // we offered. a full handshake makes a new one. the id
+    // doesn't tell us, since a server taking a ticket may
+    // send any id back
+    return offered!=nullptr && tls.same_master(session,*offered);
+}
+template<typename Tls>
+tls_save tls_session_store(tls_session_cache<Tls>* cache,Tls& tls,const char* host,uint16_t port,typename Tls::session* session,size_t* size) {
+    // takes ownership of session. we keep it even when it
+    // won't serialize, so we can still resume until we sleep
+    *size = 0;
+    tls_saved_sessions* saved = cache->saved;
+    int slot = tls_slot_for(saved,host,port);
+    if(slot<0) {
+        if(strlen(host)>=sizeof(saved->entries[0].host)) {
+            tls.clear(session);
+            return tls_save::skipped;
+        }
+        slot = saved->next;
+        saved->next = (saved->next+1)%tls_session_slots;
+        tls_session_forget(cache,tls,slot);
+        strcpy(saved->entries[slot].host,host);
+        saved->entries[slot].port = port;
+    }
+    tls.clear(&cache->live[slot]);
+    cache->live[slot] = *session;
+    cache->valid[slot] = true;
+    tls_session_entry& entry = saved->entries[slot];
+    tls_save result = tls.save(cache->live[slot],entry.data,sizeof(entry.data),size);
+    entry.size = result==tls_save::saved?(uint16_t)*size:0;
+    return result;
+}
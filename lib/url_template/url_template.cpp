@@ -0,0 +1,149 @@
+#include "url_template.hpp"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char* url_param_names[] = {nullptr,"room","volume","fav"};
+
+// which characters url encoding leaves alone
+struct url_encoding_table {
+    bool keep[256];
+    constexpr url_encoding_table() : keep() {
+        for(int i = 0;i<256;++i) {
+            keep[i] = (i>='0' && i<='9') || (i>='a' && i<='z') || (i>='A' && i<='Z') ||
+                i=='~' || i=='-' || i=='.' || i=='_';
+        }
+    }
+};
+constexpr static const url_encoding_table url_encoding;
+
+int url_encode_into(const char* str,char* out,size_t size) {
+    static const char* hex = "0123456789ABCDEF";
+    if(size==0) {
+        return -1;
+    }
+    size_t len = 0;
+    for(;*str;++str) {
+        uint8_t ch = (uint8_t)*str;
+        if(url_encoding.keep[ch]) {
+            if(len+1>=size) {
+                return -1;
+            }
+            out[len++]=(char)ch;
+        } else {
+            if(len+3>=size) {
+                return -1;
+            }
+            out[len++]='%';
+            out[len++]=hex[ch>>4];
+            out[len++]=hex[ch&15];
+        }
+    }
+    out[len]=0;
+    return (int)len;
+}
+size_t url_decode_into(const char* str,size_t len,char* out,size_t size) {
+    size_t result = 0;
+    for(size_t i = 0;i<len && result+1<size;++i) {
+        char ch = str[i];
+        if(ch=='%' && i+2<len && isxdigit((uint8_t)str[i+1]) && isxdigit((uint8_t)str[i+2])) {
+            char hex[3] = {str[i+1],str[i+2],0};
+            ch = (char)strtoul(hex,nullptr,16);
+            i+=2;
+        }
+        out[result++]=ch;
+    }
+    out[result]=0;
+    return result;
+}
+static size_t url_token_add(url_token* tokens,size_t count,url_param param,const char* text,size_t len) {
+    if(param==url_param::literal && len==0) {
+        return count;
+    }
+    if(tokens!=nullptr) {
+        tokens[count] = {param,(uint16_t)len,text};
+    }
+    return count+1;
+}
+size_t url_compile(const char* fmt,url_token* tokens,bool* unknown) {
+    size_t count = 0;
+    const char* literal = fmt;
+    const char* sz = fmt;
+    if(unknown!=nullptr) {
+        *unknown = false;
+    }
+    while(*sz) {
+        if(sz[0]=='%' && sz[1]=='%') {
+            // keep one of them
+            count = url_token_add(tokens,count,url_param::literal,literal,sz+1-literal);
+            sz+=2;
+            literal = sz;
+            continue;
+        }
+        url_param param = url_param::literal;
+        size_t len = 0;
+        if(sz[0]=='%' && sz[1]=='s') {
+            param = url_param::room;
+            len = 2;
+        } else if(sz[0]=='{') {
+            const char* end = strchr(sz,'}');
+            if(end!=nullptr) {
+                for(int i = 1;i<(int)url_param::count;++i) {
+                    const char* name = url_param_names[i];
+                    if(end-sz-1==(int)strlen(name) && 0==strncmp(sz+1,name,end-sz-1)) {
+                        param = (url_param)i;
+                        len = end-sz+1;
+                        break;
+                    }
+                }
+                if(param==url_param::literal && unknown!=nullptr) {
+                    *unknown = true;
+                }
+            }
+        }
+        if(param==url_param::literal) {
+            // anything else, including a stray %, is just text
+            ++sz;
+            continue;
+        }
+        count = url_token_add(tokens,count,url_param::literal,literal,sz-literal);
+        count = url_token_add(tokens,count,param,nullptr,0);
+        sz+=len;
+        literal = sz;
+    }
+    return url_token_add(tokens,count,url_param::literal,literal,sz-literal);
+}
+int url_render(const url_token* tokens,size_t count,const char* room,const char* const* params,char* out,size_t size) {
+    size_t len = 0;
+    for(size_t i = 0;i<count;++i) {
+        const url_token& token = tokens[i];
+        const char* text = token.text;
+        size_t text_len = token.len;
+        if(token.param==url_param::room) {
+            int encoded = url_encode_into(room,out+len,size-len);
+            if(encoded<0) {
+                return -1;
+            }
+            len+=encoded;
+            continue;
+        }
+        if(token.param!=url_param::literal) {
+            text = params[(int)token.param];
+            if(text==nullptr) {
+                // not in params.txt
+                text = "";
+            }
+            text_len = strlen(text);
+        }
+        if(len+text_len>=size) {
+            return -1;
+        }
+        memcpy(out+len,text,text_len);
+        len+=text_len;
+    }
+    if(len>=size) {
+        return -1;
+    }
+    out[len]=0;
+    return (int)len;
+}
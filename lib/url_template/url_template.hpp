@@ -0,0 +1,33 @@
+#pragma once
+// api.txt lines are compiled at boot into runs of literal
+// text and placeholders: {room} (or the old %s), {volume}
+// and {fav}. %% is always a literal %. rendering one is then
+// a few copies and the room's url encoding
+#include <stdint.h>
+#include <stddef.h>
+
+enum struct url_param : uint8_t {
+    literal,
+    room,
+    volume,
+    fav,
+    count
+};
+extern const char* url_param_names[];
+struct url_token {
+    url_param param;
+    // literal text, pointing into the format string
+    uint16_t len;
+    const char* text;
+};
+// returns the length, or -1 if it doesn't fit
+int url_encode_into(const char* str,char* out,size_t size);
+// undoes url_encode_into(), cutting it short if need be
+size_t url_decode_into(const char* str,size_t len,char* out,size_t size);
+// returns how many tokens fmt takes. with no tokens we're
+// only counting. unknown (if not null) is set to true if
+// fmt has a {placeholder} we don't know, which is left as text
+size_t url_compile(const char* fmt,url_token* tokens,bool* unknown);
+// params holds each url_param's (already encoded) text, or
+// null for empty. returns the length, or -1 if it doesn't fit
+int url_render(const url_token* tokens,size_t count,const char* room,const char* const* params,char* out,size_t size);
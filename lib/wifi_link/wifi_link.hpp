@@ -0,0 +1,131 @@
+#pragma once
+// the connection state machine. it's templated on the radio
+// so the same code drives the ESP32's WiFi on the device and
+// a stub access point in the native tests. the radio has:
+//   bool begin() - start connecting. true if it went
+//     straight to the last access point (the fast rejoin)
+//   bool up() - WiFi.status()==WL_CONNECTED
+//   void forget() - the fast rejoin failed. disconnect and
+//     forget the access point so begin() does a full connect
+//   void give_up(uint32_t retry_ms) - a full connect timed out
+//   void lost() - a connection went down
+//   void connected(bool fast,uint32_t outage_ms) - we're up.
+//     outage_ms is how long we were without it, or 0
+#include <stdint.h>
+
+enum struct wifi_state {
+    idle,
+    joining_fast,
+    joining,
+    connected,
+    offline
+};
+// how long we give the fast rejoin before a full connect
+constexpr static const uint32_t wifi_fast_timeout_ms = 3000;
+// how long a full connect gets before we go offline
+constexpr static const uint32_t wifi_connect_timeout_ms = 15000;
+// retry delay range while offline. it doubles each time
+constexpr static const uint32_t wifi_backoff_min_ms = 1000;
+constexpr static const uint32_t wifi_backoff_max_ms = 60000;
+
+struct wifi_link {
+    volatile wifi_state status;
+    // set by the network task when it wants a connection
+    volatile bool requested;
+    // when the current attempt started
+    uint32_t start_ts;
+    // when we try again after going offline
+    uint32_t retry_ts;
+    uint32_t backoff_ms;
+    // when we lost the connection or failed to make one,
+    // and how long we've been without it
+    uint32_t down_ts;
+    uint32_t outages;
+    uint32_t outage_total_ms;
+    uint32_t outage_max_ms;
+};
+inline void wifi_link_init(wifi_link* link) {
+    link->status = wifi_state::idle;
+    link->requested = false;
+    link->start_ts = 0;
+    link->retry_ts = 0;
+    link->backoff_ms = 0;
+    link->down_ts = 0;
+    link->outages = 0;
+    link->outage_total_ms = 0;
+    link->outage_max_ms = 0;
+}
+template<typename Radio>
+void wifi_link_begin(wifi_link* link,Radio& radio,uint32_t ts) {
+    link->start_ts = ts;
+    link->status = radio.begin()?wifi_state::joining_fast:wifi_state::joining;
+}
+template<typename Radio>
+void wifi_link_connected(wifi_link* link,Radio& radio,uint32_t ts) {
+    bool fast = link->status==wifi_state::joining_fast;
+    uint32_t outage = 0;
+    link->backoff_ms = 0;
+    if(link->down_ts!=0) {
+        outage = ts-link->down_ts;
+        ++link->outages;
+        link->outage_total_ms+=outage;
+        if(outage>link->outage_max_ms) {
+            link->outage_max_ms = outage;
+        }
+        link->down_ts = 0;
+    }
+    radio.connected(fast,outage);
+    link->requested = false;
+    link->status = wifi_state::connected;
+}
+template<typename Radio>
+void wifi_link_update(wifi_link* link,Radio& radio,uint32_t ts) {
+    switch(link->status) {
+        case wifi_state::idle:
+            if(link->requested) {
+                wifi_link_begin(link,radio,ts);
+            }
+            break;
+        case wifi_state::joining_fast:
+            if(radio.up()) {
+                wifi_link_connected(link,radio,ts);
+            } else if(ts-link->start_ts>=wifi_fast_timeout_ms) {
+                // forget the fast path and do a full connect
+                radio.forget();
+                wifi_link_begin(link,radio,ts);
+            }
+            break;
+        case wifi_state::joining:
+            if(radio.up()) {
+                wifi_link_connected(link,radio,ts);
+            } else if(ts-link->start_ts>=wifi_connect_timeout_ms) {
+                // give up for now, and wait longer
+                // each time before trying again
+                link->backoff_ms = link->backoff_ms==0?
+                    wifi_backoff_min_ms:
+                    link->backoff_ms*2;
+                if(link->backoff_ms>wifi_backoff_max_ms) {
+                    link->backoff_ms = wifi_backoff_max_ms;
+                }
+                link->retry_ts = ts+link->backoff_ms;
+                radio.give_up(link->backoff_ms);
+                if(link->down_ts==0) {
+                    link->down_ts = link->start_ts;
+                }
+                link->status = wifi_state::offline;
+            }
+            break;
+        case wifi_state::connected:
+            if(!radio.up()) {
+                radio.lost();
+                link->down_ts = ts;
+                link->status = wifi_state::idle;
+            }
+            break;
+        case wifi_state::offline:
+            if((int32_t)(ts-link->retry_ts)>=0) {
+                wifi_link_begin(link,radio,ts);
+            }
+            break;
+    }
+}
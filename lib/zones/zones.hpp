@@ -0,0 +1,145 @@
+#pragma once
+// what the bridge tells us about the rooms: who's grouped
+// with whom and whether each group is playing, read from
+// /zones as it streams in, how long what we know about a
+// room stays good, and which rooms around the current one
+// we fetch next. it's templated on the rooms so the native
+// tests can run it over a recorded /zones. the rooms have:
+//   int index_for(const char* name) - the room's index in
+//     speakers.csv, or -1
+//   void stored(int index,playback state) - what a room
+//     is doing, as of now
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <json_reader.hpp>
+
+// the most members we track in one zone
+constexpr static const size_t zone_max_members = 16;
+struct room_zone {
+    // the room that runs the group, or -1 if we don't know
+    int16_t coordinator;
+    // how many rooms are in the group, counting this one
+    uint8_t members;
+};
+enum struct playback : uint8_t {
+    unknown,
+    stopped,
+    paused,
+    playing
+};
+struct room_state {
+    // when we got it (millis), or 0 for never
+    uint32_t ts;
+    playback state;
+};
+// how long an entry is good for
+constexpr static const uint32_t room_state_ttl_ms = 15*1000;
+// how many rooms after the current one we fetch
+// (you can only go forward) and how many before
+constexpr static const int prefetch_ahead = 2;
+constexpr static const int prefetch_behind = 1;
+// what we've seen of the zone we're in the middle of
+template<typename Rooms>
+struct zones_parse {
+    Rooms* rooms;
+    // where each room's zone goes, one per room
+    room_zone* next;
+    int coordinator;
+    playback state;
+    int members[zone_max_members];
+    size_t member_count;
+    size_t total;
+};
+inline playback playback_for(const char* state) {
+    if(0==strcmp(state,"PLAYING") || 0==strcmp(state,"TRANSITIONING")) {
+        return playback::playing;
+    }
+    if(0==strcmp(state,"PAUSED_PLAYBACK")) {
+        return playback::paused;
+    }
+    if(0==strcmp(state,"STOPPED")) {
+        return playback::stopped;
+    }
+    return playback::unknown;
+}
+inline bool room_state_fresh(const room_state& entry,uint32_t now_ms) {
+    return entry.ts!=0 && now_ms-entry.ts<room_state_ttl_ms;
+}
+inline void room_state_stale(room_state* entry,uint32_t now_ms) {
+    // keep showing it, but fetch it again soon
+    if(entry->ts!=0) {
+        entry->ts = (now_ms-room_state_ttl_ms-1)|1;
+    }
+}
+inline int prefetch_room_at(int index,int count,int n) {
+    // the nth room to keep fresh: the current room, then the
+    // ones ahead, then behind. n goes up to
+    // prefetch_ahead+prefetch_behind
+    int offset = n<=prefetch_ahead?n:prefetch_ahead-n;
+    return ((index+offset)%count+count)%count;
+}
+template<typename Rooms>
+void zones_begin(zones_parse<Rooms>* zone,Rooms* rooms,room_zone* next,int count) {
+    // until /zones says otherwise everyone's on their own
+    zone->rooms = rooms;
+    zone->next = next;
+    for(int i = 0;i<count;++i) {
+        next[i].coordinator = -1;
+        next[i].members = 1;
+    }
+    zone->coordinator = -1;
+    zone->state = playback::unknown;
+    zone->member_count = 0;
+    zone->total = 0;
+}
+template<typename Rooms>
+void zones_commit(zones_parse<Rooms>* zone) {
+    // everyone in the zone we know points at its coordinator
+    // and plays what it plays
+    uint8_t members = zone->total>255?255:(uint8_t)zone->total;
+    for(size_t i = 0;i<zone->member_count;++i) {
+        zone->next[zone->members[i]].coordinator = zone->coordinator;
+        zone->next[zone->members[i]].members = members;
+        if(zone->state!=playback::unknown) {
+            zone->rooms->stored(zone->members[i],zone->state);
+        }
+    }
+    zone->coordinator = -1;
+    zone->state = playback::unknown;
+    zone->member_count = 0;
+    zone->total = 0;
+}
+template<typename Rooms>
+void zones_callback(json_reader* reader,json_type type,const char* value,void* state) {
+    // /zones is an array of {coordinator:{roomName..},members:[{roomName..}..]}
+    zones_parse<Rooms>* zone = (zones_parse<Rooms>*)state;
+    if(type==json_type::end) {
+        if(reader->depth==1) {
+            zones_commit(zone);
+        }
+        return;
+    }
+    if(type!=json_type::string) {
+        return;
+    }
+    const char* sz = strchr(reader->path,']');
+    if(sz==nullptr) {
+        return;
+    }
+    ++sz;
+    if(0==strcmp(sz,".coordinator.roomName")) {
+        zone->coordinator = zone->rooms->index_for(value);
+    } else if(0==strcmp(sz,".coordinator.state.playbackState")) {
+        zone->state = playback_for(value);
+    } else if(0==strncmp(sz,".members[",9)) {
+        sz = strchr(sz+9,']');
+        if(sz!=nullptr && 0==strcmp(sz+1,".roomName")) {
+            ++zone->total;
+            int index = zone->rooms->index_for(value);
+            if(index>=0 && zone->member_count<zone_max_members) {
+                zone->members[zone->member_count++]=index;
+            }
+        }
+    }
+}
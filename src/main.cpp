@@ -5,24 +5,325 @@
 #include <logo.hpp>
 #include <SPIFFS.h>
 #include <WiFi.h>
+#ifdef HTTP_BENCHMARK_URL
 #include <HTTPClient.h>
+#endif
+#include <ESPmDNS.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/net_sockets.h>
+#include <http_pool.hpp>
+#include <tls_session.hpp>
+#include <command_queue.hpp>
+#include <wifi_link.hpp>
+#include <soap.hpp>
+#include <url_template.hpp>
+#include <dns_cache.hpp>
+#include <bridge_endpoints.hpp>
+#include <ssdp.hpp>
+#include <json_reader.hpp>
+#include <zones.hpp>
+#include <mqtt_packet.hpp>
+#include <mqtt_session.hpp>
+#include <gena.hpp>
 
 // background color for the display (24 bit, followed by display's native pixel type)
 constexpr static const rgb_pixel<24> bg_color_24(/*R*/12,/*G*/12,/*B*/12);
 constexpr static const lcd_t::pixel_type bg_color = convert<rgb_pixel<24>,lcd_t::pixel_type>(bg_color_24);
 
 // function prototypes
-static void ensure_connected();
+static bool ensure_connected();
 static void draw_room(int index);
 static const char* room_for_index(int index);
 static const char* string_for_index(const char* strings,int index);
-static void do_request(int index,const char* url_fmt);
+static bool do_request(int index,int url_index,int count);
+static void queue_command(int index,int url_index);
+static const char* url_for(int index,int url_index);
+static bool net_pending();
+static int speaker_index_for(const char* name);
+static bool parse_url(const char* url,char* host,size_t host_size,uint16_t* port,const char** path,bool* secure);
+static bool dns_resolve(const char* host,IPAddress* ip);
+static void dns_invalidate(const char* host);
+static bool do_udp_request(const char* url,int count);
+static bool do_mqtt_request(const char* url,int count);
+static bool do_http_request(const char* url,int count,bool failover = false);
+static bool do_failover_request(const char* url,int count);
+static uint32_t http_deadline();
+static uint32_t http_wait_left();
+static void feedback_show(int url_index,uint32_t ts,bool queued);
+static int zone_route(int index,int url_index);
 
 // font
 static const open_font& speaker_font = SonosFont;
 static const uint16_t speaker_font_height = 35;
 // global state
-static HTTPClient http;
+// keep-alive connections to the bridge(s), one per
+// distinct host:port seen in api.txt
+constexpr static const size_t http_pool_size = 4;
+// how long we'll hold an idle connection open. node's
+// http server (node-sonos-http-api) drops idle sockets
+// after 5 seconds so we let go of them a bit before that
+constexpr static const uint32_t http_keep_alive_ms = 4000;
+// a WiFiClient that can run TLS over itself, so https
+// connections go through the same code as http ones.
+// WiFiClientSecure can't resume sessions, which is
+// most of the cost of a handshake on this chip
+class tls_client : public WiFiClient {
+    mbedtls_ssl_context m_ssl;
+    bool m_secure = false;
+    static int bio_send(void* state,const unsigned char* buf,size_t len);
+    static int bio_recv(void* state,unsigned char* buf,size_t len);
+public:
+    bool handshake(const char* host,uint16_t port);
+    bool secure() const { return m_secure; }
+    size_t write(const uint8_t* buf,size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buf,size_t size) override;
+    uint8_t connected() override;
+    void stop() override;
+};
+using http_conn = http_connection<tls_client>;
+static http_conn http_pool[http_pool_size];
+// how many times we reused a warm connection
+static uint32_t http_reused = 0;
+// how many times we had to open a new one
+static uint32_t http_opened = 0;
+// how long we wait on the bridge for a response
+constexpr static const uint32_t http_timeout_ms = 5000;
+// when a request with another bridge to fail over to gives
+// up on this one. it covers the lookup, connect and every
+// response, so time one step takes comes out of the rest
+static bool http_deadline_set = false;
+static uint32_t http_deadline_ts = 0;
+// scratch for building requests and reading responses
+static char http_buffer[1024];
+// speakers we find with an SSDP search. we find a speaker's
+// room by fetching its device description, one at a time
+// in between commands, and persist the results to /rooms
+static ssdp_discovery ssdp;
+// how often we search again, across deep sleeps
+constexpr static const time_t ssdp_refresh_secs = 10*60;
+static WiFiUDP ssdp_udp;
+RTC_DATA_ATTR static time_t ssdp_last_search = 0;
+RTC_DATA_ATTR static bool ssdp_searched = false;
+// held while /rooms is being rewritten
+static SemaphoreHandle_t rooms_lock = nullptr;
+// request latency by transport, for comparison
+struct latency_stat {
+    uint32_t count;
+    uint64_t total;
+};
+static latency_stat bridge_latency = {0,0};
+// bridges for api.txt lines that list more than one
+// (see bridge_endpoints.hpp)
+static bridge_endpoints endpoints;
+static latency_stat soap_latency = {0,0};
+// press (queue) to request written, by transport
+static latency_stat press_latency[4] = {{0,0},{0,0},{0,0},{0,0}};
+// TLS sessions we can resume (see tls_session.hpp)
+struct mbedtls_sessions {
+    using session = mbedtls_ssl_session;
+    void init(session* s) {
+        mbedtls_ssl_session_init(s);
+    }
+    void clear(session* s) {
+        mbedtls_ssl_session_free(s);
+        mbedtls_ssl_session_init(s);
+    }
+    tls_save save(const session& s,uint8_t* data,size_t size,size_t* needed) {
+        // a shallow copy, so the live session keeps its cert
+        mbedtls_ssl_session saved = s;
+#if defined(MBEDTLS_SSL_KEEP_PEER_CERTIFICATE)
+        saved.peer_cert = nullptr;
+#endif
+        int ret = mbedtls_ssl_session_save(&saved,data,size,needed);
+        if(ret==0) {
+            return tls_save::saved;
+        }
+        return ret==MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL?tls_save::too_big:tls_save::failed;
+    }
+    bool load(session* s,const uint8_t* data,size_t size) {
+        return 0==mbedtls_ssl_session_load(s,data,size);
+    }
+    bool same_master(const session& a,const session& b) {
+        return 0==memcmp(a.master,b.master,sizeof(a.master));
+    }
+};
+static mbedtls_sessions tls_library;
+RTC_DATA_ATTR static tls_saved_sessions tls_saved;
+static tls_session_cache<mbedtls_sessions> tls_cache;
+// each TLS connection holds an mbedtls context with its
+// record buffers, about 33KB. there are 4 pool slots and 8
+// group slots, far more than the heap has room for, so
+// only this many may be secure at once
+#ifndef TLS_MAX_CONTEXTS
+#define TLS_MAX_CONTEXTS 3
+#endif
+static int tls_contexts = 0;
+static bool tls_ready = false;
+static mbedtls_entropy_context tls_entropy;
+static mbedtls_ctr_drbg_context tls_drbg;
+static mbedtls_ssl_config tls_conf;
+static mbedtls_x509_crt tls_ca;
+// handshake durations
+static latency_stat tls_full = {0,0};
+static latency_stat tls_resumed = {0,0};
+// an api.txt line of the form udp://host:port/path (or
+// udp+ack://) sends the formatted path in a datagram to a
+// relay and doesn't wait for any response. the packet is
+// 'S','R', version, flags, sequence (big endian 16-bit),
+// repeat count, then the path without the leading slash.
+// with udp+ack:// the relay echoes 'S','A' and the sequence
+// back, and we resend once if it doesn't
+constexpr static const uint16_t udp_local_port = 5007;
+constexpr static const uint32_t udp_ack_timeout_ms = 150;
+constexpr static const uint8_t udp_flag_ack = 1;
+static WiFiUDP udp_cmd;
+static bool udp_cmd_started = false;
+// so the relay can spot duplicates across deep sleep
+RTC_DATA_ATTR static uint16_t udp_seq = 0;
+static uint32_t udp_sent = 0;
+static uint32_t udp_retries = 0;
+static uint32_t udp_lost = 0;
+// an api.txt line of the form mqtt://host[:port]/topic or
+// mqtt://host[:port]/topic?payload publishes the payload
+// (empty if there isn't one) to the topic at QoS 0, down one
+// connection we keep open. /mqtt.txt can have a line like
+// state=mqtt://host[:port]/sonos/{room}/state and we keep
+// a subscription to that for what's playing in each room
+constexpr static const uint16_t mqtt_default_port = 1883;
+// we're rarely awake for a whole minute so we hardly ever
+// have to ping, and the broker drops the connection we
+// leave behind when we sleep after a minute and a half
+#ifndef MQTT_KEEP_ALIVE_SECS
+#define MQTT_KEEP_ALIVE_SECS 60
+#endif
+// how long we wait to try again if we can't connect
+constexpr static const uint32_t mqtt_retry_ms = 10*1000;
+// what's playing in each room from the state topic
+constexpr static const size_t mqtt_title_size = 48;
+// the connection to the broker (see mqtt_session.hpp)
+static mqtt_session mqtt;
+static char mqtt_client_id[24];
+// from /mqtt.txt. the state topic is split around {room}
+static char mqtt_state_host[64];
+static uint16_t mqtt_state_port = 0;
+static char mqtt_state_prefix[96];
+static char mqtt_state_suffix[32];
+static bool mqtt_state_room = false;
+// the broker the first mqtt:// line in api.txt publishes to,
+// so we can connect ahead without a state topic. the port is
+// set once the host is there
+static char mqtt_api_host[64];
+static volatile uint16_t mqtt_api_port = 0;
+static char* mqtt_titles = nullptr;
+// the room we last put up what's playing for
+static int mqtt_index = -1;
+static uint32_t mqtt_retry_ts = 0;
+// the most rooms a group can have
+constexpr static const size_t group_max_rooms = 8;
+// a set of rooms from groups.csv that
+// we send commands to all at once
+struct room_group {
+    char name[64];
+    int count;
+    int members[group_max_rooms];
+};
+static room_group* groups = nullptr;
+static int group_count = 0;
+// a group gets its own connections, one per member,
+// so the members' requests can be in flight together
+static http_conn group_pool[group_max_rooms];
+// while a group's requests are out its connections
+// can't be closed to make room for others
+static bool group_sending = false;
+// resolved bridge host addresses (see dns_cache.hpp)
+RTC_DATA_ATTR static dns_cache dns;
+// .local hosts are resolved with mDNS
+static const char* mdns_hostname = "ttgo-sonos";
+constexpr static const uint32_t mdns_timeout_ms = 2000;
+static bool mdns_started = false;
+static uint32_t mdns_retry_ts = 0;
+// presses waiting for the network task, and what
+// coalescing and sending did with them
+static command_queue queued_commands;
+static command_stats command_totals = {0,0,0,0,0};
+// the command_kind of each api.txt line
+static command_kind* url_kinds = nullptr;
+// commands pressed while we aren't connected are held
+// here, then flushed together once we are. held commands
+// older than this are no longer worth sending
+#ifndef OFFLINE_COMMAND_MAX_AGE_MS
+#define OFFLINE_COMMAND_MAX_AGE_MS 30000
+#endif
+static command_held held;
+// how a press turned out, as far as the screen is concerned
+enum struct feedback_state {
+    none,
+    pending,
+    held,
+    sent,
+    failed
+};
+// the network task posts these to loop() when it's done
+// with the press stamped ts (and any before it)
+struct command_result {
+    uint32_t ts;
+    feedback_state state;
+};
+static QueueHandle_t result_queue = nullptr;
+// the feedback overlay for the latest press.
+// only loop() touches these
+static feedback_state feedback = feedback_state::none;
+static command_kind feedback_kind = command_kind::other;
+static uint32_t feedback_ts = 0;
+static uint32_t feedback_clear_ts = 0;
+// how long the outcome stays up
+constexpr static const uint32_t feedback_hold_ms = 1000;
+// press to feedback on the display
+static latency_stat pixel_latency = {0,0};
+static uint32_t pixel_latency_max = 0;
+static TaskHandle_t net_task_handle = nullptr;
+// true while the network task is working on a command
+static volatile bool net_busy = false;
+// when do_request() last started sending (micros)
+static uint32_t request_send_ts = 0;
+// how a command went out, for press to send timing
+enum struct transport {
+    bridge,
+    upnp,
+    udp,
+    mqtt
+};
+// when do_request() finished writing the request, and how
+static uint32_t request_sent_ts = 0;
+static transport request_transport = transport::bridge;
+// where the time goes between a press and the response.
+// each stage gets a histogram with log2 millisecond
+// buckets: <1ms, <2ms, <4ms ... <16s, and everything slower
+enum struct stage {
+    wifi, // press to wifi ready (includes queueing)
+    connect, // wifi ready to tcp connected
+    send, // connected to request written
+    status, // request written to status line read
+    total, // press to status line read
+    count
+};
+constexpr static const size_t stage_buckets = 16;
+static const char* stage_names[] = {"wifi","connect","send","status","total"};
+// these survive deep sleep so they cover many presses
+RTC_DATA_ATTR static uint32_t stage_histogram[(int)stage::count][stage_buckets];
+// the current request's timestamps (micros). 0 means
+// the request never got that far
+struct stage_trace {
+    uint32_t press;
+    uint32_t ready;
+    uint32_t connected;
+    uint32_t status;
+};
+static stage_trace trace = {0,0,0,0};
 // current speaker/room
 static int speaker_index = 0;
 // number of speakers/rooms
@@ -30,17 +331,60 @@ static int speaker_count = 0;
 // series of concatted null 
 // termed strings for speakers/rooms
 static char* speaker_strings = nullptr;
+// each room's speaker address from speakers.csv,
+// or 0 if it wasn't given
+static uint32_t* speaker_addresses = nullptr;
 // how many urls are in api txt
 static int format_url_count = 0;
 // the format string urls
 static char* format_urls = nullptr;
 // temp for formatting urls
-static char url[1024];
-static char url_encoded[1024];
+static char url_buffer[1024];
+// api.txt lines, compiled at boot (see url_template.hpp)
+static url_token* url_tokens = nullptr;
+// where each line's tokens start, plus the end of the last
+static uint16_t* url_token_start = nullptr;
+// {volume} and {fav} from params.txt, already encoded
+static char* url_params[(int)url_param::count];
+// the largest we'll let the precomputed url table get
+#ifndef URL_TABLE_BUDGET
+#define URL_TABLE_BUDGET 16384
+#endif
+static_assert(URL_TABLE_BUDGET<=65536,"URL_TABLE_BUDGET is too large");
+// every room x api.txt url, formatted at boot. it starts with
+// an offset for each url (room major), followed by the urls.
+// null if it wouldn't fit in the budget
+static uint8_t* url_table = nullptr;
 // the Wifi SSID
 static char wifi_ssid[256];
 // the Wifi password
 static char wifi_pass[256];
+// the last good connection, kept across deep sleep
+// so we can rejoin without scanning or DHCP
+struct wifi_cache {
+    bool valid;
+    uint8_t bssid[6];
+    int32_t channel;
+    uint32_t address;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    // when we got the address from DHCP
+    time_t lease_ts;
+};
+RTC_DATA_ATTR static wifi_cache wifi_last;
+// we only reuse an address this young, so we're unlikely
+// to outlive the DHCP lease
+constexpr static const time_t wifi_lease_secs = 60*60;
+// the connection state machine, pumped from loop()
+static wifi_link wifi;
+// set when we connect so the network task can
+// do its post connect work on its own core
+static volatile bool wifi_fresh = false;
+static bool wifi_static_ip = false;
+// connect phase timestamps, set by the WiFi events
+static volatile uint32_t wifi_assoc_ts = 0;
+static volatile uint32_t wifi_address_ts = 0;
 // temp for using a file
 static File file;
 // begin fade timestamp
@@ -54,77 +398,2238 @@ using frame_buffer_t = bitmap<typename lcd_t::pixel_type>;
 constexpr static const size16 frame_buffer_size({lcd_t::base_height,speaker_font_height});
 static uint8_t frame_buffer_data[frame_buffer_t::sizeof_buffer(frame_buffer_size)];
 static frame_buffer_t frame_buffer(frame_buffer_size,frame_buffer_data);
+// a smaller one under the room for what's playing
+static const uint16_t now_playing_font_height = 20;
+constexpr static const size16 now_playing_buffer_size({lcd_t::base_height,now_playing_font_height});
+static uint8_t now_playing_buffer_data[frame_buffer_t::sizeof_buffer(now_playing_buffer_size)];
+static frame_buffer_t now_playing_buffer(now_playing_buffer_size,now_playing_buffer_data);
+// what's playing in the current room, from UPnP events.
+// written by the network task and drawn by loop()
+static char now_playing[132];
+static bool now_playing_active = false;
+static volatile bool now_playing_changed = false;
+static portMUX_TYPE now_playing_lock = portMUX_INITIALIZER_UNLOCKED;
+// set by loop() so the network task knows
+// to drop its event subscription
+static volatile bool ui_dimmed = false;
+// we subscribe to the current room's AVTransport
+// events and take the NOTIFYs on this port
+constexpr static const uint16_t gena_port = 3400;
+constexpr static const int gena_timeout_secs = 300;
+// how long before it expires we renew a subscription
+constexpr static const uint32_t gena_renew_margin_ms = 30*1000;
+// how long we wait to try again if we can't subscribe
+constexpr static const uint32_t gena_retry_ms = 10*1000;
+static const char* gena_path = "/MediaRenderer/AVTransport/Event";
+static WiFiServer gena_server(gena_port);
+static bool gena_listening = false;
+static gena_subscription gena;
+// the bridge's /zones, so we know who's grouped with whom.
+// we fetch it this often while the screen is on
+constexpr static const uint32_t zones_refresh_ms = 30*1000;
+// one per room in speakers.csv. written by the network
+// task, read by it and by loop()
+static room_zone* room_zones = nullptr;
+static room_zone* zones_next = nullptr;
+static portMUX_TYPE zones_lock = portMUX_INITIALIZER_UNLOCKED;
+// the first bridge in api.txt, like http://host:5005
+static char bridge_url[128];
+static char zones_url[160];
+static bool zones_synced = false;
+static uint32_t zones_ts = 0;
+static uint32_t zones_changes = 0;
+static uint32_t zones_routed = 0;
+// the current room's group changed so it needs redrawing
+static volatile bool zones_changed = false;
+// whether each room is playing, so we can show it as soon
+// as you switch to it. filled in from /zones for every room
+// and from /{room}/state for the ones around the current one
+static room_state* room_states = nullptr;
+static portMUX_TYPE room_states_lock = portMUX_INITIALIZER_UNLOCKED;
+// the last room draw_room() looked up, so redraws don't count
+static int room_state_drawn = -1;
+static uint32_t room_state_hits = 0;
+static uint32_t room_state_misses = 0;
+static uint32_t room_state_fetches = 0;
+// the current room's state changed so it needs redrawing
+static volatile bool room_state_changed = false;
 
 static void button_a_on_click(int clicks,void* state) {
     // if we're dimming/dimmed we don't want 
     // to actually increment
-    if(!dimmer.dimmed()) {
+    // (there may be no rooms until discovery finds some)
+    if(!dimmer.dimmed() && speaker_count+group_count>0) {
         // move to the next speaker
+        // groups come after the rooms
         speaker_index+=clicks;
-        while(speaker_index>=speaker_count) {
+        while(speaker_index>=speaker_count+group_count) {
             // wrap around
-            speaker_index -= speaker_count;
+            speaker_index -= speaker_count+group_count;
         }
+        // the last command's feedback was for the old room
+        feedback = feedback_state::none;
         // redraw
         draw_room(speaker_index);
     }
-    // reset the dimmer
-    dimmer.wake();
+    // reset the dimmer
+    dimmer.wake();
+}
+static void button_b_on_click(int clicks,void* state) {
+    if(clicks<format_url_count) {
+        queue_command(speaker_index, clicks);
+    }
+    // reset the dimmer
+    dimmer.wake();
+}
+static void button_b_on_long_click(void* state) {
+    // play the first URL
+    if(format_url_count>0) {
+        queue_command(speaker_index,0);
+    }
+    // reset the dimmer
+    dimmer.wake();
+}
+static void compile_url_templates() {
+    // count them, then compile them
+    size_t count = 0;
+    const char* fmt = format_urls;
+    for(int i = 0;i<format_url_count;++i) {
+        bool unknown;
+        count+=url_compile(fmt,nullptr,&unknown);
+        if(unknown) {
+            Serial.printf("Unknown placeholder in %s\n",fmt);
+        }
+        fmt+=strlen(fmt)+1;
+    }
+    url_tokens = (url_token*)malloc((count+1)*sizeof(url_token));
+    url_token_start = (uint16_t*)malloc((format_url_count+1)*sizeof(uint16_t));
+    if(url_tokens==nullptr || url_token_start==nullptr) {
+        Serial.println("Out of memory compiling API urls");
+        while(true);
+    }
+    count = 0;
+    fmt = format_urls;
+    for(int i = 0;i<format_url_count;++i) {
+        url_token_start[i] = (uint16_t)count;
+        count+=url_compile(fmt,url_tokens+count,nullptr);
+        fmt+=strlen(fmt)+1;
+    }
+    url_token_start[format_url_count] = (uint16_t)count;
+}
+static int url_render_index(int url_index,const char* room,char* out,size_t size) {
+    // returns the length, or -1 if it doesn't fit
+    return url_render(
+        url_tokens+url_token_start[url_index],
+        url_token_start[url_index+1]-url_token_start[url_index],
+        room,
+        url_params,
+        out,
+        size);
+}
+static const char* url_for(int index,int url_index) {
+    if(url_table!=nullptr) {
+        // straight lookup
+        const uint16_t* offsets = (const uint16_t*)url_table;
+        return (const char*)url_table+offsets[index*format_url_count+url_index];
+    }
+    // too big to precompute so render it now
+    if(0>url_render_index(url_index,string_for_index(speaker_strings, index),url_buffer,sizeof(url_buffer))) {
+        Serial.println("URL is too long");
+        url_buffer[0]=0;
+    }
+    return url_buffer;
+}
+static void build_url_table() {
+    // render every url for every room up front. first
+    // we figure out how much room it will take
+    size_t index_size = speaker_count*format_url_count*sizeof(uint16_t);
+    size_t size = index_size;
+    const char* room = speaker_strings;
+    for(int i = 0;i<speaker_count;++i) {
+        for(int j = 0;j<format_url_count;++j) {
+            int len = url_render_index(j,room,url_buffer,sizeof(url_buffer));
+            if(len<0) {
+                Serial.printf("A URL for %s is too long\n",room);
+                return;
+            }
+            size+=len+1;
+        }
+        room+=strlen(room)+1;
+    }
+    if(size>URL_TABLE_BUDGET) {
+        Serial.printf("URL table needs %d bytes, over the %d byte budget. Formatting on demand\n",
+            (int)size,
+            (int)URL_TABLE_BUDGET);
+        return;
+    }
+    url_table = (uint8_t*)malloc(size);
+    if(url_table==nullptr) {
+        Serial.println("Out of memory building URL table. Formatting on demand");
+        return;
+    }
+    // now fill it in
+    uint16_t* offsets = (uint16_t*)url_table;
+    size_t offset = index_size;
+    room = speaker_strings;
+    for(int i = 0;i<speaker_count;++i) {
+        for(int j = 0;j<format_url_count;++j) {
+            *offsets++ = (uint16_t)offset;
+            offset+=url_render_index(j,room,(char*)url_table+offset,size-offset)+1;
+        }
+        room+=strlen(room)+1;
+    }
+    Serial.printf("URL table: %d urls, %d bytes of urls, %d bytes of index (budget %d)\n",
+        speaker_count*format_url_count,
+        (int)(size-index_size),
+        (int)index_size,
+        (int)URL_TABLE_BUDGET);
+}
+static bool parse_authority(const char* sz,char* host,size_t host_size,uint16_t* port,const char** path) {
+    // host[:port]/path, leaving the port alone if it's not given
+    const char* host_end = sz;
+    while(*host_end && *host_end!=':' && *host_end!='/') {
+        ++host_end;
+    }
+    size_t len = host_end-sz;
+    if(len==0 || len>=host_size) {
+        return false;
+    }
+    memcpy(host,sz,len);
+    host[len]=0;
+    if(*host_end==':') {
+        *port = (uint16_t)strtoul(host_end+1,(char**)&host_end,10);
+    }
+    *path = *host_end=='/'?host_end:"/";
+    return true;
+}
+static bool parse_url(const char* url,char* host,size_t host_size,uint16_t* port,const char** path,bool* secure) {
+    // we handle http(s)://host[:port]/path here
+    *secure = 0==strncmp(url,"https://",8);
+    if(!*secure && 0!=strncmp(url,"http://",7)) {
+        return false;
+    }
+    *port = *secure?443:80;
+    return parse_authority(url+(*secure?8:7),host,host_size,port,path);
+}
+static bool parse_udp_url(const char* url,char* host,size_t host_size,uint16_t* port,const char** path,bool* ack) {
+    // udp://host:port/path or udp+ack://host:port/path
+    *ack = 0==strncmp(url,"udp+ack://",10);
+    if(!*ack && 0!=strncmp(url,"udp://",6)) {
+        return false;
+    }
+    *port = 0;
+    return parse_authority(url+(*ack?10:6),host,host_size,port,path) && *port!=0;
+}
+static bool parse_mqtt_url(const char* url,char* host,size_t host_size,uint16_t* port,const char** path) {
+    // mqtt://host[:port]/topic
+    if(0!=strncmp(url,"mqtt://",7)) {
+        return false;
+    }
+    *port = mqtt_default_port;
+    return parse_authority(url+7,host,host_size,port,path) && (*path)[1]!=0;
+}
+static bool tls_init() {
+    if(tls_ready) {
+        return true;
+    }
+    mbedtls_entropy_init(&tls_entropy);
+    mbedtls_ctr_drbg_init(&tls_drbg);
+    mbedtls_ssl_config_init(&tls_conf);
+    mbedtls_x509_crt_init(&tls_ca);
+    static const char* personalization = "ttgo_sonos";
+    if(0!=mbedtls_ctr_drbg_seed(&tls_drbg,mbedtls_entropy_func,&tls_entropy,
+                (const unsigned char*)personalization,strlen(personalization)) ||
+            0!=mbedtls_ssl_config_defaults(&tls_conf,
+                MBEDTLS_SSL_IS_CLIENT,
+                MBEDTLS_SSL_TRANSPORT_STREAM,
+                MBEDTLS_SSL_PRESET_DEFAULT)) {
+        Serial.println("Unable to initialize TLS");
+        return false;
+    }
+    mbedtls_ssl_conf_rng(&tls_conf,mbedtls_ctr_drbg_random,&tls_drbg);
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_conf_session_tickets(&tls_conf,MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    // verify the server if we've been given a CA for it
+    bool verify = false;
+    File file = SPIFFS.open("/ca.pem");
+    if(file && file.size()>0) {
+        size_t size = file.size();
+        uint8_t* pem = (uint8_t*)malloc(size+1);
+        if(pem==nullptr) {
+            Serial.println("Out of memory loading ca.pem");
+            while(true);
+        }
+        size = file.read(pem,size);
+        pem[size]=0;
+        // PEM parsing wants the terminator counted
+        verify = 0==mbedtls_x509_crt_parse(&tls_ca,pem,size+1);
+        free(pem);
+        if(!verify) {
+            Serial.println("Unable to parse ca.pem");
+        }
+    }
+    file.close();
+    if(verify) {
+        mbedtls_ssl_conf_ca_chain(&tls_conf,&tls_ca,nullptr);
+        mbedtls_ssl_conf_authmode(&tls_conf,MBEDTLS_SSL_VERIFY_REQUIRED);
+    } else {
+        Serial.println("No CA in ca.pem. TLS servers will not be verified");
+        mbedtls_ssl_conf_authmode(&tls_conf,MBEDTLS_SSL_VERIFY_NONE);
+    }
+    tls_session_init(&tls_cache,tls_library,&tls_saved);
+    tls_ready = true;
+    return true;
+}
+static void tls_session_keep(const char* host,uint16_t port,mbedtls_ssl_session* session) {
+    // takes ownership of session
+    size_t size;
+    switch(tls_session_store(&tls_cache,tls_library,host,port,session,&size)) {
+        case tls_save::saved:
+            Serial.printf("TLS session for %s is %d of %d bytes\n",host,(int)size,(int)TLS_SESSION_SIZE);
+            break;
+        case tls_save::too_big:
+            Serial.printf("TLS session is too big to keep across sleep (%d bytes). Raise TLS_SESSION_SIZE\n",(int)size);
+            break;
+        case tls_save::failed:
+            Serial.println("Unable to save TLS session");
+            break;
+        default:
+            break;
+    }
+}
+int tls_client::bio_send(void* state,const unsigned char* buf,size_t len) {
+    tls_client* client = (tls_client*)state;
+    size_t written = client->WiFiClient::write(buf,len);
+    if(written==0) {
+        return client->WiFiClient::connected()?
+            MBEDTLS_ERR_SSL_WANT_WRITE:
+            MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+    return (int)written;
+}
+int tls_client::bio_recv(void* state,unsigned char* buf,size_t len) {
+    tls_client* client = (tls_client*)state;
+    if(client->WiFiClient::available()<=0) {
+        return client->WiFiClient::connected()?
+            MBEDTLS_ERR_SSL_WANT_READ:
+            MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    int read = client->WiFiClient::read(buf,len);
+    return read>0?read:MBEDTLS_ERR_SSL_WANT_READ;
+}
+static bool tls_release_idle(const tls_client* except) {
+    // close the least recently used secure connection that
+    // isn't busy, to make room for another. a group's
+    // connections are busy while its requests are out
+    http_conn* oldest = nullptr;
+    for(size_t i = 0;i<http_pool_size+group_max_rooms;++i) {
+        bool group = i>=http_pool_size;
+        if(group && group_sending) {
+            break;
+        }
+        http_conn* conn = group?&group_pool[i-http_pool_size]:&http_pool[i];
+        if(&conn->client==except || !conn->client.secure()) {
+            continue;
+        }
+        if(oldest==nullptr || (int32_t)(conn->used_ts-oldest->used_ts)<0) {
+            oldest = conn;
+        }
+    }
+    if(oldest==nullptr) {
+        return false;
+    }
+    oldest->client.stop();
+    return true;
+}
+bool tls_client::handshake(const char* host,uint16_t port) {
+    if(!tls_init()) {
+        return false;
+    }
+    if(tls_contexts>=TLS_MAX_CONTEXTS && !tls_release_idle(this)) {
+        Serial.printf("Too many TLS connections open (%d) to reach %s\n",tls_contexts,host);
+        stop();
+        return false;
+    }
+    mbedtls_ssl_init(&m_ssl);
+    m_secure = true;
+    ++tls_contexts;
+    if(0!=mbedtls_ssl_setup(&m_ssl,&tls_conf) ||
+            0!=mbedtls_ssl_set_hostname(&m_ssl,host)) {
+        Serial.println("Out of memory starting TLS");
+        stop();
+        return false;
+    }
+    mbedtls_ssl_set_bio(&m_ssl,this,bio_send,bio_recv,nullptr);
+    // offer the last session we had with this server
+    mbedtls_ssl_session* offered = tls_session_offer(&tls_cache,tls_library,host,port);
+    if(offered!=nullptr && 0!=mbedtls_ssl_set_session(&m_ssl,offered)) {
+        offered = nullptr;
+    }
+    uint32_t start_ts = micros();
+    uint32_t deadline = http_deadline();
+    int ret;
+    while(0!=(ret = mbedtls_ssl_handshake(&m_ssl))) {
+        if((ret!=MBEDTLS_ERR_SSL_WANT_READ && ret!=MBEDTLS_ERR_SSL_WANT_WRITE) ||
+                (int32_t)(millis()-deadline)>=0) {
+            Serial.printf("TLS handshake with %s failed (-0x%04x)\n",host,-ret);
+            if(offered!=nullptr) {
+                tls_session_forget(&tls_cache,tls_library,host,port);
+            }
+            stop();
+            return false;
+        }
+        delay(1);
+    }
+    uint32_t elapsed = micros()-start_ts;
+    bool resumed = false;
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if(0==mbedtls_ssl_get_session(&m_ssl,&session)) {
+        resumed = tls_session_resumed(tls_library,offered,session);
+        // keep it either way. the server may have sent a new ticket
+        tls_session_keep(host,port,&session);
+    } else {
+        mbedtls_ssl_session_free(&session);
+    }
+    latency_stat& stat = resumed?tls_resumed:tls_full;
+    ++stat.count;
+    stat.total+=elapsed;
+    Serial.printf("TLS handshake (%s) took %dus (full: %d, avg %dus, resumed: %d, avg %dus)\n",
+        resumed?"resumed":"full",
+        (int)elapsed,
+        (int)tls_full.count,
+        (int)(tls_full.count?tls_full.total/tls_full.count:0),
+        (int)tls_resumed.count,
+        (int)(tls_resumed.count?tls_resumed.total/tls_resumed.count:0));
+    return true;
+}
+size_t tls_client::write(const uint8_t* buf,size_t size) {
+    if(!m_secure) {
+        return WiFiClient::write(buf,size);
+    }
+    size_t written = 0;
+    uint32_t deadline = http_deadline();
+    while(written<size) {
+        int ret = mbedtls_ssl_write(&m_ssl,buf+written,size-written);
+        if(ret>0) {
+            written+=ret;
+        } else if((ret!=MBEDTLS_ERR_SSL_WANT_READ && ret!=MBEDTLS_ERR_SSL_WANT_WRITE) ||
+                (int32_t)(millis()-deadline)>=0) {
+            break;
+        } else {
+            delay(1);
+        }
+    }
+    return written;
+}
+int tls_client::available() {
+    if(!m_secure) {
+        return WiFiClient::available();
+    }
+    size_t avail = mbedtls_ssl_get_bytes_avail(&m_ssl);
+    if(avail==0 && WiFiClient::available()>0) {
+        // a zero length read decrypts the next record
+        mbedtls_ssl_read(&m_ssl,nullptr,0);
+        avail = mbedtls_ssl_get_bytes_avail(&m_ssl);
+    }
+    return (int)avail;
+}
+int tls_client::read() {
+    uint8_t result;
+    return 1==read(&result,1)?result:-1;
+}
+int tls_client::read(uint8_t* buf,size_t size) {
+    if(!m_secure) {
+        return WiFiClient::read(buf,size);
+    }
+    if(available()<=0) {
+        return -1;
+    }
+    int ret = mbedtls_ssl_read(&m_ssl,buf,size);
+    if(ret>0) {
+        return ret;
+    }
+    if(ret==0 || ret==MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        stop();
+    }
+    return -1;
+}
+uint8_t tls_client::connected() {
+    if(m_secure && mbedtls_ssl_get_bytes_avail(&m_ssl)>0) {
+        return 1;
+    }
+    return WiFiClient::connected();
+}
+void tls_client::stop() {
+    if(m_secure) {
+        if(WiFiClient::connected()) {
+            mbedtls_ssl_close_notify(&m_ssl);
+        }
+        mbedtls_ssl_free(&m_ssl);
+        m_secure = false;
+        --tls_contexts;
+    }
+    WiFiClient::stop();
+}
+static uint32_t http_deadline() {
+    // when the current step gives up on the bridge
+    uint32_t deadline = millis()+http_timeout_ms;
+    if(http_deadline_set && (int32_t)(http_deadline_ts-deadline)<0) {
+        return http_deadline_ts;
+    }
+    return deadline;
+}
+static uint32_t http_wait_left() {
+    int32_t left = (int32_t)(http_deadline()-millis());
+    return left>0?left:0;
+}
+uint32_t http_millis() {
+    return millis();
+}
+void http_idle() {
+    delay(1);
+}
+static bool http_open(http_conn* conn,const char* host,uint16_t port,bool secure) {
+    uint32_t ts = millis();
+    if(http_pool_reuse(conn,host,port,secure,ts,http_keep_alive_ms)) {
+        ++http_reused;
+        return true;
+    }
+    // (re)open the connection
+    ++http_opened;
+    IPAddress ip;
+    if(!dns_resolve(host,&ip)) {
+        Serial.printf("Unable to resolve %s\n",host);
+        return false;
+    }
+    // the lookup may have used up our time
+    uint32_t wait_ms = http_wait_left();
+    if(wait_ms==0) {
+        Serial.printf("Out of time connecting to %s:%d\n",host,(int)port);
+        return false;
+    }
+    if(!conn->client.connect(ip,port,(int32_t)wait_ms)) {
+        Serial.printf("Unable to connect to %s:%d\n",host,(int)port);
+        // the host may have moved
+        dns_invalidate(host);
+        return false;
+    }
+    // we write each request in one go, so don't hold it back
+    conn->client.setNoDelay(true);
+    if(secure && !conn->client.handshake(host,port)) {
+        return false;
+    }
+    conn->used_ts = ts;
+    return true;
+}
+static http_conn* http_acquire(const char* host,uint16_t port,bool secure) {
+    http_conn* result = http_pool_find(http_pool,http_pool_size,host,port,secure);
+    return http_open(result,host,port,secure)?result:nullptr;
+}
+static bool http_send(http_conn* conn,const char* host,const char* path,int count) {
+    return http_write_requests(conn->client,http_buffer,sizeof(http_buffer),host,path,count);
+}
+static int http_read_response(http_conn* conn,char* body,size_t body_size) {
+    return http_read_status(conn->client,http_buffer,sizeof(http_buffer),http_deadline(),body,body_size);
+}
+static bool http_read_json_body(WiFiClient& client,json_reader* reader,long length,uint32_t deadline) {
+    // a length of -1 reads until the server closes
+    while(length!=0) {
+        size_t len = sizeof(http_buffer);
+        if(length>0 && len>(size_t)length) {
+            len = length;
+        }
+        int read = client.read((uint8_t*)http_buffer,len);
+        if(read>0) {
+            json_feed(reader,http_buffer,read);
+            if(length>0) {
+                length-=read;
+            }
+            continue;
+        }
+        if(!client.connected()) {
+            return length<0;
+        }
+        if((int32_t)(millis()-deadline)>=0) {
+            return false;
+        }
+        delay(1);
+    }
+    return true;
+}
+static int http_read_json(http_conn* conn,json_reader* reader) {
+    // like http_read_response() but the body goes through
+    // the JSON reader as it arrives, so it can be any size
+    WiFiClient& client = conn->client;
+    uint32_t deadline = http_deadline();
+    bool keep_alive;
+    bool chunked;
+    long content_length;
+    int status = http_read_head(client,http_buffer,sizeof(http_buffer),deadline,&keep_alive,&content_length,&chunked);
+    if(status<0) {
+        return -1;
+    }
+    bool complete = false;
+    if(chunked) {
+        while(0<http_read_line(client,http_buffer,sizeof(http_buffer),deadline)) {
+            long chunk = strtol(http_buffer,nullptr,16);
+            if(chunk==0) {
+                // the (empty) trailers
+                complete = 0==http_read_line(client,http_buffer,sizeof(http_buffer),deadline);
+                break;
+            }
+            if(!http_read_json_body(client,reader,chunk,deadline) ||
+                    0!=http_read_line(client,http_buffer,sizeof(http_buffer),deadline)) {
+                break;
+            }
+        }
+    } else {
+        complete = http_read_json_body(client,reader,content_length,deadline) && content_length>=0;
+    }
+    if(!complete || !keep_alive) {
+        client.stop();
+    }
+    return status;
+}
+static int bridge_get_json(const char* url,json_reader* reader) {
+    // GET a url from the bridge and stream the response
+    // through reader. returns the status, or -1
+    char host[128];
+    uint16_t port;
+    const char* path;
+    bool secure;
+    if(!parse_url(url,host,sizeof(host),&port,&path,&secure) || !ensure_connected()) {
+        return -1;
+    }
+    http_conn* conn = http_acquire(host,port,secure);
+    if(conn==nullptr) {
+        return -1;
+    }
+    int status = -1;
+    if(http_send(conn,host,path,1)) {
+        status = http_read_json(conn,reader);
+    }
+    conn->used_ts = millis();
+    return status;
+}
+static bool bridge_get_fields(const char* url,json_field* fields,size_t count) {
+    for(size_t i = 0;i<count;++i) {
+        fields[i].found = false;
+        fields[i].value[0]=0;
+    }
+    json_fields state = {fields,count};
+    json_reader reader;
+    json_init(&reader,json_extract_callback,&state);
+    int status = bridge_get_json(url,&reader);
+    return status>=200 && status<300 && reader.status!=json_state::error;
+}
+static bool room_state_fresh(const room_state& entry) {
+    return room_state_fresh(entry,millis());
+}
+static void room_state_store(int index,playback state) {
+    portENTER_CRITICAL(&room_states_lock);
+    room_state& entry = room_states[index];
+    // the room shows differently once its state is stale,
+    // so coming back fresh is a change too
+    bool changed = entry.state!=state || !room_state_fresh(entry);
+    entry.state = state;
+    // never 0, that's for never fetched
+    entry.ts = millis()|1;
+    portEXIT_CRITICAL(&room_states_lock);
+    if(changed && index==speaker_index) {
+        room_state_changed = true;
+    }
+}
+static void room_state_expire(int index) {
+    // keep showing it, but fetch it again soon
+    portENTER_CRITICAL(&room_states_lock);
+    room_state_stale(&room_states[index],millis());
+    portEXIT_CRITICAL(&room_states_lock);
+}
+// what lib/zones needs of the rooms in speakers.csv
+struct zones_rooms {
+    int index_for(const char* name) {
+        return speaker_index_for(name);
+    }
+    void stored(int index,playback state) {
+        room_state_store(index,state);
+    }
+};
+static void zones_update() {
+    // only while someone's looking, and not too often
+    if(room_zones==nullptr || zones_url[0]==0 ||
+            wifi.status!=wifi_state::connected || ui_dimmed) {
+        return;
+    }
+    if(zones_synced && millis()-zones_ts<zones_refresh_ms) {
+        return;
+    }
+    zones_synced = true;
+    zones_ts = millis();
+    zones_rooms rooms;
+    zones_parse<zones_rooms> zone;
+    zones_begin(&zone,&rooms,zones_next,speaker_count);
+    json_reader reader;
+    json_init(&reader,zones_callback<zones_rooms>,&zone);
+    int status = bridge_get_json(zones_url,&reader);
+    if(status<200 || status>=300 || reader.status==json_state::error || 
+            reader.fed==0 || reader.depth!=0) {
+        Serial.printf("Unable to sync zones from %s\n",zones_url);
+        return;
+    }
+    // only touch the rooms that changed
+    int changed = 0;
+    for(int i = 0;i<speaker_count;++i) {
+        room_zone& entry = room_zones[i];
+        const room_zone& next = zones_next[i];
+        if(entry.coordinator==next.coordinator && entry.members==next.members) {
+            continue;
+        }
+        portENTER_CRITICAL(&zones_lock);
+        entry = next;
+        portEXIT_CRITICAL(&zones_lock);
+        ++changed;
+        if(i==speaker_index) {
+            zones_changed = true;
+        }
+    }
+    if(changed>0) {
+        zones_changes+=changed;
+        Serial.printf("Zones: %d rooms changed (%d total), %d commands routed to coordinators\n",
+            changed,
+            (int)zones_changes,
+            (int)zones_routed);
+    }
+}
+static bool prefetch_room(int index) {
+    // fetch the room's state unless we have it already
+    if(room_state_fresh(room_states[index])) {
+        return false;
+    }
+    char url[256];
+    int len = snprintf(url,sizeof(url),"%s/",bridge_url);
+    int encoded = url_encode_into(string_for_index(speaker_strings,index),url+len,sizeof(url)-len);
+    if(encoded<0 || len+encoded+7>(int)sizeof(url)) {
+        return false;
+    }
+    strcpy(url+len+encoded,"/state");
+    char state[24];
+    json_field field = {"playbackState",state,sizeof(state),false};
+    ++room_state_fetches;
+    // if it fails we leave it a while before trying again
+    playback result = playback::unknown;
+    if(bridge_get_fields(url,&field,1) && field.found) {
+        result = playback_for(state);
+    }
+    room_state_store(index,result);
+    Serial.printf("Room state cache: %d hits, %d misses (%d%%), %d fetches\n",
+        (int)room_state_hits,
+        (int)room_state_misses,
+        (int)(room_state_hits+room_state_misses?
+            room_state_hits*100/(room_state_hits+room_state_misses):0),
+        (int)room_state_fetches);
+    return true;
+}
+static void prefetch_update() {
+    // keep the rooms around the current one fresh, one
+    // request at a time so commands don't wait long
+    if(room_states==nullptr || bridge_url[0]==0 ||
+            wifi.status!=wifi_state::connected || ui_dimmed) {
+        return;
+    }
+    int count = speaker_count+group_count;
+    int index = speaker_index;
+    for(int n = 0;n<=prefetch_ahead+prefetch_behind;++n) {
+        int i = prefetch_room_at(index,count,n);
+        // groups don't have state of their own
+        if(i<speaker_count && prefetch_room(i)) {
+            return;
+        }
+    }
+}
+static bool mdns_query(const char* host,IPAddress* ip) {
+    if(!mdns_started) {
+        if(!MDNS.begin(mdns_hostname)) {
+            Serial.println("Unable to start mDNS");
+            return false;
+        }
+        mdns_started = true;
+    }
+    // the responder wants the name without .local
+    char name[64];
+    size_t len = strlen(host)-6;
+    if(len>=sizeof(name)) {
+        return false;
+    }
+    memcpy(name,host,len);
+    name[len]=0;
+    // a request on its way to another bridge can't wait long
+    uint32_t timeout = http_wait_left();
+    if(timeout>mdns_timeout_ms) {
+        timeout = mdns_timeout_ms;
+    }
+    if(timeout==0) {
+        return false;
+    }
+    uint32_t ts = millis();
+    *ip = MDNS.queryHost(name,timeout);
+    if((uint32_t)*ip==0) {
+        Serial.printf("No mDNS answer for %s\n",host);
+        return false;
+    }
+    Serial.printf("Resolved %s to %s with mDNS in %dms\n",
+        host,
+        ip->toString().c_str(),
+        (int)(millis()-ts));
+    return true;
+}
+// looks up hosts for the cache in dns_cache
+struct dns_resolver {
+    bool lookup(const char* host,uint32_t* address) {
+        IPAddress ip;
+        if(!WiFi.hostByName(host,ip)) {
+            return false;
+        }
+        *address = (uint32_t)ip;
+        return true;
+    }
+    bool query(const char* host,uint32_t* address) {
+        IPAddress ip;
+        if(!mdns_query(host,&ip)) {
+            return false;
+        }
+        *address = (uint32_t)ip;
+        return true;
+    }
+};
+static dns_resolver dns_resolver_device;
+static bool dns_resolve(const char* host,IPAddress* ip) {
+    // no need to look up literal addresses
+    if(ip->fromString(host)) {
+        return true;
+    }
+    uint32_t address;
+    if(!dns_cache_resolve(&dns,dns_resolver_device,host,&address,time(nullptr))) {
+        return false;
+    }
+    *ip = address;
+    return true;
+}
+static void dns_invalidate(const char* host) {
+    dns_cache_invalidate(&dns,host,millis(),&mdns_retry_ts);
+}
+static void dns_refresh() {
+    // look up stale .local entries again, if it's time
+    if(wifi.status!=wifi_state::connected) {
+        return;
+    }
+    dns_cache_refresh(&dns,dns_resolver_device,millis(),&mdns_retry_ts);
+}
+static void dns_prefetch() {
+    // resolve each distinct host in api.txt up front.
+    // the hosts come before any format specifiers so
+    // we can parse the format strings directly
+    char host[128];
+    uint16_t port;
+    const char* path;
+    IPAddress ip;
+    for(int i = 0;i<format_url_count;++i) {
+        // each of the bridges, if there's more than one
+        const char* url = string_for_index(format_urls,i);
+        while(url!=nullptr) {
+            bool ack;
+            bool secure;
+            if(parse_url(url,host,sizeof(host),&port,&path,&secure) ||
+                    parse_udp_url(url,host,sizeof(host),&port,&path,&ack) ||
+                    parse_mqtt_url(url,host,sizeof(host),&port,&path)) {
+                dns_resolve(host,&ip);
+            }
+            url = strchr(url,'|');
+            if(url!=nullptr) {
+                ++url;
+            }
+        }
+    }
+    Serial.printf("DNS cache hits: %d, misses: %d\n",(int)dns.hits,(int)dns.misses);
+}
+static void build_soap_requests() {
+    // prebuild the requests for each upnp: line in api.txt
+    const char* fmt = format_urls;
+    for(int i = 0;i<format_url_count;++i) {
+        if(0==strncmp(fmt,"upnp:",5)) {
+            soap_action* action = soap_action_for(fmt+5);
+            if(action==nullptr) {
+                Serial.printf("Unknown UPnP action %s\n",fmt+5);
+            } else if(action->service==nullptr) {
+                // playpause needs these
+                if(!soap_build(soap_action_for("GetTransportInfo")) ||
+                        !soap_build(soap_action_for("Play")) ||
+                        !soap_build(soap_action_for("Pause"))) {
+                    Serial.println("Out of memory building UPnP requests");
+                }
+            } else if(!soap_build(action)) {
+                Serial.println("Out of memory building UPnP requests");
+            }
+        }
+        fmt+=strlen(fmt)+1;
+    }
+}
+static bool soap_send(http_conn* conn,const char* host,const soap_action* action,int count) {
+    int len = soap_format(http_buffer,sizeof(http_buffer),action,host);
+    if(len<0) {
+        return false;
+    }
+    for(int i = 0;i<count;++i) {
+        if(len!=conn->client.write((const uint8_t*)http_buffer,len)) {
+            return false;
+        }
+    }
+    return true;
+}
+static bool do_soap_request(int index,const char* name,int count) {
+    soap_action* action = soap_action_for(name);
+    if(action==nullptr) {
+        Serial.printf("Unknown UPnP action %s\n",name);
+        return false;
+    }
+    IPAddress address = speaker_addresses[index];
+    if(speaker_addresses[index]==0) {
+        Serial.printf("No address for %s in speakers.csv\n",string_for_index(speaker_strings,index));
+        return false;
+    }
+    if(!ensure_connected()) {
+        Serial.println("Offline. Dropping command");
+        return false;
+    }
+    char host[16];
+    snprintf(host,sizeof(host),"%d.%d.%d.%d",address[0],address[1],address[2],address[3]);
+    Serial.printf("Sending %s to %s\n",name,host);
+    uint32_t start_ts = micros();
+    request_send_ts = start_ts;
+    http_conn* conn = http_acquire(host,soap_port,false);
+    if(conn==nullptr) {
+        return false;
+    }
+    if(trace.connected==0) {
+        trace.connected = micros();
+    }
+    if(action->service==nullptr) {
+        // playpause: see what it's doing, then do the opposite.
+        // an even number of toggles is a no-op
+        if(count%2==0) {
+            return true;
+        }
+        count = 1;
+        char body[512];
+        if(!soap_send(conn,host,soap_action_for("GetTransportInfo"),1) ||
+                0>http_read_response(conn,body,sizeof(body))) {
+            conn->client.stop();
+            return false;
+        }
+        action = soap_action_for(nullptr!=strstr(body,"<CurrentTransportState>PLAYING<")?"Pause":"Play");
+        if(!conn->client.connected() && !http_open(conn,host,soap_port,false)) {
+            return false;
+        }
+    }
+    int remaining = count;
+    if(action->request!=nullptr && soap_send(conn,host,action,count)) {
+        request_sent_ts = micros();
+        request_transport = transport::upnp;
+        while(remaining>0) {
+            int status = http_read_response(conn,nullptr,0);
+            if(status<0) {
+                break;
+            }
+            if(trace.status==0) {
+                trace.status = micros();
+            }
+            if(status>=400) {
+                // a SOAP fault
+                Serial.printf("Speaker returned %d\n",status);
+            }
+            --remaining;
+        }
+    }
+    conn->used_ts = millis();
+    if(remaining>0) {
+        conn->client.stop();
+        Serial.printf("%d of %d requests failed\n",remaining,count);
+        return false;
+    }
+    uint32_t elapsed = micros()-start_ts;
+    ++soap_latency.count;
+    soap_latency.total+=elapsed;
+    Serial.printf("UPnP request took %dus (avg %dus, bridge avg %dus)\n",
+        (int)elapsed,
+        (int)(soap_latency.total/soap_latency.count),
+        (int)(bridge_latency.count?bridge_latency.total/bridge_latency.count:0));
+    return true;
+}
+static bool do_group_request(int group_index,int url_index,int count) {
+    const room_group& group = groups[group_index];
+    const char* fmt = string_for_index(format_urls,url_index);
+    if(0==strncmp(fmt,"upnp:",5)) {
+        // these go to each speaker in turn
+        bool result = true;
+        for(int i = 0;i<group.count;++i) {
+            result = do_soap_request(group.members[i],fmt+5,count) && result;
+        }
+        return result;
+    }
+    if(0==strncmp(fmt,"udp",3)) {
+        // these don't wait on anything so one
+        // at a time is as good as all at once
+        bool result = true;
+        for(int i = 0;i<group.count;++i) {
+            result = do_udp_request(url_for(group.members[i],url_index),count) && result;
+        }
+        return result;
+    }
+    if(0==strncmp(fmt,"mqtt",4)) {
+        // one connection, so these go out back to back anyway
+        bool result = true;
+        for(int i = 0;i<group.count;++i) {
+            result = do_mqtt_request(url_for(group.members[i],url_index),count) && result;
+        }
+        return result;
+    }
+    if(nullptr!=strchr(fmt,'|')) {
+        // each member picks its bridge, so one at a time
+        bool result = true;
+        for(int i = 0;i<group.count;++i) {
+            result = do_failover_request(url_for(group.members[i],url_index),count) && result;
+        }
+        return result;
+    }
+    if(!ensure_connected()) {
+        Serial.println("Offline. Dropping command");
+        return false;
+    }
+    Serial.printf("Sending to group %s\n",group.name);
+    uint32_t start_ts = micros();
+    request_send_ts = start_ts;
+    // send to every member before waiting on any of them
+    uint32_t member_ts[group_max_rooms];
+    int remaining[group_max_rooms];
+    int outstanding = 0;
+    int failed = 0;
+    group_sending = true;
+    for(int i = 0;i<group.count;++i) {
+        member_ts[i] = micros();
+        remaining[i] = 0;
+        const char* url = url_for(group.members[i],url_index);
+        char host[128];
+        uint16_t port;
+        const char* path;
+        bool secure;
+        http_conn* conn = &group_pool[i];
+        if(!parse_url(url,host,sizeof(host),&port,&path,&secure) ||
+                !http_open(conn,host,port,secure)) {
+            Serial.printf("Unable to send %s\n",url);
+            conn->client.stop();
+            ++failed;
+            continue;
+        }
+        // the stages run from the first member connected
+        // to the last member answering
+        if(trace.connected==0) {
+            trace.connected = micros();
+        }
+        if(!http_send(conn,host,path,count)) {
+            Serial.printf("Unable to send %s\n",url);
+            conn->client.stop();
+            ++failed;
+            continue;
+        }
+        remaining[i] = count;
+        ++outstanding;
+    }
+    request_sent_ts = micros();
+    request_transport = transport::bridge;
+    // now collect the responses in whatever
+    // order they come back in
+    uint32_t serial = 0;
+    uint32_t deadline = millis()+http_timeout_ms;
+    while(outstanding>0) {
+        bool timed_out = (int32_t)(millis()-deadline)>=0;
+        for(int i = 0;i<group.count;++i) {
+            if(remaining[i]==0) {
+                continue;
+            }
+            http_conn* conn = &group_pool[i];
+            if(conn->client.available()) {
+                int status = http_read_response(conn,nullptr,0);
+                if(status>=400) {
+                    Serial.printf("Bridge returned %d\n",status);
+                }
+                if(status>=0 && --remaining[i]>0) {
+                    continue;
+                }
+                if(status<0) {
+                    conn->client.stop();
+                    ++failed;
+                }
+                conn->used_ts = millis();
+                serial+=micros()-member_ts[i];
+                trace.status = micros();
+            } else if(timed_out || !conn->client.connected()) {
+                conn->client.stop();
+                ++failed;
+            } else {
+                continue;
+            }
+            remaining[i] = 0;
+            --outstanding;
+        }
+        if(outstanding>0) {
+            delay(1);
+        }
+    }
+    group_sending = false;
+    Serial.printf("Group %s took %dus, %dus sent one at a time (%d of %d failed)\n",
+        group.name,
+        (int)(micros()-start_ts),
+        (int)serial,
+        failed,
+        group.count);
+    return failed==0;
+}
+static bool udp_wait_ack(uint16_t seq) {
+    uint32_t ts = millis();
+    while(millis()-ts<udp_ack_timeout_ms) {
+        while(0<udp_cmd.parsePacket()) {
+            uint8_t ack[4];
+            if(4==udp_cmd.read(ack,sizeof(ack)) && 
+                    ack[0]=='S' && ack[1]=='A' && 
+                    ack[2]==(seq>>8) && ack[3]==(seq&0xFF)) {
+                return true;
+            }
+        }
+        delay(1);
+    }
+    return false;
+}
+static bool do_udp_request(const char* url,int count) {
+    char host[128];
+    uint16_t port;
+    const char* path;
+    bool ack;
+    if(!parse_udp_url(url,host,sizeof(host),&port,&path,&ack)) {
+        Serial.printf("Bad UDP url %s\n",url);
+        return false;
+    }
+    if(!ensure_connected()) {
+        Serial.println("Offline. Dropping command");
+        return false;
+    }
+    request_send_ts = micros();
+    IPAddress ip;
+    if(!dns_resolve(host,&ip)) {
+        Serial.printf("Unable to resolve %s\n",host);
+        return false;
+    }
+    if(!udp_cmd_started) {
+        // bound so we can hear acks
+        udp_cmd_started = udp_cmd.begin(udp_local_port);
+    }
+    // build the packet
+    uint16_t seq = ++udp_seq;
+    uint8_t* packet = (uint8_t*)http_buffer;
+    size_t path_len = strlen(path+1);
+    if(path_len+7>sizeof(http_buffer)) {
+        return false;
+    }
+    packet[0]='S';
+    packet[1]='R';
+    packet[2]=1;
+    packet[3]=ack?udp_flag_ack:0;
+    packet[4]=seq>>8;
+    packet[5]=seq&0xFF;
+    packet[6]=count>255?255:count;
+    memcpy(packet+7,path+1,path_len);
+    for(int tries = 0;tries<(ack?2:1);++tries) {
+        if(tries>0) {
+            ++udp_retries;
+        }
+        if(!udp_cmd.beginPacket(ip,port) ||
+                path_len+7!=udp_cmd.write(packet,path_len+7) ||
+                !udp_cmd.endPacket()) {
+            Serial.println("Unable to send UDP command");
+            return false;
+        }
+        if(tries==0) {
+            request_sent_ts = micros();
+            request_transport = transport::udp;
+            ++udp_sent;
+        }
+        if(!ack || udp_wait_ack(seq)) {
+            return true;
+        }
+    }
+    ++udp_lost;
+    Serial.printf("No ack for UDP command %d (sent %d, retried %d, lost %d)\n",
+        (int)seq,
+        (int)udp_sent,
+        (int)udp_retries,
+        (int)udp_lost);
+    return false;
+}
+static bool do_request(int index, int url_index, int count) {
+    if(index>=speaker_count) {
+        return do_group_request(index-speaker_count,url_index,count);
+    }
+    int coordinator = zone_route(index,url_index);
+    if(coordinator!=index) {
+        ++zones_routed;
+        Serial.printf("%s is grouped. Sending to %s\n",
+            string_for_index(speaker_strings,index),
+            string_for_index(speaker_strings,coordinator));
+        index = coordinator;
+    }
+    const char* fmt = string_for_index(format_urls,url_index);
+    if(0==strncmp(fmt,"upnp:",5)) {
+        return do_soap_request(index,fmt+5,count);
+    }
+    const char* url = url_for(index,url_index);
+    if(0==strncmp(url,"udp",3)) {
+        return do_udp_request(url,count);
+    }
+    if(0==strncmp(url,"mqtt",4)) {
+        return do_mqtt_request(url,count);
+    }
+    if(nullptr!=strchr(url,'|')) {
+        return do_failover_request(url,count);
+    }
+    return do_http_request(url,count);
+}
+static bool do_http_request(const char* url,int count,bool failover) {
+    // connect if necessary
+    if(!ensure_connected()) {
+        Serial.println("Offline. Dropping command");
+        return false;
+    }
+    // send the command
+    Serial.print("Sending ");
+    Serial.println(url);
+    uint32_t start_ts = micros();
+    request_send_ts = start_ts;
+    char host[128];
+    uint16_t port;
+    const char* path;
+    bool secure;
+    if(!parse_url(url,host,sizeof(host),&port,&path,&secure)) {
+        Serial.println("Not an http(s) url. Dropping command");
+        return false;
+    }
+    // try the warm connection first. if the bridge dropped
+    // it out from under us, reconnect once and resend. not
+    // when there's another bridge to try, that's quicker
+    int remaining = count;
+    for(int tries = 0;tries<(failover?1:2) && remaining>0;++tries) {
+        uint32_t reused = http_reused;
+        http_conn* conn = http_acquire(host,port,secure);
+        if(conn==nullptr) {
+            break;
+        }
+        // a retry restarts the clock on the connection
+        trace.connected = micros();
+        if(http_send(conn,host,path,remaining)) {
+            request_sent_ts = micros();
+            request_transport = transport::bridge;
+            while(remaining>0) {
+                int status = http_read_response(conn,nullptr,0);
+                if(status<0) {
+                    break;
+                }
+                if(trace.status==0) {
+                    trace.status = micros();
+                }
+                if(status>=400) {
+                    Serial.printf("Bridge returned %d\n",status);
+                }
+                --remaining;
+            }
+        }
+        conn->used_ts = millis();
+        if(remaining==0 || reused==http_reused) {
+            break;
+        }
+        conn->client.stop();
+    }
+    if(remaining>0) {
+        Serial.printf("%d of %d requests failed\n",remaining,count);
+        return false;
+    }
+    uint32_t elapsed = micros()-start_ts;
+    ++bridge_latency.count;
+    bridge_latency.total+=elapsed;
+    Serial.printf("Request took %dus (connections reused: %d, opened: %d)\n",
+        (int)elapsed,
+        (int)http_reused,
+        (int)http_opened);
+    return true;
+}
+// sends api.txt lines that list more than one bridge
+struct bridge_transport {
+    uint32_t now_ms() {
+        return millis();
+    }
+    uint32_t now_us() {
+        return micros();
+    }
+    bool parse(const char* url,char* host,size_t host_size,uint16_t* port,bool* secure) {
+        const char* path;
+        return parse_url(url,host,host_size,port,&path,secure);
+    }
+    bool request(const char* url,int count,bool failover,uint32_t deadline_ms) {
+        http_deadline_set = failover;
+        http_deadline_ts = deadline_ms;
+        bool result = do_http_request(url,count,failover);
+        http_deadline_set = false;
+        return result;
+    }
+    bool probe(const bridge_endpoint& e,uint32_t deadline_ms) {
+        // anything that answers will do, even a 404
+        http_deadline_set = true;
+        http_deadline_ts = deadline_ms;
+        http_conn* conn = http_acquire(e.host,e.port,e.secure);
+        bool alive = conn!=nullptr && 
+            http_send(conn,e.host,"/",1) && 
+            0<http_read_response(conn,nullptr,0);
+        http_deadline_set = false;
+        if(alive) {
+            conn->used_ts = millis();
+        }
+        return alive;
+    }
+    void down(const bridge_endpoint& e) {
+        Serial.printf("Bridge %s:%d is down\n",e.host,(int)e.port);
+    }
+    void back(const bridge_endpoint& e) {
+        Serial.printf("Bridge %s:%d is back (%dus)\n",e.host,(int)e.port,(int)e.srtt);
+    }
+    void failing_over(uint32_t failovers) {
+        Serial.printf("Failing over (%d times so far)\n",(int)failovers);
+    }
+};
+static bridge_transport bridge_device;
+static bool do_failover_request(const char* url,int count) {
+    // we can't tell a down bridge from no connection
+    if(!ensure_connected()) {
+        Serial.println("Offline. Dropping command");
+        return false;
+    }
+    return endpoints_request(&endpoints,bridge_device,url,count);
+}
+static void endpoint_probe() {
+    if(wifi.status!=wifi_state::connected) {
+        return;
+    }
+    endpoints_probe(&endpoints,bridge_device);
+}
+#ifdef HTTP_BENCHMARK_URL
+static void http_benchmark() {
+    // compare HTTPClient against our own GET with the
+    // same url, a number of times each
+    constexpr static const int iterations = 20;
+    static HTTPClient http;
+    char host[128];
+    uint16_t port;
+    const char* path;
+    bool secure;
+    if(!parse_url(HTTP_BENCHMARK_URL,host,sizeof(host),&port,&path,&secure)) {
+        Serial.println("Can't benchmark " HTTP_BENCHMARK_URL);
+        return;
+    }
+    // the way the remote used it, keeping the connection
+    http.setReuse(true);
+    uint32_t heap_start = ESP.getFreeHeap();
+    uint32_t heap_peak = 0;
+    uint32_t ts = micros();
+    for(int i = 0;i<iterations;++i) {
+        http.begin(HTTP_BENCHMARK_URL);
+        http.GET();
+        uint32_t used = heap_start-ESP.getFreeHeap();
+        if(used>heap_peak) {
+            heap_peak = used;
+        }
+        http.end();
+    }
+    Serial.printf("HTTPClient: %dus per request, %d bytes peak heap, %d bytes heap delta\n",
+        (int)((micros()-ts)/iterations),
+        (int)heap_peak,
+        (int)(heap_start-ESP.getFreeHeap()));
+    heap_start = ESP.getFreeHeap();
+    heap_peak = 0;
+    ts = micros();
+    for(int i = 0;i<iterations;++i) {
+        http_conn* conn = http_acquire(host,port,secure);
+        if(conn!=nullptr && http_send(conn,host,path,1)) {
+            uint32_t used = heap_start-ESP.getFreeHeap();
+            if(used>heap_peak) {
+                heap_peak = used;
+            }
+            http_read_response(conn,nullptr,0);
+            conn->used_ts = millis();
+        }
+    }
+    Serial.printf("Raw GET: %dus per request, %d bytes peak heap, %d bytes heap delta\n",
+        (int)((micros()-ts)/iterations),
+        (int)heap_peak,
+        (int)(heap_start-ESP.getFreeHeap()));
+}
+#endif
+static void queue_command(int index,int url_index) {
+    if(index>=speaker_count+group_count) {
+        // no rooms yet
+        return;
+    }
+    command cmd;
+    cmd.index = index;
+    cmd.url_index = url_index;
+    cmd.ts = micros();
+    cmd.repeat = 1;
+    // never block the UI waiting for room in the queue
+    if(!command_queue_push(&queued_commands,cmd)) {
+        Serial.println("Command queue full. Dropped command");
+        feedback_show(url_index,cmd.ts,false);
+        return;
+    }
+    xTaskNotifyGive(net_task_handle);
+    feedback_show(url_index,cmd.ts,true);
+}
+static bool net_pending() {
+    return net_busy || held.count>0 || command_queue_depth(&queued_commands)>0;
+}
+static int zone_route(int index,int url_index) {
+    // transport commands only work on a group's coordinator.
+    // volume and the rest stay with the room
+    if(room_zones==nullptr || index>=speaker_count) {
+        return index;
+    }
+    int coordinator = room_zones[index].coordinator;
+    if(coordinator<0 || coordinator==index) {
+        return index;
+    }
+    const char* fmt = string_for_index(format_urls,url_index);
+    if(url_kinds[url_index]==command_kind::other) {
+        soap_action* action = 0==strncmp(fmt,"upnp:",5)?soap_action_for(fmt+5):nullptr;
+        if(action==nullptr || action->service==nullptr ||
+                0!=strcmp(action->service,"AVTransport")) {
+            return index;
+        }
+    }
+    return coordinator;
+}
+static void ssdp_save(const ssdp_speaker& speaker) {
+    // apply a room as soon as we have it and merge it into
+    // /rooms for next boot. we only ever replace or add a
+    // line, so a search that comes up short never loses rooms
+    // we found before. rooms we didn't know about show up
+    // after a reboot
+    int index = speaker_index_for(speaker.room);
+    if(index>=0) {
+        speaker_addresses[index] = speaker.address;
+    } else {
+        Serial.printf("New room %s\n",speaker.room);
+    }
+    IPAddress address = speaker.address;
+    char line[96];
+    snprintf(line,sizeof(line),"%s=%d.%d.%d.%d",speaker.room,address[0],address[1],address[2],address[3]);
+    size_t room_len = strlen(speaker.room);
+    // loop() won't deep sleep while we hold this
+    xSemaphoreTake(rooms_lock,portMAX_DELAY);
+    bool exists = SPIFFS.exists("/rooms");
+    if(exists) {
+        // don't wear the flash if nothing changed
+        File file = SPIFFS.open("/rooms");
+        bool same = false;
+        while(!same && file.available()) {
+            String s = file.readStringUntil('\n');
+            s.trim();
+            same = 0==strcmp(s.c_str(),line);
+        }
+        file.close();
+        if(same) {
+            xSemaphoreGive(rooms_lock);
+            return;
+        }
+    }
+    File out = SPIFFS.open("/rooms.new","w",true);
+    if(exists) {
+        File file = SPIFFS.open("/rooms");
+        while(file.available()) {
+            String s = file.readStringUntil('\n');
+            s.trim();
+            if(s.isEmpty() || 
+                    (s.indexOf('=')==(int)room_len && 0==strncmp(s.c_str(),speaker.room,room_len))) {
+                continue;
+            }
+            out.printf("%s\n",s.c_str());
+        }
+        file.close();
+    }
+    out.printf("%s\n",line);
+    out.close();
+    SPIFFS.remove("/rooms");
+    SPIFFS.rename("/rooms.new","/rooms");
+    xSemaphoreGive(rooms_lock);
+}
+// the radio and sockets for the discovery in lib/ssdp
+struct ssdp_network {
+    uint32_t now_ms() {
+        return millis();
+    }
+    bool search(const char* msearch,size_t len) {
+        ssdp_udp.begin(1901);
+        ssdp_udp.beginPacket(IPAddress(239,255,255,250),1900);
+        ssdp_udp.write((const uint8_t*)msearch,len);
+        return 0!=ssdp_udp.endPacket();
+    }
+    int receive(char* buf,size_t size,uint32_t* address) {
+        if(0>=ssdp_udp.parsePacket()) {
+            return -1;
+        }
+        int len = ssdp_udp.read((uint8_t*)buf,size);
+        *address = ssdp_udp.remoteIP();
+        return len<0?0:len;
+    }
+    void search_done() {
+        ssdp_udp.stop();
+    }
+    bool describe(uint32_t address,char* body,size_t size) {
+        // not on a pooled connection. walking every speaker
+        // would push the bridge's warm ones out of the pool.
+        // the room name is near the top of the description
+        // so we only read that far
+        IPAddress ip = address;
+        char host[16];
+        snprintf(host,sizeof(host),"%d.%d.%d.%d",ip[0],ip[1],ip[2],ip[3]);
+        WiFiClient client;
+        if(!client.connect(ip,soap_port,(int32_t)http_timeout_ms)) {
+            return false;
+        }
+        client.setNoDelay(true);
+        bool result = http_write_requests(client,http_buffer,sizeof(http_buffer),host,"/xml/device_description.xml",1) &&
+            200==http_read_status(client,http_buffer,sizeof(http_buffer),millis()+http_timeout_ms,body,size);
+        client.stop();
+        return result;
+    }
+    void found(const ssdp_speaker& s) {
+        ssdp_save(s);
+    }
+    void failed(const ssdp_speaker& s) {
+        Serial.println("Unable to get room name for speaker");
+    }
+};
+static ssdp_network ssdp_device;
+static void ssdp_update() {
+    // do a little discovery work at a time so
+    // commands never wait long behind it
+    static char body[2048];
+    switch(ssdp.status) {
+        case ssdp_state::idle:
+            if(wifi.status==wifi_state::connected && 
+                    (!ssdp_searched || time(nullptr)-ssdp_last_search>=ssdp_refresh_secs)) {
+                Serial.println("Searching for speakers");
+                ssdp_search(&ssdp,ssdp_device);
+            }
+            break;
+        case ssdp_state::listening:
+            if(ssdp_listen(&ssdp,ssdp_device,http_buffer,sizeof(http_buffer))) {
+                Serial.printf("Found %d speakers\n",ssdp.count);
+            }
+            break;
+        case ssdp_state::describing:
+            if(wifi.status!=wifi_state::connected) {
+                break;
+            }
+            if(!ssdp_describe_next(&ssdp,ssdp_device,body,sizeof(body))) {
+                // only now is the search done. if we slept before
+                // this, we'll search again next time we wake
+                ssdp_searched = true;
+                ssdp_last_search = time(nullptr);
+            }
+            break;
+        case ssdp_state::done:
+            break;
+    }
+}
+static void now_playing_set(const char* text,bool active) {
+    portENTER_CRITICAL(&now_playing_lock);
+    if(active!=now_playing_active || 0!=strcmp(text,now_playing)) {
+        strncpy(now_playing,text,sizeof(now_playing)-1);
+        now_playing[sizeof(now_playing)-1]=0;
+        now_playing_active = active;
+        now_playing_changed = true;
+    }
+    portEXIT_CRITICAL(&now_playing_lock);
+}
+static void gena_notify(WiFiClient& client) {
+    gena_event event;
+    if(!gena_notify(&gena,client,http_buffer,sizeof(http_buffer),&event)) {
+        return;
+    }
+    // an event only has what changed, so start from what we have
+    char text[sizeof(now_playing)];
+    bool active;
+    portENTER_CRITICAL(&now_playing_lock);
+    memcpy(text,now_playing,sizeof(text));
+    active = now_playing_active;
+    portEXIT_CRITICAL(&now_playing_lock);
+    gena_now_playing(&event,text,sizeof(text),&active);
+    now_playing_set(text,active);
+}
+// what lib/gena needs of the speakers
+struct gena_speakers {
+    bool request(int index,const char* method) {
+        IPAddress address = speaker_addresses[index];
+        char host[24];
+        snprintf(host,sizeof(host),"%d.%d.%d.%d:%d",
+            address[0],address[1],address[2],address[3],(int)soap_port);
+        IPAddress local = WiFi.localIP();
+        char callback[48];
+        snprintf(callback,sizeof(callback),"http://%d.%d.%d.%d:%d/notify",
+            local[0],local[1],local[2],local[3],(int)gena_port);
+        // a connection of its own, like discovery's, so renewals
+        // don't push the bridge's warm one out of the pool
+        WiFiClient client;
+        if(!client.connect(address,soap_port,(int32_t)http_timeout_ms)) {
+            return false;
+        }
+        client.setNoDelay(true);
+        bool result = gena_request(&gena,client,method,gena_path,host,callback,http_buffer,sizeof(http_buffer));
+        client.stop();
+        if(gena.status>=0 && gena.status!=200) {
+            Serial.printf("%s returned %d\n",method,gena.status);
+        }
+        return result;
+    }
+};
+static void gena_update() {
+    if(wifi.status!=wifi_state::connected) {
+        gena_reset(&gena);
+        return;
+    }
+    if(!gena_listening) {
+        gena_server.begin();
+        gena_listening = true;
+    }
+    WiFiClient client = gena_server.available();
+    if(client) {
+        gena_notify(client);
+        client.stop();
+    }
+    // follow the current room, but only while we're showing it
+    int index = speaker_index;
+    int want = -1;
+    if(!ui_dimmed && index<speaker_count && speaker_addresses[index]!=0) {
+        want = index;
+    }
+    if(want!=gena.index) {
+        now_playing_set("",false);
+    }
+    gena_speakers speakers;
+    gena_follow(&gena,speakers,want);
+}
+static void mqtt_show(int index) {
+    // put up what we last heard was playing in the room,
+    // unless it has a UPnP subscription of its own
+    if(gena_showing(&gena,index)) {
+        return;
+    }
+    mqtt_index = index;
+    const char* title = index<speaker_count?mqtt_titles+index*mqtt_title_size:"";
+    bool active = index<speaker_count && room_states!=nullptr &&
+        room_states[index].state==playback::playing;
+    now_playing_set(title,active);
 }
-static void button_b_on_click(int clicks,void* state) {
-    if(clicks<format_url_count) {
-        const char* fmt_url = string_for_index(format_urls, clicks);
-        if(fmt_url!=nullptr) {
-            do_request(speaker_index, fmt_url);
+static void mqtt_on_state(const char* topic,size_t topic_len,const char* payload,size_t payload_len) {
+    if(mqtt_titles==nullptr) {
+        // left over from a session that had a state topic
+        return;
+    }
+    // which room it's for
+    int index = speaker_index;
+    if(mqtt_state_room) {
+        size_t prefix_len = strlen(mqtt_state_prefix);
+        size_t suffix_len = strlen(mqtt_state_suffix);
+        if(topic_len<=prefix_len+suffix_len ||
+                0!=strncmp(topic,mqtt_state_prefix,prefix_len) ||
+                0!=strncmp(topic+topic_len-suffix_len,mqtt_state_suffix,suffix_len)) {
+            return;
         }
+        char room[64];
+        size_t room_len = topic_len-prefix_len-suffix_len;
+        if(room_len>=sizeof(room)) {
+            return;
+        }
+        memcpy(room,topic+prefix_len,room_len);
+        room[room_len]=0;
+        index = speaker_index_for(room);
+    }
+    if(index<0 || index>=speaker_count) {
+        return;
+    }
+    // the payload is either JSON like the bridge's /state
+    // or just the text to show
+    char* title = mqtt_titles+index*mqtt_title_size;
+    if(payload_len>0 && payload[0]=='{') {
+        char state[24];
+        char track[mqtt_title_size];
+        char artist[mqtt_title_size];
+        json_field fields[] = {
+            {"playbackState",state,sizeof(state),false},
+            {"currentTrack.title",track,sizeof(track),false},
+            {"currentTrack.artist",artist,sizeof(artist),false}
+        };
+        for(json_field& field : fields) {
+            field.value[0]=0;
+        }
+        json_fields extract = {fields,sizeof(fields)/sizeof(json_field)};
+        json_reader reader;
+        json_init(&reader,json_extract_callback,&extract);
+        json_feed(&reader,payload,payload_len);
+        if(fields[0].found && room_states!=nullptr) {
+            room_state_store(index,playback_for(state));
+        }
+        if(fields[1].found) {
+            if(artist[0]!=0) {
+                snprintf(title,mqtt_title_size,"%s - %s",track,artist);
+            } else {
+                strcpy(title,track);
+            }
+        }
+    } else {
+        size_t len = payload_len<mqtt_title_size-1?payload_len:mqtt_title_size-1;
+        memcpy(title,payload,len);
+        title[len]=0;
+    }
+    if(index==speaker_index) {
+        mqtt_show(index);
     }
-    // reset the dimmer
-    dimmer.wake();
 }
-static void button_b_on_long_click(void* state) {
-    // play the first URL
-    if(format_urls!=nullptr) {
-        do_request(speaker_index,format_urls);
+struct mqtt_network {
+    WiFiClient client;
+    uint32_t now_ms() {
+        return millis();
     }
-    // reset the dimmer
-    dimmer.wake();
+    void idle() {
+        delay(1);
+    }
+    bool connect(const char* host,uint16_t port) {
+        IPAddress ip;
+        if(!dns_resolve(host,&ip)) {
+            Serial.printf("Unable to resolve %s\n",host);
+            return false;
+        }
+        if(!client.connect(ip,port,(int32_t)http_wait_left())) {
+            Serial.printf("Unable to connect to %s:%d\n",host,(int)port);
+            dns_invalidate(host);
+            return false;
+        }
+        client.setNoDelay(true);
+        return true;
+    }
+    size_t write(const uint8_t* data,size_t size) {
+        return client.write(data,size);
+    }
+    int read() {
+        return client.read();
+    }
+    int available() {
+        return client.available();
+    }
+    bool connected() {
+        return client.connected();
+    }
+    void stop() {
+        client.stop();
+    }
+    void received(const char* topic,size_t topic_len,const char* payload,size_t payload_len) {
+        mqtt_on_state(topic,topic_len,payload,payload_len);
+    }
+};
+static mqtt_network mqtt_device;
+static bool mqtt_open(const char* host,uint16_t port) {
+    uint32_t start_ts = millis();
+    mqtt_opened opened = mqtt_open(&mqtt,mqtt_device,host,port,http_deadline());
+    switch(opened) {
+        case mqtt_opened::failed:
+            return false;
+        case mqtt_opened::refused:
+            Serial.printf("MQTT broker %s:%d refused us (%d)\n",host,(int)port,mqtt.code);
+            return false;
+        case mqtt_opened::reused:
+            return true;
+        default:
+            break;
+    }
+    Serial.printf("Connected to MQTT broker %s:%d in %dms (%s, %d of %d resumed)\n",
+        host,
+        (int)port,
+        (int)(millis()-start_ts),
+        opened==mqtt_opened::resumed?"resumed":"new session",
+        (int)mqtt.resumed,
+        (int)mqtt.connects);
+    return true;
 }
-static void url_encode(const char *str, char *enc){
-
-    for (; *str; str++){
-        int i = *str;
-        if(isalnum(i)|| i == '~' || i == '-' || i == '.' || i == '_') {
-            *enc=*str;
-        } else {
-            sprintf( enc, "%%%02X", *str);
+static void mqtt_update() {
+    if(wifi.status!=wifi_state::connected) {
+        if(mqtt.connected) {
+            mqtt_close(&mqtt,mqtt_device);
+        }
+        return;
+    }
+    bool state = mqtt_titles!=nullptr;
+    if(!mqtt.connected && (state || mqtt_api_port!=0) && !ui_dimmed &&
+            (int32_t)(millis()-mqtt_retry_ts)>=0) {
+        // connect ahead of any press, so a command only
+        // has to write its PUBLISH. to the state topic's
+        // broker if there is one, else api.txt's
+        if(!mqtt_open(state?mqtt_state_host:mqtt_api_host,state?mqtt_state_port:mqtt_api_port)) {
+            mqtt_retry_ts = millis()+mqtt_retry_ms;
+        }
+    }
+    if(state) {
+        // stand aside while UPnP has the room, and put ours
+        // back up once it lets go
+        if(gena_showing(&gena,speaker_index)) {
+            mqtt_index = -1;
+        } else if(mqtt_index!=speaker_index) {
+            mqtt_show(speaker_index);
         }
-        while (*++enc);
+    }
+    if(!mqtt.connected) {
+        return;
+    }
+    if(!mqtt_device.connected()) {
+        mqtt_close(&mqtt,mqtt_device);
+        return;
+    }
+    mqtt_receive(&mqtt,mqtt_device,http_deadline());
+    if(mqtt.connected && !mqtt_keep_alive(&mqtt,mqtt_device)) {
+        Serial.println("MQTT broker stopped answering");
     }
 }
-static void do_request(int index, const char* url_fmt) {
-    const char* room = string_for_index(speaker_strings, index);
-    url_encode(room,url_encoded);
-    snprintf(url,1024,url_fmt,url_encoded);
-    // connect if necessary
-    ensure_connected();
-    // send the command
-    Serial.print("Sending ");
+static bool do_mqtt_request(const char* url,int count) {
+    char host[128];
+    uint16_t port;
+    const char* path;
+    if(!parse_mqtt_url(url,host,sizeof(host),&port,&path)) {
+        Serial.printf("Bad MQTT url %s\n",url);
+        return false;
+    }
+    if(!ensure_connected()) {
+        Serial.println("Offline. Dropping command");
+        return false;
+    }
+    Serial.print("Publishing ");
     Serial.println(url);
-    http.begin(url);
-    http.GET();
-    http.end();
+    request_send_ts = micros();
+    // the room went into the topic url encoded
+    const char* query = strchr(path,'?');
+    size_t path_len = query!=nullptr?query-path:strlen(path);
+    char topic[128];
+    char payload[128];
+    size_t topic_len = url_decode_into(path+1,path_len-1,topic,sizeof(topic));
+    size_t payload_len = query!=nullptr?url_decode_into(query+1,strlen(query+1),payload,sizeof(payload)):0;
+    // not in the session's buffer, connecting uses that
+    uint8_t packet[sizeof(topic)+sizeof(payload)+8];
+    size_t len = mqtt_publish_packet(packet,sizeof(packet),topic,topic_len,payload,payload_len);
+    if(!mqtt_open(host,port)) {
+        return false;
+    }
+    trace.connected = micros();
+    if(!mqtt_publish(&mqtt,mqtt_device,host,port,packet,len,count,http_deadline())) {
+        Serial.printf("Unable to publish to %s:%d\n",host,(int)port);
+        return false;
+    }
+    request_sent_ts = micros();
+    trace.status = request_sent_ts;
+    request_transport = transport::mqtt;
+    return true;
 }
-
-static void ensure_connected() {
-    // if not connected, reconnect
-    if(WiFi.status()!=WL_CONNECTED) {
+static void stage_record(stage s,uint32_t start_ts,uint32_t end_ts) {
+    if(start_ts==0 || end_ts==0) {
+        return;
+    }
+    uint32_t ms = (end_ts-start_ts)/1000;
+    size_t bucket = ms==0?0:32-__builtin_clz(ms);
+    if(bucket>=stage_buckets) {
+        bucket = stage_buckets-1;
+    }
+    ++stage_histogram[(int)s][bucket];
+}
+static void stage_record_trace() {
+    // the current request's stages, once it's done
+    stage_record(stage::wifi,trace.press,trace.ready);
+    stage_record(stage::connect,trace.ready,trace.connected);
+    stage_record(stage::send,trace.connected,request_sent_ts);
+    stage_record(stage::status,request_sent_ts,trace.status);
+    stage_record(stage::total,trace.press,trace.status);
+}
+static void stage_dump() {
+    // csv. the header is each bucket's upper bound in ms
+    Serial.print("stage");
+    for(size_t i = 0;i<stage_buckets-1;++i) {
+        Serial.printf(",%d",(int)(1<<i));
+    }
+    Serial.println(",inf");
+    for(int s = 0;s<(int)stage::count;++s) {
+        Serial.print(stage_names[s]);
+        for(size_t i = 0;i<stage_buckets;++i) {
+            Serial.printf(",%d",(int)stage_histogram[s][i]);
+        }
+        Serial.println();
+    }
+}
+static void post_result(uint32_t ts,feedback_state state) {
+    command_result result = {ts,state};
+    // if loop() is that far behind it won't miss this one
+    xQueueSend(result_queue,&result,0);
+}
+static bool send_command(const command& c) {
+    request_sent_ts = 0;
+    trace = {c.ts,0,0,0};
+    bool sent = do_request(c.index,c.url_index,c.repeat);
+    if(sent) {
+        stage_record_trace();
+    }
+    if(request_sent_ts!=0) {
+        // it went out, even if it then failed
+        latency_stat& stat = press_latency[(int)request_transport];
+        ++stat.count;
+        stat.total+=request_sent_ts-c.ts;
+        Serial.printf("Press to send: bridge %dus, upnp %dus, udp %dus, mqtt %dus (avg)\n",
+            (int)(press_latency[0].count?press_latency[0].total/press_latency[0].count:0),
+            (int)(press_latency[1].count?press_latency[1].total/press_latency[1].count:0),
+            (int)(press_latency[2].count?press_latency[2].total/press_latency[2].count:0),
+            (int)(press_latency[3].count?press_latency[3].total/press_latency[3].count:0));
+    }
+    if(!sent) {
+        return false;
+    }
+    if(c.index<speaker_count && room_states!=nullptr) {
+        // whatever we had for the room is probably wrong now
+        room_state_expire(c.index);
+    }
+    uint32_t latency = request_send_ts-c.ts;
+    command_record_sent(&command_totals,latency);
+    Serial.printf("Queue depth: %d (max %d, dropped %d), queued to send: %dus (avg %dus, max %dus)\n",
+        (int)command_queue_depth(&queued_commands),
+        (int)queued_commands.max_depth,
+        (int)queued_commands.dropped,
+        (int)latency,
+        (int)(command_totals.latency_total/command_totals.sent),
+        (int)command_totals.latency_max);
+    return true;
+}
+static void held_expire() {
+    uint32_t latest_ts;
+    if(command_held_expire(&held,micros(),OFFLINE_COMMAND_MAX_AGE_MS,&latest_ts)) {
+        // the latest press is among them
+        post_result(latest_ts,feedback_state::failed);
+    }
+}
+static size_t send_burst(const command* cmds,size_t count,bool* ok) {
+    // pipeline a run of bridge commands for the same host
+    // down one connection, then read all the responses.
+    // returns how many commands it took care of
+    char host[128];
+    char run_host[128];
+    uint16_t port = 0;
+    uint16_t run_port;
+    bool secure = false;
+    bool run_secure;
+    const char* path;
+    size_t run = 0;
+    int total = 0;
+    for(;run<count;++run) {
+        const command& c = cmds[run];
+        const char* fmt = string_for_index(format_urls,c.url_index);
+        if(c.index>=speaker_count ||
+                0==strncmp(fmt,"upnp:",5) ||
+                nullptr!=strchr(fmt,'|') ||
+                !parse_url(url_for(zone_route(c.index,c.url_index),c.url_index),run_host,sizeof(run_host),&run_port,&path,&run_secure)) {
+            break;
+        }
+        if(run==0) {
+            strcpy(host,run_host);
+            port = run_port;
+            secure = run_secure;
+        } else if(run_port!=port || run_secure!=secure || 0!=strcmp(run_host,host)) {
+            break;
+        }
+        total+=c.repeat;
+    }
+    if(run<2) {
+        // nothing to gain. send them the usual way
+        return 0;
+    }
+    // the stages run from the oldest press in the burst
+    request_sent_ts = 0;
+    trace = {cmds[0].ts,0,0,0};
+    if(!ensure_connected()) {
+        return 0;
+    }
+    uint32_t start_ts = micros();
+    int remaining = total;
+    // if the warm connection was dropped out from under us
+    // before anything came back, reconnect once and resend
+    for(int tries = 0;tries<2 && remaining==total;++tries) {
+        uint32_t reused = http_reused;
+        http_conn* conn = http_acquire(host,port,secure);
+        if(conn==nullptr) {
+            break;
+        }
+        trace.connected = micros();
+        bool written = true;
+        for(size_t i = 0;i<run && written;++i) {
+            // url_for() may share its buffer, so parse each again
+            int index = zone_route(cmds[i].index,cmds[i].url_index);
+            if(tries==0 && index!=cmds[i].index) {
+                ++zones_routed;
+            }
+            parse_url(url_for(index,cmds[i].url_index),run_host,sizeof(run_host),&run_port,&path,&run_secure);
+            written = http_send(conn,host,path,cmds[i].repeat);
+        }
+        request_sent_ts = micros();
+        request_transport = transport::bridge;
+        while(written && remaining>0) {
+            int status = http_read_response(conn,nullptr,0);
+            if(status<0) {
+                break;
+            }
+            trace.status = micros();
+            if(status>=400) {
+                Serial.printf("Bridge returned %d\n",status);
+            }
+            --remaining;
+        }
+        conn->used_ts = millis();
+        if(remaining==0 || reused==http_reused) {
+            break;
+        }
+        conn->client.stop();
+    }
+    if(remaining==0) {
+        command_totals.sent+=run;
+        stage_record_trace();
+    }
+    *ok = remaining==0;
+    Serial.printf("Sent %d held requests to %s in one burst in %dus (%d failed)\n",
+        total,
+        host,
+        (int)(micros()-start_ts),
+        remaining);
+    return run;
+}
+static void held_flush() {
+    // take them all so that new presses
+    // don't get mixed in while we're sending
+    static command batch[command_queue_size];
+    size_t count = held.count;
+    memcpy(batch,held.items,count*sizeof(command));
+    held.count = 0;
+    uint32_t last_ts = batch[count-1].ts;
+    count = coalesce_commands(batch,count,url_kinds,&command_totals);
+    bool result = true;
+    size_t i = 0;
+    while(i<count) {
+        bool ok;
+        size_t sent = send_burst(batch+i,count-i,&ok);
+        if(sent==0) {
+            ok = send_command(batch[i]);
+            sent = 1;
+        }
+        result = ok && result;
+        i+=sent;
+    }
+    post_result(last_ts,result?feedback_state::sent:feedback_state::failed);
+    Serial.printf("Held commands dropped: %d expired, %d superseded, %d overflowed\n",
+        (int)held.expired,
+        (int)held.superseded,
+        (int)held.overflowed);
+}
+static void held_update() {
+    held_expire();
+    if(held.count==0) {
+        return;
+    }
+    if(wifi.status!=wifi_state::connected) {
+        // (re)ask for the connection, in case we lost it
+        wifi.requested = true;
+        return;
+    }
+    net_busy = true;
+    held_flush();
+    net_busy = false;
+}
+static void net_task(void* state) {
+    static command batch[command_queue_size];
+    command cmd;
+#ifdef HTTP_BENCHMARK_URL
+    if(ensure_connected()) {
+        http_benchmark();
+    }
+#endif
+    while(true) {
+        // peek first so net_pending() never sees an empty
+        // queue before we've flagged ourselves busy. while
+        // we're holding commands we check the connection often
+        if(!command_queue_peek(&queued_commands,&cmd)) {
+            // queue_command() wakes us early
+            ulTaskNotifyTake(pdTRUE,pdMS_TO_TICKS(held.count>0?10:100));
+            if(command_queue_peek(&queued_commands,&cmd)) {
+                continue;
+            }
+            held_update();
+            // nothing to send so discover in the meantime
+            dns_refresh();
+            endpoint_probe();
+            ssdp_update();
+            gena_update();
+            mqtt_update();
+            zones_update();
+            prefetch_update();
+            continue;
+        }
+        net_busy = true;
+        // a lone press goes straight out. presses that came in
+        // while the last send was in flight are already queued
+        // behind it, and get merged here
+        size_t count = command_take_batch(&queued_commands,batch,command_queue_size);
+        if(held.count>0 || wifi.status!=wifi_state::connected) {
+            // don't wait on the connection. hold them and
+            // send them all together once we have it
+            for(size_t i = 0;i<count;++i) {
+                command_hold(&held,batch[i],url_kinds);
+            }
+            post_result(batch[count-1].ts,feedback_state::held);
+            held_update();
+            net_busy = false;
+            continue;
+        }
+        uint32_t last_ts = batch[count-1].ts;
+        count = coalesce_commands(batch,count,url_kinds,&command_totals);
+        bool result = true;
+        for(size_t i = 0;i<count;++i) {
+            result = send_command(batch[i]) && result;
+        }
+        post_result(last_ts,result?feedback_state::sent:feedback_state::failed);
+        Serial.printf("Coalescing saved %d requests, batched %d skips\n",
+            (int)command_totals.saved,
+            (int)command_totals.batched);
+        net_busy = false;
+    }
+}
+static void wifi_on_event(arduino_event_id_t event,arduino_event_info_t info) {
+    switch(event) {
+        case ARDUINO_EVENT_WIFI_STA_CONNECTED:
+            wifi_assoc_ts = millis();
+            break;
+        case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+            wifi_address_ts = millis();
+            break;
+        default:
+            break;
+    }
+}
+// drives the real radio for the state machine in wifi_link
+struct wifi_radio {
+    bool begin() {
         Serial.printf("Connecting to %s...\n",wifi_ssid);
+        wifi_assoc_ts = 0;
+        wifi_address_ts = 0;
+        wifi_static_ip = false;
+        if(wifi_last.valid) {
+            // go straight to the last access point, and
+            // skip DHCP if our address is recent enough
+            if(time(nullptr)-wifi_last.lease_ts<wifi_lease_secs) {
+                wifi_static_ip = WiFi.config(
+                    wifi_last.address,
+                    wifi_last.gateway,
+                    wifi_last.subnet,
+                    wifi_last.dns);
+            }
+            WiFi.begin(wifi_ssid,wifi_pass,wifi_last.channel,wifi_last.bssid);
+            return true;
+        }
         WiFi.begin(wifi_ssid,wifi_pass);
-        while(WiFi.status()!=WL_CONNECTED) {
-            delay(10);
+        return false;
+    }
+    bool up() {
+        return WiFi.status()==WL_CONNECTED;
+    }
+    void forget() {
+        Serial.println("Fast rejoin failed");
+        WiFi.disconnect();
+        WiFi.config(INADDR_NONE,INADDR_NONE,INADDR_NONE);
+        wifi_last.valid = false;
+    }
+    void give_up(uint32_t retry_ms) {
+        WiFi.disconnect();
+        Serial.printf("Unable to connect. Retrying in %dms\n",(int)retry_ms);
+    }
+    void lost() {
+        Serial.println("Connection lost");
+    }
+    void connected(bool fast,uint32_t outage_ms) {
+        uint32_t ts = millis();
+        uint32_t assoc_ts = wifi_assoc_ts?wifi_assoc_ts:ts;
+        uint32_t address_ts = wifi_address_ts?wifi_address_ts:ts;
+        Serial.printf("Connected (%s) in %dms: associate %dms, address %dms\n",
+            fast?(wifi_static_ip?"fast, static":"fast"):"full",
+            (int)(ts-wifi.start_ts),
+            (int)(assoc_ts-wifi.start_ts),
+            (int)(address_ts>assoc_ts?address_ts-assoc_ts:0));
+        // remember how we got here for next time
+        memcpy(wifi_last.bssid,WiFi.BSSID(),sizeof(wifi_last.bssid));
+        wifi_last.channel = WiFi.channel();
+        wifi_last.address = WiFi.localIP();
+        wifi_last.gateway = WiFi.gatewayIP();
+        wifi_last.subnet = WiFi.subnetMask();
+        wifi_last.dns = WiFi.dnsIP();
+        if(!wifi_static_ip) {
+            wifi_last.lease_ts = time(nullptr);
+        }
+        wifi_last.valid = true;
+        if(outage_ms!=0) {
+            Serial.printf("Offline for %dms (%d times, %dms total, %dms max)\n",
+                (int)outage_ms,
+                (int)wifi.outages,
+                (int)wifi.outage_total_ms,
+                (int)wifi.outage_max_ms);
+        }
+        wifi_fresh = true;
+    }
+};
+static wifi_radio wifi_device;
+static void wifi_update() {
+    wifi_link_update(&wifi,wifi_device,millis());
+}
+static bool ensure_connected() {
+    if(wifi.status!=wifi_state::connected) {
+        // ask loop() to connect us, and wait for it
+        // unless it has already given up
+        wifi.requested = true;
+        while(wifi.status!=wifi_state::connected) {
+            if(wifi.status==wifi_state::offline) {
+                return false;
+            }
+            vTaskDelay(pdMS_TO_TICKS(10));
         }
-        Serial.println("Connected.");
     }
+    if(wifi_fresh) {
+        wifi_fresh = false;
+        dns_prefetch();
+    }
+    if(trace.ready==0) {
+        trace.ready = micros();
+    }
+    return true;
 }
 static void draw_center_text(const char* text) {
     // set up the font
@@ -159,32 +2664,250 @@ static const char* string_for_index(const char* strings,int index) {
     return sz;
 }
 
+static void draw_now_playing() {
+    char text[sizeof(now_playing)];
+    bool active;
+    portENTER_CRITICAL(&now_playing_lock);
+    memcpy(text,now_playing,sizeof(text));
+    active = now_playing_active;
+    now_playing_changed = false;
+    portEXIT_CRITICAL(&now_playing_lock);
+    draw::wait_all_async(lcd);
+    now_playing_buffer.fill(now_playing_buffer.bounds(), bg_color);
+    if(text[0]!=0) {
+        open_text_info oti;
+        oti.font = &speaker_font;
+        oti.text = text;
+        oti.scale = oti.font->scale(now_playing_font_height);
+        ssize16 text_size = oti.font->measure_text(
+            ssize16::max(),
+            spoint16::zero(),
+            oti.text,
+            oti.scale);
+        srect16 text_rect = text_size.bounds();
+        // center it if it fits, otherwise show the start
+        if(text_size.width<now_playing_buffer.dimensions().width) {
+            text_rect.center_horizontal_inplace((srect16)now_playing_buffer.bounds());
+        }
+        // dim it when it's not playing
+        draw::text(now_playing_buffer,text_rect,oti,active?color_t::white:color_t::gray,bg_color);
+    }
+    srect16 bmp_rect(0,0,now_playing_buffer.dimensions().width-1,now_playing_font_height-1);
+    bmp_rect.offset_inplace(0,lcd.bounds().y2-now_playing_font_height-3);
+    draw::bitmap_async(lcd,bmp_rect,now_playing_buffer,now_playing_buffer.bounds());
+}
+static srect16 room_rect() {
+    // where the frame buffer goes on the display
+    srect16 result(0,0,frame_buffer.dimensions().width-1,speaker_font_height-1);
+    result.center_vertical_inplace((srect16)lcd.bounds());
+    result.offset_inplace(0,23);
+    return result;
+}
+static void draw_triangle(int16_t x,int16_t y,int16_t width,int16_t height,bool right,lcd_t::pixel_type color) {
+    // a column at a time, narrowing to the point
+    for(int16_t i = 0;i<width;++i) {
+        int16_t inset = (height/2)*i/width;
+        int16_t cx = right?x+i:x+width-1-i;
+        draw::line(frame_buffer,srect16(cx,y+inset,cx,y+height-1-inset),color);
+    }
+}
+static void draw_feedback_glyph(const srect16& area) {
+    // the indicator says how it's going, the glyph what it was
+    lcd_t::pixel_type color = color_t::yellow;
+    switch(feedback) {
+        case feedback_state::held:
+            color = color_t::orange;
+            break;
+        case feedback_state::sent:
+            color = color_t::green;
+            break;
+        case feedback_state::failed:
+            color = color_t::red;
+            break;
+        default:
+            break;
+    }
+    int16_t h = area.height();
+    srect16 dot(spoint16(area.x1,area.y1+(h-7)/2),ssize16(7,7));
+    draw::filled_ellipse(frame_buffer,dot,color);
+    int16_t x = area.x1+11;
+    switch(feedback_kind) {
+        case command_kind::toggle:
+            draw_triangle(x,area.y1,7,h,true,color_t::white);
+            draw::filled_rectangle(frame_buffer,srect16(x+9,area.y1,x+10,area.y2),color_t::white);
+            draw::filled_rectangle(frame_buffer,srect16(x+13,area.y1,x+14,area.y2),color_t::white);
+            break;
+        case command_kind::next:
+            draw_triangle(x,area.y1,6,h,true,color_t::white);
+            draw_triangle(x+6,area.y1,6,h,true,color_t::white);
+            draw::filled_rectangle(frame_buffer,srect16(x+13,area.y1,x+14,area.y2),color_t::white);
+            break;
+        case command_kind::prev:
+            draw::filled_rectangle(frame_buffer,srect16(x,area.y1,x+1,area.y2),color_t::white);
+            draw_triangle(x+3,area.y1,6,h,false,color_t::white);
+            draw_triangle(x+9,area.y1,6,h,false,color_t::white);
+            break;
+        default:
+            draw::filled_rectangle(frame_buffer,srect16(x+3,area.y1+3,x+11,area.y2-3),color_t::white);
+            break;
+    }
+}
+static srect16 feedback_rect() {
+    // the right end of the room's frame buffer
+    int16_t w = frame_buffer.dimensions().width;
+    return srect16(w-30,(speaker_font_height-15)/2,w-5,(speaker_font_height-15)/2+14);
+}
+static void draw_state_glyph(int index) {
+    // whether the room is playing, from the cache
+    portENTER_CRITICAL(&room_states_lock);
+    room_state entry = room_states[index];
+    portEXIT_CRITICAL(&room_states_lock);
+    bool fresh = room_state_fresh(entry) && entry.state!=playback::unknown;
+    if(index!=room_state_drawn) {
+        // only count switching to a room
+        room_state_drawn = index;
+        if(fresh) {
+            ++room_state_hits;
+        } else {
+            ++room_state_misses;
+        }
+    }
+    if(entry.ts==0 || entry.state==playback::unknown) {
+        return;
+    }
+    // stale is still better than nothing, but dimmer
+    srect16 area = feedback_rect();
+    int16_t x = area.x1+11;
+    int16_t h = area.height();
+    switch(entry.state) {
+        case playback::playing:
+            draw_triangle(x,area.y1,9,h,true,fresh?color_t::green:color_t::gray);
+            break;
+        case playback::paused:
+            draw::filled_rectangle(frame_buffer,srect16(x+1,area.y1,x+3,area.y2),fresh?color_t::white:color_t::gray);
+            draw::filled_rectangle(frame_buffer,srect16(x+6,area.y1,x+8,area.y2),fresh?color_t::white:color_t::gray);
+            break;
+        default:
+            draw::filled_rectangle(frame_buffer,srect16(x,area.y1+3,x+8,area.y2-3),color_t::gray);
+            break;
+    }
+}
+static void draw_feedback() {
+    // just the overlay, so we don't have to lay the room
+    // name out again to get something on the screen
+    srect16 area = feedback_rect();
+    draw::wait_all_async(lcd);
+    frame_buffer.fill((rect16)area,bg_color);
+    draw_feedback_glyph(area);
+    srect16 dst = area.offset(0,room_rect().y1);
+    draw::bitmap_async(lcd,dst,frame_buffer,(rect16)area);
+}
+static void feedback_show(int url_index,uint32_t ts,bool queued) {
+    feedback_kind = url_kinds[url_index];
+    feedback_ts = ts;
+    feedback = queued?feedback_state::pending:feedback_state::failed;
+    feedback_clear_ts = millis()+feedback_hold_ms;
+    draw_feedback();
+    // wait on the transfer so we time the pixels, not the
+    // request to draw them. the next draw waits on it anyway
+    draw::wait_all_async(lcd);
+    uint32_t elapsed = micros()-ts;
+    ++pixel_latency.count;
+    pixel_latency.total+=elapsed;
+    if(elapsed>pixel_latency_max) {
+        pixel_latency_max = elapsed;
+    }
+    Serial.printf("Press to pixel: %dus (avg %dus, max %dus)\n",
+        (int)elapsed,
+        (int)(pixel_latency.total/pixel_latency.count),
+        (int)pixel_latency_max);
+}
+static void feedback_update() {
+    command_result result;
+    while(pdTRUE==xQueueReceive(result_queue,&result,0)) {
+        // only the latest press is on the screen
+        if(feedback==feedback_state::none || result.ts!=feedback_ts) {
+            continue;
+        }
+        feedback = result.state;
+        feedback_clear_ts = millis()+feedback_hold_ms;
+        draw_feedback();
+    }
+    // take the outcome down after a moment. we leave it
+    // up while it's still pending or held
+    if((feedback==feedback_state::sent || feedback==feedback_state::failed) && 
+            (int32_t)(millis()-feedback_clear_ts)>=0) {
+        feedback = feedback_state::none;
+        draw_room(speaker_index);
+    }
+}
 static void draw_room(int index) {
     draw::wait_all_async(lcd);
     // clear the frame buffer
     frame_buffer.fill(frame_buffer.bounds(), bg_color);
-    // get the room string
-    const char* sz = string_for_index(speaker_strings, index);
+    // get the room or group string
+    const char* sz = nullptr;
+    if(index<speaker_count) {
+        sz = string_for_index(speaker_strings, index);
+    } else if(index<speaker_count+group_count) {
+        sz = groups[index-speaker_count].name;
+    }
     // and draw it. Note we are only drawing the text region
-    draw_center_text(sz);
-    srect16 bmp_rect(0,0,frame_buffer.dimensions().width-1,speaker_font_height-1);
-    bmp_rect.center_vertical_inplace((srect16)lcd.bounds());
-    bmp_rect.offset_inplace(0,23);
-    draw::bitmap_async(lcd,bmp_rect,frame_buffer,frame_buffer.bounds());
+    if(sz!=nullptr) {
+        draw_center_text(sz);
+    }
+    if(wifi.status==wifi_state::offline) {
+        // mark the room as unreachable
+        srect16 dot(spoint16(4,(speaker_font_height-9)/2),ssize16(9,9));
+        draw::filled_ellipse(frame_buffer,dot,color_t::red);
+    } else if(index<speaker_count && room_zones!=nullptr) {
+        // a ring if it's grouped, filled in if it runs the group
+        portENTER_CRITICAL(&zones_lock);
+        room_zone zone = room_zones[index];
+        portEXIT_CRITICAL(&zones_lock);
+        if(zone.members>1) {
+            srect16 dot(spoint16(4,(speaker_font_height-9)/2),ssize16(9,9));
+            if(zone.coordinator==index) {
+                draw::filled_ellipse(frame_buffer,dot,color_t::white);
+            } else {
+                draw::ellipse(frame_buffer,dot,color_t::white);
+            }
+        }
+    }
+    if(feedback!=feedback_state::none) {
+        draw_feedback_glyph(feedback_rect());
+    } else if(index<speaker_count && room_states!=nullptr) {
+        draw_state_glyph(index);
+    }
+    draw::bitmap_async(lcd,room_rect(),frame_buffer,frame_buffer.bounds());
 }
-void setup() {
-    char *sz = (char*)malloc(0);
-    sz = strchr("",1);
-    // start everything up
-    Serial.begin(115200);
+static void boot_display() {
     ttgo_initialize();
+}
+static void boot_spiffs() {
     SPIFFS.begin();
-    // set the button callbacks
-    button_b.on_click(button_b_on_click);
-    button_b.on_long_click(button_b_on_long_click);
-    button_a.on_click(button_a_on_click);
+}
+static void boot_wifi_config() {
+    // parse wifi.txt
+    File file = SPIFFS.open("/wifi.txt");
+    String s = file.readStringUntil('\n');
+    s.trim();
+    strcpy(wifi_ssid,s.c_str());
+    s = file.readStringUntil('\n');
+    s.trim();
+    strcpy(wifi_pass,s.c_str());
+    file.close();
+}
+static void boot_wifi() {
+    // time the connect phases
+    WiFi.onEvent(wifi_on_event);
+    // start connecting now so we're likely
+    // online by the time the user presses
+    wifi_link_begin(&wifi,wifi_device,millis());
+}
+static void boot_speakers() {
     // parse speakers.csv into speaker_strings
-    file = SPIFFS.open("/speakers.csv");
+    File file = SPIFFS.open("/speakers.csv");
     String s = file.readStringUntil(',');
     size_t size = 0;
     while(!s.isEmpty()) {
@@ -203,16 +2926,81 @@ void setup() {
                 while(true);
             }
         }
+        speaker_addresses = (uint32_t*)realloc(
+            speaker_addresses,
+            (speaker_count+1)*sizeof(uint32_t));
+        if(speaker_addresses==nullptr) {
+            Serial.println("Out of memory loading speakers");
+            while(true);
+        }
+        // an entry can be room=address to give the
+        // speaker address for upnp: commands
+        speaker_addresses[speaker_count] = 0;
+        int i = s.indexOf('=');
+        if(i>=0) {
+            IPAddress address;
+            String a = s.substring(i+1);
+            a.trim();
+            if(address.fromString(a.c_str())) {
+                speaker_addresses[speaker_count] = address;
+            }
+            s = s.substring(0,i);
+            s.trim();
+        }
         strcpy(speaker_strings+size,s.c_str());
         size+=s.length()+1;
         s = file.readStringUntil(',');
         ++speaker_count;
     }
     file.close();
+}
+static void boot_rooms() {
+    // load the rooms we discovered last time
+    if(!SPIFFS.exists("/rooms")) {
+        return;
+    }
+    File file = SPIFFS.open("/rooms");
+    String s = file.readStringUntil('\n');
+    s.trim();
+    size_t size = 0;
+    const char* sz = speaker_strings;
+    for(int i = 0;i<speaker_count;++i) {
+        size+=strlen(sz)+1;
+        sz+=strlen(sz)+1;
+    }
+    while(!s.isEmpty()) {
+        int i = s.indexOf('=');
+        IPAddress address;
+        if(i>0 && address.fromString(s.substring(i+1).c_str())) {
+            String name = s.substring(0,i);
+            int index = speaker_index_for(name.c_str());
+            if(index<0) {
+                // a room that isn't in speakers.csv
+                speaker_strings = (char*)realloc(speaker_strings,size+name.length()+1);
+                speaker_addresses = (uint32_t*)realloc(
+                    speaker_addresses,
+                    (speaker_count+1)*sizeof(uint32_t));
+                if(speaker_strings==nullptr || speaker_addresses==nullptr) {
+                    Serial.println("Out of memory loading rooms");
+                    while(true);
+                }
+                strcpy(speaker_strings+size,name.c_str());
+                size+=name.length()+1;
+                speaker_addresses[speaker_count++] = address;
+            } else {
+                speaker_addresses[index] = address;
+            }
+        }
+        s = file.readStringUntil('\n');
+        s.trim();
+    }
+    file.close();
+}
+static void boot_api() {
     // parse api.txt into our url format strings
-    size = 0;
-    file = SPIFFS.open("/api.txt");
-    s=file.readStringUntil('\n');
+    size_t size = 0;
+    File file = SPIFFS.open("/api.txt");
+    String s=file.readStringUntil('\n');
     s.trim();
     while(!s.isEmpty()) {
         if(format_urls==nullptr) {
@@ -237,31 +3025,249 @@ void setup() {
         s.trim();
     }
     file.close();
-    // parse wifi.txt
-    file = SPIFFS.open("/wifi.txt");
-    s = file.readStringUntil('\n');
-    s.trim();
-    strcpy(wifi_ssid,s.c_str());
-    s = file.readStringUntil('\n');
+    // so coalescing doesn't have to parse the urls
+    url_kinds = (command_kind*)malloc(format_url_count*sizeof(command_kind)+1);
+    if(url_kinds==nullptr) {
+        Serial.println("Out of memory loading API urls");
+        while(true);
+    }
+    const char* sz = format_urls;
+    for(int i = 0;i<format_url_count;++i) {
+        url_kinds[i]=kind_for_url(sz);
+        sz+=strlen(sz)+1;
+    }
+}
+static int speaker_index_for(const char* name) {
+    const char* sz = speaker_strings;
+    for(int i = 0;i<speaker_count;++i) {
+        if(0==strcmp(sz,name)) {
+            return i;
+        }
+        sz+=strlen(sz)+1;
+    }
+    return -1;
+}
+static void boot_groups() {
+    // parse groups.csv. each line is a name,
+    // a colon, and a comma separated room list
+    if(!SPIFFS.exists("/groups.csv")) {
+        return;
+    }
+    File file = SPIFFS.open("/groups.csv");
+    String s = file.readStringUntil('\n');
     s.trim();
-    strcpy(wifi_pass,s.c_str());
+    while(!s.isEmpty()) {
+        int i = s.indexOf(':');
+        if(i>0) {
+            groups = (room_group*)realloc(groups,(group_count+1)*sizeof(room_group));
+            if(groups==nullptr) {
+                Serial.println("Out of memory loading groups");
+                while(true);
+            }
+            room_group& group = groups[group_count++];
+            String name = s.substring(0,i);
+            name.trim();
+            strncpy(group.name,name.c_str(),sizeof(group.name)-1);
+            group.name[sizeof(group.name)-1]=0;
+            group.count = 0;
+            while(i>=0 && i<s.length()) {
+                int j = s.indexOf(',',i+1);
+                String room = s.substring(i+1,j<0?s.length():j);
+                room.trim();
+                int index = speaker_index_for(room.c_str());
+                if(index<0) {
+                    Serial.printf("Group %s: unknown room %s\n",group.name,room.c_str());
+                } else if(group.count<group_max_rooms) {
+                    group.members[group.count++]=index;
+                }
+                i = j;
+            }
+        }
+        s = file.readStringUntil('\n');
+        s.trim();
+    }
+    file.close();
+}
+static void boot_params() {
+    // name=value lines for the {volume} and {fav}
+    // placeholders. the values are encoded once, here
+    if(!SPIFFS.exists("/params.txt")) {
+        return;
+    }
+    File file = SPIFFS.open("/params.txt");
+    String s=file.readStringUntil('\n');
+    while(!s.isEmpty() || file.available()) {
+        s.trim();
+        int i = s.indexOf('=');
+        if(i>0) {
+            String name = s.substring(0,i);
+            name.trim();
+            String value = s.substring(i+1);
+            value.trim();
+            for(int j = 1;j<(int)url_param::count;++j) {
+                if((url_param)j!=url_param::room && 0==strcmp(name.c_str(),url_param_names[j])) {
+                    size_t size = value.length()*3+1;
+                    char* encoded = (char*)malloc(size);
+                    if(encoded==nullptr) {
+                        Serial.println("Out of memory loading params");
+                        while(true);
+                    }
+                    url_encode_into(value.c_str(),encoded,size);
+                    free(url_params[j]);
+                    url_params[j] = encoded;
+                }
+            }
+        }
+        s = file.readStringUntil('\n');
+    }
     file.close();
+}
+static void boot_mqtt() {
+    // the broker keeps our session under this, so it
+    // mustn't change from one wake to the next
+    snprintf(mqtt_client_id,sizeof(mqtt_client_id),"ttgo-sonos-%012llx",
+        (unsigned long long)(ESP.getEfuseMac()&0xFFFFFFFFFFFFULL));
+    const char* fmt = format_urls;
+    for(int i = 0;i<format_url_count;++i) {
+        char host[sizeof(mqtt_api_host)];
+        uint16_t port;
+        const char* path;
+        if(parse_mqtt_url(fmt,host,sizeof(host),&port,&path)) {
+            strcpy(mqtt_api_host,host);
+            mqtt_api_port = port;
+            break;
+        }
+        fmt+=strlen(fmt)+1;
+    }
+    if(!SPIFFS.exists("/mqtt.txt")) {
+        return;
+    }
+    // name=value lines. client= overrides the id and
+    // state= is the topic for what's playing
+    File file = SPIFFS.open("/mqtt.txt");
+    String s=file.readStringUntil('\n');
+    while(!s.isEmpty() || file.available()) {
+        s.trim();
+        int i = s.indexOf('=');
+        if(i>0) {
+            String name = s.substring(0,i);
+            name.trim();
+            String value = s.substring(i+1);
+            value.trim();
+            if(name=="client" && !value.isEmpty()) {
+                strncpy(mqtt_client_id,value.c_str(),sizeof(mqtt_client_id)-1);
+                mqtt_client_id[sizeof(mqtt_client_id)-1]=0;
+            } else if(name=="state") {
+                const char* path;
+                if(!parse_mqtt_url(value.c_str(),mqtt_state_host,sizeof(mqtt_state_host),&mqtt_state_port,&path)) {
+                    Serial.printf("Bad MQTT state url %s\n",value.c_str());
+                } else {
+                    // split the topic around the room
+                    const char* topic = path+1;
+                    const char* room = strstr(topic,"{room}");
+                    size_t prefix_len = room!=nullptr?room-topic:strlen(topic);
+                    const char* suffix = room!=nullptr?room+6:"";
+                    mqtt_state_room = room!=nullptr;
+                    if(prefix_len<sizeof(mqtt_state_prefix) && strlen(suffix)<sizeof(mqtt_state_suffix)) {
+                        memcpy(mqtt_state_prefix,topic,prefix_len);
+                        mqtt_state_prefix[prefix_len]=0;
+                        strcpy(mqtt_state_suffix,suffix);
+                    } else {
+                        Serial.printf("MQTT state topic too long: %s\n",topic);
+                        mqtt_state_host[0]=0;
+                    }
+                }
+            }
+        }
+        s = file.readStringUntil('\n');
+    }
+    file.close();
+    if(mqtt_state_host[0]!=0 && speaker_count>0) {
+        char* titles = (char*)calloc(speaker_count,mqtt_title_size);
+        if(titles==nullptr) {
+            Serial.println("Out of memory loading MQTT settings");
+            while(true);
+        }
+        // the state topic with + for the room, which we
+        // subscribe to whenever the broker's lost our session
+        snprintf(mqtt.filter,sizeof(mqtt.filter),"%s%s%s",
+            mqtt_state_prefix,
+            mqtt_state_room?"+":"",
+            mqtt_state_suffix);
+        strcpy(mqtt.subscribe_host,mqtt_state_host);
+        mqtt.subscribe_port = mqtt_state_port;
+        // the network task starts watching once this is set
+        mqtt_titles = titles;
+    }
+}
+static void boot_zones() {
+    // a slot per room for how the bridge has them grouped
+    // and what they're playing, and where to ask: the first
+    // bridge in api.txt
+    if(speaker_count==0) {
+        return;
+    }
+    room_zone* zones = (room_zone*)malloc(speaker_count*2*sizeof(room_zone));
+    if(zones==nullptr) {
+        Serial.println("Out of memory allocating zones");
+        while(true);
+    }
+    for(int i = 0;i<speaker_count;++i) {
+        zones[i].coordinator = -1;
+        zones[i].members = 1;
+    }
+    zones_next = zones+speaker_count;
+    room_state* states = (room_state*)calloc(speaker_count,sizeof(room_state));
+    if(states==nullptr) {
+        Serial.println("Out of memory allocating room states");
+        while(true);
+    }
+    const char* fmt = format_urls;
+    for(int i = 0;i<format_url_count;++i) {
+        char host[128];
+        uint16_t port;
+        const char* path;
+        bool secure;
+        if(parse_url(fmt,host,sizeof(host),&port,&path,&secure)) {
+            snprintf(bridge_url,sizeof(bridge_url),"%s://%s:%d",
+                secure?"https":"http",
+                host,
+                (int)port);
+            snprintf(zones_url,sizeof(zones_url),"%s/zones",bridge_url);
+            break;
+        }
+        fmt+=strlen(fmt)+1;
+    }
+    // the network task starts using them once these are set
+    room_states = states;
+    room_zones = zones;
+}
+static void boot_url_table() {
+    // compile our urls, and render them all now
+    // so a press is just a lookup
+    compile_url_templates();
+    build_url_table();
+    build_soap_requests();
+}
+static void boot_state() {
     // when we sleep we store the last room
     // so we can boot with it. it's written
     // to a /state file so we see if it exists
     // and if so, set the speaker_index to the
     // contents
     if(SPIFFS.exists("/state")) {
-        file = SPIFFS.open("/state","rb");
+        File file = SPIFFS.open("/state","rb");
         file.read(
             (uint8_t*)&speaker_index,
             sizeof(speaker_index));
         file.close();
         // in case /state is stale relative to speakers.csv:
-        if(speaker_index>=speaker_count) {
+        if(speaker_index>=speaker_count+group_count) {
             speaker_index = 0;
         }
     }
+}
+static void boot_logo() {
     // draw logo to screen
     draw::image(lcd,lcd.bounds(),&logo);
     // clear the remainder
@@ -278,19 +3284,174 @@ void setup() {
     for(int i = 0;i<rc;++i) {
         draw::filled_rectangle(lcd,outr[i],bg_color);
     }
-    
+}
+static void boot_room() {
     // initial draw
     draw_room(speaker_index);
 }
+// boot is a small dependency graph. each stage runs on
+// the given core once the stages in its deps have run.
+// stages on the same core run in table order
+enum {
+    boot_stage_display,
+    boot_stage_spiffs,
+    boot_stage_wifi_config,
+    boot_stage_wifi,
+    boot_stage_speakers,
+    boot_stage_rooms,
+    boot_stage_api,
+    boot_stage_params,
+    boot_stage_url_table,
+    boot_stage_groups,
+    boot_stage_zones,
+    boot_stage_mqtt,
+    boot_stage_state,
+    boot_stage_logo,
+    boot_stage_room,
+    boot_stage_count
+};
+struct boot_stage {
+    const char* name;
+    void(*fn)();
+    EventBits_t deps;
+    BaseType_t core;
+    uint32_t start_ts;
+    uint32_t end_ts;
+};
+#define BOOT_DEP(x) (1<<(boot_stage_##x))
+static boot_stage boot_stages[boot_stage_count] = {
+    {"display",boot_display,0,1},
+    {"spiffs",boot_spiffs,0,0},
+    {"wifi config",boot_wifi_config,BOOT_DEP(spiffs),0},
+    {"wifi",boot_wifi,BOOT_DEP(wifi_config),0},
+    {"speakers",boot_speakers,BOOT_DEP(spiffs),0},
+    {"rooms",boot_rooms,BOOT_DEP(speakers),0},
+    {"api",boot_api,BOOT_DEP(spiffs),0},
+    {"params",boot_params,BOOT_DEP(spiffs),0},
+    {"url table",boot_url_table,BOOT_DEP(rooms)|BOOT_DEP(api)|BOOT_DEP(params),0},
+    {"groups",boot_groups,BOOT_DEP(rooms),0},
+    {"zones",boot_zones,BOOT_DEP(rooms)|BOOT_DEP(api),0},
+    {"mqtt",boot_mqtt,BOOT_DEP(rooms)|BOOT_DEP(api),0},
+    {"state",boot_state,BOOT_DEP(groups),0},
+    {"logo",boot_logo,BOOT_DEP(display),1},
+    {"room",boot_room,BOOT_DEP(logo)|BOOT_DEP(state),1}
+};
+static EventGroupHandle_t boot_events = nullptr;
+static void boot_run(BaseType_t core) {
+    for(int i = 0;i<boot_stage_count;++i) {
+        boot_stage& stage = boot_stages[i];
+        if(stage.core!=core) {
+            continue;
+        }
+        if(stage.deps!=0) {
+            xEventGroupWaitBits(boot_events,stage.deps,pdFALSE,pdTRUE,portMAX_DELAY);
+        }
+        stage.start_ts = micros();
+        stage.fn();
+        stage.end_ts = micros();
+        xEventGroupSetBits(boot_events,1<<i);
+    }
+}
+static void boot_task(void* state) {
+    boot_run(0);
+    vTaskDelete(nullptr);
+}
+void setup() {
+    char *sz = (char*)malloc(0);
+    sz = strchr("",1);
+    // start everything up
+    Serial.begin(115200);
+    uint32_t boot_ts = micros();
+    // button presses go into a queue that a task on the
+    // other core drains, so the network never stalls the UI
+    command_queue_init(&queued_commands);
+    command_held_init(&held);
+    wifi_link_init(&wifi);
+    gena_init(&gena,gena_timeout_secs,gena_renew_margin_ms,gena_retry_ms,http_timeout_ms);
+    // the client id is filled in when mqtt.txt is read
+    mqtt_session_init(&mqtt,mqtt_client_id,MQTT_KEEP_ALIVE_SECS);
+    result_queue = xQueueCreate(command_queue_size,sizeof(command_result));
+    rooms_lock = xSemaphoreCreateMutex();
+    if(result_queue==nullptr || rooms_lock==nullptr ||
+            pdPASS!=xTaskCreatePinnedToCore(net_task,"net_task",8192,nullptr,1,&net_task_handle,0)) {
+        Serial.println("Out of memory creating the network task");
+        while(true);
+    }
+    // run the boot stages across both cores. we're on core 1
+    boot_events = xEventGroupCreate();
+    if(boot_events==nullptr || 
+            pdPASS!=xTaskCreatePinnedToCore(boot_task,"boot_task",8192,nullptr,1,nullptr,0)) {
+        Serial.println("Out of memory creating the boot task");
+        while(true);
+    }
+    boot_run(1);
+    xEventGroupWaitBits(boot_events,(1<<boot_stage_count)-1,pdFALSE,pdTRUE,portMAX_DELAY);
+    // report the timeline
+    uint32_t total = micros()-boot_ts;
+    uint32_t serial = 0;
+    for(int i = 0;i<boot_stage_count;++i) {
+        const boot_stage& stage = boot_stages[i];
+        serial+=stage.end_ts-stage.start_ts;
+        Serial.printf("Boot: %-12s core %d %7dus - %7dus (%dus)\n",
+            stage.name,
+            (int)stage.core,
+            (int)(stage.start_ts-boot_ts),
+            (int)(stage.end_ts-boot_ts),
+            (int)(stage.end_ts-stage.start_ts));
+    }
+    Serial.printf("Boot took %dus. Run serially it would take %dus, saving %dus\n",
+        (int)total,
+        (int)serial,
+        (int)serial-(int)total);
+    // set the button callbacks
+    button_b.on_click(button_b_on_click);
+    button_b.on_long_click(button_b_on_long_click);
+    button_a.on_click(button_a_on_click);
+}
 
 void loop() {
     // pump all our objects
     dimmer.update();
     button_a.update();
     button_b.update();
+    // pump the connection, and redraw if
+    // we've gone on or offline
+    bool offline = wifi.status==wifi_state::offline;
+    wifi_update();
+    if(offline!=(wifi.status==wifi_state::offline)) {
+        draw_room(speaker_index);
+    }
+    // let the network task know whether to
+    // keep listening for what's playing
+    ui_dimmed = dimmer.dimmed();
+    if(now_playing_changed) {
+        draw_now_playing();
+    }
+    // only when the current room's group or state changed
+    if(zones_changed || room_state_changed) {
+        zones_changed = false;
+        room_state_changed = false;
+        draw_room(speaker_index);
+    }
+    feedback_update();
+    // 'h' dumps the latency histograms, 'z' clears them
+    if(Serial.available()) {
+        int ch = Serial.read();
+        if(ch=='h') {
+            stage_dump();
+        } else if(ch=='z') {
+            memset(stage_histogram,0,sizeof(stage_histogram));
+        }
+    }
 
-    // if we're faded all the way, sleep
-    if(dimmer.faded()) {
+    // if we're faded all the way, sleep, but
+    // not until any queued commands are sent
+    // unless we can't send them anyway, and never while
+    // /rooms is half written. once we have the lock we
+    // keep it, so no write starts after we check
+    if(dimmer.faded() && 
+            (!net_pending() || wifi.status==wifi_state::offline) &&
+            pdTRUE==xSemaphoreTake(rooms_lock,0)) {
         // write the state
         file = SPIFFS.open("/state","wb",true);
         file.seek(0);
@@ -0,0 +1,82 @@
+#pragma once
+// counts the heap allocations a thread makes, by standing in
+// for malloc and friends. operator new goes through malloc,
+// so C++ allocations are counted too. include it in one file
+// per test. it needs glibc, and can't be used under ASan,
+// which brings its own malloc
+#include <stddef.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#ifdef __GLIBC__
+constexpr static const bool heap_counting = true;
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count,size_t size);
+void* __libc_realloc(void* ptr,size_t size);
+void __libc_free(void* ptr);
+}
+#else
+constexpr static const bool heap_counting = false;
+#endif
+
+// only the thread between heap_watch_begin() and
+// heap_watch_end() is counted, so stub servers on other
+// threads don't muddy the numbers
+static thread_local bool heap_watched = false;
+static size_t heap_allocations = 0;
+static long heap_in_use = 0;
+static long heap_peak = 0;
+
+static inline void heap_watch_begin() {
+    heap_allocations = 0;
+    heap_in_use = 0;
+    heap_peak = 0;
+    heap_watched = true;
+}
+static inline void heap_watch_end() {
+    heap_watched = false;
+}
+
+#ifdef __GLIBC__
+static void heap_added(void* ptr) {
+    if(ptr==nullptr || !heap_watched) {
+        return;
+    }
+    ++heap_allocations;
+    heap_in_use+=(long)malloc_usable_size(ptr);
+    if(heap_in_use>heap_peak) {
+        heap_peak = heap_in_use;
+    }
+}
+static void heap_removed(void* ptr) {
+    if(ptr!=nullptr && heap_watched) {
+        heap_in_use-=(long)malloc_usable_size(ptr);
+    }
+}
+extern "C" void* malloc(size_t size) {
+    void* result = __libc_malloc(size);
+    heap_added(result);
+    return result;
+}
+extern "C" void* calloc(size_t count,size_t size) {
+    void* result = __libc_calloc(count,size);
+    heap_added(result);
+    return result;
+}
+extern "C" void* realloc(void* ptr,size_t size) {
+    long before = ptr==nullptr?0:(long)malloc_usable_size(ptr);
+    void* result = __libc_realloc(ptr,size);
+    if(result!=nullptr || size==0) {
+        if(heap_watched) {
+            heap_in_use-=before;
+        }
+        heap_added(result);
+    }
+    return result;
+}
+extern "C" void free(void* ptr) {
+    heap_removed(ptr);
+    __libc_free(ptr);
+}
+#endif
@@ -0,0 +1,182 @@
+#pragma once
+// what the native tests that talk to stub servers on
+// localhost share: a socket with the parts of Arduino's
+// Client interface lib/ uses, and a TCP server that hands
+// each connection it accepts to the test on a thread of its
+// own. the test supplies http_idle(), as http_pool.hpp asks
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+void http_idle();
+
+// a blocking-connect, non-blocking-read socket. it connects
+// to 127.0.0.1 unless it's given another loopback address
+// (in network order, like IPAddress holds it)
+class socket_client {
+    int m_fd = -1;
+public:
+    bool connect(uint16_t port,uint32_t address = htonl(INADDR_LOOPBACK)) {
+        stop();
+        m_fd = socket(AF_INET,SOCK_STREAM,0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = address;
+        if(0!=::connect(m_fd,(sockaddr*)&addr,sizeof(addr))) {
+            stop();
+            return false;
+        }
+        int one = 1;
+        setsockopt(m_fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+        fcntl(m_fd,F_SETFL,O_NONBLOCK);
+        return true;
+    }
+    size_t write(const uint8_t* buf,size_t size) {
+        size_t written = 0;
+        while(m_fd>=0 && written<size) {
+            ssize_t w = send(m_fd,buf+written,size-written,MSG_NOSIGNAL);
+            if(w<=0) {
+                if(w<0 && errno==EAGAIN) {
+                    http_idle();
+                    continue;
+                }
+                break;
+            }
+            written+=w;
+        }
+        return written;
+    }
+    int read(uint8_t* buf,size_t size) {
+        if(m_fd<0) {
+            return -1;
+        }
+        ssize_t r = recv(m_fd,buf,size,0);
+        return r>0?(int)r:-1;
+    }
+    int read() {
+        uint8_t ch;
+        return read(&ch,1)==1?ch:-1;
+    }
+    int available() {
+        if(m_fd<0) {
+            return 0;
+        }
+        uint8_t buf[256];
+        ssize_t r = recv(m_fd,buf,sizeof(buf),MSG_PEEK);
+        return r>0?(int)r:0;
+    }
+    bool connected() {
+        if(m_fd<0) {
+            return false;
+        }
+        uint8_t ch;
+        ssize_t r = recv(m_fd,&ch,1,MSG_PEEK);
+        return r>0 || (r<0 && errno==EAGAIN);
+    }
+    void stop() {
+        if(m_fd>=0) {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+    ~socket_client() {
+        stop();
+    }
+};
+
+struct stub_server {
+    int fd = -1;
+    // any loopback address, in network order
+    uint32_t address = htonl(INADDR_LOOPBACK);
+    // 0 picks one. after a stop, starting again takes the
+    // same port, so clients see the server come back
+    uint16_t port = 0;
+    std::atomic<int> accepted{0};
+    std::thread thread;
+    // runs for each connection. the socket is closed when
+    // it returns
+    std::function<void(int fd)> serve;
+};
+inline bool stub_start(stub_server* server) {
+    server->fd = socket(AF_INET,SOCK_STREAM,0);
+    int one = 1;
+    setsockopt(server->fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = server->address;
+    addr.sin_port = htons(server->port);
+    if(0!=bind(server->fd,(sockaddr*)&addr,sizeof(addr))) {
+        close(server->fd);
+        server->fd = -1;
+        return false;
+    }
+    socklen_t size = sizeof(addr);
+    getsockname(server->fd,(sockaddr*)&addr,&size);
+    server->port = ntohs(addr.sin_port);
+    listen(server->fd,16);
+    server->thread = std::thread([server]() {
+        while(true) {
+            int fd = accept(server->fd,nullptr,nullptr);
+            if(fd<0) {
+                break;
+            }
+            ++server->accepted;
+            std::thread([server,fd]() {
+                server->serve(fd);
+                close(fd);
+            }).detach();
+        }
+    });
+    return true;
+}
+inline void stub_stop(stub_server* server) {
+    if(server->fd<0) {
+        return;
+    }
+    shutdown(server->fd,SHUT_RDWR);
+    close(server->fd);
+    server->fd = -1;
+    server->thread.join();
+}
+inline bool stub_read_request(int fd,std::string* pending,std::string* request) {
+    // the next HTTP request on the connection, with its body
+    // if it has a Content-Length. pending holds what's been
+    // read past it. false once the client has gone
+    while(true) {
+        size_t end = pending->find("\r\n\r\n");
+        if(end!=std::string::npos) {
+            size_t body = 0;
+            const char* sz = strcasestr(pending->c_str(),"\r\nContent-Length:");
+            if(sz!=nullptr && (size_t)(sz-pending->c_str())<end) {
+                body = (size_t)atol(sz+17);
+            }
+            if(pending->size()>=end+4+body) {
+                *request = pending->substr(0,end+4+body);
+                pending->erase(0,end+4+body);
+                return true;
+            }
+        }
+        char buf[2048];
+        ssize_t r = recv(fd,buf,sizeof(buf),0);
+        if(r<=0) {
+            return false;
+        }
+        pending->append(buf,r);
+    }
+}
+inline void stub_send(int fd,const std::string& data) {
+    send(fd,data.data(),data.size(),MSG_NOSIGNAL);
+}
@@ -0,0 +1,287 @@
+// routing across two stub bridges on localhost. each can be
+// made slow, made to hang after accepting, or shut down, and
+// counts the requests it answers. the transport does what the
+// device's does, minus the connection pool, DNS and TLS. the
+// clock can be moved forward so probes come due without
+// waiting minutes for them
+#include <unity.h>
+#include <http_pool.hpp>
+#include <bridge_endpoints.hpp>
+#include "../socket_stub.hpp"
+#include <chrono>
+
+static std::atomic<uint32_t> skew_ms(0);
+uint32_t http_millis() {
+    using namespace std::chrono;
+    return skew_ms+(uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+void http_idle() {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+// a stub bridge
+struct stub_bridge {
+    stub_server server;
+    std::atomic<int> latency_ms{0};
+    std::atomic<bool> hang{false};
+    std::atomic<int> requests{0};
+};
+static void serve_connection(stub_bridge* bridge,int fd) {
+    std::string pending;
+    std::string request;
+    while(stub_read_request(fd,&pending,&request)) {
+        if(bridge->hang) {
+            // read it and say nothing
+            continue;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(bridge->latency_ms));
+        ++bridge->requests;
+        stub_send(fd,"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nOK");
+    }
+}
+static void bridge_start(stub_bridge* bridge) {
+    // on the port it had before, if it had one
+    bridge->server.serve = [bridge](int fd) {
+        serve_connection(bridge,fd);
+    };
+    TEST_ASSERT_TRUE(stub_start(&bridge->server));
+}
+static void bridge_stop(stub_bridge* bridge) {
+    stub_stop(&bridge->server);
+}
+
+static char buffer[1024];
+
+// the device's transport, minus the pool, DNS and TLS
+struct test_transport {
+    int requests = 0;
+    int probes = 0;
+    int downs = 0;
+    int backs = 0;
+    bool last_failover = false;
+    uint32_t last_deadline = 0;
+    uint32_t now_ms() {
+        return http_millis();
+    }
+    uint32_t now_us() {
+        using namespace std::chrono;
+        return skew_ms*1000+(uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+    bool parse(const char* url,char* host,size_t host_size,uint16_t* port,bool* secure) {
+        unsigned p;
+        if(1!=sscanf(url,"http://127.0.0.1:%u/",&p)) {
+            return false;
+        }
+        snprintf(host,host_size,"127.0.0.1");
+        *port = (uint16_t)p;
+        *secure = false;
+        return true;
+    }
+    bool get(uint16_t port,const char* path,int count,uint32_t deadline) {
+        socket_client client;
+        if(!client.connect(port) ||
+                !http_write_requests(client,buffer,sizeof(buffer),"127.0.0.1",path,count)) {
+            return false;
+        }
+        for(int i = 0;i<count;++i) {
+            if(0>http_read_status(client,buffer,sizeof(buffer),deadline,nullptr,0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    bool request(const char* url,int count,bool failover,uint32_t deadline_ms) {
+        ++requests;
+        last_failover = failover;
+        last_deadline = deadline_ms;
+        char host[64];
+        uint16_t port;
+        bool secure;
+        parse(url,host,sizeof(host),&port,&secure);
+        return get(port,strchr(url+7,'/'),count,failover?deadline_ms:now_ms()+5000);
+    }
+    bool probe(const bridge_endpoint& e,uint32_t deadline_ms) {
+        ++probes;
+        return get(e.port,"/",1,deadline_ms);
+    }
+    void down(const bridge_endpoint& e) {
+        ++downs;
+    }
+    void back(const bridge_endpoint& e) {
+        ++backs;
+    }
+    void failing_over(uint32_t failovers) {
+    }
+};
+
+static stub_bridge first;
+static stub_bridge second;
+static bridge_endpoints table;
+static test_transport transport;
+static char line[256];
+
+static bool send_line(int count = 1) {
+    return endpoints_request(&table,transport,line,count);
+}
+static bridge_endpoint* endpoint_on(const stub_bridge& bridge) {
+    return endpoint_for(&table,"127.0.0.1",bridge.server.port,false);
+}
+
+void setUp(void) {
+    first.server.port = 0;
+    second.server.port = 0;
+    bridge_start(&first);
+    bridge_start(&second);
+    first.latency_ms = 0;
+    second.latency_ms = 0;
+    first.hang = false;
+    second.hang = false;
+    first.requests = 0;
+    second.requests = 0;
+    memset(&table,0,sizeof(table));
+    transport = test_transport();
+    skew_ms = 0;
+    snprintf(line,sizeof(line),"http://127.0.0.1:%d/Kitchen/next|http://127.0.0.1:%d/Kitchen/next",
+        (int)first.server.port,(int)second.server.port);
+}
+void tearDown(void) {
+    bridge_stop(&first);
+    bridge_stop(&second);
+}
+
+static void test_learns_the_fastest() {
+    first.latency_ms = 40;
+    second.latency_ms = 2;
+    // each is timed once, in api.txt order, then the
+    // faster one gets everything
+    for(int i = 0;i<10;++i) {
+        TEST_ASSERT_TRUE(send_line());
+    }
+    TEST_ASSERT_EQUAL_INT(1,first.requests);
+    TEST_ASSERT_EQUAL_INT(9,second.requests);
+    TEST_ASSERT_EQUAL_UINT32(0,table.failovers);
+    TEST_ASSERT_TRUE(transport.last_failover);
+    TEST_ASSERT_GREATER_THAN(endpoint_on(second)->srtt,endpoint_on(first)->srtt);
+}
+static void test_batch_goes_to_one_bridge() {
+    TEST_ASSERT_TRUE(send_line(3));
+    TEST_ASSERT_EQUAL_INT(3,first.requests);
+    TEST_ASSERT_EQUAL_INT(0,second.requests);
+}
+static void test_fails_over_when_down() {
+    // the first is faster, so it's preferred
+    second.latency_ms = 30;
+    for(int i = 0;i<3;++i) {
+        send_line();
+    }
+    TEST_ASSERT_EQUAL_INT(2,first.requests);
+    int before = second.requests;
+    bridge_stop(&first);
+    TEST_ASSERT_TRUE(send_line());
+    TEST_ASSERT_EQUAL_INT(before+1,second.requests);
+    TEST_ASSERT_EQUAL_UINT32(1,table.failovers);
+    TEST_ASSERT_EQUAL_INT(1,transport.downs);
+    TEST_ASSERT_FALSE(endpoint_on(first)->healthy);
+    // now the down one is tried last, so there's no more
+    // failing over, even though it was faster
+    int requests = transport.requests;
+    for(int i = 0;i<5;++i) {
+        TEST_ASSERT_TRUE(send_line());
+    }
+    TEST_ASSERT_EQUAL_INT(requests+5,transport.requests);
+    TEST_ASSERT_EQUAL_UINT32(1,table.failovers);
+    TEST_ASSERT_EQUAL_INT(1,transport.downs);
+}
+static void test_hung_bridge_is_bounded() {
+    // it takes the connection and the request but never
+    // answers. we give it one deadline for the lot
+    first.hang = true;
+    uint32_t start = http_millis();
+    TEST_ASSERT_TRUE(send_line());
+    uint32_t elapsed = http_millis()-start;
+    TEST_ASSERT_EQUAL_INT(1,second.requests);
+    TEST_ASSERT_EQUAL_UINT32(1,table.failovers);
+    TEST_ASSERT_GREATER_OR_EQUAL(endpoint_failover_ms,elapsed);
+    TEST_ASSERT_LESS_THAN(endpoint_failover_ms+500,elapsed);
+    // the second attempt got a deadline of its own
+    TEST_ASSERT_GREATER_OR_EQUAL(start+endpoint_failover_ms*2,transport.last_deadline);
+}
+static void test_all_down() {
+    bridge_stop(&first);
+    bridge_stop(&second);
+    TEST_ASSERT_FALSE(send_line());
+    TEST_ASSERT_EQUAL_INT(2,transport.requests);
+    // there's nowhere to go after the last
+    TEST_ASSERT_EQUAL_UINT32(1,table.failovers);
+    TEST_ASSERT_EQUAL_INT(2,transport.downs);
+}
+static void test_single_bridge_is_not_failover() {
+    snprintf(line,sizeof(line),"http://127.0.0.1:%d/Kitchen/next|",(int)first.server.port);
+    TEST_ASSERT_TRUE(send_line());
+    TEST_ASSERT_FALSE(transport.last_failover);
+    // and a line we can't route has no candidates at all
+    snprintf(line,sizeof(line),"ftp://bridge/|udp://bridge/");
+    TEST_ASSERT_FALSE(send_line());
+    TEST_ASSERT_EQUAL_INT(1,transport.requests);
+}
+static void test_probe_backs_off_and_recovers() {
+    bridge_stop(&first);
+    TEST_ASSERT_TRUE(send_line());
+    bridge_endpoint* e = endpoint_on(first);
+    TEST_ASSERT_FALSE(e->healthy);
+    // nothing's due yet
+    TEST_ASSERT_FALSE(endpoints_probe(&table,transport));
+    skew_ms+=endpoint_probe_min_ms;
+    TEST_ASSERT_TRUE(endpoints_probe(&table,transport));
+    TEST_ASSERT_EQUAL_INT(1,transport.probes);
+    TEST_ASSERT_EQUAL_UINT32(endpoint_probe_min_ms*2,e->probe_backoff_ms);
+    // it waits twice as long before the next one
+    skew_ms+=endpoint_probe_min_ms;
+    TEST_ASSERT_FALSE(endpoints_probe(&table,transport));
+    bridge_start(&first);
+    skew_ms+=endpoint_probe_min_ms;
+    TEST_ASSERT_TRUE(endpoints_probe(&table,transport));
+    TEST_ASSERT_EQUAL_INT(2,transport.probes);
+    TEST_ASSERT_EQUAL_INT(1,transport.backs);
+    TEST_ASSERT_TRUE(e->healthy);
+    TEST_ASSERT_EQUAL_UINT32(endpoint_probe_min_ms,e->probe_backoff_ms);
+    // the probe reached the bridge, not a command
+    TEST_ASSERT_EQUAL_INT(1,first.requests);
+    TEST_ASSERT_FALSE(endpoints_probe(&table,transport));
+}
+static void test_probe_backoff_caps() {
+    bridge_endpoint* e = endpoint_on(first);
+    bridge_stop(&first);
+    endpoint_down(e,http_millis());
+    for(int i = 0;i<12;++i) {
+        skew_ms+=e->probe_backoff_ms;
+        TEST_ASSERT_TRUE(endpoints_probe(&table,transport));
+    }
+    TEST_ASSERT_EQUAL_UINT32(endpoint_probe_max_ms,e->probe_backoff_ms);
+}
+static void test_table_full() {
+    // lines past endpoint_max distinct bridges still go out,
+    // we just don't keep times for them
+    char host[16];
+    for(size_t i = 0;i<endpoint_max;++i) {
+        snprintf(host,sizeof(host),"10.0.0.%d",(int)i);
+        TEST_ASSERT_NOT_NULL(endpoint_for(&table,host,80,false));
+    }
+    TEST_ASSERT_NULL(endpoint_on(first));
+    TEST_ASSERT_TRUE(send_line());
+    TEST_ASSERT_EQUAL_INT(1,first.requests);
+}
+
+int main(int argc,char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_learns_the_fastest);
+    RUN_TEST(test_batch_goes_to_one_bridge);
+    RUN_TEST(test_fails_over_when_down);
+    RUN_TEST(test_hung_bridge_is_bounded);
+    RUN_TEST(test_all_down);
+    RUN_TEST(test_single_bridge_is_not_failover);
+    RUN_TEST(test_probe_backs_off_and_recovers);
+    RUN_TEST(test_probe_backoff_caps);
+    RUN_TEST(test_table_full);
+    return UNITY_END();
+}
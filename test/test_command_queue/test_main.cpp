@@ -0,0 +1,245 @@
+// the press queue and coalescing. the slow server test runs
+// the queue the way the device does, with presses coming in
+// on one thread while another is stuck sending to a bridge
+// that takes its time answering
+#include <unity.h>
+#include <command_queue.hpp>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string.h>
+
+static uint32_t now_us() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// like an api.txt
+static const char* urls[] = {
+    "http://bridge:5005/%s/playpause",
+    "http://bridge:5005/%s/next",
+    "http://bridge:5005/%s/previous",
+    "http://bridge:5005/%s/volume/+1",
+    "upnp:Next"
+};
+constexpr static const int url_toggle = 0;
+constexpr static const int url_next = 1;
+constexpr static const int url_prev = 2;
+constexpr static const int url_volume = 3;
+static command_kind kinds[5];
+
+static command_queue queue;
+static command_stats stats;
+
+static command make(int index,int url_index) {
+    command cmd;
+    cmd.index = index;
+    cmd.url_index = url_index;
+    cmd.ts = now_us();
+    cmd.repeat = 1;
+    return cmd;
+}
+
+void setUp(void) {
+    command_queue_init(&queue);
+    memset(&stats,0,sizeof(stats));
+    for(int i = 0;i<5;++i) {
+        kinds[i]=kind_for_url(urls[i]);
+    }
+}
+void tearDown(void) {
+}
+
+static void test_kind_for_url() {
+    TEST_ASSERT_TRUE(command_kind::toggle==kinds[url_toggle]);
+    TEST_ASSERT_TRUE(command_kind::next==kinds[url_next]);
+    TEST_ASSERT_TRUE(command_kind::prev==kinds[url_prev]);
+    TEST_ASSERT_TRUE(command_kind::other==kinds[url_volume]);
+    TEST_ASSERT_TRUE(command_kind::next==kinds[4]);
+    TEST_ASSERT_TRUE(command_kind::prev==kind_for_url("http://bridge/%s/prev"));
+    TEST_ASSERT_TRUE(command_kind::other==kind_for_url("nothing"));
+}
+static void test_push_pop_in_order() {
+    command cmd;
+    TEST_ASSERT_FALSE(command_queue_peek(&queue,&cmd));
+    for(int i = 0;i<3;++i) {
+        TEST_ASSERT_TRUE(command_queue_push(&queue,make(i,url_next)));
+    }
+    TEST_ASSERT_EQUAL_INT(3,(int)command_queue_depth(&queue));
+    TEST_ASSERT_TRUE(command_queue_peek(&queue,&cmd));
+    TEST_ASSERT_EQUAL_INT(0,cmd.index);
+    // peeking doesn't take it
+    TEST_ASSERT_EQUAL_INT(3,(int)command_queue_depth(&queue));
+    for(int i = 0;i<3;++i) {
+        TEST_ASSERT_TRUE(command_queue_pop(&queue,&cmd));
+        TEST_ASSERT_EQUAL_INT(i,cmd.index);
+    }
+    TEST_ASSERT_FALSE(command_queue_pop(&queue,&cmd));
+    TEST_ASSERT_EQUAL_UINT32(3,queue.max_depth);
+}
+static void test_full_queue_drops() {
+    for(size_t i = 0;i<command_queue_size;++i) {
+        TEST_ASSERT_TRUE(command_queue_push(&queue,make((int)i,url_next)));
+    }
+    TEST_ASSERT_FALSE(command_queue_push(&queue,make(99,url_next)));
+    TEST_ASSERT_EQUAL_UINT32(1,queue.dropped);
+    TEST_ASSERT_EQUAL_UINT32(command_queue_size,queue.max_depth);
+    // and it wraps around once there's room again
+    command batch[command_queue_size];
+    TEST_ASSERT_EQUAL_INT(command_queue_size,(int)command_take_batch(&queue,batch,command_queue_size));
+    TEST_ASSERT_EQUAL_INT((int)command_queue_size-1,batch[command_queue_size-1].index);
+    TEST_ASSERT_TRUE(command_queue_push(&queue,make(7,url_next)));
+    command cmd;
+    TEST_ASSERT_TRUE(command_queue_pop(&queue,&cmd));
+    TEST_ASSERT_EQUAL_INT(7,cmd.index);
+}
+static void test_coalesce_toggle_pair() {
+    command cmds[] = {make(0,url_toggle),make(0,url_toggle),make(1,url_toggle)};
+    TEST_ASSERT_EQUAL_INT(1,(int)coalesce_commands(cmds,3,kinds,&stats));
+    TEST_ASSERT_EQUAL_INT(1,cmds[0].index);
+    TEST_ASSERT_EQUAL_UINT32(2,stats.saved);
+}
+static void test_coalesce_batches_skips() {
+    command cmds[] = {make(0,url_next),make(0,url_next),make(0,url_next),make(0,url_volume)};
+    TEST_ASSERT_EQUAL_INT(2,(int)coalesce_commands(cmds,4,kinds,&stats));
+    TEST_ASSERT_EQUAL_INT(url_next,cmds[0].url_index);
+    TEST_ASSERT_EQUAL_INT(3,cmds[0].repeat);
+    TEST_ASSERT_EQUAL_INT(url_volume,cmds[1].url_index);
+    TEST_ASSERT_EQUAL_UINT32(2,stats.batched);
+}
+static void test_coalesce_next_prev_cancel() {
+    command cmds[] = {make(0,url_next),make(0,url_next),make(0,url_prev),make(1,url_prev)};
+    TEST_ASSERT_EQUAL_INT(2,(int)coalesce_commands(cmds,4,kinds,&stats));
+    TEST_ASSERT_EQUAL_INT(1,cmds[0].repeat);
+    TEST_ASSERT_EQUAL_INT(1,cmds[1].index);
+    TEST_ASSERT_EQUAL_UINT32(2,stats.saved);
+}
+static void test_coalesce_other_rooms_untouched() {
+    command cmds[] = {make(0,url_next),make(1,url_next),make(0,url_volume),make(0,url_volume)};
+    TEST_ASSERT_EQUAL_INT(4,(int)coalesce_commands(cmds,4,kinds,&stats));
+    TEST_ASSERT_EQUAL_UINT32(0,stats.saved);
+    TEST_ASSERT_EQUAL_UINT32(0,stats.batched);
+}
+static void test_held_keeps_latest_toggle() {
+    command_held held;
+    command_held_init(&held);
+    command_hold(&held,make(0,url_toggle),kinds);
+    command_hold(&held,make(1,url_toggle),kinds);
+    command_hold(&held,make(0,url_next),kinds);
+    command last = make(0,url_toggle);
+    command_hold(&held,last,kinds);
+    TEST_ASSERT_EQUAL_INT(3,(int)held.count);
+    TEST_ASSERT_EQUAL_UINT32(1,held.superseded);
+    TEST_ASSERT_EQUAL_INT(1,held.items[0].index);
+    TEST_ASSERT_EQUAL_INT(url_next,held.items[1].url_index);
+    TEST_ASSERT_EQUAL_UINT32(last.ts,held.items[2].ts);
+}
+static void test_held_overflow_drops_oldest() {
+    command_held held;
+    command_held_init(&held);
+    for(int i = 0;i<(int)command_queue_size+2;++i) {
+        command_hold(&held,make(i,url_next),kinds);
+    }
+    TEST_ASSERT_EQUAL_INT((int)command_queue_size,(int)held.count);
+    TEST_ASSERT_EQUAL_UINT32(2,held.overflowed);
+    TEST_ASSERT_EQUAL_INT(2,held.items[0].index);
+    TEST_ASSERT_EQUAL_INT((int)command_queue_size+1,held.items[command_queue_size-1].index);
+}
+static void test_held_expire() {
+    command_held held;
+    command_held_init(&held);
+    command old = make(0,url_next);
+    old.ts-=40*1000*1000;
+    command_hold(&held,old,kinds);
+    command_hold(&held,make(1,url_next),kinds);
+    uint32_t latest_ts = 0;
+    TEST_ASSERT_FALSE(command_held_expire(&held,now_us(),30*1000,&latest_ts));
+    TEST_ASSERT_EQUAL_INT(1,(int)held.count);
+    TEST_ASSERT_EQUAL_INT(1,held.items[0].index);
+    TEST_ASSERT_EQUAL_UINT32(1,held.expired);
+    // once the latest one goes too, it has failed
+    uint32_t ts = held.items[0].ts;
+    TEST_ASSERT_TRUE(command_held_expire(&held,ts+31*1000*1000,30*1000,&latest_ts));
+    TEST_ASSERT_EQUAL_INT(0,(int)held.count);
+    TEST_ASSERT_EQUAL_UINT32(ts,latest_ts);
+    // and nothing left is nothing to report
+    TEST_ASSERT_FALSE(command_held_expire(&held,ts+62*1000*1000,30*1000,&latest_ts));
+}
+static void test_slow_server() {
+    // each request takes this long, like a bridge that's
+    // slow to answer, and we press faster than that
+    const int server_ms = 100;
+    const int press_ms = 20;
+    const int presses = 15;
+    std::atomic<bool> done(false);
+    std::atomic<int> requests(0);
+    std::atomic<int> skips(0);
+    std::atomic<int> batches(0);
+    // the network task
+    std::thread consumer([&]() {
+        command batch[command_queue_size];
+        while(true) {
+            command cmd;
+            if(!command_queue_peek(&queue,&cmd)) {
+                if(done) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            size_t count = command_take_batch(&queue,batch,command_queue_size);
+            count = coalesce_commands(batch,count,kinds,&stats);
+            ++batches;
+            for(size_t i = 0;i<count;++i) {
+                command_record_sent(&stats,now_us()-batch[i].ts);
+                std::this_thread::sleep_for(std::chrono::milliseconds(server_ms));
+                ++requests;
+                skips+=batch[i].repeat;
+            }
+        }
+    });
+    // loop(), pressing next over and over
+    uint32_t push_max = 0;
+    for(int i = 0;i<presses;++i) {
+        uint32_t ts = now_us();
+        TEST_ASSERT_TRUE(command_queue_push(&queue,make(0,url_next)));
+        uint32_t elapsed = now_us()-ts;
+        if(elapsed>push_max) {
+            push_max = elapsed;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(press_ms));
+    }
+    done = true;
+    consumer.join();
+    char msg[128];
+    snprintf(msg,sizeof(msg),"%d presses: %d requests in %d batches, push max %dus, queued to send avg %dus max %dus",
+        presses,(int)requests,(int)batches,(int)push_max,
+        (int)(stats.latency_total/stats.sent),(int)stats.latency_max);
+    TEST_MESSAGE(msg);
+    // the buttons never waited on the bridge
+    TEST_ASSERT_LESS_THAN(1000,push_max);
+    TEST_ASSERT_EQUAL_UINT32(0,queue.dropped);
+    // every press made it, and the ones that piled up behind
+    // a slow request went out as batched skips
+    TEST_ASSERT_EQUAL_INT(presses,(int)skips);
+    TEST_ASSERT_LESS_THAN(presses,(int)requests);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)(presses-requests),stats.batched);
+    TEST_ASSERT_GREATER_THAN(1,queue.max_depth);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)requests,stats.sent);
+}
+
+int main(int argc,char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_kind_for_url);
+    RUN_TEST(test_push_pop_in_order);
+    RUN_TEST(test_full_queue_drops);
+    RUN_TEST(test_coalesce_toggle_pair);
+    RUN_TEST(test_coalesce_batches_skips);
+    RUN_TEST(test_coalesce_next_prev_cancel);
+    RUN_TEST(test_coalesce_other_rooms_untouched);
+    RUN_TEST(test_held_keeps_latest_toggle);
+    RUN_TEST(test_held_overflow_drops_oldest);
+    RUN_TEST(test_held_expire);
+    RUN_TEST(test_slow_server);
+    return UNITY_END();
+}
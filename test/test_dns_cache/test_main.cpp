@@ -0,0 +1,220 @@
+// the dns cache against a stub resolver. .local names go to
+// a simulated mDNS responder that we can silence or move to
+// another address, and which takes its timeout to not answer,
+// like the real one does
+#include <unity.h>
+#include <dns_cache.hpp>
+#include <string>
+#include <map>
+
+static uint32_t now_ms;
+static time_t now_secs;
+
+struct stub_resolver {
+    // what DNS knows
+    std::map<std::string,uint32_t> dns;
+    // what the mDNS responders on the network answer to
+    std::map<std::string,uint32_t> responders;
+    bool responding = true;
+    int lookups = 0;
+    int queries = 0;
+    bool lookup(const char* host,uint32_t* address) {
+        ++lookups;
+        auto it = dns.find(host);
+        if(it==dns.end()) {
+            return false;
+        }
+        *address = it->second;
+        return true;
+    }
+    bool query(const char* host,uint32_t* address) {
+        ++queries;
+        auto it = responders.find(host);
+        if(!responding || it==responders.end()) {
+            // nobody answered before the timeout
+            now_ms+=2000;
+            return false;
+        }
+        now_ms+=5;
+        *address = it->second;
+        return true;
+    }
+};
+
+static dns_cache cache;
+static stub_resolver resolver;
+static uint32_t retry_ts;
+
+static uint32_t resolve(const char* host) {
+    uint32_t address = 0;
+    if(!dns_cache_resolve(&cache,resolver,host,&address,now_secs)) {
+        return 0;
+    }
+    return address;
+}
+
+void setUp(void) {
+    memset(&cache,0,sizeof(cache));
+    resolver = stub_resolver();
+    resolver.dns["bridge.example.com"] = 0x0A00000A;
+    resolver.dns["other.example.com"] = 0x0B00000A;
+    resolver.responders["sonos-bridge.local"] = 0x1400A8C0;
+    now_ms = 0xFFFFFFFF-30000;
+    now_secs = 1700000000;
+    retry_ts = 0;
+}
+void tearDown(void) {
+}
+
+static void test_is_mdns() {
+    TEST_ASSERT_TRUE(dns_is_mdns("bridge.local"));
+    TEST_ASSERT_TRUE(dns_is_mdns("Bridge.LOCAL"));
+    TEST_ASSERT_FALSE(dns_is_mdns(".local"));
+    TEST_ASSERT_FALSE(dns_is_mdns("bridge.localdomain"));
+    TEST_ASSERT_FALSE(dns_is_mdns("bridge"));
+}
+static void test_dns_hit_until_ttl() {
+    TEST_ASSERT_EQUAL_UINT32(0x0A00000A,resolve("bridge.example.com"));
+    TEST_ASSERT_EQUAL_UINT32(0x0A00000A,resolve("bridge.example.com"));
+    TEST_ASSERT_EQUAL_INT(1,resolver.lookups);
+    TEST_ASSERT_EQUAL_UINT32(1,cache.hits);
+    TEST_ASSERT_EQUAL_UINT32(1,cache.misses);
+    // it moves, but we don't notice until the entry expires
+    resolver.dns["bridge.example.com"] = 0x0C00000A;
+    now_secs+=dns_ttl_secs-1;
+    TEST_ASSERT_EQUAL_UINT32(0x0A00000A,resolve("bridge.example.com"));
+    now_secs+=1;
+    TEST_ASSERT_EQUAL_UINT32(0x0C00000A,resolve("bridge.example.com"));
+    TEST_ASSERT_EQUAL_INT(2,resolver.lookups);
+    // and it took the same slot
+    int used = 0;
+    for(const dns_entry& e : cache.entries) {
+        used+=e.host[0]!=0;
+    }
+    TEST_ASSERT_EQUAL_INT(1,used);
+}
+static void test_failed_lookup() {
+    TEST_ASSERT_EQUAL_UINT32(0,resolve("nowhere.example.com"));
+    TEST_ASSERT_EQUAL_UINT32(1,cache.misses);
+    for(const dns_entry& e : cache.entries) {
+        TEST_ASSERT_EQUAL_INT(0,e.host[0]);
+    }
+}
+static void test_invalidate_drops_dns_entry() {
+    resolve("bridge.example.com");
+    dns_cache_invalidate(&cache,"bridge.example.com",now_ms,&retry_ts);
+    resolve("bridge.example.com");
+    TEST_ASSERT_EQUAL_INT(2,resolver.lookups);
+    // nothing to refresh in the background
+    TEST_ASSERT_FALSE(dns_cache_refresh(&cache,resolver,now_ms,&retry_ts));
+}
+static void test_evicts_soonest_expiry() {
+    char host[32];
+    for(size_t i = 0;i<dns_cache_size;++i) {
+        snprintf(host,sizeof(host),"b%d.example.com",(int)i);
+        resolver.dns[host] = (uint32_t)i+1;
+        resolve(host);
+        now_secs+=10;
+    }
+    resolve("other.example.com");
+    // b0 was the oldest, so it went
+    bool found = false;
+    for(const dns_entry& e : cache.entries) {
+        TEST_ASSERT_TRUE(0!=strcmp(e.host,"b0.example.com"));
+        found = found || 0==strcmp(e.host,"other.example.com");
+    }
+    TEST_ASSERT_TRUE(found);
+}
+static void test_long_host_not_cached() {
+    std::string host(80,'a');
+    host+=".example.com";
+    resolver.dns[host] = 0x0D00000A;
+    TEST_ASSERT_EQUAL_UINT32(0x0D00000A,resolve(host.c_str()));
+    TEST_ASSERT_EQUAL_UINT32(0x0D00000A,resolve(host.c_str()));
+    TEST_ASSERT_EQUAL_INT(2,resolver.lookups);
+}
+static void test_mdns_never_expires() {
+    TEST_ASSERT_EQUAL_UINT32(0x1400A8C0,resolve("sonos-bridge.local"));
+    now_secs+=dns_ttl_secs*24;
+    resolver.responding = false;
+    TEST_ASSERT_EQUAL_UINT32(0x1400A8C0,resolve("sonos-bridge.local"));
+    TEST_ASSERT_EQUAL_INT(1,resolver.queries);
+    TEST_ASSERT_EQUAL_INT(0,resolver.lookups);
+}
+static void test_mdns_stale_keeps_answering() {
+    resolve("sonos-bridge.local");
+    // the bridge got a new address and we couldn't connect.
+    // the old one keeps coming back so presses don't wait on
+    // a 2 second query, and the lookup happens in the background
+    resolver.responders["sonos-bridge.local"] = 0x1500A8C0;
+    dns_cache_invalidate(&cache,"sonos-bridge.local",now_ms,&retry_ts);
+    TEST_ASSERT_EQUAL_UINT32(0x1400A8C0,resolve("sonos-bridge.local"));
+    TEST_ASSERT_EQUAL_INT(1,resolver.queries);
+    TEST_ASSERT_TRUE(dns_cache_refresh(&cache,resolver,now_ms,&retry_ts));
+    TEST_ASSERT_EQUAL_INT(2,resolver.queries);
+    TEST_ASSERT_EQUAL_UINT32(0x1500A8C0,resolve("sonos-bridge.local"));
+    // and it's fresh, so there's nothing more to do
+    TEST_ASSERT_FALSE(dns_cache_refresh(&cache,resolver,now_ms,&retry_ts));
+    TEST_ASSERT_EQUAL_INT(2,resolver.queries);
+}
+static void test_mdns_retry_backs_off() {
+    resolve("sonos-bridge.local");
+    resolver.responding = false;
+    dns_cache_invalidate(&cache,"sonos-bridge.local",now_ms,&retry_ts);
+    // the first refresh goes straight away and gets no answer
+    uint32_t start = now_ms;
+    TEST_ASSERT_TRUE(dns_cache_refresh(&cache,resolver,now_ms,&retry_ts));
+    TEST_ASSERT_EQUAL_INT(2,resolver.queries);
+    TEST_ASSERT_EQUAL_UINT32(start+mdns_retry_ms,retry_ts);
+    // and until the retry time, idle passes don't query
+    while((int32_t)(now_ms-retry_ts)<0) {
+        TEST_ASSERT_FALSE(dns_cache_refresh(&cache,resolver,now_ms,&retry_ts));
+        now_ms+=100;
+    }
+    TEST_ASSERT_EQUAL_INT(2,resolver.queries);
+    // the responder is back by then
+    resolver.responding = true;
+    TEST_ASSERT_TRUE(dns_cache_refresh(&cache,resolver,now_ms,&retry_ts));
+    TEST_ASSERT_EQUAL_INT(3,resolver.queries);
+    for(const dns_entry& e : cache.entries) {
+        TEST_ASSERT_FALSE(e.stale);
+    }
+}
+static void test_mdns_refresh_one_per_pass() {
+    resolver.responders["kitchen-bridge.local"] = 0x1600A8C0;
+    resolve("sonos-bridge.local");
+    resolve("kitchen-bridge.local");
+    dns_cache_invalidate(&cache,"sonos-bridge.local",now_ms,&retry_ts);
+    dns_cache_invalidate(&cache,"kitchen-bridge.local",now_ms,&retry_ts);
+    TEST_ASSERT_TRUE(dns_cache_refresh(&cache,resolver,now_ms,&retry_ts));
+    TEST_ASSERT_EQUAL_INT(3,resolver.queries);
+    TEST_ASSERT_TRUE(dns_cache_refresh(&cache,resolver,now_ms,&retry_ts));
+    TEST_ASSERT_EQUAL_INT(4,resolver.queries);
+    TEST_ASSERT_FALSE(dns_cache_refresh(&cache,resolver,now_ms,&retry_ts));
+}
+static void test_mdns_first_query_fails() {
+    resolver.responding = false;
+    uint32_t start = now_ms;
+    TEST_ASSERT_EQUAL_UINT32(0,resolve("sonos-bridge.local"));
+    // it cost the full timeout, and isn't cached
+    TEST_ASSERT_EQUAL_UINT32(start+2000,now_ms);
+    resolver.responding = true;
+    TEST_ASSERT_EQUAL_UINT32(0x1400A8C0,resolve("sonos-bridge.local"));
+    TEST_ASSERT_EQUAL_UINT32(2,cache.misses);
+}
+
+int main(int argc,char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_is_mdns);
+    RUN_TEST(test_dns_hit_until_ttl);
+    RUN_TEST(test_failed_lookup);
+    RUN_TEST(test_invalidate_drops_dns_entry);
+    RUN_TEST(test_evicts_soonest_expiry);
+    RUN_TEST(test_long_host_not_cached);
+    RUN_TEST(test_mdns_never_expires);
+    RUN_TEST(test_mdns_stale_keeps_answering);
+    RUN_TEST(test_mdns_retry_backs_off);
+    RUN_TEST(test_mdns_refresh_one_per_pass);
+    RUN_TEST(test_mdns_first_query_fails);
+    return UNITY_END();
+}
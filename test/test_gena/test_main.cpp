@@ -0,0 +1,415 @@
+// the UPnP event subscription against two stub speakers the
+// way gena_update() drives it: subscribing, renewing, a
+// speaker that forgot us, moving rooms and a speaker that's
+// gone. then NOTIFYs with LastChange escaped the way a
+// speaker escapes it, sent in small pieces so entities and
+// patterns split across reads
+#include <unity.h>
+#include <gena.hpp>
+#include "../socket_stub.hpp"
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+uint32_t http_millis() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+void http_idle() {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+static char buffer[1024];
+
+// a speaker that answers SUBSCRIBE and UNSUBSCRIBE, and
+// keeps what it was sent
+struct stub_speaker {
+    stub_server server;
+    std::mutex lock;
+    std::vector<std::string> requests;
+    std::atomic<int> status{200};
+    // what it says in TIMEOUT
+    std::string timeout = "Second-300";
+    std::atomic<int> sids{0};
+    int index;
+};
+static stub_speaker speakers[2];
+
+static void serve(stub_speaker* speaker,int fd) {
+    std::string pending;
+    std::string request;
+    while(stub_read_request(fd,&pending,&request)) {
+        {
+            std::lock_guard<std::mutex> guard(speaker->lock);
+            speaker->requests.push_back(request);
+        }
+        char head[256];
+        int status = speaker->status;
+        if(status!=200) {
+            snprintf(head,sizeof(head),"HTTP/1.1 %d Precondition Failed\r\nContent-Length: 0\r\n\r\n",status);
+        } else if(0==strncmp(request.c_str(),"UNSUBSCRIBE ",12)) {
+            snprintf(head,sizeof(head),"HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+        } else {
+            // a renewal keeps its id
+            const char* sid = strstr(request.c_str(),"\r\nSID: ");
+            char id[64];
+            if(sid!=nullptr) {
+                snprintf(id,sizeof(id),"%.*s",(int)(strstr(sid+2,"\r\n")-sid-7),sid+7);
+            } else {
+                snprintf(id,sizeof(id),"uuid:RINCON_%d_sub%d",speaker->index,++speaker->sids);
+            }
+            snprintf(head,sizeof(head),
+                "HTTP/1.1 200 OK\r\nSID: %s\r\nTIMEOUT: %s\r\n"
+                "Server: Linux UPnP/1.0 Sonos/70.3-35220 (ZPS1)\r\nContent-Length: 0\r\n\r\n",
+                id,speaker->timeout.c_str());
+        }
+        stub_send(fd,head);
+    }
+}
+static std::vector<std::string> taken(int index) {
+    std::lock_guard<std::mutex> guard(speakers[index].lock);
+    std::vector<std::string> result;
+    result.swap(speakers[index].requests);
+    return result;
+}
+
+static gena_subscription gena;
+// the speakers the way gena_speakers has them
+struct test_speakers {
+    int requests = 0;
+    bool request(int index,const char* method) {
+        ++requests;
+        char host[24];
+        snprintf(host,sizeof(host),"127.0.0.1:%d",(int)speakers[index].server.port);
+        socket_client client;
+        if(!client.connect(speakers[index].server.port)) {
+            return false;
+        }
+        bool result = gena_request(&gena,client,method,"/MediaRenderer/AVTransport/Event",host,
+            "http://127.0.0.1:3400/notify",buffer,sizeof(buffer));
+        client.stop();
+        return result;
+    }
+};
+
+void setUp(void) {
+    gena_init(&gena,300,30*1000,10*1000,1000);
+    for(int i = 0;i<2;++i) {
+        speakers[i].status = 200;
+        speakers[i].timeout = "Second-300";
+        speakers[i].sids = 0;
+        taken(i);
+    }
+}
+void tearDown(void) {
+}
+
+static void test_subscribe() {
+    test_speakers s;
+    uint32_t ts = http_millis();
+    gena_follow(&gena,s,0);
+    std::vector<std::string> sent = taken(0);
+    TEST_ASSERT_EQUAL_INT(1,(int)sent.size());
+    const char* request = sent[0].c_str();
+    TEST_ASSERT_EQUAL_INT(0,strncmp(request,"SUBSCRIBE /MediaRenderer/AVTransport/Event HTTP/1.1\r\n",53));
+    TEST_ASSERT_NOT_NULL(strstr(request,"\r\nCALLBACK: <http://127.0.0.1:3400/notify>\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(request,"\r\nNT: upnp:event\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(request,"\r\nTIMEOUT: Second-300\r\n"));
+    TEST_ASSERT_NULL(strstr(request,"\r\nSID:"));
+    TEST_ASSERT_EQUAL_STRING("uuid:RINCON_0_sub1",gena.sid);
+    TEST_ASSERT_TRUE(gena_showing(&gena,0));
+    TEST_ASSERT_FALSE(gena_showing(&gena,1));
+    // renewed 30 seconds before the 300 run out
+    TEST_ASSERT_GREATER_OR_EQUAL(ts+270*1000,gena.renew_ts);
+    TEST_ASSERT_LESS_OR_EQUAL(http_millis()+270*1000,gena.renew_ts);
+    // and nothing more until then
+    gena_follow(&gena,s,0);
+    TEST_ASSERT_EQUAL_INT(1,s.requests);
+}
+static void test_renew() {
+    test_speakers s;
+    // a speaker can grant less than we asked for
+    speakers[0].timeout = "Second-100";
+    gena_follow(&gena,s,0);
+    taken(0);
+    uint32_t ts = http_millis();
+    TEST_ASSERT_LESS_OR_EQUAL(ts+70*1000,gena.renew_ts);
+    TEST_ASSERT_GREATER_THAN(ts+60*1000,gena.renew_ts);
+    gena.renew_ts = http_millis();
+    gena_follow(&gena,s,0);
+    std::vector<std::string> sent = taken(0);
+    TEST_ASSERT_EQUAL_INT(1,(int)sent.size());
+    const char* request = sent[0].c_str();
+    TEST_ASSERT_NOT_NULL(strstr(request,"\r\nSID: uuid:RINCON_0_sub1\r\n"));
+    TEST_ASSERT_NULL(strstr(request,"\r\nCALLBACK:"));
+    TEST_ASSERT_NULL(strstr(request,"\r\nNT:"));
+    TEST_ASSERT_EQUAL_STRING("uuid:RINCON_0_sub1",gena.sid);
+    // too short to renew 30 seconds early, so at half
+    speakers[0].timeout = "Second-40";
+    gena.renew_ts = http_millis();
+    gena_follow(&gena,s,0);
+    TEST_ASSERT_LESS_OR_EQUAL(http_millis()+20*1000,gena.renew_ts);
+    TEST_ASSERT_GREATER_THAN(http_millis()+10*1000,gena.renew_ts);
+    // and one we can't trust is ours
+    speakers[0].timeout = "Second-infinite";
+    gena.renew_ts = http_millis();
+    gena_follow(&gena,s,0);
+    TEST_ASSERT_GREATER_THAN(http_millis()+260*1000,gena.renew_ts);
+}
+static void test_speaker_forgot() {
+    // a speaker that restarted refuses the renewal, so we
+    // start a new subscription in the same pass
+    test_speakers s;
+    gena_follow(&gena,s,0);
+    taken(0);
+    speakers[0].status = 412;
+    gena.renew_ts = http_millis();
+    gena_follow(&gena,s,0);
+    TEST_ASSERT_EQUAL_INT(412,gena.status);
+    TEST_ASSERT_EQUAL_INT(0,gena.sid[0]);
+    TEST_ASSERT_EQUAL_INT(2,(int)taken(0).size());
+    speakers[0].status = 200;
+    gena.renew_ts = http_millis();
+    gena_follow(&gena,s,0);
+    std::vector<std::string> sent = taken(0);
+    TEST_ASSERT_EQUAL_INT(1,(int)sent.size());
+    TEST_ASSERT_NOT_NULL(strstr(sent[0].c_str(),"\r\nCALLBACK:"));
+    TEST_ASSERT_EQUAL_STRING("uuid:RINCON_0_sub2",gena.sid);
+}
+static void test_move_rooms() {
+    test_speakers s;
+    gena_follow(&gena,s,0);
+    taken(0);
+    gena_follow(&gena,s,1);
+    std::vector<std::string> left = taken(0);
+    TEST_ASSERT_EQUAL_INT(1,(int)left.size());
+    TEST_ASSERT_EQUAL_INT(0,strncmp(left[0].c_str(),"UNSUBSCRIBE ",12));
+    TEST_ASSERT_NOT_NULL(strstr(left[0].c_str(),"\r\nSID: uuid:RINCON_0_sub1\r\n"));
+    TEST_ASSERT_NULL(strstr(left[0].c_str(),"\r\nTIMEOUT:"));
+    std::vector<std::string> joined = taken(1);
+    TEST_ASSERT_EQUAL_INT(1,(int)joined.size());
+    TEST_ASSERT_EQUAL_INT(0,strncmp(joined[0].c_str(),"SUBSCRIBE ",10));
+    TEST_ASSERT_EQUAL_STRING("uuid:RINCON_1_sub1",gena.sid);
+    TEST_ASSERT_TRUE(gena_showing(&gena,1));
+    // the screen dimmed
+    gena_follow(&gena,s,-1);
+    TEST_ASSERT_EQUAL_INT(1,(int)taken(1).size());
+    TEST_ASSERT_EQUAL_INT(0,(int)taken(0).size());
+    TEST_ASSERT_FALSE(gena_showing(&gena,1));
+    TEST_ASSERT_EQUAL_INT(-1,gena.index);
+}
+static void test_speaker_gone() {
+    // we wait a while before trying again
+    test_speakers s;
+    stub_stop(&speakers[0].server);
+    uint32_t ts = http_millis();
+    gena_follow(&gena,s,0);
+    TEST_ASSERT_EQUAL_INT(1,s.requests);
+    TEST_ASSERT_EQUAL_INT(0,gena.sid[0]);
+    TEST_ASSERT_EQUAL_INT(-1,gena.status);
+    TEST_ASSERT_GREATER_OR_EQUAL(ts+10*1000,gena.renew_ts);
+    gena_follow(&gena,s,0);
+    TEST_ASSERT_EQUAL_INT(1,s.requests);
+    // it's back
+    TEST_ASSERT_TRUE(stub_start(&speakers[0].server));
+    gena.renew_ts = http_millis();
+    gena_follow(&gena,s,0);
+    TEST_ASSERT_TRUE(gena_showing(&gena,0));
+    TEST_ASSERT_EQUAL_INT(2,s.requests);
+}
+
+// escaped for XML once
+static std::string escaped(const std::string& text) {
+    std::string result;
+    for(char ch : text) {
+        switch(ch) {
+            case '&': result+="&amp;"; break;
+            case '<': result+="&lt;"; break;
+            case '>': result+="&gt;"; break;
+            case '"': result+="&quot;"; break;
+            default: result+=ch; break;
+        }
+    }
+    return result;
+}
+static std::string didl(const std::string& title,const std::string& artist,const std::string& stream) {
+    return "<DIDL-Lite xmlns:dc=\"http://purl.org/dc/elements/1.1/\" "
+        "xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\" "
+        "xmlns:r=\"urn:schemas-rinconnetworks-com:metadata-1-0/\" "
+        "xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\">"
+        "<item id=\"-1\" parentID=\"-1\" restricted=\"true\">"
+        "<res protocolInfo=\"sonos.com-http:*:audio/mpeg:*\" duration=\"0:04:05\">x-sonos-http:track.mp3</res>"
+        "<r:streamContent>"+escaped(stream)+"</r:streamContent>"
+        "<dc:title>"+escaped(title)+"</dc:title>"
+        "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+        "<dc:creator>"+escaped(artist)+"</dc:creator>"
+        "<upnp:album>Album</upnp:album></item></DIDL-Lite>";
+}
+// a NOTIFY body the way a speaker sends it. the track
+// metadata is escaped into an attribute of LastChange's
+// Event, which is escaped again into the property
+static std::string lastchange(const char* state,const std::string& track,const std::string& next) {
+    std::string event = "<Event xmlns=\"urn:schemas-upnp-org:metadata-1-0/AVT/\" "
+        "xmlns:r=\"urn:schemas-rinconnetworks-com:metadata-1-0/\"><InstanceID val=\"0\">";
+    if(state!=nullptr) {
+        event+=std::string("<TransportState val=\"")+state+"\"/>";
+    }
+    event+="<CurrentPlayMode val=\"NORMAL\"/><NumberOfTracks val=\"12\"/><CurrentTrack val=\"3\"/>";
+    if(!track.empty()) {
+        event+="<CurrentTrackMetaData val=\""+escaped(track)+"\"/>";
+    }
+    if(!next.empty()) {
+        event+="<r:NextTrackMetaData val=\""+escaped(next)+"\"/>";
+    }
+    event+="</InstanceID></Event>";
+    return "<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\"><e:property><LastChange>"+
+        escaped(event)+"</LastChange></e:property></e:propertyset>";
+}
+
+// a speaker sending us a NOTIFY a few bytes at a time
+static stub_server notifier;
+static std::string notify_body;
+static std::string notify_sid;
+static std::atomic<bool> notify_answered{false};
+static void serve_notify(int fd) {
+    char head[256];
+    snprintf(head,sizeof(head),
+        "NOTIFY /notify HTTP/1.1\r\nHOST: 127.0.0.1:3400\r\nCONTENT-TYPE: text/xml\r\n"
+        "Content-Length: %d\r\nNT: upnp:event\r\nNTS: upnp:propchange\r\nSID: %s\r\nSEQ: 0\r\n\r\n",
+        (int)notify_body.size(),notify_sid.c_str());
+    std::string message = head+notify_body;
+    for(size_t i = 0;i<message.size();i+=7) {
+        stub_send(fd,message.substr(i,7));
+        if(i%700==0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+    char answer[128];
+    ssize_t r = recv(fd,answer,sizeof(answer)-1,0);
+    notify_answered = r>0 && 0==strncmp(answer,"HTTP/1.1 200 OK\r\n",17);
+}
+static bool notify(const char* sid,const std::string& body,gena_event* event) {
+    notify_sid = sid;
+    notify_body = body;
+    notify_answered = false;
+    socket_client client;
+    TEST_ASSERT_TRUE(client.connect(notifier.port));
+    bool ours = gena_notify(&gena,client,buffer,sizeof(buffer),event);
+    // the speaker hears back either way
+    for(int i = 0;i<1000 && !notify_answered;++i) {
+        http_idle();
+    }
+    TEST_ASSERT_TRUE(notify_answered.load());
+    return ours;
+}
+
+static void test_notify_track() {
+    strcpy(gena.sid,"uuid:RINCON_0_sub1");
+    gena.index = 0;
+    gena_event event;
+    std::string body = lastchange("PLAYING",
+        didl("Rock & Roll <Live>","Led Zeppelin","")+"",
+        didl("Black Dog","Led Zeppelin",""));
+    // big enough that it takes a few reads of buffer
+    TEST_ASSERT_GREATER_THAN(sizeof(buffer),body.size());
+    TEST_ASSERT_TRUE(notify("uuid:RINCON_0_sub1",body,&event));
+    char text[132] = "what was playing";
+    bool active = false;
+    gena_now_playing(&event,text,sizeof(text),&active);
+    std::string expected = "Rock & Roll <Live> - Led Zeppelin";
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(),text);
+    TEST_ASSERT_TRUE(active);
+}
+static void test_notify_radio() {
+    // the stream's what's playing takes over from the title
+    strcpy(gena.sid,"uuid:RINCON_0_sub1");
+    gena_event event;
+    TEST_ASSERT_TRUE(notify("uuid:RINCON_0_sub1",
+        lastchange("TRANSITIONING",didl("x-sonosapi-stream:s24861","","Bonobo - Kerala"),""),&event));
+    char text[132] = "";
+    bool active = false;
+    gena_now_playing(&event,text,sizeof(text),&active);
+    std::string expected = "Bonobo - Kerala";
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(),text);
+    TEST_ASSERT_TRUE(active);
+}
+static void test_notify_only_state() {
+    // a pause only sends the state, and keeps the track
+    strcpy(gena.sid,"uuid:RINCON_0_sub1");
+    gena_event event;
+    TEST_ASSERT_TRUE(notify("uuid:RINCON_0_sub1",lastchange("PAUSED_PLAYBACK","",""),&event));
+    char text[132] = "So What - Miles Davis";
+    bool active = true;
+    gena_now_playing(&event,text,sizeof(text),&active);
+    std::string expected = "So What - Miles Davis";
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(),text);
+    TEST_ASSERT_FALSE(active);
+}
+static void test_notify_not_ours() {
+    // left over from the room before
+    strcpy(gena.sid,"uuid:RINCON_1_sub1");
+    gena_event event;
+    TEST_ASSERT_FALSE(notify("uuid:RINCON_0_sub1",lastchange("PLAYING","",""),&event));
+    gena.sid[0]=0;
+    TEST_ASSERT_FALSE(notify("uuid:RINCON_0_sub1",lastchange("PLAYING","",""),&event));
+}
+static void test_event_split_anywhere() {
+    // what a speaker sends, fed a byte at a time and whole,
+    // comes out the same
+    std::string body = lastchange("PLAYING",didl("Café & \"Bar\"","A&B",""),"");
+    gena_event whole;
+    gena_event_init(&whole);
+    gena_event_feed(&whole,body.data(),body.size());
+    gena_event split;
+    gena_event_init(&split);
+    for(char ch : body) {
+        gena_event_feed(&split,&ch,1);
+    }
+    char a[132] = "";
+    char b[132] = "";
+    bool active_a = false;
+    bool active_b = false;
+    gena_now_playing(&whole,a,sizeof(a),&active_a);
+    gena_now_playing(&split,b,sizeof(b),&active_b);
+    std::string expected = "Café & \"Bar\" - A&B";
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(),a);
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(),b);
+    TEST_ASSERT_TRUE(active_a && active_b);
+}
+
+int main(int argc,char** argv) {
+    for(int i = 0;i<2;++i) {
+        speakers[i].index = i;
+        stub_speaker* speaker = &speakers[i];
+        speakers[i].server.serve = [speaker](int fd) {
+            serve(speaker,fd);
+        };
+        if(!stub_start(&speakers[i].server)) {
+            return 1;
+        }
+    }
+    notifier.serve = serve_notify;
+    if(!stub_start(&notifier)) {
+        return 1;
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_subscribe);
+    RUN_TEST(test_renew);
+    RUN_TEST(test_speaker_forgot);
+    RUN_TEST(test_move_rooms);
+    RUN_TEST(test_speaker_gone);
+    RUN_TEST(test_notify_track);
+    RUN_TEST(test_notify_radio);
+    RUN_TEST(test_notify_only_state);
+    RUN_TEST(test_notify_not_ours);
+    RUN_TEST(test_event_split_anywhere);
+    int result = UNITY_END();
+    for(int i = 0;i<2;++i) {
+        stub_stop(&speakers[i].server);
+    }
+    stub_stop(&notifier);
+    return result;
+}
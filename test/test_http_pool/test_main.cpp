@@ -0,0 +1,287 @@
+// the keep-alive pool against a stub bridge on localhost. the
+// stub takes a while to answer the first request on each new
+// connection, like a bridge behind a TCP (and maybe TLS)
+// handshake, and answers later ones on it straight away.
+// the last test races the pool against what HTTPClient did
+// for each request before it, on the same stub
+#include <unity.h>
+#include <http_pool.hpp>
+#include "../socket_stub.hpp"
+#include "../heap_count.hpp"
+#include <chrono>
+
+uint32_t http_millis() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+void http_idle() {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+// the stub bridge
+static const int handshake_ms = 20;
+static stub_server server;
+// what node-sonos-http-api sends back for a command
+static const char* ok_response =
+    "HTTP/1.1 200 OK\r\n"
+    "X-Powered-By: Express\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Content-Type: application/json;charset=utf8\r\n"
+    "Content-Length: 20\r\n"
+    "Date: Sat, 01 Jun 2024 12:00:00 GMT\r\n"
+    "Connection: keep-alive\r\n"
+    "Keep-Alive: timeout=5\r\n"
+    "\r\n"
+    "{\"status\":\"success\"}";
+static std::atomic<int> server_requests(0);
+static void serve_connection(int fd) {
+    bool first = true;
+    std::string pending;
+    std::string request;
+    while(stub_read_request(fd,&pending,&request)) {
+        if(first) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(handshake_ms));
+            first = false;
+        }
+        ++server_requests;
+        stub_send(fd,ok_response);
+    }
+}
+
+using test_conn = http_connection<socket_client>;
+constexpr static const size_t pool_size = 2;
+static test_conn pool[pool_size];
+static uint32_t reused;
+static uint32_t opened;
+static char buffer[1024];
+
+// what the device's http_acquire() does, minus DNS and TLS
+static test_conn* acquire(const char* host,uint16_t port) {
+    test_conn* conn = http_pool_find(pool,pool_size,host,port,false);
+    uint32_t ts = http_millis();
+    if(http_pool_reuse(conn,host,port,false,ts,4000)) {
+        ++reused;
+        return conn;
+    }
+    ++opened;
+    if(!conn->client.connect(port)) {
+        return nullptr;
+    }
+    conn->used_ts = ts;
+    return conn;
+}
+static int command(const char* host,bool keep) {
+    test_conn* conn = acquire(host,server.port);
+    if(conn==nullptr || !http_write_requests(conn->client,buffer,sizeof(buffer),host,"/Kitchen/next",1)) {
+        return -1;
+    }
+    int status = http_read_status(conn->client,buffer,sizeof(buffer),http_millis()+1000,nullptr,0);
+    conn->used_ts = http_millis();
+    if(!keep) {
+        conn->client.stop();
+    }
+    return status;
+}
+static void reset_pool() {
+    for(test_conn& c : pool) {
+        c.client.stop();
+        c.host[0]=0;
+        c.port = 0;
+        c.used_ts = 0;
+    }
+    reused = 0;
+    opened = 0;
+}
+
+void setUp(void) {
+    reset_pool();
+}
+void tearDown(void) {
+}
+
+static void test_find_same_host() {
+    test_conn* a = http_pool_find(pool,pool_size,"bridge",5005,false);
+    strcpy(a->host,"bridge");
+    a->port = 5005;
+    TEST_ASSERT_EQUAL_PTR(a,http_pool_find(pool,pool_size,"bridge",5005,false));
+    // a different port or scheme is a different connection
+    TEST_ASSERT_TRUE(a!=http_pool_find(pool,pool_size,"bridge",5006,false));
+    TEST_ASSERT_TRUE(a!=http_pool_find(pool,pool_size,"bridge",5005,true));
+}
+static void test_find_evicts_least_recent() {
+    strcpy(pool[0].host,"a");
+    pool[0].port = 80;
+    pool[0].used_ts = 200;
+    strcpy(pool[1].host,"b");
+    pool[1].port = 80;
+    pool[1].used_ts = 100;
+    TEST_ASSERT_EQUAL_PTR(&pool[1],http_pool_find(pool,pool_size,"c",80,false));
+}
+static void test_reuse_idle_timeout() {
+    test_conn* conn = acquire("127.0.0.1",server.port);
+    TEST_ASSERT_NOT_NULL(conn);
+    TEST_ASSERT_EQUAL_INT(200,command("127.0.0.1",true));
+    uint32_t ts = conn->used_ts;
+    TEST_ASSERT_TRUE(http_pool_reuse(conn,"127.0.0.1",server.port,false,ts+3999,4000));
+    // idled out, so it's closed for reopening
+    TEST_ASSERT_FALSE(http_pool_reuse(conn,"127.0.0.1",server.port,false,ts+4000,4000));
+    TEST_ASSERT_FALSE(conn->client.connected());
+}
+static void test_reopens_dead_connection() {
+    TEST_ASSERT_EQUAL_INT(200,command("127.0.0.1",true));
+    pool[0].client.stop();
+    TEST_ASSERT_EQUAL_INT(200,command("127.0.0.1",true));
+    TEST_ASSERT_EQUAL_UINT32(2,opened);
+    TEST_ASSERT_EQUAL_UINT32(0,reused);
+}
+static void test_pipelined_requests() {
+    test_conn* conn = acquire("127.0.0.1",server.port);
+    TEST_ASSERT_NOT_NULL(conn);
+    int before = server_requests;
+    TEST_ASSERT_TRUE(http_write_requests(conn->client,buffer,sizeof(buffer),"127.0.0.1","/Kitchen/next",3));
+    for(int i = 0;i<3;++i) {
+        TEST_ASSERT_EQUAL_INT(200,http_read_status(conn->client,buffer,sizeof(buffer),http_millis()+1000,nullptr,0));
+    }
+    TEST_ASSERT_EQUAL_INT(before+3,(int)server_requests);
+    TEST_ASSERT_TRUE(conn->client.connected());
+}
+static void test_keep_alive_is_faster() {
+    const int commands = 10;
+    uint32_t start = http_millis();
+    for(int i = 0;i<commands;++i) {
+        TEST_ASSERT_EQUAL_INT(200,command("127.0.0.1",false));
+    }
+    uint32_t fresh_ms = http_millis()-start;
+    TEST_ASSERT_EQUAL_UINT32(commands,opened);
+    reset_pool();
+    start = http_millis();
+    for(int i = 0;i<commands;++i) {
+        TEST_ASSERT_EQUAL_INT(200,command("127.0.0.1",true));
+    }
+    uint32_t warm_ms = http_millis()-start;
+    TEST_ASSERT_EQUAL_UINT32(1,opened);
+    TEST_ASSERT_EQUAL_UINT32(commands-1,reused);
+    char msg[96];
+    snprintf(msg,sizeof(msg),"%d commands: %dms reconnecting, %dms kept alive",
+        commands,(int)fresh_ms,(int)warm_ms);
+    TEST_MESSAGE(msg);
+    // only the first kept alive command pays for the handshake
+    TEST_ASSERT_GREATER_OR_EQUAL(commands*handshake_ms,fresh_ms);
+    TEST_ASSERT_LESS_THAN(fresh_ms/2,warm_ms);
+}
+// what HTTPClient's begin(), GET() and end() did for each
+// command, with setReuse(true): the request is built up in a
+// String, each response header line is read into one, and
+// the body is drained before the connection goes back
+static int httpclient_get(socket_client& client,const char* host,const char* path) {
+    if(!client.connected() && !client.connect(server.port)) {
+        return -1;
+    }
+    std::string request = "GET ";
+    request+=path;
+    request+=" HTTP/1.1\r\nHost: ";
+    request+=host;
+    request+="\r\nUser-Agent: ESP32HTTPClient\r\nConnection: keep-alive\r\n";
+    request+="Accept-Encoding: identity;q=1,chunked;q=0.1,*;q=0\r\n\r\n";
+    if(request.size()!=client.write((const uint8_t*)request.data(),request.size())) {
+        return -1;
+    }
+    int status = -1;
+    long content_length = -1;
+    uint32_t deadline = http_millis()+1000;
+    while(true) {
+        std::string line;
+        while(true) {
+            int i = client.read();
+            if(i<0) {
+                if((int32_t)(http_millis()-deadline)>=0) {
+                    return -1;
+                }
+                http_idle();
+                continue;
+            }
+            if(i=='\n') {
+                break;
+            }
+            line+=(char)i;
+        }
+        if(!line.empty() && line.back()=='\r') {
+            line.pop_back();
+        }
+        if(line.empty()) {
+            break;
+        }
+        if(status<0) {
+            status = atoi(line.substr(9).c_str());
+            continue;
+        }
+        std::string name = line.substr(0,line.find(':'));
+        std::string value = line.substr(line.find(':')+1);
+        if(0==strcasecmp(name.c_str(),"Content-Length")) {
+            content_length = atol(value.c_str());
+        }
+    }
+    std::string body;
+    while((long)body.size()<content_length) {
+        int i = client.read();
+        if(i<0) {
+            http_idle();
+            continue;
+        }
+        body+=(char)i;
+    }
+    return status;
+}
+static void test_compared_with_httpclient() {
+    // warm connections both ways, so what's left is the work
+    // each does per request
+    const int commands = 200;
+    socket_client client;
+    TEST_ASSERT_EQUAL_INT(200,httpclient_get(client,"127.0.0.1","/Kitchen/next"));
+    TEST_ASSERT_EQUAL_INT(200,command("127.0.0.1",true));
+    using namespace std::chrono;
+    heap_watch_begin();
+    auto start = steady_clock::now();
+    for(int i = 0;i<commands;++i) {
+        TEST_ASSERT_EQUAL_INT(200,httpclient_get(client,"127.0.0.1","/Kitchen/next"));
+    }
+    long httpclient_us = (long)duration_cast<microseconds>(steady_clock::now()-start).count();
+    heap_watch_end();
+    size_t httpclient_allocations = heap_allocations;
+    heap_watch_begin();
+    start = steady_clock::now();
+    for(int i = 0;i<commands;++i) {
+        TEST_ASSERT_EQUAL_INT(200,command("127.0.0.1",true));
+    }
+    long pool_us = (long)duration_cast<microseconds>(steady_clock::now()-start).count();
+    heap_watch_end();
+    size_t pool_allocations = heap_allocations;
+    TEST_ASSERT_EQUAL_UINT32(1,opened);
+    char msg[160];
+    snprintf(msg,sizeof(msg),"%d commands: HTTPClient style %ldus/%d allocations per request, pool %ldus/%d allocations per request",
+        commands,
+        httpclient_us/commands,(int)(httpclient_allocations/commands),
+        pool_us/commands,(int)(pool_allocations/commands));
+    TEST_MESSAGE(msg);
+    if(heap_counting) {
+        // the pool's GET never touches the heap
+        TEST_ASSERT_EQUAL_UINT32(0,pool_allocations);
+        TEST_ASSERT_GREATER_OR_EQUAL(commands,httpclient_allocations);
+    }
+}
+
+int main(int argc,char** argv) {
+    server.serve = serve_connection;
+    stub_start(&server);
+    UNITY_BEGIN();
+    RUN_TEST(test_find_same_host);
+    RUN_TEST(test_find_evicts_least_recent);
+    RUN_TEST(test_reuse_idle_timeout);
+    RUN_TEST(test_reopens_dead_connection);
+    RUN_TEST(test_pipelined_requests);
+    RUN_TEST(test_keep_alive_is_faster);
+    RUN_TEST(test_compared_with_httpclient);
+    int result = UNITY_END();
+    stub_stop(&server);
+    return result;
+}
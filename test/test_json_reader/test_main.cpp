@@ -0,0 +1,460 @@
+// the streaming JSON reader against /zones and /state bodies
+// in the shape node-sonos-http-api sends them. the bridge's
+// responses reach us a socket read at a time, split anywhere,
+// so every test feeds them in pieces and expects the same
+// values it gets from the whole document. the benchmark feeds
+// them through a buffer the size of http_buffer and reports
+// the throughput and the memory the reader needed
+#include <unity.h>
+#include <json_reader.hpp>
+#include "../heap_count.hpp"
+#include "../zones_recorded.hpp"
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// runs fn on a thread whose stack we've painted, and returns
+// how many bytes of it were written to. the thread's own
+// bookkeeping sits at the top of the stack too, so compare
+// against a thread that does nothing
+constexpr static const size_t painted_stack_size = 256*1024;
+constexpr static const uint8_t stack_paint = 0xA5;
+static size_t stack_used(void* (*fn)(void*),void* arg) {
+    uint8_t* stack = (uint8_t*)aligned_alloc(4096,painted_stack_size);
+    memset(stack,stack_paint,painted_stack_size);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr,stack,painted_stack_size);
+    pthread_t thread;
+    TEST_ASSERT_EQUAL_INT(0,pthread_create(&thread,&attr,fn,arg));
+    pthread_join(thread,nullptr);
+    pthread_attr_destroy(&attr);
+    // stacks grow down
+    size_t untouched = 0;
+    while(untouched<painted_stack_size && stack[untouched]==stack_paint) {
+        ++untouched;
+    }
+    free(stack);
+    return painted_stack_size-untouched;
+}
+static void* do_nothing(void*) {
+    return nullptr;
+}
+
+static const char* state_body = R"({"volume":23,"mute":false,"equalizer":{"bass":0,"treble":-2,"loudness":true},)"
+    R"("currentTrack":{"artist":"Beyonc\u00e9","title":"Caf\u00e9 \"Live\" \/ Remastered","album":"Kind of Blue",)"
+    R"("albumArtUri":"/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a4vLYewWIvqHfKtJDk8c8tq%3fsid%3d12%26flags%3d8224%26sn%3d1",)"
+    R"("duration":562,"uri":"x-sonos-spotify:spotify%3atrack%3a4vLYewWIvqHfKtJDk8c8tq?sid=12&flags=8224&sn=1",)"
+    R"("trackUri":"x-sonos-spotify:spotify%3atrack%3a4vLYewWIvqHfKtJDk8c8tq?sid=12&flags=8224&sn=1","type":"track","stationName":"",)"
+    R"("absoluteAlbumArtUri":"http://192.168.0.21:1400/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a4vLYewWIvqHfKtJDk8c8tq"},)"
+    R"("nextTrack":{"artist":"Miles Davis","title":"Freddie Freeloader","album":"Kind of Blue","albumArtUri":"","duration":589,"uri":""},)"
+    R"("trackNo":1,"elapsedTime":103,"elapsedTimeFormatted":"00:01:43","playbackState":"PLAYING",)"
+    R"("playMode":{"repeat":"none","shuffle":false,"crossfade":false},"subwoofer":null})";
+
+// a member of a zone, with its own state
+static std::string zones_member(const char* uuid,const char* room,const char* coordinator,const char* playback) {
+    char buf[2048];
+    snprintf(buf,sizeof(buf),
+        R"({"uuid":"%s","state":{"volume":18,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},)"
+        R"("currentTrack":{"artist":"Nils Frahm","title":"Says","album":"Spaces","albumArtUri":"/getaa?s=1&u=x-sonos-http%%3atrack%%253a1.mp3",)"
+        R"("duration":497,"uri":"x-sonos-http:track%%3a1.mp3?sid=204&flags=8224&sn=3","type":"track","stationName":""},)"
+        R"("nextTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":""},)"
+        R"("trackNo":4,"elapsedTime":12,"elapsedTimeFormatted":"00:00:12","playbackState":"%s",)"
+        R"("playMode":{"repeat":"all","shuffle":true,"crossfade":false}},)"
+        R"("roomName":"%s","coordinator":"%s","groupState":{"volume":21,"mute":false}})",
+        uuid,playback,room,coordinator);
+    return buf;
+}
+static std::string zones_zone(const char* coordinator_room,const char* playback,const std::vector<const char*>& rooms) {
+    std::string uuid = std::string("RINCON_")+coordinator_room+"01400";
+    std::string result = "{\"uuid\":\""+uuid+"\",\"coordinator\":";
+    result+=zones_member(uuid.c_str(),coordinator_room,uuid.c_str(),playback);
+    result+=",\"members\":[";
+    for(size_t i = 0;i<rooms.size();++i) {
+        std::string member_uuid = std::string("RINCON_")+rooms[i]+"01400";
+        if(i>0) {
+            result+=",";
+        }
+        result+=zones_member(member_uuid.c_str(),rooms[i],uuid.c_str(),playback);
+    }
+    return result+"]}";
+}
+// a house of seven rooms in four zones, pretty printed the
+// way the bridge does with ?pretty
+static std::string zones_body() {
+    std::string result = "[\n  ";
+    result+=zones_zone("Living Room","PLAYING",{"Living Room","Kitchen","Dining Room"});
+    result+=",\n  ";
+    result+=zones_zone("Office","PAUSED_PLAYBACK",{"Office"});
+    result+=",\n  ";
+    result+=zones_zone("Master Bedroom","STOPPED",{"Master Bedroom","Bathroom"});
+    result+=",\n  ";
+    result+=zones_zone("Patio","TRANSITIONING",{"Patio"});
+    return result+"\n]\n";
+}
+
+// every value the reader reports, in order
+struct recorded_value {
+    json_type type;
+    std::string path;
+    std::string value;
+    size_t depth;
+};
+static void record_callback(json_reader* reader,json_type type,const char* value,void* state) {
+    ((std::vector<recorded_value>*)state)->push_back({type,reader->path,value,reader->depth});
+}
+static std::vector<recorded_value> read_all(const std::string& doc,json_state* status) {
+    std::vector<recorded_value> result;
+    json_reader reader;
+    json_init(&reader,record_callback,&result);
+    json_feed(&reader,doc.data(),doc.size());
+    if(status!=nullptr) {
+        *status = reader.status;
+    }
+    return result;
+}
+static std::vector<recorded_value> read_chunks(const std::string& doc,const std::vector<size_t>& chunks,json_reader* reader) {
+    std::vector<recorded_value> result;
+    json_init(reader,record_callback,&result);
+    size_t used = 0;
+    for(size_t chunk : chunks) {
+        json_feed(reader,doc.data()+used,chunk);
+        used+=chunk;
+    }
+    TEST_ASSERT_EQUAL_UINT32(doc.size(),used);
+    TEST_ASSERT_EQUAL_UINT32(doc.size(),reader->fed);
+    return result;
+}
+static void assert_same(const std::vector<recorded_value>& expected,const std::vector<recorded_value>& actual) {
+    TEST_ASSERT_EQUAL_UINT32(expected.size(),actual.size());
+    for(size_t i = 0;i<expected.size();++i) {
+        TEST_ASSERT_TRUE(expected[i].type==actual[i].type);
+        TEST_ASSERT_EQUAL_STRING(expected[i].path.c_str(),actual[i].path.c_str());
+        TEST_ASSERT_EQUAL_STRING(expected[i].value.c_str(),actual[i].value.c_str());
+    }
+}
+static const recorded_value* find(const std::vector<recorded_value>& values,const char* path) {
+    for(const recorded_value& v : values) {
+        if(v.type!=json_type::end && v.path==path) {
+            return &v;
+        }
+    }
+    return nullptr;
+}
+
+void setUp(void) {
+}
+void tearDown(void) {
+}
+
+static void test_state_values() {
+    json_state status;
+    std::vector<recorded_value> values = read_all(state_body,&status);
+    TEST_ASSERT_TRUE(status==json_state::next);
+    const recorded_value* v = find(values,"playbackState");
+    TEST_ASSERT_NOT_NULL(v);
+    TEST_ASSERT_EQUAL_STRING("PLAYING",v->value.c_str());
+    v = find(values,"volume");
+    TEST_ASSERT_TRUE(v->type==json_type::number);
+    TEST_ASSERT_EQUAL_STRING("23",v->value.c_str());
+    v = find(values,"equalizer.treble");
+    TEST_ASSERT_EQUAL_STRING("-2",v->value.c_str());
+    v = find(values,"mute");
+    TEST_ASSERT_TRUE(v->type==json_type::boolean);
+    TEST_ASSERT_EQUAL_STRING("false",v->value.c_str());
+    v = find(values,"subwoofer");
+    TEST_ASSERT_TRUE(v->type==json_type::null);
+    // escapes, and \u to UTF-8
+    v = find(values,"currentTrack.artist");
+    TEST_ASSERT_EQUAL_STRING("Beyonc\xC3\xA9",v->value.c_str());
+    v = find(values,"currentTrack.title");
+    TEST_ASSERT_EQUAL_STRING("Caf\xC3\xA9 \"Live\" / Remastered",v->value.c_str());
+    v = find(values,"playMode.shuffle");
+    TEST_ASSERT_EQUAL_STRING("false",v->value.c_str());
+}
+static void test_state_fields() {
+    char state[24];
+    char title[64];
+    char volume[8];
+    json_field fields[] = {
+        {"playbackState",state,sizeof(state),false},
+        {"currentTrack.title",title,sizeof(title),false},
+        {"volume",volume,sizeof(volume),false},
+        {"nope",nullptr,0,false}
+    };
+    json_fields extract = {fields,sizeof(fields)/sizeof(fields[0])};
+    json_reader reader;
+    json_init(&reader,json_extract_callback,&extract);
+    // a byte at a time, the worst a socket can do
+    const char* sz = state_body;
+    while(*sz) {
+        json_feed(&reader,sz++,1);
+    }
+    TEST_ASSERT_TRUE(fields[0].found && fields[1].found && fields[2].found);
+    TEST_ASSERT_FALSE(fields[3].found);
+    TEST_ASSERT_EQUAL_STRING("PLAYING",state);
+    TEST_ASSERT_EQUAL_STRING("23",volume);
+    // the first match wins, not nextTrack's title
+    TEST_ASSERT_EQUAL_STRING("Caf\xC3\xA9 \"Live\" / Remastered",title);
+}
+static void test_zones_structure() {
+    std::string doc = zones_body();
+    json_state status;
+    std::vector<recorded_value> values = read_all(doc,&status);
+    TEST_ASSERT_TRUE(status==json_state::next);
+    TEST_ASSERT_EQUAL_STRING("Living Room",find(values,"[0].coordinator.roomName")->value.c_str());
+    TEST_ASSERT_EQUAL_STRING("PLAYING",find(values,"[0].coordinator.state.playbackState")->value.c_str());
+    TEST_ASSERT_EQUAL_STRING("Dining Room",find(values,"[0].members[2].roomName")->value.c_str());
+    TEST_ASSERT_EQUAL_STRING("Office",find(values,"[1].members[0].roomName")->value.c_str());
+    TEST_ASSERT_EQUAL_STRING("Bathroom",find(values,"[2].members[1].roomName")->value.c_str());
+    TEST_ASSERT_EQUAL_STRING("TRANSITIONING",find(values,"[3].coordinator.state.playbackState")->value.c_str());
+    // zones_update() commits a zone when it closes at depth 1
+    int zones = 0;
+    int rooms = 0;
+    for(const recorded_value& v : values) {
+        zones+=v.type==json_type::end && v.depth==1;
+        rooms+=v.type==json_type::string && v.path.find(".members[")!=std::string::npos &&
+            v.path.compare(v.path.size()-9,9,".roomName")==0;
+    }
+    TEST_ASSERT_EQUAL_INT(4,zones);
+    TEST_ASSERT_EQUAL_INT(7,rooms);
+    // and the document closed
+    TEST_ASSERT_TRUE(values.back().type==json_type::end);
+    TEST_ASSERT_EQUAL_UINT32(0,values.back().depth);
+}
+static void test_every_split_point() {
+    // two pieces, split at every byte
+    std::vector<recorded_value> expected = read_all(state_body,nullptr);
+    std::string doc = state_body;
+    json_reader reader;
+    for(size_t split = 0;split<=doc.size();++split) {
+        assert_same(expected,read_chunks(doc,{split,doc.size()-split},&reader));
+        TEST_ASSERT_TRUE(reader.status==json_state::next);
+    }
+}
+static void test_random_chunks() {
+    std::mt19937 rng(1234);
+    std::string docs[] = {state_body,zones_body()};
+    json_reader reader;
+    for(const std::string& doc : docs) {
+        std::vector<recorded_value> expected = read_all(doc,nullptr);
+        for(int n = 0;n<200;++n) {
+            // socket reads are mostly small, now and then big
+            std::vector<size_t> chunks;
+            size_t left = doc.size();
+            while(left>0) {
+                size_t chunk = rng()%4==0?rng()%1024:rng()%16;
+                if(chunk>left) {
+                    chunk = left;
+                }
+                chunks.push_back(chunk);
+                left-=chunk;
+            }
+            assert_same(expected,read_chunks(doc,chunks,&reader));
+            TEST_ASSERT_EQUAL_UINT32(0,reader.depth);
+        }
+    }
+}
+static void test_long_values_are_cut() {
+    std::string title(400,'x');
+    std::string doc = "{\"currentTrack\":{\"title\":\""+title+"\",\"artist\":\"A\"}}";
+    json_state status;
+    std::vector<recorded_value> values = read_all(doc,&status);
+    TEST_ASSERT_TRUE(status==json_state::next);
+    TEST_ASSERT_EQUAL_UINT32(json_max_value-1,find(values,"currentTrack.title")->value.size());
+    TEST_ASSERT_EQUAL_STRING("A",find(values,"currentTrack.artist")->value.c_str());
+    // a long key only costs us the path
+    std::string key(300,'k');
+    values = read_all("{\""+key+"\":{\"a\":1},\"b\":2}",&status);
+    TEST_ASSERT_TRUE(status==json_state::next);
+    TEST_ASSERT_EQUAL_STRING("2",find(values,"b")->value.c_str());
+}
+static void test_bad_documents() {
+    const char* docs[] = {
+        "{\"a\":1]",
+        "[1,2}",
+        "{\"a\" 1}",
+        "{1:2}",
+        "{\"a\":\"\\u12x4\"}"
+    };
+    for(const char* doc : docs) {
+        json_state status;
+        read_all(doc,&status);
+        TEST_ASSERT_TRUE_MESSAGE(status==json_state::error,doc);
+    }
+    // too deep to track
+    std::string deep(json_max_depth+1,'[');
+    json_state status;
+    read_all(deep,&status);
+    TEST_ASSERT_TRUE(status==json_state::error);
+    // a truncated one isn't an error, it just never closes
+    std::string doc = zones_body();
+    json_reader reader;
+    read_chunks(doc.substr(0,doc.size()/2),{doc.size()/2},&reader);
+    TEST_ASSERT_TRUE(reader.status!=json_state::error);
+    TEST_ASSERT_GREATER_THAN(0,reader.depth);
+}
+static void test_zones_recorded() {
+    std::string doc = zones_recorded;
+    TEST_ASSERT_GREATER_THAN(8*1024,doc.size());
+    json_state status;
+    std::vector<recorded_value> values = read_all(doc,&status);
+    TEST_ASSERT_TRUE(status==json_state::next);
+    int zones = 0;
+    int rooms = 0;
+    for(const recorded_value& v : values) {
+        zones+=v.type==json_type::end && v.depth==1;
+        rooms+=v.type==json_type::string && v.path.find(".members[")!=std::string::npos &&
+            v.path.compare(v.path.size()-9,9,".roomName")==0;
+    }
+    TEST_ASSERT_EQUAL_INT(6,zones);
+    TEST_ASSERT_EQUAL_INT(9,rooms);
+    const char* expected[][2] = {
+        {"[0].members[2].roomName","Dining Room"},
+        {"[0].coordinator.state.playMode.repeat","all"},
+        {"[1].coordinator.state.currentTrack.title","Maria Tambi\xC3\xA9n"},
+        {"[1].coordinator.state.currentTrack.type","radio"},
+        {"[2].coordinator.state.playbackState","PLAYING"},
+        {"[3].members[1].roomName","Bathroom"},
+        {"[3].members[1].state.mute","true"},
+        {"[3].coordinator.state.currentTrack.title","Episode 212: \"Night Train\" / Part 2"},
+        {"[4].coordinator.state.playbackState","STOPPED"},
+        {"[5].coordinator.roomName","Garage"}
+    };
+    for(const auto& e : expected) {
+        const recorded_value* v = find(values,e[0]);
+        TEST_ASSERT_NOT_NULL_MESSAGE(v,e[0]);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(e[1],v->value.c_str(),e[0]);
+    }
+    // and the same however the socket splits it
+    std::mt19937 rng(99);
+    json_reader reader;
+    for(int n = 0;n<50;++n) {
+        std::vector<size_t> chunks;
+        size_t left = doc.size();
+        while(left>0) {
+            size_t chunk = 1+rng()%1460;
+            if(chunk>left) {
+                chunk = left;
+            }
+            chunks.push_back(chunk);
+            left-=chunk;
+        }
+        assert_same(values,read_chunks(doc,chunks,&reader));
+    }
+}
+
+// the way bridge_get_json() feeds it, a buffer at a time.
+// it runs on a painted stack, with the heap counted
+constexpr static const size_t buffer_size = 1024;
+constexpr static const int iterations = 400;
+struct throughput_run {
+    const std::string* doc;
+    size_t values;
+    double secs;
+    size_t allocations;
+    long heap_peak;
+};
+static void* run_throughput(void* arg) {
+    throughput_run* run = (throughput_run*)arg;
+    const std::string& doc = *run->doc;
+    char buffer[buffer_size];
+    json_reader reader;
+    run->values = 0;
+    heap_watch_begin();
+    auto ts = std::chrono::steady_clock::now();
+    for(int n = 0;n<iterations;++n) {
+        json_init(&reader,[](json_reader* reader,json_type type,const char* value,void* state) {
+            ++*(size_t*)state;
+        },&run->values);
+        for(size_t used = 0;used<doc.size();used+=buffer_size) {
+            size_t len = doc.size()-used<buffer_size?doc.size()-used:buffer_size;
+            // as if it came off the socket
+            memcpy(buffer,doc.data()+used,len);
+            json_feed(&reader,buffer,len);
+        }
+        if(reader.status!=json_state::next) {
+            run->values = 0;
+            break;
+        }
+    }
+    run->secs = std::chrono::duration<double>(std::chrono::steady_clock::now()-ts).count();
+    heap_watch_end();
+    run->allocations = heap_allocations;
+    run->heap_peak = heap_peak;
+    return nullptr;
+}
+static void test_throughput() {
+    std::string docs[] = {state_body,zones_recorded};
+    const char* names[] = {"/state","/zones"};
+    if(heap_counting) {
+        // the counter sees what the reader would have used
+        heap_watch_begin();
+        char* copy = strdup(docs[1].c_str());
+        heap_watch_end();
+        free(copy);
+        TEST_ASSERT_EQUAL_UINT32(1,heap_allocations);
+        TEST_ASSERT_GREATER_OR_EQUAL(docs[1].size()+1,heap_peak);
+    }
+    size_t idle = stack_used(do_nothing,nullptr);
+    for(int d = 0;d<2;++d) {
+        const std::string& doc = docs[d];
+        throughput_run run = {&doc,0,0,0,0};
+        // once first, so the dynamic linker's lazy binding
+        // isn't counted against the reader
+        run_throughput(&run);
+        size_t stack = stack_used(run_throughput,&run)-idle;
+        TEST_ASSERT_GREATER_THAN(0,run.values);
+        if(heap_counting) {
+            TEST_ASSERT_EQUAL_UINT32(0,run.allocations);
+            TEST_ASSERT_EQUAL_INT(0,run.heap_peak);
+        }
+        // the buffer and the reader live on the stack, and
+        // are most of what it took
+        TEST_ASSERT_GREATER_OR_EQUAL(sizeof(json_reader)+buffer_size,stack);
+        char msg[320];
+        snprintf(msg,sizeof(msg),
+            "%s: %d byte body, %d values, %.1f MB/s, %.1fM values/s. peak RAM %d bytes "
+            "(stack %d, of which reader %d + buffer %d; heap %ld in %d allocations), against %d to hold the body",
+            names[d],
+            (int)doc.size(),
+            (int)(run.values/iterations),
+            doc.size()*(double)iterations/run.secs/1e6,
+            run.values/run.secs/1e6,
+            (int)(stack+run.heap_peak),
+            (int)stack,
+            (int)sizeof(json_reader),
+            (int)buffer_size,
+            run.heap_peak,
+            (int)run.allocations,
+            (int)doc.size());
+        TEST_MESSAGE(msg);
+        // well inside the net task's 8KB stack, on the host
+        // at least. it was twice this while array paths
+        // went through snprintf()
+        TEST_ASSERT_LESS_THAN(4096,stack);
+        if(d==1) {
+            // the reader's needs don't grow with the house
+            TEST_ASSERT_LESS_THAN(doc.size(),stack+run.heap_peak);
+        }
+    }
+}
+
+int main(int argc,char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_state_values);
+    RUN_TEST(test_state_fields);
+    RUN_TEST(test_zones_structure);
+    RUN_TEST(test_every_split_point);
+    RUN_TEST(test_random_chunks);
+    RUN_TEST(test_long_values_are_cut);
+    RUN_TEST(test_bad_documents);
+    RUN_TEST(test_zones_recorded);
+    RUN_TEST(test_throughput);
+    return UNITY_END();
+}
@@ -0,0 +1,222 @@
+// the MQTT packets we build, byte for byte against what a
+// 3.1.1 broker expects, and reading back what one sends us
+// the way mqtt_read_packet() and mqtt_receive() do
+#include <unity.h>
+#include <mqtt_packet.hpp>
+#include <string>
+#include <vector>
+#include <string.h>
+
+static uint8_t packet[512];
+
+// the packets in a stream of bytes from the broker, with
+// each body cut to fit a buffer of body_max
+struct read_packet {
+    int type;
+    std::vector<uint8_t> body;
+};
+static std::vector<read_packet> read_stream(const std::vector<uint8_t>& in,size_t body_max) {
+    std::vector<read_packet> result;
+    size_t i = 0;
+    while(i<in.size()) {
+        mqtt_header header;
+        mqtt_header_init(&header);
+        int complete = 0;
+        while(complete==0 && i<in.size()) {
+            complete = mqtt_header_feed(&header,in[i++]);
+        }
+        if(complete<0) {
+            result.push_back({-1,{}});
+            return result;
+        }
+        TEST_ASSERT_EQUAL_INT(1,complete);
+        read_packet p = {header.type,{}};
+        for(size_t n = 0;n<header.length;++n) {
+            TEST_ASSERT_LESS_THAN(in.size(),i);
+            if(p.body.size()<body_max) {
+                p.body.push_back(in[i]);
+            }
+            ++i;
+        }
+        result.push_back(p);
+    }
+    return result;
+}
+static void assert_span(const std::string& expected,const char* data,size_t size) {
+    TEST_ASSERT_EQUAL_UINT32(expected.size(),size);
+    TEST_ASSERT_EQUAL_MEMORY(expected.data(),data,size);
+}
+static std::vector<uint8_t> bytes(const uint8_t* data,size_t size) {
+    return std::vector<uint8_t>(data,data+size);
+}
+
+void setUp(void) {
+}
+void tearDown(void) {
+}
+
+static void test_connect() {
+    static const uint8_t expected[] = {
+        0x10,0x1a,
+        0x00,0x04,'M','Q','T','T',
+        // 3.1.1, no clean session, 60 second keep-alive
+        0x04,0x00,0x00,0x3c,
+        0x00,0x0e,'t','t','g','o','-','s','o','n','o','s','-','a','b','c'
+    };
+    size_t len = mqtt_connect_packet(packet,sizeof(packet),"ttgo-sonos-abc",60);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected),len);
+    TEST_ASSERT_EQUAL_MEMORY(expected,packet,len);
+    // it has to fit whole
+    TEST_ASSERT_EQUAL_UINT32(len,mqtt_connect_packet(packet,len,"ttgo-sonos-abc",60));
+    TEST_ASSERT_EQUAL_UINT32(0,mqtt_connect_packet(packet,len-1,"ttgo-sonos-abc",60));
+}
+static void test_subscribe() {
+    static const uint8_t expected[] = {
+        0x82,0x12,
+        0x00,0x01,
+        0x00,0x0d,'s','o','n','o','s','/','+','/','s','t','a','t','e',
+        // QoS 0
+        0x00
+    };
+    size_t len = mqtt_subscribe_packet(packet,sizeof(packet),1,"sonos/+/state");
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected),len);
+    TEST_ASSERT_EQUAL_MEMORY(expected,packet,len);
+    len = mqtt_subscribe_packet(packet,sizeof(packet),0x1234,"sonos/+/state");
+    TEST_ASSERT_EQUAL_HEX8(0x12,packet[2]);
+    TEST_ASSERT_EQUAL_HEX8(0x34,packet[3]);
+    TEST_ASSERT_EQUAL_UINT32(0,mqtt_subscribe_packet(packet,sizeof(expected)-1,1,"sonos/+/state"));
+}
+static void test_publish() {
+    static const uint8_t expected[] = {
+        0x30,0x16,
+        0x00,0x12,'s','o','n','o','s','/','K','i','t','c','h','e','n','/','n','e','x','t',
+        '1','2'
+    };
+    size_t len = mqtt_publish_packet(packet,sizeof(packet),"sonos/Kitchen/next",18,"12",2);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected),len);
+    TEST_ASSERT_EQUAL_MEMORY(expected,packet,len);
+    // an empty payload
+    len = mqtt_publish_packet(packet,sizeof(packet),"a/b",3,"",0);
+    static const uint8_t empty[] = {0x30,0x05,0x00,0x03,'a','/','b'};
+    TEST_ASSERT_EQUAL_UINT32(sizeof(empty),len);
+    TEST_ASSERT_EQUAL_MEMORY(empty,packet,len);
+    // the remaining length takes two bytes past 127
+    std::string payload(200,'x');
+    len = mqtt_publish_packet(packet,sizeof(packet),"t",1,payload.data(),payload.size());
+    TEST_ASSERT_EQUAL_UINT32(1+2+2+1+200,len);
+    TEST_ASSERT_EQUAL_HEX8(0x80|(203&0x7F),packet[1]);
+    TEST_ASSERT_EQUAL_HEX8(203>>7,packet[2]);
+    TEST_ASSERT_EQUAL_UINT32(0,mqtt_publish_packet(packet,len-1,"t",1,payload.data(),payload.size()));
+}
+static void test_length_round_trip() {
+    static const size_t lengths[] = {0,1,127,128,16383,16384,2097151,2097152,268435455};
+    static const size_t sizes[] = {1,1,1,2,2,3,3,4,4};
+    for(size_t i = 0;i<sizeof(lengths)/sizeof(lengths[0]);++i) {
+        uint8_t out[5];
+        out[0] = 0x30;
+        size_t len = mqtt_put_length(out+1,lengths[i]);
+        TEST_ASSERT_EQUAL_UINT32(sizes[i],len);
+        mqtt_header header;
+        mqtt_header_init(&header);
+        for(size_t j = 0;j<len;++j) {
+            TEST_ASSERT_EQUAL_INT(0,mqtt_header_feed(&header,out[j]));
+        }
+        TEST_ASSERT_EQUAL_INT(1,mqtt_header_feed(&header,out[len]));
+        TEST_ASSERT_EQUAL_HEX8(0x30,header.type);
+        TEST_ASSERT_EQUAL_UINT32(lengths[i],header.length);
+    }
+}
+static void test_header_too_long() {
+    // a fifth length byte isn't allowed
+    static const uint8_t in[] = {0x30,0xFF,0xFF,0xFF,0xFF,0x01};
+    std::vector<read_packet> packets = read_stream(bytes(in,sizeof(in)),512);
+    TEST_ASSERT_EQUAL_UINT32(1,packets.size());
+    TEST_ASSERT_EQUAL_INT(-1,packets[0].type);
+}
+static void test_connack() {
+    bool resumed;
+    int code;
+    static const uint8_t fresh[] = {0x20,0x02,0x00,0x00};
+    std::vector<read_packet> packets = read_stream(bytes(fresh,sizeof(fresh)),512);
+    TEST_ASSERT_TRUE(mqtt_parse_connack(packets[0].type,packets[0].body.data(),packets[0].body.size(),&resumed,&code));
+    TEST_ASSERT_FALSE(resumed);
+    TEST_ASSERT_EQUAL_INT(0,code);
+    static const uint8_t resumed_session[] = {0x20,0x02,0x01,0x00};
+    packets = read_stream(bytes(resumed_session,sizeof(resumed_session)),512);
+    TEST_ASSERT_TRUE(mqtt_parse_connack(packets[0].type,packets[0].body.data(),packets[0].body.size(),&resumed,&code));
+    TEST_ASSERT_TRUE(resumed);
+    // not authorized
+    static const uint8_t refused[] = {0x20,0x02,0x00,0x05};
+    packets = read_stream(bytes(refused,sizeof(refused)),512);
+    TEST_ASSERT_FALSE(mqtt_parse_connack(packets[0].type,packets[0].body.data(),packets[0].body.size(),&resumed,&code));
+    TEST_ASSERT_EQUAL_INT(5,code);
+    // something else altogether
+    static const uint8_t suback[] = {0x90,0x03,0x00,0x01,0x00};
+    packets = read_stream(bytes(suback,sizeof(suback)),512);
+    TEST_ASSERT_FALSE(mqtt_parse_connack(packets[0].type,packets[0].body.data(),packets[0].body.size(),&resumed,&code));
+    TEST_ASSERT_EQUAL_INT(-1,code);
+}
+static void test_receive_stream() {
+    // a state update, a ping response, another publish, and
+    // one at QoS 1 with its packet id, back to back
+    std::string topic = "sonos/Living Room/state";
+    std::string payload = "{\"playbackState\":\"PLAYING\",\"currentTrack\":{\"title\":\"Song\",\"artist\":\"Band\"}}";
+    std::vector<uint8_t> in(sizeof(packet));
+    size_t len = mqtt_publish_packet(in.data(),in.size(),topic.data(),topic.size(),payload.data(),payload.size());
+    in.resize(len);
+    static const uint8_t rest[] = {
+        0xD0,0x00,
+        0x30,0x0e,0x00,0x07,'o','t','h','e','r','/','x','h','e','l','l','o',
+        0x32,0x09,0x00,0x03,'a','/','b',0x00,0x07,'h','i'
+    };
+    in.insert(in.end(),rest,rest+sizeof(rest));
+    std::vector<read_packet> packets = read_stream(in,512);
+    TEST_ASSERT_EQUAL_UINT32(4,packets.size());
+    const char* t;
+    const char* p;
+    size_t t_len;
+    size_t p_len;
+    TEST_ASSERT_TRUE(mqtt_parse_publish(packets[0].type,packets[0].body.data(),packets[0].body.size(),&t,&t_len,&p,&p_len));
+    assert_span(topic,t,t_len);
+    assert_span(payload,p,p_len);
+    TEST_ASSERT_EQUAL_HEX8(0xD0,packets[1].type);
+    TEST_ASSERT_EQUAL_UINT32(0,packets[1].body.size());
+    TEST_ASSERT_FALSE(mqtt_parse_publish(packets[1].type,packets[1].body.data(),packets[1].body.size(),&t,&t_len,&p,&p_len));
+    TEST_ASSERT_TRUE(mqtt_parse_publish(packets[2].type,packets[2].body.data(),packets[2].body.size(),&t,&t_len,&p,&p_len));
+    assert_span("other/x",t,t_len);
+    assert_span("hello",p,p_len);
+    TEST_ASSERT_TRUE(mqtt_parse_publish(packets[3].type,packets[3].body.data(),packets[3].body.size(),&t,&t_len,&p,&p_len));
+    assert_span("a/b",t,t_len);
+    assert_span("hi",p,p_len);
+}
+static void test_receive_too_big() {
+    // a topic longer than what we keep of the body is
+    // skipped. a long payload is just cut short
+    std::string topic(40,'t');
+    std::string payload(100,'p');
+    std::vector<uint8_t> in(sizeof(packet));
+    in.resize(mqtt_publish_packet(in.data(),in.size(),topic.data(),topic.size(),payload.data(),payload.size()));
+    std::vector<read_packet> packets = read_stream(in,32);
+    const char* t;
+    const char* p;
+    size_t t_len;
+    size_t p_len;
+    TEST_ASSERT_FALSE(mqtt_parse_publish(packets[0].type,packets[0].body.data(),packets[0].body.size(),&t,&t_len,&p,&p_len));
+    packets = read_stream(in,64);
+    TEST_ASSERT_TRUE(mqtt_parse_publish(packets[0].type,packets[0].body.data(),packets[0].body.size(),&t,&t_len,&p,&p_len));
+    TEST_ASSERT_EQUAL_UINT32(40,t_len);
+    TEST_ASSERT_EQUAL_UINT32(64-42,p_len);
+}
+
+int main(int argc,char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_connect);
+    RUN_TEST(test_subscribe);
+    RUN_TEST(test_publish);
+    RUN_TEST(test_length_round_trip);
+    RUN_TEST(test_header_too_long);
+    RUN_TEST(test_connack);
+    RUN_TEST(test_receive_stream);
+    RUN_TEST(test_receive_too_big);
+    return UNITY_END();
+}
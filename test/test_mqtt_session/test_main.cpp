@@ -0,0 +1,448 @@
+// the broker connection against an in-process stub broker:
+// whether the session is resumed or made again, that the
+// subscription is only sent when the broker lost it, one
+// PUBLISH per press, and keeping the connection alive
+#include <unity.h>
+#include <mqtt_session.hpp>
+#include "../socket_stub.hpp"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+void http_idle() {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+// a 3.1.1 broker that keeps sessions by client id, unless
+// asked for a clean one, and delivers to subscribers
+struct stub_broker {
+    stub_server server;
+    std::mutex lock;
+    // client id to its subscriptions
+    std::map<std::string,std::set<std::string>> sessions;
+    std::map<std::string,int> fds;
+    std::vector<std::string> subscribes;
+    std::vector<std::pair<std::string,std::string>> publishes;
+    std::atomic<int> connects{0};
+    std::atomic<int> pings{0};
+    // the CONNACK return code to give
+    std::atomic<int> refuse{0};
+    // don't answer pings
+    std::atomic<bool> mute{false};
+};
+static stub_broker broker;
+
+static bool topic_matches(const std::string& filter,const std::string& topic) {
+    // + matches one level
+    size_t f = 0;
+    size_t t = 0;
+    while(f<filter.size() && t<=topic.size()) {
+        if(filter[f]=='+') {
+            size_t end = topic.find('/',t);
+            t = end==std::string::npos?topic.size():end;
+            ++f;
+            continue;
+        }
+        if(t==topic.size() || filter[f]!=topic[t]) {
+            return false;
+        }
+        ++f;
+        ++t;
+    }
+    return f==filter.size() && t==topic.size();
+}
+static bool read_exact(int fd,uint8_t* buf,size_t size) {
+    size_t got = 0;
+    while(got<size) {
+        ssize_t r = recv(fd,buf+got,size-got,0);
+        if(r<=0) {
+            return false;
+        }
+        got+=r;
+    }
+    return true;
+}
+static bool read_packet(int fd,uint8_t* type,std::vector<uint8_t>* body) {
+    if(!read_exact(fd,type,1)) {
+        return false;
+    }
+    mqtt_header header;
+    mqtt_header_init(&header);
+    mqtt_header_feed(&header,*type);
+    int complete = 0;
+    while(complete==0) {
+        uint8_t ch;
+        if(!read_exact(fd,&ch,1)) {
+            return false;
+        }
+        complete = mqtt_header_feed(&header,ch);
+    }
+    if(complete<0) {
+        return false;
+    }
+    body->resize(header.length);
+    return header.length==0 || read_exact(fd,body->data(),header.length);
+}
+static std::string get_string(const std::vector<uint8_t>& body,size_t* at) {
+    size_t len = (body[*at]<<8)|body[*at+1];
+    std::string result((const char*)body.data()+*at+2,len);
+    *at+=2+len;
+    return result;
+}
+static void broker_serve(int fd) {
+    uint8_t type;
+    std::vector<uint8_t> body;
+    std::string client_id;
+    while(read_packet(fd,&type,&body)) {
+        std::lock_guard<std::mutex> guard(broker.lock);
+        switch(type>>4) {
+            case 1: {
+                // CONNECT: protocol name, level, flags, keep-alive, id
+                size_t at = 0;
+                if(get_string(body,&at)!="MQTT" || body[at]!=4) {
+                    return;
+                }
+                bool clean = body[at+1]&0x02;
+                at+=4;
+                client_id = get_string(body,&at);
+                ++broker.connects;
+                if(broker.refuse!=0) {
+                    uint8_t connack[] = {0x20,2,0,(uint8_t)broker.refuse.load()};
+                    stub_send(fd,std::string((char*)connack,sizeof(connack)));
+                    return;
+                }
+                bool present = !clean && broker.sessions.count(client_id)>0;
+                if(clean || !present) {
+                    broker.sessions[client_id].clear();
+                }
+                broker.fds[client_id] = fd;
+                uint8_t connack[] = {0x20,2,(uint8_t)(present?1:0),0};
+                stub_send(fd,std::string((char*)connack,sizeof(connack)));
+                break;
+            }
+            case 3: {
+                // PUBLISH at QoS 0, delivered to whoever's subscribed
+                size_t at = 0;
+                std::string topic = get_string(body,&at);
+                std::string payload((const char*)body.data()+at,body.size()-at);
+                broker.publishes.push_back({topic,payload});
+                for(auto& session : broker.sessions) {
+                    for(const std::string& filter : session.second) {
+                        if(topic_matches(filter,topic) && broker.fds.count(session.first)) {
+                            uint8_t out[600];
+                            size_t len = mqtt_publish_packet(out,sizeof(out),topic.data(),topic.size(),payload.data(),payload.size());
+                            stub_send(broker.fds[session.first],std::string((char*)out,len));
+                            break;
+                        }
+                    }
+                }
+                break;
+            }
+            case 8: {
+                // SUBSCRIBE: packet id, then filter and QoS pairs
+                size_t at = 2;
+                std::string filter = get_string(body,&at);
+                broker.subscribes.push_back(filter);
+                broker.sessions[client_id].insert(filter);
+                uint8_t suback[] = {0x90,3,body[0],body[1],0};
+                stub_send(fd,std::string((char*)suback,sizeof(suback)));
+                break;
+            }
+            case 12:
+                ++broker.pings;
+                if(!broker.mute) {
+                    stub_send(fd,std::string("\xD0\x00",2));
+                }
+                break;
+            case 14:
+                broker.fds.erase(client_id);
+                return;
+        }
+    }
+    std::lock_guard<std::mutex> guard(broker.lock);
+    if(broker.fds.count(client_id) && broker.fds[client_id]==fd) {
+        broker.fds.erase(client_id);
+    }
+}
+
+// the network, over a socket to the stub. the clock can be
+// moved on to test the keep-alive without waiting a minute
+struct test_network {
+    socket_client client;
+    uint32_t offset_ms = 0;
+    int connects = 0;
+    std::vector<std::pair<std::string,std::string>> received_messages;
+    uint32_t now_ms() {
+        using namespace std::chrono;
+        return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count()+offset_ms;
+    }
+    void idle() {
+        http_idle();
+    }
+    bool connect(const char* host,uint16_t port) {
+        ++connects;
+        return client.connect(port);
+    }
+    size_t write(const uint8_t* data,size_t size) {
+        return client.write(data,size);
+    }
+    int read() {
+        return client.read();
+    }
+    int available() {
+        return client.available();
+    }
+    bool connected() {
+        return client.connected();
+    }
+    void stop() {
+        client.stop();
+    }
+    void received(const char* topic,size_t topic_len,const char* payload,size_t payload_len) {
+        received_messages.push_back({std::string(topic,topic_len),std::string(payload,payload_len)});
+    }
+};
+
+static const char* client_id = "ttgo-sonos-0123456789ab";
+static test_network network;
+static mqtt_session session;
+
+static void start_session() {
+    // a fresh wake: nothing survives but the client id
+    network.stop();
+    network.offset_ms = 0;
+    network.received_messages.clear();
+    mqtt_session_init(&session,client_id,60);
+    strcpy(session.subscribe_host,"broker.local");
+    session.subscribe_port = broker.server.port;
+    strcpy(session.filter,"sonos/+/state");
+}
+static uint32_t deadline() {
+    return network.now_ms()+2000;
+}
+static mqtt_opened open_broker() {
+    return mqtt_open(&session,network,"broker.local",broker.server.port,deadline());
+}
+static bool wait_for(const std::function<bool()>& done) {
+    for(int i = 0;i<2000 && !done();++i) {
+        http_idle();
+    }
+    return done();
+}
+static size_t publish_count() {
+    std::lock_guard<std::mutex> guard(broker.lock);
+    return broker.publishes.size();
+}
+static bool press(const char* topic,const char* payload,int count) {
+    // as do_mqtt_request() does it
+    uint8_t packet[256];
+    size_t len = mqtt_publish_packet(packet,sizeof(packet),topic,strlen(topic),payload,strlen(payload));
+    mqtt_opened opened = open_broker();
+    if(opened==mqtt_opened::failed || opened==mqtt_opened::refused) {
+        return false;
+    }
+    return mqtt_publish(&session,network,"broker.local",broker.server.port,packet,len,count,deadline());
+}
+
+void setUp(void) {
+    std::lock_guard<std::mutex> guard(broker.lock);
+    broker.sessions.clear();
+    broker.subscribes.clear();
+    broker.publishes.clear();
+    broker.connects = 0;
+    broker.pings = 0;
+    broker.refuse = 0;
+    broker.mute = false;
+}
+void tearDown(void) {
+    network.stop();
+}
+
+static void test_new_session_subscribes() {
+    start_session();
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::fresh);
+    TEST_ASSERT_TRUE(session.connected);
+    TEST_ASSERT_EQUAL_UINT32(1,session.connects);
+    TEST_ASSERT_EQUAL_UINT32(0,session.resumed);
+    TEST_ASSERT_TRUE(wait_for([]() {
+        std::lock_guard<std::mutex> guard(broker.lock);
+        return broker.subscribes.size()==1;
+    }));
+    std::string filter = broker.subscribes[0];
+    TEST_ASSERT_EQUAL_STRING("sonos/+/state",filter.c_str());
+    // already open, so nothing more goes out
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::reused);
+    TEST_ASSERT_EQUAL_INT(1,network.connects);
+}
+static void test_resumed_session_keeps_subscription() {
+    start_session();
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::fresh);
+    // deep sleep drops the connection and everything else
+    start_session();
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::resumed);
+    TEST_ASSERT_EQUAL_UINT32(1,session.resumed);
+    // and the broker still delivers what we subscribed to
+    // before, without our asking again
+    socket_client speaker;
+    TEST_ASSERT_TRUE(speaker.connect(broker.server.port));
+    uint8_t packet[256];
+    size_t len = mqtt_connect_packet(packet,sizeof(packet),"bridge",60);
+    speaker.write(packet,len);
+    TEST_ASSERT_TRUE(wait_for([&]() {
+        return speaker.read()>=0;
+    }));
+    const char* payload = "{\"playbackState\":\"PLAYING\"}";
+    len = mqtt_publish_packet(packet,sizeof(packet),"sonos/Kitchen/state",19,payload,strlen(payload));
+    speaker.write(packet,len);
+    TEST_ASSERT_TRUE(wait_for([]() {
+        mqtt_receive(&session,network,deadline());
+        return network.received_messages.size()==1;
+    }));
+    std::string topic = network.received_messages[0].first;
+    std::string received = network.received_messages[0].second;
+    TEST_ASSERT_EQUAL_STRING("sonos/Kitchen/state",topic.c_str());
+    TEST_ASSERT_EQUAL_STRING(payload,received.c_str());
+    std::lock_guard<std::mutex> guard(broker.lock);
+    TEST_ASSERT_EQUAL_UINT32(1,broker.subscribes.size());
+}
+static void test_broker_lost_session() {
+    start_session();
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::fresh);
+    TEST_ASSERT_TRUE(wait_for([]() {
+        std::lock_guard<std::mutex> guard(broker.lock);
+        return broker.subscribes.size()==1;
+    }));
+    start_session();
+    {
+        // it restarted without persistence
+        std::lock_guard<std::mutex> guard(broker.lock);
+        broker.sessions.clear();
+    }
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::fresh);
+    TEST_ASSERT_TRUE(wait_for([]() {
+        std::lock_guard<std::mutex> guard(broker.lock);
+        return broker.subscribes.size()==2;
+    }));
+    // a broker that isn't ours to subscribe on gets nothing
+    start_session();
+    session.subscribe_port = 1;
+    {
+        std::lock_guard<std::mutex> guard(broker.lock);
+        broker.sessions.clear();
+    }
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::fresh);
+    TEST_ASSERT_TRUE(press("sonos/Office/next","",1));
+    TEST_ASSERT_TRUE(wait_for([]() {
+        return publish_count()==1;
+    }));
+    std::lock_guard<std::mutex> guard(broker.lock);
+    TEST_ASSERT_EQUAL_UINT32(2,broker.subscribes.size());
+}
+static void test_refused() {
+    start_session();
+    broker.refuse = 5;
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::refused);
+    TEST_ASSERT_EQUAL_INT(5,session.code);
+    TEST_ASSERT_FALSE(session.connected);
+    TEST_ASSERT_FALSE(press("sonos/Office/next","",1));
+    TEST_ASSERT_EQUAL_UINT32(0,publish_count());
+}
+static void test_one_publish_per_press() {
+    start_session();
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::fresh);
+    TEST_ASSERT_TRUE(press("sonos/Living Room/next","",1));
+    TEST_ASSERT_TRUE(wait_for([]() {
+        return publish_count()==1;
+    }));
+    // three presses coalesced into one command
+    TEST_ASSERT_TRUE(press("sonos/Living Room/volume","+2",3));
+    TEST_ASSERT_TRUE(wait_for([]() {
+        return publish_count()==4;
+    }));
+    // give anything extra time to turn up
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::lock_guard<std::mutex> guard(broker.lock);
+    TEST_ASSERT_EQUAL_UINT32(4,broker.publishes.size());
+    std::string topic = broker.publishes[0].first;
+    TEST_ASSERT_EQUAL_STRING("sonos/Living Room/next",topic.c_str());
+    for(size_t i = 1;i<4;++i) {
+        std::string payload = broker.publishes[i].second;
+        TEST_ASSERT_EQUAL_STRING("+2",payload.c_str());
+    }
+    TEST_ASSERT_EQUAL_UINT32(4,session.published);
+    TEST_ASSERT_EQUAL_INT(1,broker.connects);
+}
+static void test_publish_after_drop() {
+    start_session();
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::fresh);
+    // the broker dropped us while we weren't looking
+    {
+        std::lock_guard<std::mutex> guard(broker.lock);
+        shutdown(broker.fds[client_id],SHUT_RDWR);
+    }
+    TEST_ASSERT_TRUE(wait_for([]() {
+        return !network.connected();
+    }));
+    TEST_ASSERT_TRUE(press("sonos/Kitchen/playpause","",1));
+    TEST_ASSERT_TRUE(wait_for([]() {
+        return publish_count()==1;
+    }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    TEST_ASSERT_EQUAL_UINT32(1,publish_count());
+    TEST_ASSERT_EQUAL_INT(2,broker.connects);
+    TEST_ASSERT_EQUAL_UINT32(1,session.resumed);
+}
+static void test_keep_alive() {
+    start_session();
+    // no SUBACK to muddy what answers the ping
+    session.filter[0]=0;
+    TEST_ASSERT_TRUE(open_broker()==mqtt_opened::fresh);
+    // nothing owed yet
+    TEST_ASSERT_TRUE(mqtt_keep_alive(&session,network));
+    TEST_ASSERT_FALSE(session.ping_pending);
+    // three quarters of the way through we ping
+    network.offset_ms = 45*1000;
+    TEST_ASSERT_TRUE(mqtt_keep_alive(&session,network));
+    TEST_ASSERT_TRUE(session.ping_pending);
+    // and only once
+    TEST_ASSERT_TRUE(mqtt_keep_alive(&session,network));
+    TEST_ASSERT_TRUE(wait_for([]() {
+        mqtt_receive(&session,network,deadline());
+        return !session.ping_pending;
+    }));
+    TEST_ASSERT_EQUAL_INT(1,broker.pings);
+    // a broker that stops answering is let go of after one
+    // and a half keep-alives without a word
+    broker.mute = true;
+    network.offset_ms+=45*1000;
+    TEST_ASSERT_TRUE(mqtt_keep_alive(&session,network));
+    TEST_ASSERT_TRUE(session.ping_pending);
+    TEST_ASSERT_TRUE(wait_for([]() {
+        return broker.pings==2;
+    }));
+    network.offset_ms+=46*1000;
+    TEST_ASSERT_FALSE(mqtt_keep_alive(&session,network));
+    TEST_ASSERT_FALSE(session.connected);
+    TEST_ASSERT_FALSE(network.connected());
+}
+
+int main(int argc,char** argv) {
+    broker.server.serve = broker_serve;
+    if(!stub_start(&broker.server)) {
+        return 1;
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_new_session_subscribes);
+    RUN_TEST(test_resumed_session_keeps_subscription);
+    RUN_TEST(test_broker_lost_session);
+    RUN_TEST(test_refused);
+    RUN_TEST(test_one_publish_per_press);
+    RUN_TEST(test_publish_after_drop);
+    RUN_TEST(test_keep_alive);
+    int result = UNITY_END();
+    stub_stop(&broker.server);
+    return result;
+}
@@ -0,0 +1,376 @@
+// the prebuilt UPnP requests. a speaker drops a request
+// whose Content-Length doesn't match its body, or whose
+// SOAPACTION doesn't name the action in the envelope. the
+// last tests send them to a stub speaker on localhost:1400
+// the way do_soap_request() does, and time that against
+// going through a stub bridge that makes the same request
+// of the speaker for us
+#include <unity.h>
+#include <soap.hpp>
+#include <http_pool.hpp>
+#include "../socket_stub.hpp"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t http_millis() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+void http_idle() {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+static char buffer[1024];
+
+// the value of a header in a request, or null
+static const char* header_value(const char* request,const char* name,char* value,size_t size) {
+    const char* end = strstr(request,"\r\n\r\n");
+    size_t name_len = strlen(name);
+    const char* line = request;
+    while(line!=nullptr && line<end) {
+        if(0==strncmp(line,name,name_len) && line[name_len]==':') {
+            const char* sz = line+name_len+1;
+            while(*sz==' ') {
+                ++sz;
+            }
+            const char* eol = strstr(sz,"\r\n");
+            size_t len = eol-sz;
+            if(len>=size) {
+                return nullptr;
+            }
+            memcpy(value,sz,len);
+            value[len]=0;
+            return value;
+        }
+        line = strstr(line,"\r\n");
+        if(line!=nullptr) {
+            line+=2;
+        }
+    }
+    return nullptr;
+}
+
+// the stub speaker. it checks each POST the way a speaker
+// does, answers with a SOAP envelope, and keeps the
+// transport state so playpause has something to look at
+static stub_server speaker;
+static std::atomic<int> speaker_actions(0);
+static std::atomic<int> speaker_faults(0);
+static std::atomic<bool> speaker_playing(false);
+static std::string soap_response(int status,const std::string& body) {
+    char head[160];
+    snprintf(head,sizeof(head),
+        "HTTP/1.1 %d %s\r\nCONTENT-TYPE: text/xml; charset=\"utf-8\"\r\n"
+        "Server: Linux UPnP/1.0 Sonos/70.3-35220 (ZPS1)\r\nContent-Length: %d\r\n\r\n",
+        status,status==200?"OK":"Internal Server Error",(int)body.size());
+    return head+body;
+}
+static void serve_speaker(int fd) {
+    static const char* envelope_start =
+        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+        "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>";
+    static const char* envelope_end = "</s:Body></s:Envelope>";
+    std::string pending;
+    std::string request;
+    char value[128];
+    while(stub_read_request(fd,&pending,&request)) {
+        size_t body = request.find("\r\n\r\n")+4;
+        const char* service = strstr(request.c_str(),"urn:schemas-upnp-org:service:");
+        const char* action = strchr(request.c_str(),'#');
+        // the body is as long as Content-Length says. if
+        // that's wrong, the envelope is cut short
+        static const char* end_tag = "</s:Envelope>";
+        bool ok = 0==request.compare(0,5,"POST ") &&
+            request.size()-body>strlen(end_tag) &&
+            0==request.compare(request.size()-strlen(end_tag),strlen(end_tag),end_tag) &&
+            nullptr!=header_value(request.c_str(),"SOAPACTION",value,sizeof(value)) &&
+            service!=nullptr && action!=nullptr;
+        std::string name;
+        if(ok) {
+            name = std::string(action+1,strchr(action,'"')-action-1);
+            // the envelope has to call what SOAPACTION says
+            ok = std::string::npos!=request.find("<u:"+name+" ",body);
+        }
+        if(!ok) {
+            ++speaker_faults;
+            stub_send(fd,soap_response(500,std::string(envelope_start)+
+                "<s:Fault><faultcode>s:Client</faultcode><faultstring>UPnPError</faultstring></s:Fault>"+
+                envelope_end));
+            continue;
+        }
+        ++speaker_actions;
+        std::string result;
+        if(name=="GetTransportInfo") {
+            result = std::string("<CurrentTransportState>")+
+                (speaker_playing?"PLAYING":"PAUSED_PLAYBACK")+
+                "</CurrentTransportState><CurrentTransportStatus>OK</CurrentTransportStatus>"
+                "<CurrentSpeed>1</CurrentSpeed>";
+        } else if(name=="Play") {
+            speaker_playing = true;
+        } else if(name=="Pause") {
+            speaker_playing = false;
+        }
+        stub_send(fd,soap_response(200,std::string(envelope_start)+
+            "<u:"+name+"Response xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\">"+
+            result+"</u:"+name+"Response>"+envelope_end));
+    }
+}
+
+// the stub bridge. like node-sonos-http-api, it turns each
+// GET into a SOAP request on a fresh connection to the
+// speaker, and answers once the speaker has
+static stub_server bridge;
+static void serve_bridge(int fd) {
+    std::string pending;
+    std::string request;
+    while(stub_read_request(fd,&pending,&request)) {
+        soap_action* action = soap_action_for(strrchr(request.substr(0,request.find(" HTTP/")).c_str(),'/')+1);
+        socket_client client;
+        char buf[1024];
+        int status = -1;
+        int len = action==nullptr?-1:soap_format(buf,sizeof(buf),action,"127.0.0.1");
+        if(len>0 && client.connect(speaker.port) &&
+                (size_t)len==client.write((const uint8_t*)buf,len)) {
+            status = http_read_status(client,buf,sizeof(buf),http_millis()+1000,nullptr,0);
+        }
+        stub_send(fd,status==200?
+            "HTTP/1.1 200 OK\r\nX-Powered-By: Express\r\nContent-Type: application/json;charset=utf8\r\n"
+            "Content-Length: 20\r\nConnection: keep-alive\r\n\r\n{\"status\":\"success\"}":
+            "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: keep-alive\r\n\r\n");
+    }
+}
+
+// the device's side, over kept alive connections like its
+// http_pool gives it
+using test_conn = http_connection<socket_client>;
+static test_conn speaker_conn;
+static test_conn bridge_conn;
+static bool open_conn(test_conn* conn,const stub_server& server) {
+    if(conn->client.connected()) {
+        return true;
+    }
+    return conn->client.connect(server.port);
+}
+// what do_soap_request() does
+static int soap_command(const char* name) {
+    soap_action* action = soap_action_for(name);
+    if(action==nullptr || !open_conn(&speaker_conn,speaker)) {
+        return -1;
+    }
+    if(action->service==nullptr) {
+        int len = soap_format(buffer,sizeof(buffer),soap_action_for("GetTransportInfo"),"127.0.0.1");
+        char body[512];
+        if(len<0 || (size_t)len!=speaker_conn.client.write((const uint8_t*)buffer,len) ||
+                200!=http_read_status(speaker_conn.client,buffer,sizeof(buffer),http_millis()+1000,body,sizeof(body))) {
+            return -1;
+        }
+        action = soap_action_for(nullptr!=strstr(body,"<CurrentTransportState>PLAYING<")?"Pause":"Play");
+        if(!open_conn(&speaker_conn,speaker)) {
+            return -1;
+        }
+    }
+    int len = soap_format(buffer,sizeof(buffer),action,"127.0.0.1");
+    if(len<0 || (size_t)len!=speaker_conn.client.write((const uint8_t*)buffer,len)) {
+        return -1;
+    }
+    return http_read_status(speaker_conn.client,buffer,sizeof(buffer),http_millis()+1000,nullptr,0);
+}
+// what do_http_request() does with http://bridge/room/<name>
+static int bridge_command(const char* name) {
+    if(!open_conn(&bridge_conn,bridge)) {
+        return -1;
+    }
+    char path[64];
+    snprintf(path,sizeof(path),"/Kitchen/%s",name);
+    if(!http_write_requests(bridge_conn.client,buffer,sizeof(buffer),"127.0.0.1",path,1)) {
+        return -1;
+    }
+    return http_read_status(bridge_conn.client,buffer,sizeof(buffer),http_millis()+1000,nullptr,0);
+}
+
+void setUp(void) {
+    speaker_actions = 0;
+    speaker_faults = 0;
+}
+void tearDown(void) {
+}
+
+static void test_action_lookup() {
+    TEST_ASSERT_NOT_NULL(soap_action_for("Next"));
+    // api.txt is case insensitive
+    TEST_ASSERT_EQUAL_PTR(soap_action_for("Next"),soap_action_for("next"));
+    TEST_ASSERT_NULL(soap_action_for("Rewind"));
+}
+static void test_playpause_has_no_request() {
+    soap_action* action = soap_action_for("PlayPause");
+    TEST_ASSERT_TRUE(soap_build(action));
+    TEST_ASSERT_NULL(action->request);
+}
+static void test_build_is_idempotent() {
+    soap_action* action = soap_action_for("Stop");
+    TEST_ASSERT_TRUE(soap_build(action));
+    char* request = action->request;
+    TEST_ASSERT_NOT_NULL(request);
+    TEST_ASSERT_TRUE(soap_build(action));
+    TEST_ASSERT_EQUAL_PTR(request,action->request);
+}
+static void test_content_length_matches_body() {
+    char value[128];
+    for(size_t i = 0;i<soap_action_count;++i) {
+        soap_action* action = &soap_actions[i];
+        if(action->service==nullptr) {
+            continue;
+        }
+        TEST_ASSERT_TRUE(soap_build(action));
+        const char* body = strstr(action->request,"\r\n\r\n");
+        TEST_ASSERT_NOT_NULL(body);
+        body+=4;
+        TEST_ASSERT_NOT_NULL(header_value(action->request,"Content-Length",value,sizeof(value)));
+        TEST_ASSERT_EQUAL_INT((int)strlen(body),atoi(value));
+    }
+}
+static void test_soapaction_names_the_action() {
+    char value[128];
+    char expected[128];
+    for(size_t i = 0;i<soap_action_count;++i) {
+        soap_action* action = &soap_actions[i];
+        if(action->service==nullptr) {
+            continue;
+        }
+        TEST_ASSERT_TRUE(soap_build(action));
+        TEST_ASSERT_NOT_NULL(header_value(action->request,"SOAPACTION",value,sizeof(value)));
+        snprintf(expected,sizeof(expected),"\"urn:schemas-upnp-org:service:%s:1#%s\"",
+            action->service,action->action);
+        TEST_ASSERT_EQUAL_STRING(expected,value);
+        // and the envelope calls the same action on the same service
+        snprintf(expected,sizeof(expected),"<u:%s xmlns:u=\"urn:schemas-upnp-org:service:%s:1\">",
+            action->action,action->service);
+        TEST_ASSERT_NOT_NULL(strstr(action->request,expected));
+        snprintf(expected,sizeof(expected),"%s</u:%s></s:Body></s:Envelope>",
+            action->args,action->action);
+        TEST_ASSERT_NOT_NULL(strstr(action->request,expected));
+    }
+}
+static void test_format_request() {
+    soap_action* action = soap_action_for("VolumeUp");
+    TEST_ASSERT_TRUE(soap_build(action));
+    int len = soap_format(buffer,sizeof(buffer),action,"192.168.1.20");
+    TEST_ASSERT_GREATER_THAN(0,len);
+    buffer[len]=0;
+    const char* start = "POST /MediaRenderer/RenderingControl/Control HTTP/1.1\r\nHost: 192.168.1.20:1400\r\n";
+    TEST_ASSERT_EQUAL_INT(0,strncmp(buffer,start,strlen(start)));
+    TEST_ASSERT_EQUAL_STRING(action->request,buffer+strlen(start));
+    // the length covers the whole request, and nothing else
+    char value[16];
+    TEST_ASSERT_NOT_NULL(header_value(buffer,"Content-Length",value,sizeof(value)));
+    TEST_ASSERT_EQUAL_INT(len,(int)(strstr(buffer,"\r\n\r\n")+4-buffer)+atoi(value));
+}
+static void test_format_too_small() {
+    soap_action* action = soap_action_for("Play");
+    TEST_ASSERT_TRUE(soap_build(action));
+    int len = soap_format(buffer,sizeof(buffer),action,"speaker");
+    TEST_ASSERT_GREATER_THAN(0,len);
+    TEST_ASSERT_EQUAL_INT(len,soap_format(buffer,len,action,"speaker"));
+    TEST_ASSERT_EQUAL_INT(-1,soap_format(buffer,len-1,action,"speaker"));
+    TEST_ASSERT_EQUAL_INT(-1,soap_format(buffer,16,action,"speaker"));
+}
+static void test_speaker_accepts_every_action() {
+    for(size_t i = 0;i<soap_action_count;++i) {
+        TEST_ASSERT_TRUE(soap_build(&soap_actions[i]));
+        TEST_ASSERT_EQUAL_INT(200,soap_command(soap_actions[i].name));
+    }
+    // playpause took two
+    TEST_ASSERT_EQUAL_INT((int)soap_action_count+1,(int)speaker_actions);
+    TEST_ASSERT_EQUAL_INT(0,(int)speaker_faults);
+    // all on the one connection
+    TEST_ASSERT_EQUAL_INT(1,(int)speaker.accepted);
+}
+static void test_speaker_rejects_bad_length() {
+    soap_action* action = soap_action_for("Next");
+    TEST_ASSERT_TRUE(soap_build(action));
+    int len = soap_format(buffer,sizeof(buffer),action,"127.0.0.1");
+    buffer[len]=0;
+    // claim a byte less than the body has
+    std::string request = buffer;
+    size_t at = request.find("Content-Length: ")+16;
+    size_t digits = request.find("\r\n",at)-at;
+    request.replace(at,digits,std::to_string(atoi(request.c_str()+at)-1));
+    socket_client client;
+    TEST_ASSERT_TRUE(client.connect(speaker.port));
+    TEST_ASSERT_EQUAL_UINT32(request.size(),client.write((const uint8_t*)request.data(),request.size()));
+    TEST_ASSERT_EQUAL_INT(500,http_read_status(client,buffer,sizeof(buffer),http_millis()+1000,nullptr,0));
+    TEST_ASSERT_EQUAL_INT(1,(int)speaker_faults);
+}
+static void test_playpause_toggles() {
+    speaker_playing = false;
+    TEST_ASSERT_TRUE(soap_build(soap_action_for("GetTransportInfo")));
+    TEST_ASSERT_TRUE(soap_build(soap_action_for("Play")));
+    TEST_ASSERT_TRUE(soap_build(soap_action_for("Pause")));
+    TEST_ASSERT_EQUAL_INT(200,soap_command("PlayPause"));
+    TEST_ASSERT_TRUE(speaker_playing);
+    TEST_ASSERT_EQUAL_INT(200,soap_command("playpause"));
+    TEST_ASSERT_FALSE(speaker_playing);
+}
+static void test_direct_is_faster_than_bridge() {
+    const int commands = 100;
+    TEST_ASSERT_TRUE(soap_build(soap_action_for("Next")));
+    // warm both connections first
+    TEST_ASSERT_EQUAL_INT(200,soap_command("Next"));
+    TEST_ASSERT_EQUAL_INT(200,bridge_command("Next"));
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    for(int i = 0;i<commands;++i) {
+        TEST_ASSERT_EQUAL_INT(200,soap_command("Next"));
+    }
+    long direct_us = (long)duration_cast<microseconds>(steady_clock::now()-start).count();
+    int before = speaker_actions;
+    start = steady_clock::now();
+    for(int i = 0;i<commands;++i) {
+        TEST_ASSERT_EQUAL_INT(200,bridge_command("Next"));
+    }
+    long bridge_us = (long)duration_cast<microseconds>(steady_clock::now()-start).count();
+    // every bridge command reached the speaker
+    TEST_ASSERT_EQUAL_INT(before+commands,(int)speaker_actions);
+    TEST_ASSERT_EQUAL_INT(0,(int)speaker_faults);
+    char msg[128];
+    snprintf(msg,sizeof(msg),"%d commands: %ldus each straight to the speaker, %ldus each through the bridge",
+        commands,direct_us/commands,bridge_us/commands);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_LESS_THAN(bridge_us,direct_us);
+}
+
+int main(int argc,char** argv) {
+    // on the speakers' port if we can have it
+    speaker.port = soap_port;
+    speaker.serve = serve_speaker;
+    if(!stub_start(&speaker)) {
+        speaker.port = 0;
+        stub_start(&speaker);
+    }
+    bridge.serve = serve_bridge;
+    stub_start(&bridge);
+    UNITY_BEGIN();
+    RUN_TEST(test_action_lookup);
+    RUN_TEST(test_playpause_has_no_request);
+    RUN_TEST(test_build_is_idempotent);
+    RUN_TEST(test_content_length_matches_body);
+    RUN_TEST(test_soapaction_names_the_action);
+    RUN_TEST(test_format_request);
+    RUN_TEST(test_format_too_small);
+    RUN_TEST(test_speaker_accepts_every_action);
+    RUN_TEST(test_speaker_rejects_bad_length);
+    RUN_TEST(test_playpause_toggles);
+    RUN_TEST(test_direct_is_faster_than_bridge);
+    int result = UNITY_END();
+    speaker_conn.client.stop();
+    bridge_conn.client.stop();
+    stub_stop(&bridge);
+    stub_stop(&speaker);
+    for(size_t i = 0;i<soap_action_count;++i) {
+        free(soap_actions[i].request);
+        soap_actions[i].request = nullptr;
+    }
+    return result;
+}
@@ -0,0 +1,412 @@
+// discovery against a simulated house of speakers on
+// loopback addresses. the responder stands in for the
+// multicast group: it checks the M-SEARCH, then each speaker
+// answers from its own address at a random point in the MX
+// window, twice, the way SSDP repeats itself over UDP. a
+// router answers too, for something else. each speaker serves
+// its device description from its own address, and notes
+// whether we hung up once we had it
+#include <unity.h>
+#include <ssdp.hpp>
+#include <http_pool.hpp>
+#include "../socket_stub.hpp"
+#include <chrono>
+#include <random>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+uint32_t http_millis() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+void http_idle() {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+constexpr static const int speaker_count = 55;
+// the first few are stereo pairs, which share a room
+constexpr static const int pair_count = 3;
+static uint32_t speaker_address(int i) {
+    return htonl(INADDR_LOOPBACK+10+i);
+}
+static std::string speaker_room(int i) {
+    if(i<pair_count*2) {
+        return "Pair "+std::to_string(i/2);
+    }
+    return "Room "+std::to_string(i);
+}
+static const uint32_t router_address = htonl(INADDR_LOOPBACK+250);
+
+struct stub_speaker {
+    stub_server server;
+    int udp = -1;
+    std::atomic<int> described{0};
+    // connections we closed, and ones the speaker gave up on
+    std::atomic<int> closed{0};
+    std::atomic<int> left_open{0};
+    std::atomic<bool> broken{false};
+};
+static stub_speaker speakers[speaker_count];
+static int router_udp = -1;
+static uint16_t description_port = 0;
+
+static void serve_description(int i,int fd) {
+    stub_speaker& speaker = speakers[i];
+    std::string pending;
+    std::string request;
+    if(!stub_read_request(fd,&pending,&request)) {
+        return;
+    }
+    if(speaker.broken || 0!=request.find("GET /xml/device_description.xml HTTP/1.1\r\n")) {
+        stub_send(fd,"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    } else {
+        ++speaker.described;
+        std::string body = "<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
+            "<root xmlns=\"urn:schemas-upnp-org:device-1-0\"><specVersion><major>1</major><minor>0</minor></specVersion>"
+            "<device><deviceType>urn:schemas-upnp-org:device:ZonePlayer:1</deviceType>"
+            "<friendlyName>127.0.0." + std::to_string(10+i) + " - Sonos One</friendlyName>"
+            "<manufacturer>Sonos, Inc.</manufacturer><modelNumber>S18</modelNumber>"
+            "<roomName>" + speaker_room(i) + "</roomName><displayName>One</displayName>"
+            "<serviceList>" + std::string(4000,' ') + "</serviceList></device></root>";
+        stub_send(fd,"HTTP/1.1 200 OK\r\nCONTENT-TYPE: text/xml; charset=\"utf-8\"\r\n"
+            "Content-Length: "+std::to_string(body.size())+"\r\nConnection: keep-alive\r\n\r\n"+body);
+    }
+    // a speaker keeps the connection. we should be the ones
+    // to close it. it's reset if we hung up without reading
+    // the whole description
+    timeval timeout = {1,0};
+    setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+    char ch;
+    ssize_t r = recv(fd,&ch,1,0);
+    if(r==0 || (r<0 && errno==ECONNRESET)) {
+        ++speaker.closed;
+    } else {
+        ++speaker.left_open;
+    }
+}
+static int udp_socket(uint32_t address) {
+    int fd = socket(AF_INET,SOCK_DGRAM,0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = address;
+    TEST_ASSERT_EQUAL_INT(0,bind(fd,(sockaddr*)&addr,sizeof(addr)));
+    return fd;
+}
+
+// the multicast group
+static int group_udp = -1;
+static uint16_t group_port = 0;
+static std::thread group_thread;
+// the searches the speakers would have answered
+static std::atomic<int> searches(0);
+static bool header_is(const std::string& request,const char* name,const char* value) {
+    std::string line = std::string("\r\n")+name+": "+value+"\r\n";
+    return std::string::npos!=request.find(line);
+}
+static void group_serve() {
+    std::mt19937 random(25);
+    char buf[1024];
+    while(true) {
+        sockaddr_in from = {};
+        socklen_t from_size = sizeof(from);
+        ssize_t r = recvfrom(group_udp,buf,sizeof(buf)-1,0,(sockaddr*)&from,&from_size);
+        if(r<=0) {
+            break;
+        }
+        std::string request(buf,r);
+        // what a speaker needs to see before it answers
+        if(0!=request.find("M-SEARCH * HTTP/1.1\r\n") ||
+                !header_is(request,"MAN","\"ssdp:discover\"") ||
+                !header_is(request,"ST","urn:schemas-upnp-org:device:ZonePlayer:1") ||
+                std::string::npos==request.find("\r\nMX: ")) {
+            continue;
+        }
+        ++searches;
+        int mx = atoi(request.c_str()+request.find("\r\nMX: ")+6);
+        // who answers when
+        std::vector<std::pair<int,int>> answers;
+        std::uniform_int_distribution<int> when(0,mx*1000-1);
+        for(int i = 0;i<speaker_count;++i) {
+            answers.push_back({when(random),i});
+            answers.push_back({when(random),i});
+        }
+        answers.push_back({when(random),-1});
+        std::sort(answers.begin(),answers.end());
+        auto start = std::chrono::steady_clock::now();
+        for(const auto& answer : answers) {
+            std::this_thread::sleep_until(start+std::chrono::milliseconds(answer.first));
+            std::string response;
+            int fd;
+            if(answer.second<0) {
+                fd = router_udp;
+                response = "HTTP/1.1 200 OK\r\nCACHE-CONTROL: max-age=120\r\n"
+                    "ST: urn:schemas-upnp-org:device:InternetGatewayDevice:1\r\n"
+                    "USN: uuid:router::urn:schemas-upnp-org:device:InternetGatewayDevice:1\r\n\r\n";
+            } else {
+                fd = speakers[answer.second].udp;
+                response = "HTTP/1.1 200 OK\r\nCACHE-CONTROL: max-age = 1800\r\nEXT:\r\n"
+                    "LOCATION: http://127.0.0." + std::to_string(10+answer.second) + ":1400/xml/device_description.xml\r\n"
+                    "SERVER: Linux UPnP/1.0 Sonos/70.3-35220 (ZPS1)\r\n"
+                    "ST: urn:schemas-upnp-org:device:ZonePlayer:1\r\n"
+                    "USN: uuid:RINCON_000E58" + std::to_string(100000+answer.second) + "01400::urn:schemas-upnp-org:device:ZonePlayer:1\r\n"
+                    "X-RINCON-HOUSEHOLD: Sonos_test\r\n\r\n";
+            }
+            sendto(fd,response.data(),response.size(),0,(sockaddr*)&from,from_size);
+        }
+    }
+}
+
+// the device's side: a UDP socket for the search, and a
+// connection of its own for each description
+struct test_network {
+    int fd = -1;
+    int failures = 0;
+    uint32_t search_ms = 0;
+    // when each speaker's first answer reached us
+    std::map<uint32_t,uint32_t> first_answer_ms;
+    std::vector<std::string> rooms;
+    uint32_t now_ms() {
+        return http_millis();
+    }
+    bool search(const char* msearch,size_t len) {
+        search_ms = now_ms();
+        fd = udp_socket(htonl(INADDR_LOOPBACK));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(group_port);
+        return (ssize_t)len==sendto(fd,msearch,len,0,(sockaddr*)&addr,sizeof(addr));
+    }
+    int receive(char* buf,size_t size,uint32_t* address) {
+        sockaddr_in from = {};
+        socklen_t from_size = sizeof(from);
+        ssize_t r = recvfrom(fd,buf,size,MSG_DONTWAIT,(sockaddr*)&from,&from_size);
+        if(r<0) {
+            return -1;
+        }
+        *address = from.sin_addr.s_addr;
+        if(first_answer_ms.find(*address)==first_answer_ms.end()) {
+            first_answer_ms[*address] = now_ms();
+        }
+        return (int)r;
+    }
+    void search_done() {
+        close(fd);
+        fd = -1;
+    }
+    bool describe(uint32_t address,char* body,size_t size) {
+        // what the device's ssdp_network does, over a socket
+        char buffer[1024];
+        socket_client client;
+        if(!client.connect(description_port,address)) {
+            return false;
+        }
+        bool result = http_write_requests(client,buffer,sizeof(buffer),"speaker","/xml/device_description.xml",1) &&
+            200==http_read_status(client,buffer,sizeof(buffer),http_millis()+1000,body,size);
+        client.stop();
+        return result;
+    }
+    void found(const ssdp_speaker& s) {
+        rooms.push_back(s.room);
+    }
+    void failed(const ssdp_speaker& s) {
+        ++failures;
+    }
+};
+
+static ssdp_discovery discovery;
+static test_network network;
+static char buffer[1024];
+static char body[2048];
+
+// search and listen on idle passes of the network task,
+// like ssdp_update(). returns how long listening took
+static uint32_t run_search() {
+    uint32_t start = http_millis();
+    TEST_ASSERT_TRUE(ssdp_search(&discovery,network));
+    TEST_ASSERT_TRUE(ssdp_state::listening==discovery.status);
+    while(!ssdp_listen(&discovery,network,buffer,sizeof(buffer))) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    TEST_ASSERT_TRUE(ssdp_state::describing==discovery.status);
+    return http_millis()-start;
+}
+static int speaker_for(uint32_t address) {
+    for(int i = 0;i<speaker_count;++i) {
+        if(speaker_address(i)==address) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void setUp(void) {
+    memset(&discovery,0,sizeof(discovery));
+    network = test_network();
+    searches = 0;
+    for(stub_speaker& s : speakers) {
+        s.described = 0;
+        s.closed = 0;
+        s.left_open = 0;
+        s.broken = false;
+    }
+}
+void tearDown(void) {
+    if(network.fd>=0) {
+        network.search_done();
+    }
+}
+
+static void test_zone_player_answers() {
+    TEST_ASSERT_TRUE(ssdp_is_zone_player(
+        "HTTP/1.1 200 OK\r\nEXT:\r\nST: urn:schemas-upnp-org:device:ZonePlayer:1\r\nUSN: uuid:RINCON_1\r\n\r\n"));
+    // header names are case insensitive
+    TEST_ASSERT_TRUE(ssdp_is_zone_player(
+        "HTTP/1.1 200 OK\r\nst:urn:schemas-upnp-org:device:ZonePlayer:1\r\n\r\n"));
+    TEST_ASSERT_FALSE(ssdp_is_zone_player(
+        "HTTP/1.1 200 OK\r\nST: urn:schemas-upnp-org:device:InternetGatewayDevice:1\r\n"
+        "USN: uuid:x::urn:schemas-upnp-org:device:ZonePlayer:1\r\n\r\n"));
+    // another search, or an announcement, isn't an answer
+    TEST_ASSERT_FALSE(ssdp_is_zone_player(ssdp_msearch));
+    TEST_ASSERT_FALSE(ssdp_is_zone_player(
+        "NOTIFY * HTTP/1.1\r\nNT: urn:schemas-upnp-org:device:ZonePlayer:1\r\n\r\n"));
+    TEST_ASSERT_FALSE(ssdp_is_zone_player(
+        "HTTP/1.1 404 Not Found\r\nST: urn:schemas-upnp-org:device:ZonePlayer:1\r\n\r\n"));
+    TEST_ASSERT_FALSE(ssdp_is_zone_player(""));
+}
+static void test_add_dedupes_and_fills() {
+    TEST_ASSERT_NOT_NULL(ssdp_add(&discovery,1));
+    TEST_ASSERT_NULL(ssdp_add(&discovery,1));
+    TEST_ASSERT_EQUAL_UINT32(1,discovery.duplicates);
+    for(uint32_t i = 2;i<=ssdp_max_speakers;++i) {
+        TEST_ASSERT_NOT_NULL(ssdp_add(&discovery,i));
+    }
+    TEST_ASSERT_NULL(ssdp_add(&discovery,1000));
+    TEST_ASSERT_EQUAL_INT((int)ssdp_max_speakers,discovery.count);
+}
+static void test_room_for() {
+    char room[16];
+    TEST_ASSERT_TRUE(ssdp_room_for("<device><roomName>Kitchen</roomName>",room,sizeof(room)));
+    TEST_ASSERT_EQUAL_STRING("Kitchen",room);
+    TEST_ASSERT_FALSE(ssdp_room_for("<device><roomName>Kitchen",room,sizeof(room)));
+    TEST_ASSERT_FALSE(ssdp_room_for("<device><displayName>One</displayName>",room,sizeof(room)));
+    // too long to keep
+    TEST_ASSERT_FALSE(ssdp_room_for("<roomName>A Very Long Room Name</roomName>",room,sizeof(room)));
+}
+static void test_finds_every_speaker_once() {
+    uint32_t elapsed = run_search();
+    TEST_ASSERT_EQUAL_INT(1,(int)searches);
+    TEST_ASSERT_EQUAL_INT(speaker_count,discovery.count);
+    // each answered twice and the router once
+    TEST_ASSERT_EQUAL_UINT32(speaker_count,discovery.duplicates);
+    TEST_ASSERT_EQUAL_UINT32(1,discovery.ignored);
+    for(int i = 0;i<speaker_count;++i) {
+        int found = 0;
+        for(int j = 0;j<discovery.count;++j) {
+            found+=discovery.speakers[j].address==speaker_address(i);
+        }
+        TEST_ASSERT_EQUAL_INT(1,found);
+    }
+    for(int j = 0;j<discovery.count;++j) {
+        TEST_ASSERT_FALSE(discovery.speakers[j].described);
+    }
+    // all inside the listening window, which ends on time
+    uint32_t last = 0;
+    for(const auto& answer : network.first_answer_ms) {
+        if(answer.first!=router_address && answer.second-network.search_ms>last) {
+            last = answer.second-network.search_ms;
+        }
+    }
+    char msg[96];
+    snprintf(msg,sizeof(msg),"%d speakers found, the last %dms after the search, listened %dms",
+        discovery.count,(int)last,(int)elapsed);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_LESS_THAN(ssdp_listen_ms,last);
+    TEST_ASSERT_GREATER_OR_EQUAL(ssdp_listen_ms,elapsed);
+    TEST_ASSERT_LESS_THAN(ssdp_listen_ms+250,elapsed);
+    TEST_ASSERT_EQUAL_INT(-1,network.fd);
+}
+static void test_describes_each_once() {
+    run_search();
+    int calls = 0;
+    while(ssdp_describe_next(&discovery,network,body,sizeof(body))) {
+        ++calls;
+    }
+    // one speaker per call, so commands only ever wait on one
+    TEST_ASSERT_EQUAL_INT(speaker_count,calls);
+    TEST_ASSERT_TRUE(ssdp_state::done==discovery.status);
+    TEST_ASSERT_EQUAL_INT(0,network.failures);
+    for(int i = 0;i<speaker_count;++i) {
+        TEST_ASSERT_EQUAL_INT(1,(int)speakers[i].described);
+    }
+    for(int j = 0;j<discovery.count;++j) {
+        std::string room = speaker_room(speaker_for(discovery.speakers[j].address));
+        TEST_ASSERT_EQUAL_STRING(room.c_str(),discovery.speakers[j].room);
+    }
+    // a pair is saved once
+    TEST_ASSERT_EQUAL_INT(speaker_count-pair_count,(int)network.rooms.size());
+    std::sort(network.rooms.begin(),network.rooms.end());
+    TEST_ASSERT_TRUE(network.rooms.end()==std::adjacent_find(network.rooms.begin(),network.rooms.end()));
+    // we hung up on every one of them
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    for(int i = 0;i<speaker_count;++i) {
+        TEST_ASSERT_EQUAL_INT(1,(int)speakers[i].closed);
+        TEST_ASSERT_EQUAL_INT(0,(int)speakers[i].left_open);
+    }
+}
+static void test_describe_failure_moves_on() {
+    run_search();
+    TEST_ASSERT_EQUAL_INT(speaker_count,discovery.count);
+    int broken = speaker_for(discovery.speakers[0].address);
+    speakers[broken].broken = true;
+    while(ssdp_describe_next(&discovery,network,body,sizeof(body))) {
+    }
+    TEST_ASSERT_EQUAL_INT(1,network.failures);
+    TEST_ASSERT_EQUAL_STRING("",discovery.speakers[0].room);
+    for(int j = 1;j<discovery.count;++j) {
+        TEST_ASSERT_TRUE(discovery.speakers[j].room[0]!=0);
+    }
+}
+
+int main(int argc,char** argv) {
+    group_udp = udp_socket(htonl(INADDR_LOOPBACK));
+    sockaddr_in addr = {};
+    socklen_t size = sizeof(addr);
+    getsockname(group_udp,(sockaddr*)&addr,&size);
+    group_port = ntohs(addr.sin_port);
+    router_udp = udp_socket(router_address);
+    for(int i = 0;i<speaker_count;++i) {
+        stub_speaker& s = speakers[i];
+        s.udp = udp_socket(speaker_address(i));
+        // every speaker on the same port, like 1400
+        s.server.address = speaker_address(i);
+        s.server.port = description_port;
+        s.server.serve = [i](int fd) {
+            serve_description(i,fd);
+        };
+        if(!stub_start(&s.server)) {
+            printf("Can't listen on 127.0.0.%d:%d\n",10+i,(int)description_port);
+            return 1;
+        }
+        description_port = s.server.port;
+    }
+    group_thread = std::thread(group_serve);
+    UNITY_BEGIN();
+    RUN_TEST(test_zone_player_answers);
+    RUN_TEST(test_add_dedupes_and_fills);
+    RUN_TEST(test_room_for);
+    RUN_TEST(test_finds_every_speaker_once);
+    RUN_TEST(test_describes_each_once);
+    RUN_TEST(test_describe_failure_moves_on);
+    int result = UNITY_END();
+    shutdown(group_udp,SHUT_RDWR);
+    close(group_udp);
+    group_thread.join();
+    for(stub_speaker& s : speakers) {
+        stub_stop(&s.server);
+        close(s.udp);
+    }
+    close(router_udp);
+    return result;
+}
@@ -0,0 +1,286 @@
+// resuming TLS sessions against an in-process OpenSSL server,
+// with the session cache running over OpenSSL the way it
+// runs over mbedtls on the device. the handshake is TLS 1.2,
+// as the device's mbedtls speaks it
+#include <unity.h>
+#include <tls_session.hpp>
+#include "../socket_stub.hpp"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+void http_idle() {
+    std::this_thread::yield();
+}
+
+struct openssl_sessions {
+    using session = SSL_SESSION*;
+    void init(session* s) {
+        *s = nullptr;
+    }
+    void clear(session* s) {
+        SSL_SESSION_free(*s);
+        *s = nullptr;
+    }
+    tls_save save(const session& s,uint8_t* data,size_t size,size_t* needed) {
+        // OpenSSL has no way to leave the certificate out, so
+        // it's counted here. the server's is a small EC one
+        int len = i2d_SSL_SESSION(s,nullptr);
+        if(len<=0) {
+            return tls_save::failed;
+        }
+        *needed = (size_t)len;
+        if((size_t)len>size) {
+            return tls_save::too_big;
+        }
+        unsigned char* out = data;
+        i2d_SSL_SESSION(s,&out);
+        return tls_save::saved;
+    }
+    bool load(session* s,const uint8_t* data,size_t size) {
+        const unsigned char* in = data;
+        SSL_SESSION* loaded = d2i_SSL_SESSION(nullptr,&in,(long)size);
+        if(loaded==nullptr) {
+            return false;
+        }
+        SSL_SESSION_free(*s);
+        *s = loaded;
+        return true;
+    }
+    bool same_master(const session& a,const session& b) {
+        unsigned char ma[64];
+        unsigned char mb[64];
+        size_t la = SSL_SESSION_get_master_key(a,ma,sizeof(ma));
+        size_t lb = SSL_SESSION_get_master_key(b,mb,sizeof(mb));
+        return la>0 && la==lb && 0==memcmp(ma,mb,la);
+    }
+};
+
+static openssl_sessions tls;
+static tls_saved_sessions saved;
+static tls_session_cache<openssl_sessions> cache;
+static SSL_CTX* client_ctx = nullptr;
+static SSL_CTX* server_ctx = nullptr;
+static stub_server server;
+static std::atomic<int> server_resumed{0};
+static std::atomic<int> server_full{0};
+
+static SSL_CTX* make_server_ctx() {
+    // a throwaway P-256 key and self-signed certificate
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(cert),1);
+    X509_gmtime_adj(X509_getm_notBefore(cert),0);
+    X509_gmtime_adj(X509_getm_notAfter(cert),60*60);
+    X509_set_pubkey(cert,key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name,"CN",MBSTRING_ASC,(const unsigned char*)"bridge.local",-1,-1,0);
+    X509_set_issuer_name(cert,name);
+    X509_sign(cert,key,EVP_sha256());
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_set_max_proto_version(ctx,TLS1_2_VERSION);
+    SSL_CTX_use_certificate(ctx,cert);
+    SSL_CTX_use_PrivateKey(ctx,key);
+    SSL_CTX_set_session_id_context(ctx,(const unsigned char*)"bridge",6);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ctx;
+}
+static void serve(int fd) {
+    // answer one line with "ok" and close
+    SSL* ssl = SSL_new(server_ctx);
+    SSL_set_fd(ssl,fd);
+    if(1==SSL_accept(ssl)) {
+        (SSL_session_reused(ssl)?server_resumed:server_full)++;
+        char buf[256];
+        if(0<SSL_read(ssl,buf,sizeof(buf))) {
+            SSL_write(ssl,"ok\n",3);
+        }
+        SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+}
+
+// one https request the way tls_client::handshake() makes
+// it: offer what we have, handshake, decide whether it
+// resumed, and keep the session either way
+struct exchange {
+    bool ok;
+    bool resumed;
+    // what OpenSSL says, to check us against
+    bool reused;
+    double handshake_us;
+    tls_save saved;
+    size_t size;
+};
+static exchange request(const char* host,uint16_t port) {
+    exchange result = {false,false,false,0,tls_save::failed,0};
+    int fd = socket(AF_INET,SOCK_STREAM,0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TEST_ASSERT_EQUAL_INT(0,connect(fd,(sockaddr*)&addr,sizeof(addr)));
+    int one = 1;
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    SSL* ssl = SSL_new(client_ctx);
+    SSL_set_fd(ssl,fd);
+    SSL_SESSION** offered = tls_session_offer(&cache,tls,host,port);
+    if(offered!=nullptr && 1!=SSL_set_session(ssl,*offered)) {
+        offered = nullptr;
+    }
+    auto start = std::chrono::steady_clock::now();
+    int ret = SSL_connect(ssl);
+    result.handshake_us = std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now()-start).count();
+    if(ret!=1) {
+        if(offered!=nullptr) {
+            tls_session_forget(&cache,tls,host,port);
+        }
+    } else {
+        result.reused = 1==SSL_session_reused(ssl);
+        SSL_SESSION* session = SSL_get1_session(ssl);
+        result.resumed = tls_session_resumed(tls,offered,session);
+        result.saved = tls_session_store(&cache,tls,host,port,&session,&result.size);
+        char buf[16];
+        result.ok = 4==SSL_write(ssl,"GET\n",4) && 3==SSL_read(ssl,buf,sizeof(buf));
+    }
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(fd);
+    return result;
+}
+static void forget_all() {
+    for(size_t i = 0;i<tls_session_slots;++i) {
+        tls.clear(&cache.live[i]);
+    }
+    memset(&saved,0,sizeof(saved));
+    tls_session_init(&cache,tls,&saved);
+}
+static double median(std::vector<double> v) {
+    std::sort(v.begin(),v.end());
+    return v[v.size()/2];
+}
+
+void setUp(void) {
+    forget_all();
+    server_resumed = 0;
+    server_full = 0;
+}
+void tearDown(void) {
+}
+
+static void test_second_handshake_resumes() {
+    exchange first = request("bridge.local",5006);
+    TEST_ASSERT_TRUE(first.ok);
+    TEST_ASSERT_FALSE(first.resumed);
+    TEST_ASSERT_FALSE(first.reused);
+    TEST_ASSERT_TRUE(first.saved==tls_save::saved);
+    TEST_ASSERT_LESS_OR_EQUAL(TLS_SESSION_SIZE,first.size);
+    exchange second = request("bridge.local",5006);
+    TEST_ASSERT_TRUE(second.ok);
+    TEST_ASSERT_TRUE(second.resumed);
+    TEST_ASSERT_TRUE(second.reused);
+    TEST_ASSERT_EQUAL_INT(1,server_full.load());
+    TEST_ASSERT_EQUAL_INT(1,server_resumed.load());
+}
+static void test_resumed_is_cheaper() {
+    // full handshakes each start from nothing. resumed ones
+    // each follow the first
+    std::vector<double> full;
+    std::vector<double> resumed;
+    for(int i = 0;i<50;++i) {
+        forget_all();
+        exchange e = request("bridge.local",5006);
+        TEST_ASSERT_TRUE(e.ok && !e.resumed);
+        full.push_back(e.handshake_us);
+    }
+    for(int i = 0;i<50;++i) {
+        exchange e = request("bridge.local",5006);
+        TEST_ASSERT_TRUE(e.ok && e.resumed);
+        resumed.push_back(e.handshake_us);
+    }
+    double f = median(full);
+    double r = median(resumed);
+    printf("handshake median: full %.0fus, resumed %.0fus\n",f,r);
+    TEST_ASSERT_TRUE(r<f);
+}
+static void test_resumes_after_sleep() {
+    TEST_ASSERT_TRUE(request("bridge.local",5006).ok);
+    // deep sleep keeps the RTC copy and nothing else
+    for(size_t i = 0;i<tls_session_slots;++i) {
+        tls.clear(&cache.live[i]);
+    }
+    tls_session_init(&cache,tls,&saved);
+    exchange e = request("bridge.local",5006);
+    TEST_ASSERT_TRUE(e.ok);
+    TEST_ASSERT_TRUE(e.resumed);
+    TEST_ASSERT_TRUE(e.reused);
+}
+static void test_server_forgot() {
+    // a server that restarted takes neither its old session
+    // ids nor its old tickets. the master secret tells us
+    TEST_ASSERT_TRUE(request("bridge.local",5006).ok);
+    SSL_CTX* old = server_ctx;
+    server_ctx = make_server_ctx();
+    exchange e = request("bridge.local",5006);
+    TEST_ASSERT_TRUE(e.ok);
+    TEST_ASSERT_FALSE(e.reused);
+    TEST_ASSERT_FALSE(e.resumed);
+    // and the new session is the one we keep
+    e = request("bridge.local",5006);
+    TEST_ASSERT_TRUE(e.resumed);
+    SSL_CTX_free(old);
+}
+static void test_sessions_per_server() {
+    // the server is the same socket, but we key by the
+    // host and port api.txt names
+    TEST_ASSERT_TRUE(request("a.local",5006).ok);
+    TEST_ASSERT_TRUE(request("b.local",5006).ok);
+    TEST_ASSERT_EQUAL_INT(0,tls_slot_for(&saved,"a.local",5006));
+    TEST_ASSERT_EQUAL_INT(1,tls_slot_for(&saved,"b.local",5006));
+    TEST_ASSERT_EQUAL_INT(-1,tls_slot_for(&saved,"a.local",443));
+    TEST_ASSERT_TRUE(request("a.local",5006).resumed);
+    // a third takes the oldest slot
+    TEST_ASSERT_FALSE(request("c.local",5006).resumed);
+    TEST_ASSERT_EQUAL_INT(0,tls_slot_for(&saved,"c.local",5006));
+    TEST_ASSERT_EQUAL_INT(-1,tls_slot_for(&saved,"a.local",5006));
+    TEST_ASSERT_TRUE(request("b.local",5006).resumed);
+    TEST_ASSERT_FALSE(request("a.local",5006).resumed);
+    // a host too long to key by isn't kept
+    std::string host(64,'h');
+    exchange e = request(host.c_str(),5006);
+    TEST_ASSERT_TRUE(e.ok);
+    TEST_ASSERT_TRUE(e.saved==tls_save::skipped);
+    TEST_ASSERT_FALSE(request(host.c_str(),5006).resumed);
+}
+static void test_forget() {
+    TEST_ASSERT_TRUE(request("bridge.local",5006).ok);
+    tls_session_forget(&cache,tls,"bridge.local",5006);
+    TEST_ASSERT_NULL(tls_session_offer(&cache,tls,"bridge.local",5006));
+    TEST_ASSERT_FALSE(request("bridge.local",5006).resumed);
+}
+
+int main(int argc,char** argv) {
+    client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_max_proto_version(client_ctx,TLS1_2_VERSION);
+    SSL_CTX_set_verify(client_ctx,SSL_VERIFY_NONE,nullptr);
+    server_ctx = make_server_ctx();
+    server.serve = serve;
+    if(!stub_start(&server)) {
+        return 1;
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_second_handshake_resumes);
+    RUN_TEST(test_resumed_is_cheaper);
+    RUN_TEST(test_resumes_after_sleep);
+    RUN_TEST(test_server_forgot);
+    RUN_TEST(test_sessions_per_server);
+    RUN_TEST(test_forget);
+    int result = UNITY_END();
+    stub_stop(&server);
+    return result;
+}
@@ -0,0 +1,234 @@
+// the compiled api.txt templates. the fuzz tests check the
+// compiler and renderer against a straightforward one pass
+// interpreter of the same rules, over random templates, rooms
+// and buffer sizes. the throughput test times them against
+// url encoding the room and snprintf()ing the line, which is
+// what the remote did before templates were compiled
+#include <unity.h>
+#include <url_template.hpp>
+#include <chrono>
+#include <random>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+static const char* params[(int)url_param::count] = {nullptr,nullptr,"50","Jazz%20Radio"};
+static url_token tokens[512];
+static char out[2048];
+static std::mt19937 rng(1234);
+
+// the rules, applied directly to the template
+static std::string reference_encode(const std::string& room) {
+    static const char* hex = "0123456789ABCDEF";
+    std::string result;
+    for(unsigned char ch : room) {
+        if(isalnum(ch) || ch=='~' || ch=='-' || ch=='.' || ch=='_') {
+            result+=(char)ch;
+        } else {
+            result+='%';
+            result+=hex[ch>>4];
+            result+=hex[ch&15];
+        }
+    }
+    return result;
+}
+static std::string reference_render(const std::string& fmt,const std::string& room) {
+    std::string result;
+    size_t i = 0;
+    while(i<fmt.size()) {
+        if(fmt.compare(i,2,"%%")==0) {
+            result+='%';
+            i+=2;
+        } else if(fmt.compare(i,2,"%s")==0 || fmt.compare(i,6,"{room}")==0) {
+            result+=reference_encode(room);
+            i+=fmt[i]=='%'?2:6;
+        } else if(fmt.compare(i,8,"{volume}")==0) {
+            result+=params[(int)url_param::volume];
+            i+=8;
+        } else if(fmt.compare(i,5,"{fav}")==0) {
+            result+=params[(int)url_param::fav];
+            i+=5;
+        } else {
+            result+=fmt[i++];
+        }
+    }
+    return result;
+}
+static int render(const char* fmt,const char* room,char* buf,size_t size) {
+    size_t count = url_compile(fmt,tokens,nullptr);
+    return url_render(tokens,count,room,params,buf,size);
+}
+static std::string random_template() {
+    static const char* pieces[] = {
+        "%","%%","%s","s","{","}","{room}","{volume}","{fav}","{nope}",
+        "{room","room}","/","http://bridge:5005/","next","a","Z","?x=1&"
+    };
+    std::string result;
+    int n = rng()%12;
+    for(int i = 0;i<n;++i) {
+        result+=pieces[rng()%(sizeof(pieces)/sizeof(pieces[0]))];
+    }
+    return result;
+}
+static std::string random_room() {
+    std::string result;
+    int n = rng()%12;
+    for(int i = 0;i<n;++i) {
+        // any byte but the terminator
+        result+=(char)(1+rng()%255);
+    }
+    return result;
+}
+
+void setUp(void) {
+}
+void tearDown(void) {
+}
+
+static void test_placeholders() {
+    TEST_ASSERT_EQUAL_INT(54,render("http://bridge:5005/{room}/favorite/{fav}","Living Room",out,sizeof(out)));
+    TEST_ASSERT_EQUAL_STRING("http://bridge:5005/Living%20Room/favorite/Jazz%20Radio",out);
+    render("http://bridge:5005/%s/volume/{volume}","Kids' Room",out,sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("http://bridge:5005/Kids%27%20Room/volume/50",out);
+}
+static void test_percent_percent_is_always_percent() {
+    // with or without a %s on the line
+    render("http://bridge/say/100%%25","Den",out,sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("http://bridge/say/100%25",out);
+    render("http://bridge/%s/say/100%%25","Den",out,sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("http://bridge/Den/say/100%25",out);
+    // a stray % is just text
+    render("http://bridge/%x/%","Den",out,sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("http://bridge/%x/%",out);
+}
+static void test_unknown_placeholder() {
+    bool unknown;
+    url_compile("http://bridge/{room}/{mood}",nullptr,&unknown);
+    TEST_ASSERT_TRUE(unknown);
+    url_compile("http://bridge/{room}/{fav",nullptr,&unknown);
+    TEST_ASSERT_FALSE(unknown);
+    render("http://bridge/{room}/{mood}","Den",out,sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("http://bridge/Den/{mood}",out);
+}
+static void test_missing_param_is_empty() {
+    const char* none[(int)url_param::count] = {};
+    size_t count = url_compile("http://bridge/{room}/volume/{volume}",tokens,nullptr);
+    url_render(tokens,count,"Den",none,out,sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("http://bridge/Den/volume/",out);
+}
+static void test_fuzz_matches_reference() {
+    for(int n = 0;n<20000;++n) {
+        std::string fmt = random_template();
+        std::string room = random_room();
+        std::string expected = reference_render(fmt,room);
+        // counting and compiling agree
+        size_t count = url_compile(fmt.c_str(),nullptr,nullptr);
+        TEST_ASSERT_LESS_OR_EQUAL(sizeof(tokens)/sizeof(tokens[0]),count);
+        TEST_ASSERT_EQUAL_INT((int)count,(int)url_compile(fmt.c_str(),tokens,nullptr));
+        // into a buffer of every size around the answer. the
+        // bytes past size must never be touched
+        size_t sizes[] = {0,1,expected.size(),expected.size()+1,expected.size()+2,(size_t)(rng()%(expected.size()+4))};
+        for(size_t size : sizes) {
+            memset(out,0x5A,sizeof(out));
+            int len = url_render(tokens,count,room.c_str(),params,out,size);
+            if(expected.size()<size) {
+                TEST_ASSERT_EQUAL_INT((int)expected.size(),len);
+                TEST_ASSERT_EQUAL_STRING(expected.c_str(),out);
+            } else {
+                TEST_ASSERT_EQUAL_INT(-1,len);
+            }
+            for(size_t i = size;i<size+8;++i) {
+                if(out[i]!=0x5A) {
+                    TEST_FAIL_MESSAGE("wrote past the end of the buffer");
+                }
+            }
+        }
+    }
+}
+static void test_fuzz_encode_round_trip() {
+    char decoded[64];
+    for(int n = 0;n<20000;++n) {
+        std::string room = random_room();
+        int len = url_encode_into(room.c_str(),out,sizeof(out));
+        TEST_ASSERT_EQUAL_INT((int)reference_encode(room).size(),len);
+        url_decode_into(out,len,decoded,sizeof(decoded));
+        TEST_ASSERT_EQUAL_STRING(room.c_str(),decoded);
+        // cut short, it never overruns
+        size_t size = rng()%(len+2);
+        memset(decoded,0x5A,sizeof(decoded));
+        size_t used = url_decode_into(out,len,decoded,size+1);
+        TEST_ASSERT_LESS_OR_EQUAL(size,used);
+        TEST_ASSERT_EQUAL_INT(0,decoded[used]);
+    }
+}
+static void test_throughput() {
+    // a typical api.txt against a typical house
+    static const char* fmts[] = {
+        "http://192.168.0.10:5005/%s/playpause",
+        "http://192.168.0.10:5005/%s/next",
+        "http://192.168.0.10:5005/%s/previous",
+        "http://192.168.0.10:5005/%s/volume/+5",
+        "http://192.168.0.10:5005/%s/volume/-5"
+    };
+    static const char* rooms[] = {"Living Room","Kitchen","Master Bedroom","Kids' Room","Office","Patio"};
+    const int fmt_count = sizeof(fmts)/sizeof(fmts[0]);
+    const int room_count = sizeof(rooms)/sizeof(rooms[0]);
+    const int iterations = 2000;
+    url_token compiled[fmt_count][8];
+    size_t counts[fmt_count];
+    for(int j = 0;j<fmt_count;++j) {
+        counts[j] = url_compile(fmts[j],compiled[j],nullptr);
+    }
+    using namespace std::chrono;
+    volatile size_t sink = 0;
+    auto ts = steady_clock::now();
+    for(int n = 0;n<iterations;++n) {
+        for(int i = 0;i<room_count;++i) {
+            // the old way
+            char encoded[128];
+            char* enc = encoded;
+            for(const char* str = rooms[i];*str;++str) {
+                int ch = (uint8_t)*str;
+                if(isalnum(ch) || ch=='~' || ch=='-' || ch=='.' || ch=='_') {
+                    *enc++=*str;
+                } else {
+                    enc+=sprintf(enc,"%%%02X",(uint8_t)*str);
+                }
+            }
+            *enc=0;
+            for(int j = 0;j<fmt_count;++j) {
+                sink+=snprintf(out,sizeof(out),fmts[j],encoded);
+            }
+        }
+    }
+    double legacy = duration<double,std::nano>(steady_clock::now()-ts).count();
+    ts = steady_clock::now();
+    for(int n = 0;n<iterations;++n) {
+        for(int i = 0;i<room_count;++i) {
+            for(int j = 0;j<fmt_count;++j) {
+                sink+=url_render(compiled[j],counts[j],rooms[i],params,out,sizeof(out));
+            }
+        }
+    }
+    double fast = duration<double,std::nano>(steady_clock::now()-ts).count();
+    int urls = iterations*room_count*fmt_count;
+    char msg[128];
+    snprintf(msg,sizeof(msg),"url_encode+snprintf %dns per url, compiled %dns per url (%.1fM urls/s)",
+        (int)(legacy/urls),(int)(fast/urls),urls/fast*1000.0);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(sink>0);
+    TEST_ASSERT_TRUE(fast<legacy);
+}
+
+int main(int argc,char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_placeholders);
+    RUN_TEST(test_percent_percent_is_always_percent);
+    RUN_TEST(test_unknown_placeholder);
+    RUN_TEST(test_missing_param_is_empty);
+    RUN_TEST(test_fuzz_matches_reference);
+    RUN_TEST(test_fuzz_encode_round_trip);
+    RUN_TEST(test_throughput);
+    return UNITY_END();
+}
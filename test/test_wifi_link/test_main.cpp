@@ -0,0 +1,186 @@
+// the connection state machine against a stub radio and a
+// clock we move by hand, so we can make the access point
+// fail and come back without waiting on real time
+#include <unity.h>
+#include <wifi_link.hpp>
+
+// a radio in front of an access point we can turn off
+struct stub_radio {
+    // whether the access point is answering
+    bool ap_up = true;
+    // how long it takes to associate and get an address
+    uint32_t join_ms = 500;
+    // the last access point is remembered for the fast path
+    bool cached = false;
+    bool joining = false;
+    uint32_t join_start = 0;
+    uint32_t* clock = nullptr;
+    // what the state machine asked for
+    int begins = 0;
+    int fast_begins = 0;
+    int forgets = 0;
+    int give_ups = 0;
+    int losses = 0;
+    int connects = 0;
+    uint32_t last_retry_ms = 0;
+    uint32_t last_outage_ms = 0;
+    bool begin() {
+        ++begins;
+        joining = true;
+        join_start = *clock;
+        if(cached) {
+            ++fast_begins;
+        }
+        return cached;
+    }
+    bool up() {
+        return ap_up && joining && *clock-join_start>=join_ms;
+    }
+    void forget() {
+        ++forgets;
+        joining = false;
+        cached = false;
+    }
+    void give_up(uint32_t retry_ms) {
+        ++give_ups;
+        joining = false;
+        last_retry_ms = retry_ms;
+    }
+    void lost() {
+        ++losses;
+        joining = false;
+    }
+    void connected(bool fast,uint32_t outage_ms) {
+        ++connects;
+        cached = true;
+        last_outage_ms = outage_ms;
+    }
+};
+
+static uint32_t now;
+static wifi_link link;
+static stub_radio radio;
+
+// pump it like loop() does, every 10ms
+static void run_for(uint32_t ms) {
+    uint32_t end = now+ms;
+    while((int32_t)(now-end)<0) {
+        wifi_link_update(&link,radio,now);
+        now+=10;
+    }
+}
+static void run_until(uint32_t ts) {
+    run_for(ts-now);
+}
+
+void setUp(void) {
+    // start near the wrap so the timing math is exercised
+    now = 0xFFFFFFFF-20000;
+    wifi_link_init(&link);
+    radio = stub_radio();
+    radio.clock = &now;
+}
+void tearDown(void) {
+}
+
+static void test_idle_until_requested() {
+    run_for(1000);
+    TEST_ASSERT_TRUE(wifi_state::idle==link.status);
+    TEST_ASSERT_EQUAL_INT(0,radio.begins);
+    link.requested = true;
+    run_for(1000);
+    TEST_ASSERT_TRUE(wifi_state::connected==link.status);
+    TEST_ASSERT_FALSE(link.requested);
+    TEST_ASSERT_EQUAL_INT(1,radio.connects);
+    TEST_ASSERT_EQUAL_UINT32(0,radio.last_outage_ms);
+}
+static void test_fast_rejoin_falls_back() {
+    // the cached access point is gone, but the network is up
+    radio.cached = true;
+    radio.join_ms = wifi_fast_timeout_ms+1000;
+    wifi_link_begin(&link,radio,now);
+    TEST_ASSERT_TRUE(wifi_state::joining_fast==link.status);
+    run_for(wifi_fast_timeout_ms+10);
+    TEST_ASSERT_EQUAL_INT(1,radio.forgets);
+    TEST_ASSERT_TRUE(wifi_state::joining==link.status);
+    radio.join_ms = 500;
+    run_for(1000);
+    TEST_ASSERT_TRUE(wifi_state::connected==link.status);
+    TEST_ASSERT_EQUAL_INT(2,radio.begins);
+    TEST_ASSERT_EQUAL_INT(1,radio.fast_begins);
+}
+static void test_ap_down_backs_off() {
+    radio.ap_up = false;
+    link.requested = true;
+    run_for(10);
+    // each failed attempt waits twice as long as the last
+    uint32_t expected = wifi_backoff_min_ms;
+    for(int i = 0;i<8;++i) {
+        run_until(link.start_ts+wifi_connect_timeout_ms+10);
+        TEST_ASSERT_TRUE(wifi_state::offline==link.status);
+        TEST_ASSERT_EQUAL_INT(i+1,radio.give_ups);
+        TEST_ASSERT_EQUAL_UINT32(expected,radio.last_retry_ms);
+        // it doesn't try again before the backoff is up
+        run_until(link.retry_ts-10);
+        TEST_ASSERT_TRUE(wifi_state::offline==link.status);
+        run_for(20);
+        TEST_ASSERT_TRUE(wifi_state::joining==link.status);
+        expected*=2;
+        if(expected>wifi_backoff_max_ms) {
+            expected = wifi_backoff_max_ms;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(wifi_backoff_max_ms,radio.last_retry_ms);
+    TEST_ASSERT_EQUAL_INT(0,radio.connects);
+}
+static void test_ap_returns() {
+    link.requested = true;
+    run_for(1000);
+    TEST_ASSERT_TRUE(wifi_state::connected==link.status);
+    // the access point goes away
+    radio.ap_up = false;
+    uint32_t down = now;
+    run_for(100);
+    TEST_ASSERT_EQUAL_INT(1,radio.losses);
+    TEST_ASSERT_TRUE(wifi_state::idle==link.status);
+    // the network task asks for it again, and we fail the
+    // fast rejoin, then a full connect, then it comes back
+    link.requested = true;
+    run_for(wifi_fast_timeout_ms+wifi_connect_timeout_ms+100);
+    TEST_ASSERT_EQUAL_INT(1,radio.forgets);
+    TEST_ASSERT_EQUAL_INT(1,radio.give_ups);
+    TEST_ASSERT_TRUE(wifi_state::offline==link.status);
+    radio.ap_up = true;
+    run_for(wifi_backoff_min_ms+1000);
+    TEST_ASSERT_TRUE(wifi_state::connected==link.status);
+    TEST_ASSERT_EQUAL_INT(2,radio.connects);
+    // the outage runs from losing it to getting it back
+    TEST_ASSERT_EQUAL_UINT32(1,link.outages);
+    TEST_ASSERT_GREATER_OR_EQUAL(now-down-1000,radio.last_outage_ms);
+    TEST_ASSERT_LESS_OR_EQUAL(now-down,radio.last_outage_ms);
+    TEST_ASSERT_EQUAL_UINT32(radio.last_outage_ms,link.outage_max_ms);
+    // and the backoff starts over for next time
+    TEST_ASSERT_EQUAL_UINT32(0,link.backoff_ms);
+}
+static void test_failed_first_connect_counts_as_outage() {
+    radio.ap_up = false;
+    link.requested = true;
+    uint32_t start = now;
+    run_for(wifi_connect_timeout_ms+10);
+    TEST_ASSERT_EQUAL_UINT32(start,link.down_ts);
+    radio.ap_up = true;
+    run_for(wifi_backoff_min_ms+1000);
+    TEST_ASSERT_TRUE(wifi_state::connected==link.status);
+    TEST_ASSERT_EQUAL_UINT32(1,link.outages);
+    TEST_ASSERT_EQUAL_UINT32(0,link.down_ts);
+}
+
+int main(int argc,char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_idle_until_requested);
+    RUN_TEST(test_fast_rejoin_falls_back);
+    RUN_TEST(test_ap_down_backs_off);
+    RUN_TEST(test_ap_returns);
+    RUN_TEST(test_failed_first_connect_counts_as_outage);
+    return UNITY_END();
+}
@@ -0,0 +1,186 @@
+// who's grouped with whom, read from a recorded /zones the
+// way zones_update() reads it, and the room state and
+// prefetch bookkeeping around it. speakers.csv here has
+// some of the recorded rooms and one /zones doesn't know
+#include <unity.h>
+#include <zones.hpp>
+#include "../zones_recorded.hpp"
+#include <algorithm>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+static const char* rooms_csv[] = {
+    "Kitchen",
+    "Living Room",
+    "Office",
+    "Bathroom",
+    "Patio",
+    "Den"
+};
+constexpr static const int room_count = sizeof(rooms_csv)/sizeof(const char*);
+constexpr static const int kitchen = 0;
+constexpr static const int living_room = 1;
+constexpr static const int office = 2;
+constexpr static const int bathroom = 3;
+constexpr static const int patio = 4;
+constexpr static const int den = 5;
+
+struct test_rooms {
+    const char** names;
+    int count;
+    playback states[32];
+    int stores;
+    int index_for(const char* name) {
+        for(int i = 0;i<count;++i) {
+            if(0==strcmp(names[i],name)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    void stored(int index,playback state) {
+        states[index] = state;
+        ++stores;
+    }
+};
+static test_rooms rooms;
+static room_zone next[32];
+
+static void read_zones(const std::string& body,size_t chunk) {
+    zones_parse<test_rooms> zone;
+    zones_begin(&zone,&rooms,next,rooms.count);
+    json_reader reader;
+    json_init(&reader,zones_callback<test_rooms>,&zone);
+    for(size_t i = 0;i<body.size();i+=chunk) {
+        json_feed(&reader,body.data()+i,std::min(chunk,body.size()-i));
+    }
+    TEST_ASSERT_TRUE(reader.status!=json_state::error);
+    TEST_ASSERT_EQUAL_INT(0,(int)reader.depth);
+}
+
+void setUp(void) {
+    rooms.names = rooms_csv;
+    rooms.count = room_count;
+    for(playback& state : rooms.states) {
+        state = playback::unknown;
+    }
+    rooms.stores = 0;
+    memset(next,0xFF,sizeof(next));
+}
+void tearDown(void) {
+}
+
+static void check_recorded() {
+    // Living Room runs Kitchen and Dining Room
+    TEST_ASSERT_EQUAL_INT(living_room,next[kitchen].coordinator);
+    TEST_ASSERT_EQUAL_INT(3,next[kitchen].members);
+    TEST_ASSERT_EQUAL_INT(living_room,next[living_room].coordinator);
+    TEST_ASSERT_EQUAL_INT(3,next[living_room].members);
+    TEST_ASSERT_EQUAL_INT(office,next[office].coordinator);
+    TEST_ASSERT_EQUAL_INT(1,next[office].members);
+    // Master Bedroom isn't in speakers.csv, so we know
+    // Bathroom is grouped but not who with
+    TEST_ASSERT_EQUAL_INT(-1,next[bathroom].coordinator);
+    TEST_ASSERT_EQUAL_INT(2,next[bathroom].members);
+    TEST_ASSERT_EQUAL_INT(patio,next[patio].coordinator);
+    // and Den isn't anywhere
+    TEST_ASSERT_EQUAL_INT(-1,next[den].coordinator);
+    TEST_ASSERT_EQUAL_INT(1,next[den].members);
+    TEST_ASSERT_TRUE(rooms.states[kitchen]==playback::playing);
+    TEST_ASSERT_TRUE(rooms.states[living_room]==playback::playing);
+    TEST_ASSERT_TRUE(rooms.states[office]==playback::playing);
+    TEST_ASSERT_TRUE(rooms.states[bathroom]==playback::paused);
+    TEST_ASSERT_TRUE(rooms.states[patio]==playback::stopped);
+    TEST_ASSERT_TRUE(rooms.states[den]==playback::unknown);
+    TEST_ASSERT_EQUAL_INT(5,rooms.stores);
+}
+static void test_recorded() {
+    read_zones(zones_recorded,strlen(zones_recorded));
+    check_recorded();
+}
+static void test_recorded_in_pieces() {
+    // a byte at a time, an odd size, and a TCP segment
+    size_t chunks[] = {1,7,1460};
+    for(size_t chunk : chunks) {
+        setUp();
+        read_zones(zones_recorded,chunk);
+        check_recorded();
+    }
+}
+static void test_more_members_than_tracked() {
+    // everyone still learns the zone's full size
+    static char names[20][16];
+    static const char* csv[20];
+    std::string body = "[{\"coordinator\":{\"roomName\":\"r0\",\"state\":{\"playbackState\":\"PLAYING\"}},\"members\":[";
+    for(int i = 0;i<20;++i) {
+        snprintf(names[i],sizeof(names[i]),"r%d",i);
+        csv[i] = names[i];
+        body+=std::string(i?",":"")+"{\"roomName\":\""+names[i]+"\"}";
+    }
+    body+="]}]";
+    rooms.names = csv;
+    rooms.count = 20;
+    read_zones(body,body.size());
+    for(int i = 0;i<(int)zone_max_members;++i) {
+        TEST_ASSERT_EQUAL_INT(0,next[i].coordinator);
+        TEST_ASSERT_EQUAL_INT(20,next[i].members);
+    }
+    TEST_ASSERT_EQUAL_INT(-1,next[zone_max_members].coordinator);
+    TEST_ASSERT_EQUAL_INT((int)zone_max_members,rooms.stores);
+}
+static void test_playback_for() {
+    TEST_ASSERT_TRUE(playback_for("PLAYING")==playback::playing);
+    TEST_ASSERT_TRUE(playback_for("TRANSITIONING")==playback::playing);
+    TEST_ASSERT_TRUE(playback_for("PAUSED_PLAYBACK")==playback::paused);
+    TEST_ASSERT_TRUE(playback_for("STOPPED")==playback::stopped);
+    TEST_ASSERT_TRUE(playback_for("")==playback::unknown);
+}
+static void test_room_state_fresh() {
+    room_state never = {0,playback::playing};
+    TEST_ASSERT_FALSE(room_state_fresh(never,1000));
+    // across millis() wrapping
+    uint32_t ts = 0xFFFFF000|1;
+    room_state entry = {ts,playback::playing};
+    TEST_ASSERT_TRUE(room_state_fresh(entry,ts+room_state_ttl_ms-1));
+    TEST_ASSERT_FALSE(room_state_fresh(entry,ts+room_state_ttl_ms));
+    // stale is still there to show, but not fresh
+    room_state_stale(&entry,ts+10);
+    TEST_ASSERT_NOT_EQUAL(0,entry.ts);
+    TEST_ASSERT_FALSE(room_state_fresh(entry,ts+10));
+    TEST_ASSERT_TRUE(entry.state==playback::playing);
+    // and never stays never
+    room_state_stale(&never,1000);
+    TEST_ASSERT_EQUAL_UINT32(0,never.ts);
+}
+static void test_prefetch_order() {
+    // the current room, the ones ahead, then behind
+    int order[prefetch_ahead+prefetch_behind+1];
+    for(int n = 0;n<=prefetch_ahead+prefetch_behind;++n) {
+        order[n] = prefetch_room_at(0,5,n);
+    }
+    int expected[] = {0,1,2,4};
+    TEST_ASSERT_EQUAL_INT_ARRAY(expected,order,4);
+    for(int n = 0;n<=prefetch_ahead+prefetch_behind;++n) {
+        order[n] = prefetch_room_at(4,5,n);
+    }
+    int wrapped[] = {4,0,1,3};
+    TEST_ASSERT_EQUAL_INT_ARRAY(wrapped,order,4);
+    // fewer rooms than we look at
+    for(int n = 0;n<=prefetch_ahead+prefetch_behind;++n) {
+        order[n] = prefetch_room_at(1,2,n);
+    }
+    int few[] = {1,0,1,0};
+    TEST_ASSERT_EQUAL_INT_ARRAY(few,order,4);
+}
+
+int main(int argc,char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_recorded);
+    RUN_TEST(test_recorded_in_pieces);
+    RUN_TEST(test_more_members_than_tracked);
+    RUN_TEST(test_playback_for);
+    RUN_TEST(test_room_state_fresh);
+    RUN_TEST(test_prefetch_order);
+    return UNITY_END();
+}
@@ -0,0 +1,9 @@
+#pragma once
+// a /zones body the way node-sonos-http-api sends it: one
+// line, no spaces, every field it reports for each player.
+// six zones, nine players: a grouped three room zone on
+// Spotify, a radio stream, a soundbar on TV, a paused pair
+// with escapes in the title, a stopped library track and a
+// line-in
+static const char* zones_recorded = R"json(
+[{"uuid":"RINCON_949F3E0C2A1401400","coordinator":{"uuid":"RINCON_949F3E0C2A1401400","state":{"volume":24,"mute":false,"equalizer":{"bass":2,"treble":0,"loudness":true},"currentTrack":{"artist":"Miles Davis","title":"So What","album":"Kind of Blue (Legacy Edition)","albumArtUri":"/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a4vLYewWIvqHfKtJDk8c8tq%3fsid%3d12%26flags%3d8224%26sn%3d1","duration":562,"uri":"x-sonos-spotify:spotify%3atrack%3a4vLYewWIvqHfKtJDk8c8tq?sid=12&flags=8224&sn=1","trackUri":"x-sonos-spotify:spotify%3atrack%3a4vLYewWIvqHfKtJDk8c8tq?sid=12&flags=8224&sn=1","type":"track","stationName":"","absoluteAlbumArtUri":"http://192.168.1.31:1400/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a4vLYewWIvqHfKtJDk8c8tq%3fsid%3d12%26flags%3d8224%26sn%3d1"},"nextTrack":{"artist":"Miles Davis","title":"Freddie Freeloader","album":"Kind of Blue (Legacy Edition)","albumArtUri":"/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a2ygMBIctKIAfbEBcT9065L%3fsid%3d12%26flags%3d8224%26sn%3d1","duration":589,"uri":"x-sonos-spotify:spotify%3atrack%3a2ygMBIctKIAfbEBcT9065L?sid=12&flags=8224&sn=1"},"trackNo":1,"elapsedTime":103,"elapsedTimeFormatted":"00:01:43","playbackState":"PLAYING","playMode":{"repeat":"all","shuffle":true,"crossfade":false}},"roomName":"Living Room","coordinator":"RINCON_949F3E0C2A1401400","groupState":{"volume":19,"mute":false}},"members":[{"uuid":"RINCON_949F3E0C2A1401400","state":{"volume":24,"mute":false,"equalizer":{"bass":2,"treble":0,"loudness":true},"currentTrack":{"artist":"Miles Davis","title":"So What","album":"Kind of Blue (Legacy Edition)","albumArtUri":"/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a4vLYewWIvqHfKtJDk8c8tq%3fsid%3d12%26flags%3d8224%26sn%3d1","duration":562,"uri":"x-sonos-spotify:spotify%3atrack%3a4vLYewWIvqHfKtJDk8c8tq?sid=12&flags=8224&sn=1","trackUri":"x-sonos-spotify:spotify%3atrack%3a4vLYewWIvqHfKtJDk8c8tq?sid=12&flags=8224&sn=1","type":"track","stationName":"","absoluteAlbumArtUri":"http://192.168.1.31:1400/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a4vLYewWIvqHfKtJDk8c8tq%3fsid%3d12%26flags%3d8224%26sn%3d1"},"nextTrack":{"artist":"Miles Davis","title":"Freddie Freeloader","album":"Kind of Blue (Legacy Edition)","albumArtUri":"/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a2ygMBIctKIAfbEBcT9065L%3fsid%3d12%26flags%3d8224%26sn%3d1","duration":589,"uri":"x-sonos-spotify:spotify%3atrack%3a2ygMBIctKIAfbEBcT9065L?sid=12&flags=8224&sn=1"},"trackNo":1,"elapsedTime":103,"elapsedTimeFormatted":"00:01:43","playbackState":"PLAYING","playMode":{"repeat":"all","shuffle":true,"crossfade":false}},"roomName":"Living Room","coordinator":"RINCON_949F3E0C2A1401400","groupState":{"volume":19,"mute":false}},{"uuid":"RINCON_B8E9372C4D5E01400","state":{"volume":18,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"Miles Davis","title":"So What","album":"Kind of Blue (Legacy Edition)","albumArtUri":"/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a4vLYewWIvqHfKtJDk8c8tq%3fsid%3d12%26flags%3d8224%26sn%3d1","duration":562,"uri":"x-sonos-spotify:spotify%3atrack%3a4vLYewWIvqHfKtJDk8c8tq?sid=12&flags=8224&sn=1","trackUri":"x-sonos-spotify:spotify%3atrack%3a4vLYewWIvqHfKtJDk8c8tq?sid=12&flags=8224&sn=1","type":"track","stationName":"","absoluteAlbumArtUri":"http://192.168.1.42:1400/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a4vLYewWIvqHfKtJDk8c8tq%3fsid%3d12%26flags%3d8224%26sn%3d1"},"nextTrack":{"artist":"Miles Davis","title":"Freddie Freeloader","album":"Kind of Blue (Legacy Edition)","albumArtUri":"/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a2ygMBIctKIAfbEBcT9065L%3fsid%3d12%26flags%3d8224%26sn%3d1","duration":589,"uri":"x-sonos-spotify:spotify%3atrack%3a2ygMBIctKIAfbEBcT9065L?sid=12&flags=8224&sn=1"},"trackNo":1,"elapsedTime":103,"elapsedTimeFormatted":"00:01:43","playbackState":"PLAYING","playMode":{"repeat":"all","shuffle":true,"crossfade":false}},"roomName":"Kitchen","coordinator":"RINCON_949F3E0C2A1401400","groupState":{"volume":19,"mute":false}},{"uuid":"RINCON_48A6B80F1E2201400","state":{"volume":15,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"Miles Davis","title":"So What","album":"Kind of Blue (Legacy Edition)","albumArtUri":"/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a4vLYewWIvqHfKtJDk8c8tq%3fsid%3d12%26flags%3d8224%26sn%3d1","duration":562,"uri":"x-sonos-spotify:spotify%3atrack%3a4vLYewWIvqHfKtJDk8c8tq?sid=12&flags=8224&sn=1","trackUri":"x-sonos-spotify:spotify%3atrack%3a4vLYewWIvqHfKtJDk8c8tq?sid=12&flags=8224&sn=1","type":"track","stationName":"","absoluteAlbumArtUri":"http://192.168.1.37:1400/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a4vLYewWIvqHfKtJDk8c8tq%3fsid%3d12%26flags%3d8224%26sn%3d1"},"nextTrack":{"artist":"Miles Davis","title":"Freddie Freeloader","album":"Kind of Blue (Legacy Edition)","albumArtUri":"/getaa?s=1&u=x-sonos-spotify%3aspotify%253atrack%253a2ygMBIctKIAfbEBcT9065L%3fsid%3d12%26flags%3d8224%26sn%3d1","duration":589,"uri":"x-sonos-spotify:spotify%3atrack%3a2ygMBIctKIAfbEBcT9065L?sid=12&flags=8224&sn=1"},"trackNo":1,"elapsedTime":103,"elapsedTimeFormatted":"00:01:43","playbackState":"PLAYING","playMode":{"repeat":"all","shuffle":true,"crossfade":false}},"roomName":"Dining Room","coordinator":"RINCON_949F3E0C2A1401400","groupState":{"volume":19,"mute":false}}]},{"uuid":"RINCON_5CAAFD8A6B3C01400","coordinator":{"uuid":"RINCON_5CAAFD8A6B3C01400","state":{"volume":31,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"Khruangbin","title":"Maria También","album":"","albumArtUri":"/getaa?s=1&u=x-sonosapi-hls%3astation%253abbc_6music%3fsid%3d254%26flags%3d8224%26sn%3d0","duration":0,"uri":"x-sonosapi-hls:station%3abbc_6music?sid=254&flags=8224&sn=0","trackUri":"x-sonosapi-hls:station%3abbc_6music?sid=254&flags=8224&sn=0","type":"radio","stationName":"BBC Radio 6 Music","absoluteAlbumArtUri":"http://192.168.1.44:1400/getaa?s=1&u=x-sonosapi-hls%3astation%253abbc_6music%3fsid%3d254%26flags%3d8224%26sn%3d0"},"nextTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":""},"trackNo":1,"elapsedTime":3121,"elapsedTimeFormatted":"00:52:01","playbackState":"PLAYING","playMode":{"repeat":"none","shuffle":false,"crossfade":false}},"roomName":"Office","coordinator":"RINCON_5CAAFD8A6B3C01400","groupState":{"volume":31,"mute":false}},"members":[{"uuid":"RINCON_5CAAFD8A6B3C01400","state":{"volume":31,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"Khruangbin","title":"Maria También","album":"","albumArtUri":"/getaa?s=1&u=x-sonosapi-hls%3astation%253abbc_6music%3fsid%3d254%26flags%3d8224%26sn%3d0","duration":0,"uri":"x-sonosapi-hls:station%3abbc_6music?sid=254&flags=8224&sn=0","trackUri":"x-sonosapi-hls:station%3abbc_6music?sid=254&flags=8224&sn=0","type":"radio","stationName":"BBC Radio 6 Music","absoluteAlbumArtUri":"http://192.168.1.44:1400/getaa?s=1&u=x-sonosapi-hls%3astation%253abbc_6music%3fsid%3d254%26flags%3d8224%26sn%3d0"},"nextTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":""},"trackNo":1,"elapsedTime":3121,"elapsedTimeFormatted":"00:52:01","playbackState":"PLAYING","playMode":{"repeat":"none","shuffle":false,"crossfade":false}},"roomName":"Office","coordinator":"RINCON_5CAAFD8A6B3C01400","groupState":{"volume":31,"mute":false}}]},{"uuid":"RINCON_542A1B5F7C8801400","coordinator":{"uuid":"RINCON_542A1B5F7C8801400","state":{"volume":42,"mute":false,"equalizer":{"bass":3,"treble":-1,"loudness":true},"currentTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":"x-sonos-htastream:RINCON_542A1B5F7C8801400:spdif","trackUri":"x-sonos-htastream:RINCON_542A1B5F7C8801400:spdif","type":"line_in","stationName":"","absoluteAlbumArtUri":""},"nextTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":""},"trackNo":0,"elapsedTime":0,"elapsedTimeFormatted":"00:00:00","playbackState":"PLAYING","playMode":{"repeat":"none","shuffle":false,"crossfade":false}},"roomName":"TV Room","coordinator":"RINCON_542A1B5F7C8801400","groupState":{"volume":42,"mute":false}},"members":[{"uuid":"RINCON_542A1B5F7C8801400","state":{"volume":42,"mute":false,"equalizer":{"bass":3,"treble":-1,"loudness":true},"currentTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":"x-sonos-htastream:RINCON_542A1B5F7C8801400:spdif","trackUri":"x-sonos-htastream:RINCON_542A1B5F7C8801400:spdif","type":"line_in","stationName":"","absoluteAlbumArtUri":""},"nextTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":""},"trackNo":0,"elapsedTime":0,"elapsedTimeFormatted":"00:00:00","playbackState":"PLAYING","playMode":{"repeat":"none","shuffle":false,"crossfade":false}},"roomName":"TV Room","coordinator":"RINCON_542A1B5F7C8801400","groupState":{"volume":42,"mute":false}}]},{"uuid":"RINCON_347E5C9A0B1201400","coordinator":{"uuid":"RINCON_347E5C9A0B1201400","state":{"volume":12,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"The Memory Palace","title":"Episode 212: \"Night Train\" / Part 2","album":"The Memory Palace","albumArtUri":"/getaa?s=1&u=x-sonos-http%3aepisode%253a9f2b.mp3%3fsid%3d239%26flags%3d8232%26sn%3d6","duration":1644,"uri":"x-sonos-http:episode%3a9f2b.mp3?sid=239&flags=8232&sn=6","trackUri":"x-sonos-http:episode%3a9f2b.mp3?sid=239&flags=8232&sn=6","type":"track","stationName":"","absoluteAlbumArtUri":"http://192.168.1.52:1400/getaa?s=1&u=x-sonos-http%3aepisode%253a9f2b.mp3%3fsid%3d239%26flags%3d8232%26sn%3d6"},"nextTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":""},"trackNo":1,"elapsedTime":812,"elapsedTimeFormatted":"00:13:32","playbackState":"PAUSED_PLAYBACK","playMode":{"repeat":"none","shuffle":false,"crossfade":false}},"roomName":"Master Bedroom","coordinator":"RINCON_347E5C9A0B1201400","groupState":{"volume":11,"mute":false}},"members":[{"uuid":"RINCON_347E5C9A0B1201400","state":{"volume":12,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"The Memory Palace","title":"Episode 212: \"Night Train\" / Part 2","album":"The Memory Palace","albumArtUri":"/getaa?s=1&u=x-sonos-http%3aepisode%253a9f2b.mp3%3fsid%3d239%26flags%3d8232%26sn%3d6","duration":1644,"uri":"x-sonos-http:episode%3a9f2b.mp3?sid=239&flags=8232&sn=6","trackUri":"x-sonos-http:episode%3a9f2b.mp3?sid=239&flags=8232&sn=6","type":"track","stationName":"","absoluteAlbumArtUri":"http://192.168.1.52:1400/getaa?s=1&u=x-sonos-http%3aepisode%253a9f2b.mp3%3fsid%3d239%26flags%3d8232%26sn%3d6"},"nextTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":""},"trackNo":1,"elapsedTime":812,"elapsedTimeFormatted":"00:13:32","playbackState":"PAUSED_PLAYBACK","playMode":{"repeat":"none","shuffle":false,"crossfade":false}},"roomName":"Master Bedroom","coordinator":"RINCON_347E5C9A0B1201400","groupState":{"volume":11,"mute":false}},{"uuid":"RINCON_000E58D4F39A01400","state":{"volume":9,"mute":true,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"The Memory Palace","title":"Episode 212: \"Night Train\" / Part 2","album":"The Memory Palace","albumArtUri":"/getaa?s=1&u=x-sonos-http%3aepisode%253a9f2b.mp3%3fsid%3d239%26flags%3d8232%26sn%3d6","duration":1644,"uri":"x-sonos-http:episode%3a9f2b.mp3?sid=239&flags=8232&sn=6","trackUri":"x-sonos-http:episode%3a9f2b.mp3?sid=239&flags=8232&sn=6","type":"track","stationName":"","absoluteAlbumArtUri":"http://192.168.1.58:1400/getaa?s=1&u=x-sonos-http%3aepisode%253a9f2b.mp3%3fsid%3d239%26flags%3d8232%26sn%3d6"},"nextTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":""},"trackNo":1,"elapsedTime":812,"elapsedTimeFormatted":"00:13:32","playbackState":"PAUSED_PLAYBACK","playMode":{"repeat":"none","shuffle":false,"crossfade":false}},"roomName":"Bathroom","coordinator":"RINCON_347E5C9A0B1201400","groupState":{"volume":11,"mute":false}}]},{"uuid":"RINCON_7828CA1D2E3F01400","coordinator":{"uuid":"RINCON_7828CA1D2E3F01400","state":{"volume":35,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"Bon Iver","title":"Holocene","album":"Bon Iver, Bon Iver","albumArtUri":"/getaa?s=1&u=x-file-cifs%3a%2f%2fnas%2fmusic%2fBon%2520Iver%2f03%2520Holocene.flac","duration":337,"uri":"x-file-cifs://nas/music/Bon%20Iver/03%20Holocene.flac","trackUri":"x-file-cifs://nas/music/Bon%20Iver/03%20Holocene.flac","type":"track","stationName":"","absoluteAlbumArtUri":"http://192.168.1.61:1400/getaa?s=1&u=x-file-cifs%3a%2f%2fnas%2fmusic%2fBon%2520Iver%2f03%2520Holocene.flac"},"nextTrack":{"artist":"Bon Iver","title":"Towers","album":"Bon Iver, Bon Iver","albumArtUri":"","duration":188,"uri":"x-file-cifs://nas/music/Bon%20Iver/04%20Towers.flac"},"trackNo":3,"elapsedTime":0,"elapsedTimeFormatted":"00:00:00","playbackState":"STOPPED","playMode":{"repeat":"none","shuffle":false,"crossfade":true}},"roomName":"Patio","coordinator":"RINCON_7828CA1D2E3F01400","groupState":{"volume":35,"mute":false}},"members":[{"uuid":"RINCON_7828CA1D2E3F01400","state":{"volume":35,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"Bon Iver","title":"Holocene","album":"Bon Iver, Bon Iver","albumArtUri":"/getaa?s=1&u=x-file-cifs%3a%2f%2fnas%2fmusic%2fBon%2520Iver%2f03%2520Holocene.flac","duration":337,"uri":"x-file-cifs://nas/music/Bon%20Iver/03%20Holocene.flac","trackUri":"x-file-cifs://nas/music/Bon%20Iver/03%20Holocene.flac","type":"track","stationName":"","absoluteAlbumArtUri":"http://192.168.1.61:1400/getaa?s=1&u=x-file-cifs%3a%2f%2fnas%2fmusic%2fBon%2520Iver%2f03%2520Holocene.flac"},"nextTrack":{"artist":"Bon Iver","title":"Towers","album":"Bon Iver, Bon Iver","albumArtUri":"","duration":188,"uri":"x-file-cifs://nas/music/Bon%20Iver/04%20Towers.flac"},"trackNo":3,"elapsedTime":0,"elapsedTimeFormatted":"00:00:00","playbackState":"STOPPED","playMode":{"repeat":"none","shuffle":false,"crossfade":true}},"roomName":"Patio","coordinator":"RINCON_7828CA1D2E3F01400","groupState":{"volume":35,"mute":false}}]},{"uuid":"RINCON_B8E937AA001101400","coordinator":{"uuid":"RINCON_B8E937AA001101400","state":{"volume":50,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":"x-rincon-stream:RINCON_B8E937AA001101400","trackUri":"x-rincon-stream:RINCON_B8E937AA001101400","type":"line_in","stationName":"","absoluteAlbumArtUri":""},"nextTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":""},"trackNo":0,"elapsedTime":0,"elapsedTimeFormatted":"00:00:00","playbackState":"STOPPED","playMode":{"repeat":"none","shuffle":false,"crossfade":false}},"roomName":"Garage","coordinator":"RINCON_B8E937AA001101400","groupState":{"volume":50,"mute":false}},"members":[{"uuid":"RINCON_B8E937AA001101400","state":{"volume":50,"mute":false,"equalizer":{"bass":0,"treble":0,"loudness":true},"currentTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":"x-rincon-stream:RINCON_B8E937AA001101400","trackUri":"x-rincon-stream:RINCON_B8E937AA001101400","type":"line_in","stationName":"","absoluteAlbumArtUri":""},"nextTrack":{"artist":"","title":"","album":"","albumArtUri":"","duration":0,"uri":""},"trackNo":0,"elapsedTime":0,"elapsedTimeFormatted":"00:00:00","playbackState":"STOPPED","playMode":{"repeat":"none","shuffle":false,"crossfade":false}},"roomName":"Garage","coordinator":"RINCON_B8E937AA001101400","groupState":{"volume":50,"mute":false}}]}])json"+1;